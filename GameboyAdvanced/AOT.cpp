@@ -0,0 +1,973 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "AOT.h"
+#include <cstdint>
+#include <cstdio>
+#include <unordered_set>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//				                 WALK									//
+//////////////////////////////////////////////////////////////////////////
+
+// recursive traversal from the cartridge entry point. a block is decoded the way tickBlock records one,
+// up to the first instr that can move pc or T, and everything it can go on to is queued with the state
+// it will be in: branch targets, the instr after a conditional one, BL return addresses, the instr after
+// an SWI. BX targets are followed when the register was loaded with a constant earlier in the same block
+// (MOV / ADD rd, pc / LDR rd, [pc]), which covers the usual ARM to THUMB switch. reaching an undefined or
+// coprocessor encoding means the walk has run into data, nothing past it is followed
+
+namespace
+{
+	struct decodedInstr
+	{
+		uint32_t addr;
+		uint32_t opcode;
+		CPU::armInstr arm;
+		CPU::thumbInstr thumb;
+	};
+
+	struct walkedBlock
+	{
+		uint32_t addr;
+		bool thumb;
+		std::vector<decodedInstr> instrs;
+	};
+
+	uint64_t blockKey(uint32_t addr, bool thumb) { return (uint64_t(addr) << 1) | thumb; }
+
+	class AOTCompiler
+	{
+	public:
+
+		AOTCompiler(CPU& cpu, uint32_t romSize) : cpu(cpu), romEnd(0x08000000 + romSize) {}
+
+		void walk(uint32_t entry);
+		bool write(const char* path, uint32_t romSize, AOT::report& out);
+
+	private:
+
+		CPU& cpu;
+		uint32_t romEnd;
+
+		std::vector<walkedBlock> blocks;
+		std::unordered_set<uint64_t> queued;
+		std::vector<std::pair<uint32_t, bool>> pending;
+
+		// constants the current block has put in registers, for BX targets
+		uint32_t known[16];
+		uint16_t knownMask;
+
+		bool inRom(uint32_t addr, uint32_t size) const { return addr >= 0x08000000 && addr + size <= romEnd; }
+		void queue(uint32_t addr, bool thumb);
+		void setKnown(uint8_t rd, uint32_t value) { known[rd] = value; knownMask |= 1 << rd; }
+		bool isKnown(uint8_t rd) const { return (knownMask >> rd) & 1; }
+		void forget(uint8_t rd) { knownMask &= ~(1 << rd); }
+
+		void callVia(uint32_t target);
+		void walkArm(walkedBlock& block);
+
+		void walkThumb(walkedBlock& block);
+
+		// per block emission state
+		FILE* f = nullptr;
+		uint32_t emitted = 0;   // instrs of this block so far, what an exit returns
+		uint32_t fallbackCount = 0;
+		std::vector<AOTFallback> fallbacks;
+		std::unordered_set<uint64_t> translated;
+
+		void emitBlock(const walkedBlock& block, AOT::report& out);
+		void exitTo(uint32_t target, bool thumb, int cycles);
+		void fallback(const decodedInstr& instr, bool thumb, bool last);
+		bool armNative(const decodedInstr& instr);
+		bool thumbNative(const decodedInstr& instr, bool& ends);
+	};
+
+	bool movesPc(const CPU::armInstr& instr)
+	{
+		switch (instr.type)
+		{
+		case CPU::armOperation::ARM_MSR:
+		case CPU::armOperation::ARM_STM:
+		case CPU::armOperation::ARM_STR:
+		case CPU::armOperation::ARM_STRH:
+			return instr.rn == 15 && (!instr.P || instr.W); // pc writeback
+		case CPU::armOperation::ARM_TST:
+		case CPU::armOperation::ARM_TEQ:
+		case CPU::armOperation::ARM_CMP:
+		case CPU::armOperation::ARM_CMN:
+			return false;
+		default:
+			return true;
+		}
+	}
+
+	void AOTCompiler::queue(uint32_t addr, bool thumb)
+	{
+		addr &= thumb ? ~1u : ~3u;
+		if (!inRom(addr, thumb ? 2 : 4)) return;
+		if (queued.insert(blockKey(addr, thumb)).second) pending.push_back({ addr, thumb });
+	}
+
+	// gcc's long calls from THUMB go through a BL to a lone `bx rN` (_call_via_rN), with rN loaded just
+	// before the BL. the trampoline is shared so its own block never knows rN, the call site does
+	void AOTCompiler::callVia(uint32_t target)
+	{
+		if (!inRom(target, 2)) return;
+		CPU::thumbInstr via = cpu.decodeThumb(cpu.bus->read16(target));
+		if (via.type == CPU::thumbOperation::THUMB_BX && via.rs != 15 && isKnown(via.rs))
+		{
+			queue(known[via.rs], known[via.rs] & 1);
+		}
+	}
+
+	void AOTCompiler::walk(uint32_t entry)
+	{
+		queue(entry, false);
+
+		while (!pending.empty())
+		{
+			walkedBlock block;
+			block.addr = pending.back().first;
+			block.thumb = pending.back().second;
+			pending.pop_back();
+
+			knownMask = 0;
+			if (block.thumb) walkThumb(block);
+			else walkArm(block);
+
+			if (!block.instrs.empty()) blocks.push_back(std::move(block));
+		}
+	}
+
+	void AOTCompiler::walkArm(walkedBlock& block)
+	{
+		uint32_t addr = block.addr;
+
+		for (int i = 0; i < CPU::maxBlockLength && inRom(addr, 4); i++, addr += 4)
+		{
+			uint32_t opcode = cpu.bus->read32(addr);
+			const CPU::armDecodeEntry& entry = CPU::armLookup(opcode);
+			CPU::armInstr instr = cpu.decodeArm(opcode, entry);
+			block.instrs.push_back({ addr, opcode, instr, {} });
+
+			uint8_t cond = instr.cond & 0xF;
+			bool conditional = cond != 0xE;
+
+			switch (instr.type)
+			{
+			case CPU::armOperation::ARM_CDP:
+			case CPU::armOperation::ARM_LDC:
+			case CPU::armOperation::ARM_STC:
+			case CPU::armOperation::ARM_MRC:
+			case CPU::armOperation::ARM_MCR:
+			case CPU::armOperation::ARM_UNDEFINED:
+				return; // data
+
+			case CPU::armOperation::ARM_B:
+			case CPU::armOperation::ARM_BL:
+				queue(addr + 8 + instr.imm, false);
+				if (conditional || instr.type == CPU::armOperation::ARM_BL) queue(addr + 4, false);
+				return;
+
+			case CPU::armOperation::ARM_BX:
+				if (instr.rm == 15) queue(addr + 8, false);
+				else if (isKnown(instr.rm)) queue(known[instr.rm], known[instr.rm] & 1);
+				if (conditional) queue(addr + 4, false);
+				return;
+
+			case CPU::armOperation::ARM_SWI:
+				queue(addr + 4, false); // where the handler returns to
+				return;
+
+			case CPU::armOperation::ARM_MOV:
+				if (instr.I && instr.rd != 15 && !conditional) setKnown(instr.rd, instr.imm);
+				else forget(instr.rd);
+				break;
+
+			case CPU::armOperation::ARM_ADD:
+			case CPU::armOperation::ARM_SUB:
+				if (instr.I && instr.rn == 15 && instr.rd != 15 && !conditional)
+				{
+					setKnown(instr.rd, instr.type == CPU::armOperation::ARM_ADD ? addr + 8 + instr.imm : addr + 8 - instr.imm);
+				}
+				else forget(instr.rd);
+				break;
+
+			case CPU::armOperation::ARM_LDR:
+			{
+				uint32_t literal = instr.U ? addr + 8 + instr.imm : addr + 8 - instr.imm;
+				if (!instr.I && instr.rn == 15 && instr.P && !instr.W && !instr.B && instr.rd != 15 && !conditional && inRom(literal, 4))
+				{
+					setKnown(instr.rd, cpu.bus->read32(literal));
+				}
+				else
+				{
+					forget(instr.rd);
+					if (!instr.P || instr.W) forget(instr.rn);
+				}
+				break;
+			}
+
+			case CPU::armOperation::ARM_CMP:
+			case CPU::armOperation::ARM_CMN:
+			case CPU::armOperation::ARM_TST:
+			case CPU::armOperation::ARM_TEQ:
+				break; // flags only
+
+			case CPU::armOperation::ARM_MSR:
+				break; // flags and mode only
+
+			case CPU::armOperation::ARM_STR:
+			case CPU::armOperation::ARM_STRH:
+				if (!instr.P || instr.W) forget(instr.rn);
+				break;
+
+			case CPU::armOperation::ARM_LDRH:
+			case CPU::armOperation::ARM_LDRSB:
+			case CPU::armOperation::ARM_LDRSH:
+				forget(instr.rd);
+				if (!instr.P || instr.W) forget(instr.rn);
+				break;
+
+			case CPU::armOperation::ARM_AND:
+			case CPU::armOperation::ARM_EOR:
+			case CPU::armOperation::ARM_ORR:
+			case CPU::armOperation::ARM_BIC:
+			case CPU::armOperation::ARM_RSB:
+			case CPU::armOperation::ARM_ADC:
+			case CPU::armOperation::ARM_SBC:
+			case CPU::armOperation::ARM_RSC:
+			case CPU::armOperation::ARM_MVN:
+			case CPU::armOperation::ARM_MUL:
+			case CPU::armOperation::ARM_MLA:
+			case CPU::armOperation::ARM_MRS:
+				forget(instr.rd);
+				break;
+
+			default:
+				knownMask = 0;
+				break;
+			}
+
+			if (CPU::endsArmBlock(instr))
+			{
+				// MSR, stores and the flag setting ops with an r15 destination end a block without
+				// moving pc, the next instr is still reached in ARM state
+				if (conditional || !movesPc(instr)) queue(addr + 4, false);
+				return;
+			}
+		}
+
+		queue(addr, false); // stopped on length, the rest is its own block
+	}
+
+	void AOTCompiler::walkThumb(walkedBlock& block)
+	{
+		uint32_t addr = block.addr;
+
+		for (int i = 0; i < CPU::maxBlockLength && inRom(addr, 2); i++, addr += 2)
+		{
+			uint16_t opcode = cpu.bus->read16(addr);
+			const CPU::thumbDecodeEntry& entry = CPU::thumbLookup(opcode);
+			CPU::thumbInstr instr = cpu.decodeThumb(opcode, entry);
+			block.instrs.push_back({ addr, opcode, {}, instr });
+
+			switch (instr.type)
+			{
+			case CPU::thumbOperation::THUMB_UNDEFINED:
+			case CPU::thumbOperation::THUMB_BLX_REG:
+				return; // data
+
+			case CPU::thumbOperation::THUMB_B:
+				queue(addr + 4 + instr.imm, true);
+				return;
+
+			case CPU::thumbOperation::THUMB_B_COND:
+				if ((instr.cond & 0xF) < 0xE) queue(addr + 4 + instr.imm, true);
+				queue(addr + 2, true);
+				return;
+
+			case CPU::thumbOperation::THUMB_BL_PREFIX:
+				setKnown(14, addr + 4 + instr.imm);
+				break;
+
+			case CPU::thumbOperation::THUMB_BL_SUFFIX:
+				if (isKnown(14))
+				{
+					uint32_t target = (known[14] + instr.imm) & ~1u;
+					queue(target, true);
+					callVia(target);
+				}
+				queue(addr + 2, true);
+				return;
+
+			case CPU::thumbOperation::THUMB_BX:
+				if (instr.rs == 15) queue(addr + 4, false);
+				else if (isKnown(instr.rs)) queue(known[instr.rs], known[instr.rs] & 1);
+				return;
+
+			case CPU::thumbOperation::THUMB_SWI:
+				queue(addr + 2, true);
+				return;
+
+			case CPU::thumbOperation::THUMB_MOV_IMM:
+				setKnown(instr.rd, instr.imm);
+				break;
+
+			case CPU::thumbOperation::THUMB_ADD_PC:
+				setKnown(instr.rd, ((addr + 4) & ~3u) + instr.imm);
+				break;
+
+			case CPU::thumbOperation::THUMB_LDR_PC:
+			{
+				uint32_t literal = ((addr + 4) & ~3u) + instr.imm;
+				if (inRom(literal, 4)) setKnown(instr.rd, cpu.bus->read32(literal));
+				else knownMask = 0;
+				break;
+			}
+
+			case CPU::thumbOperation::THUMB_CMP_IMM:
+			case CPU::thumbOperation::THUMB_CMP_REG:
+			case CPU::thumbOperation::THUMB_CMN_REG:
+			case CPU::thumbOperation::THUMB_CMP_HI:
+			case CPU::thumbOperation::THUMB_TST_REG:
+			case CPU::thumbOperation::THUMB_STR_REG:
+			case CPU::thumbOperation::THUMB_STRB_REG:
+			case CPU::thumbOperation::THUMB_STRH_REG:
+			case CPU::thumbOperation::THUMB_STR_IMM:
+			case CPU::thumbOperation::THUMB_STRB_IMM:
+			case CPU::thumbOperation::THUMB_STRH_IMM:
+			case CPU::thumbOperation::THUMB_STR_SP:
+				break; // no register written
+
+			default:
+				knownMask = 0;
+				break;
+			}
+
+			if (CPU::endsThumbBlock(instr)) return;
+		}
+
+		queue(addr, true);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+//				               C++ WRITER								//
+//////////////////////////////////////////////////////////////////////////
+
+// every block is a function over CPUState. the ops the JIT emits inline are written out as plain C++
+// mirroring the opA_ / opT_ handlers, quirks included, plus the branches, whose targets are constants
+// here. everything else is a call back into the runtime for that instr's handler, after which the block
+// carries on only if pc and T are where the next instr expects them, the same check tickBlock's replay
+// makes. a static exit into another translated block calls it directly while the link budget lasts
+
+namespace
+{
+	const char* prelude =
+		"// generated by AOT::recompile, do not edit. build it as a shared library next to the emulator's\n"
+		"// headers, CPU::loadAot checks it against the image before using it\n"
+		"#include \"AOT.h\"\n"
+		"\n"
+		"namespace\n"
+		"{\n"
+		"\tinline bool passes(const CPUState* s, uint32_t mask) { return (mask >> (s->CPSR >> 28)) & 1; }\n"
+		"\n"
+		"\tinline void flagsAdd(CPUState* s, uint32_t r, uint32_t a, uint32_t b)\n"
+		"\t{\n"
+		"\t\ts->N = r >> 31;\n"
+		"\t\ts->Z = r == 0;\n"
+		"\t\ts->C = r < a;\n"
+		"\t\ts->V = (~(a ^ b) & (a ^ r)) >> 31;\n"
+		"\t}\n"
+		"\n"
+		"\tinline void flagsSub(CPUState* s, uint32_t r, uint32_t a, uint32_t b)\n"
+		"\t{\n"
+		"\t\ts->N = r >> 31;\n"
+		"\t\ts->Z = r == 0;\n"
+		"\t\ts->C = a >= b;\n"
+		"\t\ts->V = ((a ^ b) & (a ^ r)) >> 31;\n"
+		"\t}\n"
+		"\n"
+		"\tinline void flagsNZ(CPUState* s, uint32_t r)\n"
+		"\t{\n"
+		"\t\ts->N = r >> 31;\n"
+		"\t\ts->Z = r == 0;\n"
+		"\t}\n"
+		"\n"
+		"\t// the thumb handlers assign res & 0x80000000 to the one bit N field, which always stores 0\n"
+		"\tinline void flagsThumbNZ(CPUState* s, uint32_t r)\n"
+		"\t{\n"
+		"\t\ts->N = 0;\n"
+		"\t\ts->Z = r == 0;\n"
+		"\t}\n"
+		"\n"
+		"\tinline void branch(CPUState* s, uint32_t target)\n"
+		"\t{\n"
+		"\t\ts->T = target & 1;\n"
+		"\t\ts->pc() = (target & 1) ? (target & ~1u) + 4 : (target & ~3u) + 8;\n"
+		"\t}\n"
+		"}\n"
+		"\n";
+
+	const char* blockName(uint32_t addr, bool thumb)
+	{
+		static char name[32];
+		snprintf(name, sizeof(name), "%s_%08X", thumb ? "thumb" : "arm", addr);
+		return name;
+	}
+
+	uint32_t conditionMask(uint8_t cond)
+	{
+		uint32_t mask = 0;
+		for (int nzcv = 0; nzcv < 16; nzcv++)
+		{
+			if (CPU::conditionTable[cond][nzcv]) mask |= 1u << nzcv;
+		}
+		return mask;
+	}
+
+	// pc for the run loop after a static exit, and a direct call when the target is translated too
+	void AOTCompiler::exitTo(uint32_t target, bool thumb, int cycles)
+	{
+		fprintf(f, "\ts->pc() = 0x%08Xu;\n", target + (thumb ? 4 : 8));
+		if (cycles >= 0) fprintf(f, "\ts->curOpCycles = %d;\n", cycles);
+		if (translated.count(blockKey(target, thumb)))
+		{
+			fprintf(f, "\tif (--h->linksLeft > 0) return %u + %s(s, h);\n", emitted, blockName(target, thumb));
+		}
+		fprintf(f, "\treturn %u;\n", emitted);
+	}
+
+	void AOTCompiler::fallback(const decodedInstr& instr, bool thumb, bool last)
+	{
+		fprintf(f, "\ts->pc() = 0x%08Xu;\n", instr.addr + (thumb ? 4 : 8));
+		fprintf(f, "\tc = h->fallback(h->context, %u);\n", fallbackCount++);
+		fprintf(f, "\ts->cycleTotal += c;\n");
+		fprintf(f, "\ts->curOpCycles = c;\n");
+		fallbacks.push_back({ instr.addr, instr.opcode, thumb });
+
+		if (last) fprintf(f, "\treturn %u;\n", emitted);
+		else fprintf(f, "\tif (s->pc() != 0x%08Xu || s->T != %d) return %u;\n", instr.addr + (thumb ? 6 : 12), thumb, emitted);
+	}
+
+	// data processing with an immediate or an unshifted register operand, rd below 15, the same set the
+	// JIT takes (r15 as rn is a constant here). B / BL / BX as well, they end the block
+	bool AOTCompiler::armNative(const decodedInstr& entry)
+	{
+		const CPU::armInstr& instr = entry.arm;
+		uint32_t addr = entry.addr;
+		uint8_t cond = instr.cond & 0xF;
+		if (cond == 0xF) return false;
+
+		bool conditional = cond != 0xE;
+		const char* test = conditional ? "passes(s, 0x" : nullptr;
+
+		switch (instr.type)
+		{
+		case CPU::armOperation::ARM_B:
+		case CPU::armOperation::ARM_BL:
+		{
+			if (conditional) fprintf(f, "\tif (%s%04Xu))\n\t{\n", test, conditionMask(cond));
+			if (instr.type == CPU::armOperation::ARM_BL) fprintf(f, "\ts->reg[14] = 0x%08Xu;\n", addr + 4);
+			fprintf(f, "\ts->cycleTotal += 3;\n");
+			exitTo(addr + 8 + instr.imm, false, 3);
+			if (conditional)
+			{
+				fprintf(f, "\t}\n\ts->cycleTotal += 1;\n");
+				exitTo(addr + 4, false, 1);
+			}
+			return true;
+		}
+
+		case CPU::armOperation::ARM_BX:
+		{
+			if (conditional) fprintf(f, "\tif (%s%04Xu))\n\t{\n", test, conditionMask(cond));
+			if (instr.rm == 15) fprintf(f, "\tbranch(s, 0x%08Xu);\n", addr + 8);
+			else fprintf(f, "\tbranch(s, s->reg[%d]);\n", instr.rm);
+			fprintf(f, "\ts->cycleTotal += 3;\n\ts->curOpCycles = 3;\n\treturn %u;\n", emitted);
+			if (conditional)
+			{
+				fprintf(f, "\t}\n\ts->cycleTotal += 1;\n");
+				exitTo(addr + 4, false, 1);
+			}
+			return true;
+		}
+
+		default:
+			break;
+		}
+
+		const char* expr;
+		bool arith = false, sub = false, reverse = false, logical = false, isTest = false, move = false;
+
+		switch (instr.type)
+		{
+		case CPU::armOperation::ARM_AND: expr = "a & b"; logical = true; break;
+		case CPU::armOperation::ARM_EOR: expr = "a ^ b"; logical = true; break;
+		case CPU::armOperation::ARM_ORR: expr = "a | b"; logical = true; break;
+		case CPU::armOperation::ARM_BIC: expr = "a & ~b"; break;
+		case CPU::armOperation::ARM_TST: expr = "a & b"; isTest = true; break;
+		case CPU::armOperation::ARM_TEQ: expr = "a ^ b"; isTest = true; break;
+		case CPU::armOperation::ARM_ADD: expr = "a + b"; arith = true; break;
+		case CPU::armOperation::ARM_CMN: expr = "a + b"; arith = isTest = true; break;
+		case CPU::armOperation::ARM_SUB: expr = "a - b"; arith = sub = true; break;
+		case CPU::armOperation::ARM_CMP: expr = "a - b"; arith = sub = isTest = true; break;
+		case CPU::armOperation::ARM_RSB: expr = "b - a"; arith = sub = reverse = true; break;
+		case CPU::armOperation::ARM_MOV: expr = "b"; move = true; break;
+		case CPU::armOperation::ARM_MVN: expr = "~b"; move = true; break;
+		default: return false;
+		}
+
+		bool immediate = (entry.opcode >> 25) & 1;
+		bool setFlags = (entry.opcode >> 20) & 1;
+
+		if (instr.rd == 15) return false;
+		if (!immediate && (((entry.opcode >> 4) & 0xFF) != 0 || instr.rm == 15)) return false; // LSL #0 only
+
+		if (conditional) fprintf(f, "\tif (%s%04Xu))\n", test, conditionMask(cond));
+		fprintf(f, "\t{\n");
+		if (!move)
+		{
+			if (instr.rn == 15) fprintf(f, "\t\tuint32_t a = 0x%08Xu;\n", addr + 8);
+			else fprintf(f, "\t\tuint32_t a = s->reg[%d];\n", instr.rn);
+		}
+		if (immediate) fprintf(f, "\t\tuint32_t b = 0x%08Xu;\n", instr.imm);
+		else fprintf(f, "\t\tuint32_t b = s->reg[%d];\n", instr.rm);
+		fprintf(f, "\t\tuint32_t r = %s;\n", expr);
+
+		if (setFlags)
+		{
+			if (arith && reverse) fprintf(f, "\t\tflagsSub(s, r, b, a);\n");
+			else if (arith) fprintf(f, "\t\tflags%s(s, r, a, b);\n", sub ? "Sub" : "Add");
+			else
+			{
+				fprintf(f, "\t\tflagsNZ(s, r);\n");
+				if (logical && immediate && instr.rotate != 0) fprintf(f, "\t\ts->C = %u;\n", (instr.imm >> 31) & 1);
+			}
+		}
+
+		if (!isTest) fprintf(f, "\t\ts->reg[%d] = r;\n", instr.rd);
+		fprintf(f, "\t}\n");
+		fprintf(f, "\ts->cycleTotal += 1;\n");
+		return true;
+	}
+
+	// the JIT's inline set again, plus the BL pair and BX
+	bool AOTCompiler::thumbNative(const decodedInstr& entry, bool& ends)
+	{
+		const CPU::thumbInstr& instr = entry.thumb;
+		uint32_t addr = entry.addr;
+		ends = false;
+
+		switch (instr.type)
+		{
+		case CPU::thumbOperation::THUMB_MOV_IMM:
+			fprintf(f, "\ts->reg[%d] = 0x%Xu;\n\tflagsThumbNZ(s, 0x%Xu);\n", instr.rd, instr.imm, instr.imm);
+			break;
+
+		case CPU::thumbOperation::THUMB_ADD_REG:
+		case CPU::thumbOperation::THUMB_SUB_REG:
+		{
+			bool sub = instr.type == CPU::thumbOperation::THUMB_SUB_REG;
+			fprintf(f, "\t{\n\t\tuint32_t a = s->reg[%d], b = s->reg[%d], r = a %c b;\n", instr.rs, instr.rn, sub ? '-' : '+');
+			fprintf(f, "\t\tflags%s(s, r, a, b);\n\t\ts->reg[%d] = r;\n\t}\n", sub ? "Sub" : "Add", instr.rd);
+			break;
+		}
+
+		case CPU::thumbOperation::THUMB_ADD_IMM:
+		case CPU::thumbOperation::THUMB_SUB_IMM:
+		case CPU::thumbOperation::THUMB_ADD_IMM3:
+		case CPU::thumbOperation::THUMB_SUB_IMM3:
+		case CPU::thumbOperation::THUMB_CMP_IMM:
+		{
+			bool fromRd = instr.type == CPU::thumbOperation::THUMB_ADD_IMM3 || instr.type == CPU::thumbOperation::THUMB_SUB_IMM3 || instr.type == CPU::thumbOperation::THUMB_CMP_IMM;
+			bool sub = instr.type == CPU::thumbOperation::THUMB_SUB_IMM || instr.type == CPU::thumbOperation::THUMB_SUB_IMM3 || instr.type == CPU::thumbOperation::THUMB_CMP_IMM;
+			fprintf(f, "\t{\n\t\tuint32_t a = s->reg[%d], r = a %c 0x%Xu;\n", fromRd ? instr.rd : instr.rs, sub ? '-' : '+', instr.imm);
+			fprintf(f, "\t\tflags%s(s, r, a, 0x%Xu);\n", sub ? "Sub" : "Add", instr.imm);
+			if (instr.type != CPU::thumbOperation::THUMB_CMP_IMM) fprintf(f, "\t\ts->reg[%d] = r;\n", instr.rd);
+			fprintf(f, "\t}\n");
+			break;
+		}
+
+		case CPU::thumbOperation::THUMB_CMP_REG:
+		case CPU::thumbOperation::THUMB_CMN_REG:
+		case CPU::thumbOperation::THUMB_CMP_HI:
+		{
+			if (instr.rd == 15 || instr.rs == 15) return false;
+			bool add = instr.type == CPU::thumbOperation::THUMB_CMN_REG;
+			fprintf(f, "\t{\n\t\tuint32_t a = s->reg[%d], b = s->reg[%d];\n", instr.rd, instr.rs);
+			fprintf(f, "\t\tflags%s(s, a %c b, a, b);\n\t}\n", add ? "Add" : "Sub", add ? '+' : '-');
+			break;
+		}
+
+		case CPU::thumbOperation::THUMB_NEG_REG:
+			fprintf(f, "\t{\n\t\tuint32_t b = s->reg[%d], r = 0 - b;\n", instr.rs);
+			fprintf(f, "\t\tflagsSub(s, r, 0, b);\n\t\ts->reg[%d] = r;\n\t}\n", instr.rd);
+			break;
+
+		case CPU::thumbOperation::THUMB_AND_REG:
+		case CPU::thumbOperation::THUMB_EOR_REG:
+		case CPU::thumbOperation::THUMB_ORR_REG:
+		case CPU::thumbOperation::THUMB_BIC_REG:
+		case CPU::thumbOperation::THUMB_TST_REG:
+		case CPU::thumbOperation::THUMB_MVN_REG:
+		{
+			const char* expr;
+			switch (instr.type)
+			{
+			case CPU::thumbOperation::THUMB_EOR_REG: expr = "s->reg[%d] ^ s->reg[%d]"; break;
+			case CPU::thumbOperation::THUMB_ORR_REG: expr = "s->reg[%d] | s->reg[%d]"; break;
+			case CPU::thumbOperation::THUMB_BIC_REG: expr = "s->reg[%d] & ~s->reg[%d]"; break;
+			case CPU::thumbOperation::THUMB_MVN_REG: expr = nullptr; break;
+			default: expr = "s->reg[%d] & s->reg[%d]"; break;
+			}
+			char value[64];
+			if (instr.type == CPU::thumbOperation::THUMB_MVN_REG) snprintf(value, sizeof(value), "~s->reg[%d]", instr.rs);
+			else snprintf(value, sizeof(value), expr, instr.rd, instr.rs);
+			fprintf(f, "\t{\n\t\tuint32_t r = %s;\n\t\tflagsThumbNZ(s, r);\n", value);
+			if (instr.type != CPU::thumbOperation::THUMB_TST_REG) fprintf(f, "\t\ts->reg[%d] = r;\n", instr.rd);
+			fprintf(f, "\t}\n");
+			break;
+		}
+
+		case CPU::thumbOperation::THUMB_LSL_IMM:
+		case CPU::thumbOperation::THUMB_LSR_IMM:
+		case CPU::thumbOperation::THUMB_ASR_IMM:
+		{
+			uint32_t shift = instr.imm & 0x1F;
+			if (instr.type == CPU::thumbOperation::THUMB_ASR_IMM && shift == 0) return false;
+
+			fprintf(f, "\t{\n\t\tuint32_t v = s->reg[%d];\n", instr.rs);
+			if (instr.type == CPU::thumbOperation::THUMB_LSL_IMM)
+			{
+				if (shift) fprintf(f, "\t\ts->C = (v >> %u) & 1;\n\t\tv <<= %u;\n", 32 - shift, shift);
+			}
+			else if (instr.type == CPU::thumbOperation::THUMB_LSR_IMM && shift == 0)
+			{
+				fprintf(f, "\t\ts->C = v >> 31;\n\t\tv = 0;\n"); // LSR #32
+			}
+			else if (instr.type == CPU::thumbOperation::THUMB_LSR_IMM)
+			{
+				fprintf(f, "\t\ts->C = (v >> %u) & 1;\n\t\tv >>= %u;\n", shift - 1, shift);
+			}
+			else
+			{
+				fprintf(f, "\t\ts->C = (v >> %u) & 1;\n\t\tv = uint32_t(int32_t(v) >> %u);\n", shift - 1, shift);
+			}
+			fprintf(f, "\t\tflagsThumbNZ(s, v);\n\t\ts->reg[%d] = v;\n\t}\n", instr.rd);
+			break;
+		}
+
+		case CPU::thumbOperation::THUMB_MOV_HI:
+		case CPU::thumbOperation::THUMB_ADD_HI:
+			if (instr.rd == 15 || instr.rs == 15) return false;
+			fprintf(f, "\ts->reg[%d] %s s->reg[%d];\n", instr.rd, instr.type == CPU::thumbOperation::THUMB_MOV_HI ? "=" : "+=", instr.rs);
+			break;
+
+		case CPU::thumbOperation::THUMB_BL_PREFIX:
+			fprintf(f, "\ts->reg[14] = 0x%08Xu;\n", addr + 4 + instr.imm);
+			break;
+
+		case CPU::thumbOperation::THUMB_BL_SUFFIX:
+			ends = true;
+			fprintf(f, "\t{\n\t\tuint32_t target = s->reg[14] + 0x%Xu;\n", instr.imm);
+			fprintf(f, "\t\ts->reg[14] = 0x%08Xu;\n\t\ts->pc() = (target & ~1u) + 4;\n\t}\n", (addr + 2) | 1);
+			fprintf(f, "\ts->cycleTotal += 3;\n\ts->curOpCycles = 3;\n\treturn %u;\n", emitted);
+			return true;
+
+		case CPU::thumbOperation::THUMB_BX:
+			ends = true;
+			if (instr.rs == 15) fprintf(f, "\tbranch(s, 0x%08Xu);\n", addr + 4);
+			else fprintf(f, "\tbranch(s, s->reg[%d]);\n", instr.rs);
+			fprintf(f, "\ts->cycleTotal += 3;\n\ts->curOpCycles = 3;\n\treturn %u;\n", emitted);
+			return true;
+
+		case CPU::thumbOperation::THUMB_B:
+			ends = true;
+			fprintf(f, "\ts->cycleTotal += 3;\n");
+			exitTo(addr + 4 + instr.imm, true, 3);
+			return true;
+
+		case CPU::thumbOperation::THUMB_B_COND:
+		{
+			uint8_t cond = instr.cond & 0xF;
+			if (cond >= 0xE) return false;
+
+			ends = true;
+			fprintf(f, "\ts->cycleTotal += 3;\n");
+			fprintf(f, "\tif (passes(s, 0x%04Xu))\n\t{\n", conditionMask(cond));
+			exitTo(addr + 4 + instr.imm, true, 3);
+			fprintf(f, "\t}\n");
+			exitTo(addr + 2, true, 3);
+			return true;
+		}
+
+		default:
+			return false;
+		}
+
+		fprintf(f, "\ts->cycleTotal += 1;\n");
+		return true;
+	}
+
+	void AOTCompiler::emitBlock(const walkedBlock& block, AOT::report& out)
+	{
+		emitted = 0;
+		bool thumb = block.thumb;
+		uint32_t width = thumb ? 2 : 4;
+
+		fprintf(f, "int %s(CPUState* s, AOTHost* h)\n{\n\tint c;\n\t(void)c;\n", blockName(block.addr, thumb));
+
+		for (size_t i = 0; i < block.instrs.size(); i++)
+		{
+			const decodedInstr& instr = block.instrs[i];
+			bool last = i + 1 == block.instrs.size();
+			bool ends = false;
+			emitted++;
+
+			fprintf(f, "\n\t// %08X: %0*X\n", instr.addr, thumb ? 4 : 8, instr.opcode);
+
+			bool native = thumb ? thumbNative(instr, ends) : armNative(instr);
+			if (native)
+			{
+				out.nativeInstrs++;
+				if (!thumb) ends = CPU::endsArmBlock(instr.arm); // the branches wrote their own exits
+				if (ends) break;
+				if (last)
+				{
+					exitTo(instr.addr + width, thumb, 1);
+				}
+				continue;
+			}
+
+			out.fallbackInstrs++;
+			fallback(instr, thumb, last);
+		}
+
+		fprintf(f, "}\n\n");
+	}
+
+	bool AOTCompiler::write(const char* path, uint32_t romSize, AOT::report& out)
+	{
+		f = fopen(path, "w");
+		if (!f) return false;
+
+		out = {};
+		out.blocks = uint32_t(blocks.size());
+
+		std::unordered_set<uint32_t> covered;
+		for (const walkedBlock& block : blocks)
+		{
+			translated.insert(blockKey(block.addr, block.thumb));
+			out.instrs += uint32_t(block.instrs.size());
+			for (const decodedInstr& instr : block.instrs)
+			{
+				if (covered.insert(instr.addr).second) out.bytesCovered += block.thumb ? 2 : 4;
+			}
+		}
+
+		fputs(prelude, f);
+
+		fprintf(f, "namespace\n{\n");
+		for (const walkedBlock& block : blocks) fprintf(f, "\tint %s(CPUState* s, AOTHost* h);\n", blockName(block.addr, block.thumb));
+		fprintf(f, "}\n\n");
+
+		fprintf(f, "namespace\n{\n\n");
+		for (const walkedBlock& block : blocks) emitBlock(block, out);
+
+		fprintf(f, "const AOTBlock blocks[] =\n{\n");
+		for (const walkedBlock& block : blocks)
+		{
+			fprintf(f, "\t{ 0x%08Xu, %d, &%s },\n", block.addr, block.thumb, blockName(block.addr, block.thumb));
+		}
+		fprintf(f, "};\n\n");
+
+		fprintf(f, "const AOTFallback fallbacks[] =\n{\n");
+		for (const AOTFallback& entry : fallbacks) fprintf(f, "\t{ 0x%08Xu, 0x%08Xu, %u },\n", entry.addr, entry.opcode, entry.thumb);
+		if (fallbacks.empty()) fprintf(f, "\t{ 0, 0, 0 },\n");
+		fprintf(f, "};\n\n");
+
+		fprintf(f, "const AOTModule module =\n{\n\t%u, %u, 0x%016llXull, 0x%08Xu,\n\t%u, blocks,\n\t%u, fallbacks\n};\n\n}\n\n",
+			AOT::moduleVersion, uint32_t(sizeof(CPUState)), (unsigned long long)AOT::hashImage(*cpu.bus, romSize), romSize,
+			uint32_t(blocks.size()), uint32_t(fallbacks.size()));
+
+		fprintf(f, "AOT_EXPORT const AOTModule* %s()\n{\n\treturn &module;\n}\n", AOT::moduleSymbol);
+
+		return fclose(f) == 0;
+	}
+}
+
+bool AOT::recompile(CPU& cpu, uint32_t romSize, const char* outPath, report& out)
+{
+	AOTCompiler compiler(cpu, romSize);
+	compiler.walk(0x08000000);
+	return compiler.write(outPath, romSize, out);
+}
+
+uint64_t AOT::hashImage(const Bus& bus, uint32_t size)
+{
+	uint64_t hash = 1469598103934665603ULL; // FNV-1a
+	const uint8_t* rom = bus.readRange(0x08000000, size);
+	if (!rom) return 0;
+	for (uint32_t i = 0; i < size; i++) hash = (hash ^ rom[i]) * 1099511628211ULL;
+	return hash;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//				                 RUNTIME								//
+//////////////////////////////////////////////////////////////////////////
+
+AOT::AOT(CPU* cpu) : verified(false), ranInstrs(0), ranFallbacks(0), ranBlocks(0), cpu(cpu), library(nullptr), module(nullptr)
+{
+	host.context = this;
+	host.fallback = &AOT::fallback;
+	host.linksLeft = 0;
+}
+
+AOT::~AOT()
+{
+	unload();
+}
+
+bool AOT::load(const char* path)
+{
+	unload();
+
+#if defined(_WIN32)
+	HMODULE lib = LoadLibraryA(path);
+	AOTModuleFunction get = lib ? reinterpret_cast<AOTModuleFunction>(GetProcAddress(lib, moduleSymbol)) : nullptr;
+#else
+	void* lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	AOTModuleFunction get = lib ? reinterpret_cast<AOTModuleFunction>(dlsym(lib, moduleSymbol)) : nullptr;
+#endif
+
+	const AOTModule* candidate = get ? get() : nullptr;
+	const char* problem = nullptr;
+
+	if (!lib) problem = "could not be opened";
+	else if (!candidate) problem = "does not export gbaAotModule";
+	else if (candidate->version != moduleVersion) problem = "was built by another version of the recompiler";
+	else if (candidate->stateSize != sizeof(CPUState)) problem = "was built against another CPUState";
+	else if (hashImage(*cpu->bus, candidate->romSize) != candidate->romHash) problem = "was built from another image";
+
+	if (problem)
+	{
+		printf("aot: %s %s, staying on the interpreter\n", path, problem);
+#if defined(_WIN32)
+		if (lib) FreeLibrary(lib);
+#else
+		if (lib) dlclose(lib);
+#endif
+		return false;
+	}
+
+	library = lib;
+	module = candidate;
+	verified = true;
+
+	blocks.reserve(module->blockCount);
+	for (uint32_t i = 0; i < module->blockCount; i++)
+	{
+		const AOTBlock& block = module->blocks[i];
+		blocks[(uint64_t(block.addr) << 1) | block.thumb] = &block;
+	}
+
+	fallbacks.resize(module->fallbackCount);
+	for (uint32_t i = 0; i < module->fallbackCount; i++)
+	{
+		const AOTFallback& from = module->fallbacks[i];
+		fallbackEntry& to = fallbacks[i];
+		to.thumb = from.thumb;
+		if (from.thumb)
+		{
+			const CPU::thumbDecodeEntry& entry = CPU::thumbLookup(uint16_t(from.opcode));
+			to.thumbEntry = { from.addr, cpu->decodeThumb(uint16_t(from.opcode), entry), entry.execute };
+		}
+		else
+		{
+			const CPU::armDecodeEntry& entry = CPU::armLookup(from.opcode);
+			to.arm = { from.addr, from.opcode, cpu->decodeArm(from.opcode, entry), entry.execute };
+		}
+	}
+
+	return true;
+}
+
+void AOT::unload()
+{
+	blocks.clear();
+	fallbacks.clear();
+	module = nullptr;
+
+	if (!library) return;
+#if defined(_WIN32)
+	FreeLibrary(static_cast<HMODULE>(library));
+#else
+	dlclose(library);
+#endif
+	library = nullptr;
+}
+
+const AOTBlock* AOT::lookup(uint64_t key)
+{
+	if (!module) return nullptr;
+
+	if (!verified)
+	{
+		verified = true;
+		if (hashImage(*cpu->bus, module->romSize) != module->romHash)
+		{
+			printf("aot: the image changed under the module, dropping it\n");
+			unload();
+			return nullptr;
+		}
+	}
+
+	auto found = blocks.find(key);
+	return found == blocks.end() ? nullptr : found->second;
+}
+
+int AOT::run(const AOTBlock* block)
+{
+	host.linksLeft = linkBudget;
+	int instrs = block->run(&cpu->state(), &host);
+	ranInstrs += instrs;
+	ranBlocks++;
+	return instrs;
+}
+
+// same contract as the JIT's handler calls: pc as the run loop has it going in, stepped past the instr
+// unless it branched, flags settled on the way out since the generated code reads CPSR directly
+int AOT::fallback(void* context, uint32_t index)
+{
+	AOT* aot = static_cast<AOT*>(context);
+	CPU* cpu = aot->cpu;
+	const fallbackEntry& entry = aot->fallbacks[index];
+	aot->ranFallbacks++;
+
+	cpu->pipelineFlushed = false;
+	int cycles;
+	if (entry.thumb)
+	{
+		cycles = (cpu->*entry.thumbEntry.execute)(entry.thumbEntry.instr);
+		if (!cpu->pipelineFlushed) cpu->pc() += 2;
+	}
+	else
+	{
+		cpu->instruction = entry.arm.opcode;
+		cycles = cpu->armDispatch(entry.arm.execute, entry.arm.instr);
+		if (!cpu->pipelineFlushed) cpu->pc() += 4;
+	}
+	cpu->syncFlags();
+	return cycles;
+}
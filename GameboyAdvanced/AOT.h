@@ -0,0 +1,125 @@
+#pragma once
+#include "CPU.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// ahead of time translation of a cartridge. AOT::recompile walks the image offline from its entry point,
+// following branches with ARM / THUMB state, and writes every block it reaches out as a C++ source file.
+// built into a shared library that exports gbaAotModule, CPU::loadAot hands it to tickBlock, which runs
+// the translated block for an address before it looks at the block cache or the JIT. anything the walk
+// never reached, and anything outside ROM (RAM can be rewritten, ROM can not), stays on the interpreter,
+// and a module is only used while the loaded image still hashes to the one it was built from
+
+//////////////////////////////////////////////////////////////////////////
+//				               MODULE ABI								//
+//////////////////////////////////////////////////////////////////////////
+
+// everything the generated code sees of the emulator past CPUState, so a module only has to be built
+// against the same CPU.h, not linked with the rest of it
+
+struct AOTHost
+{
+	void* context;
+	int (*fallback)(void* context, uint32_t index); // runs fallbacks[index] through its handler, returns its cycles
+	int32_t linksLeft; // block to block calls the module may still make before handing back to tickBlock
+};
+
+// an instr the module leaves to the interpreter. the runtime decodes these once when it loads the module
+struct AOTFallback
+{
+	uint32_t addr;
+	uint32_t opcode;
+	uint32_t thumb;
+};
+
+struct AOTBlock
+{
+	uint32_t addr;
+	uint32_t thumb;
+	int (*run)(CPUState* state, AOTHost* host); // instrs it ran, pc is left the way the run loop wants it
+};
+
+struct AOTModule
+{
+	uint32_t version;   // AOT::moduleVersion
+	uint32_t stateSize; // sizeof(CPUState) as the module was built
+	uint64_t romHash;   // AOT::hashImage of the image it was made from
+	uint32_t romSize;
+	uint32_t blockCount;
+	const AOTBlock* blocks;
+	uint32_t fallbackCount;
+	const AOTFallback* fallbacks;
+};
+
+#if defined(_WIN32)
+#define AOT_EXPORT extern "C" __declspec(dllexport)
+#else
+#define AOT_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+using AOTModuleFunction = const AOTModule* (*)();
+
+//////////////////////////////////////////////////////////////////////////
+//				                 RUNTIME								//
+//////////////////////////////////////////////////////////////////////////
+
+class AOT
+{
+public:
+
+	static constexpr uint32_t moduleVersion = 1;
+	static constexpr int32_t linkBudget = 64; // same as the JIT's
+	static constexpr const char* moduleSymbol = "gbaAotModule";
+
+	explicit AOT(CPU* cpu);
+	~AOT();
+
+	bool load(const char* path); // false if it will not open, or was built for another image or CPUState
+	void unload();
+	bool loaded() const { return module != nullptr; }
+
+	const AOTBlock* lookup(uint64_t key); // null when that address was not translated
+	int run(const AOTBlock* block);       // instrs it ran
+
+	bool verified; // cleared by flushBlockCache, the image is hashed again before the next lookup
+
+	uint64_t ranInstrs;    // from translated blocks, fallbacks included
+	uint64_t ranFallbacks; // of those, went through a handler
+	uint64_t ranBlocks;    // entered from tickBlock, linked ones not counted
+
+	static uint64_t hashImage(const Bus& bus, uint32_t size);
+
+public: // RECOMPILER
+
+	struct report
+	{
+		uint32_t blocks;
+		uint32_t instrs;
+		uint32_t nativeInstrs;
+		uint32_t fallbackInstrs;
+		uint32_t bytesCovered; // of ROM, each instr counted once however many blocks it is in
+	};
+
+	// the walk and the C++ writer. the cpu is only used to decode, its bus has to hold the image
+	static bool recompile(CPU& cpu, uint32_t romSize, const char* outPath, report& out);
+
+private:
+
+	struct fallbackEntry
+	{
+		bool thumb;
+		CPU::armBlockEntry arm;
+		CPU::thumbBlockEntry thumbEntry;
+	};
+
+	CPU* cpu;
+	void* library;
+	const AOTModule* module;
+	AOTHost host;
+
+	std::unordered_map<uint64_t, const AOTBlock*> blocks;
+	std::vector<fallbackEntry> fallbacks;
+
+	static int fallback(void* context, uint32_t index);
+};
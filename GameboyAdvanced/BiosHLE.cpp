@@ -0,0 +1,609 @@
+#include "CPU.h"
+#include "Bus.h"
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <array>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+#define HLE_SSE2 1
+#include <emmintrin.h>
+#else
+#define HLE_SSE2 0
+#endif
+
+// native stand ins for the bios SWI services that games lean on hardest. guest memory is one flat
+// little endian array behind the bus, so these read and write it through host pointers and leave the
+// bulk of the work to memcpy / memset and SSE2 stores. registers come back the way GBATEK says the
+// real routines leave them
+
+//////////////////////////////////////////////////////////////////////////
+//				                 COST TABLE								//
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+	enum : uint8_t
+	{
+		SWI_DIV = 0x06, SWI_DIVARM = 0x07, SWI_SQRT = 0x08, SWI_ARCTAN = 0x09, SWI_ARCTAN2 = 0x0A,
+		SWI_CPUSET = 0x0B, SWI_CPUFASTSET = 0x0C, SWI_BGAFFINESET = 0x0E, SWI_OBJAFFINESET = 0x0F,
+		SWI_LZ77WRAM = 0x11, SWI_LZ77VRAM = 0x12, SWI_HUFF = 0x13, SWI_RLWRAM = 0x14, SWI_RLVRAM = 0x15,
+	};
+
+	// rough figures for the real routines: a fixed part for the call, the bios entry and the return, then
+	// a per unit part (units copied or filled, affine entries, bytes decompressed). base 0 = not handled
+	struct hleCost
+	{
+		uint16_t base;
+		uint16_t perUnit;
+	};
+
+	constexpr hleCost hleCosts[0x16] =
+	{
+		{ 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+		{ 80, 0 },   // 06 Div
+		{ 84, 0 },   // 07 DivArm
+		{ 120, 0 },  // 08 Sqrt
+		{ 60, 0 },   // 09 ArcTan
+		{ 110, 0 },  // 0A ArcTan2
+		{ 40, 9 },   // 0B CpuSet, per halfword / word
+		{ 40, 2 },   // 0C CpuFastSet, per word
+		{ 0, 0 },
+		{ 40, 110 }, // 0E BgAffineSet, per entry
+		{ 40, 75 },  // 0F ObjAffineSet, per entry
+		{ 0, 0 },
+		{ 60, 14 },  // 11 LZ77UnCompWram, per byte out
+		{ 60, 16 },  // 12 LZ77UnCompVram
+		{ 80, 24 },  // 13 HuffUnComp
+		{ 50, 8 },   // 14 RLUnCompWram
+		{ 50, 10 },  // 15 RLUnCompVram
+	};
+
+	uint16_t load16(const uint8_t* p) { uint16_t v; memcpy(&v, p, 2); return v; }
+	uint32_t load32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+	void store16(uint8_t* p, uint16_t v) { memcpy(p, &v, 2); }
+	void store32(uint8_t* p, uint32_t v) { memcpy(p, &v, 4); }
+
+	void fill32(uint8_t* dst, uint32_t value, uint32_t words)
+	{
+		if ((value & 0xFFFF) == (value >> 16) && (value & 0xFF) == ((value >> 8) & 0xFF))
+		{
+			memset(dst, value & 0xFF, size_t(words) * 4);
+			return;
+		}
+
+		uint32_t i = 0;
+#if HLE_SSE2
+		const __m128i wide = _mm_set1_epi32(int32_t(value));
+		for (; i + 16 <= words; i += 16) // a 64 byte line per go round
+		{
+			__m128i* line = reinterpret_cast<__m128i*>(dst + i * 4);
+			_mm_storeu_si128(line, wide);
+			_mm_storeu_si128(line + 1, wide);
+			_mm_storeu_si128(line + 2, wide);
+			_mm_storeu_si128(line + 3, wide);
+		}
+		for (; i + 4 <= words; i += 4) _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), wide);
+#endif
+		for (; i < words; i++) store32(dst + i * 4, value);
+	}
+
+	void fill16(uint8_t* dst, uint16_t value, uint32_t halves)
+	{
+		if (halves & 1) store16(dst + size_t(halves - 1) * 2, value);
+		fill32(dst, value | (uint32_t(value) << 16), halves >> 1);
+	}
+
+	// the bios copies one unit at a time going up, so a destination just above its source gets the
+	// first units smeared across it. memmove would not, fall back to the plain loop for that case
+	void copyForward(uint8_t* dst, const uint8_t* src, uint32_t bytes, uint32_t unit)
+	{
+		if (dst <= src || dst >= src + bytes)
+		{
+			memmove(dst, src, bytes);
+			return;
+		}
+
+		for (uint32_t i = 0; i < bytes; i += unit) memcpy(dst + i, src + i, unit);
+	}
+
+	uint32_t isqrt(uint32_t value)
+	{
+		uint32_t result = 0;
+		uint32_t bit = 1u << 30;
+
+		while (bit > value) bit >>= 2;
+
+		while (bit)
+		{
+			if (value >= result + bit)
+			{
+				value -= result + bit;
+				result = (result >> 1) + bit;
+			}
+			else
+			{
+				result >>= 1;
+			}
+			bit >>= 2;
+		}
+
+		return result;
+	}
+
+	// the bios polynomial, tan in 1.14 fixed point in, angle out with 0x4000 = pi / 2
+	int32_t arcTan(int32_t tan)
+	{
+		int32_t a = -((tan * tan) >> 14);
+		int32_t b = ((0xA9 * a) >> 14) + 0x390;
+		b = ((b * a) >> 14) + 0x91C;
+		b = ((b * a) >> 14) + 0xFB6;
+		b = ((b * a) >> 14) + 0x16AA;
+		b = ((b * a) >> 14) + 0x2081;
+		b = ((b * a) >> 14) + 0x3651;
+		b = ((b * a) >> 14) + 0xA2F9;
+		return (tan * b) >> 16;
+	}
+
+	// full circle version, 0x0000 - 0xFFFF for the angle of (x, y)
+	uint16_t arcTan2(int32_t x, int32_t y)
+	{
+		if (y == 0) return x >= 0 ? 0x0000 : 0x8000;
+		if (x == 0) return y >= 0 ? 0x4000 : 0xC000;
+
+		if (y >= 0)
+		{
+			if (x >= 0)
+			{
+				if (x >= y) return uint16_t(arcTan((y * 0x4000) / x));
+			}
+			else if (-x >= y)
+			{
+				return uint16_t(arcTan((y * 0x4000) / x) + 0x8000);
+			}
+			return uint16_t(0x4000 - arcTan((x * 0x4000) / y));
+		}
+
+		if (x <= 0)
+		{
+			if (-x > -y) return uint16_t(arcTan((y * 0x4000) / x) + 0x8000);
+		}
+		else if (x >= -y)
+		{
+			return uint16_t(arcTan((y * 0x4000) / x) + 0x10000);
+		}
+		return uint16_t(0xC000 - arcTan((x * 0x4000) / y));
+	}
+
+	// the bios keeps a 256 entry sine table in 1.14 fixed point and only looks at the top byte of the
+	// angle, so a quarter turn is 0x4000. cos is the same table a quarter further on
+	const int16_t* sineTable()
+	{
+		static const auto table = []
+		{
+			std::array<int16_t, 256> values{};
+			for (int i = 0; i < 256; i++) values[i] = int16_t(std::lround(std::sin(i * 3.14159265358979323846 / 128.0) * 0x4000));
+			return values;
+		}();
+		return table.data();
+	}
+
+	int32_t sine(uint16_t angle) { return sineTable()[angle >> 8]; }
+	int32_t cosine(uint16_t angle) { return sineTable()[((angle >> 8) + 64) & 0xFF]; }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//				                  DISPATCH								//
+//////////////////////////////////////////////////////////////////////////
+
+void CPU::setHleBios(bool enabled)
+{
+	hleBios = enabled;
+}
+
+int CPU::hleSwi(uint8_t number)
+{
+	if (number >= sizeof(hleCosts) / sizeof(hleCosts[0]) || hleCosts[number].base == 0) return 0;
+
+	const hleCost& cost = hleCosts[number];
+	uint32_t units = 0;
+
+	switch (number)
+	{
+	case SWI_DIV:
+	case SWI_DIVARM: // same thing with numerator and denominator swapped round
+	{
+		int32_t num = int32_t(number == SWI_DIV ? reg[0] : reg[1]);
+		int32_t den = int32_t(number == SWI_DIV ? reg[1] : reg[0]);
+		if (den == 0) return 0; // the bios just hangs, leave it to do so
+
+		int64_t quotient = int64_t(num) / den; // INT_MIN / -1 wraps back round, like the bios
+		reg[0] = uint32_t(quotient);
+		reg[1] = uint32_t(int64_t(num) % den);
+		reg[3] = uint32_t(quotient < 0 ? -quotient : quotient);
+		break;
+	}
+	case SWI_SQRT:
+		reg[0] = isqrt(reg[0]);
+		break;
+	case SWI_ARCTAN:
+		reg[0] = uint32_t(arcTan(int16_t(reg[0])));
+		break;
+	case SWI_ARCTAN2:
+		reg[0] = arcTan2(int16_t(reg[0]), int16_t(reg[1]));
+		break;
+	case SWI_CPUSET:
+		if (!hleCpuSet()) return 0;
+		units = reg[2] & 0x1FFFFF;
+		break;
+	case SWI_CPUFASTSET:
+		if (!hleCpuFastSet()) return 0;
+		units = ((reg[2] & 0x1FFFFF) + 7) & ~7u;
+		break;
+	case SWI_BGAFFINESET:
+		if (!hleBgAffineSet()) return 0;
+		units = reg[2];
+		break;
+	case SWI_OBJAFFINESET:
+		if (!hleObjAffineSet()) return 0;
+		units = reg[2];
+		break;
+	case SWI_LZ77WRAM:
+	case SWI_LZ77VRAM:
+		if (!hleLZ77(units)) return 0;
+		break;
+	case SWI_HUFF:
+		if (!hleHuff(units)) return 0;
+		break;
+	case SWI_RLWRAM:
+	case SWI_RLVRAM:
+		if (!hleRL(units)) return 0;
+		break;
+	default:
+		return 0;
+	}
+
+	hleCalls++;
+
+	uint64_t cycles = cost.base + uint64_t(cost.perUnit) * units;
+	return cycles > 0x7FFFFFFF ? 0x7FFFFFFF : int(cycles);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//				                  COPIES								//
+//////////////////////////////////////////////////////////////////////////
+
+// r0 source, r1 destination, r2 bits 0-20 unit count, bit 24 fill with the first unit, bit 26 words
+bool CPU::hleCpuSet()
+{
+	const bool fill = reg[2] & (1 << 24);
+	const bool wide = reg[2] & (1 << 26);
+	const uint32_t unit = wide ? 4 : 2;
+	const uint32_t count = reg[2] & 0x1FFFFF;
+	const uint32_t src = reg[0] & ~(unit - 1);
+	const uint32_t dst = reg[1] & ~(unit - 1);
+	const uint32_t bytes = count * unit;
+
+	const uint8_t* from = bus->readRange(src, fill ? unit : bytes);
+	uint8_t* to = bus->writeRange(dst, bytes);
+	if (!from || !to) return false;
+
+	if (fill)
+	{
+		if (wide) fill32(to, load32(from), count);
+		else fill16(to, load16(from), count);
+	}
+	else
+	{
+		copyForward(to, from, bytes, unit);
+	}
+
+	return true;
+}
+
+// same registers as CpuSet but always words, and the count goes up to a multiple of 8 (one LDM / STM)
+bool CPU::hleCpuFastSet()
+{
+	const bool fill = reg[2] & (1 << 24);
+	const uint32_t count = ((reg[2] & 0x1FFFFF) + 7) & ~7u;
+	const uint32_t src = reg[0] & ~3u;
+	const uint32_t dst = reg[1] & ~3u;
+	const uint32_t bytes = count * 4;
+
+	const uint8_t* from = bus->readRange(src, fill ? 4 : bytes);
+	uint8_t* to = bus->writeRange(dst, bytes);
+	if (!from || !to) return false;
+
+	if (fill) fill32(to, load32(from), count);
+	else copyForward(to, from, bytes, 32);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//				                  AFFINE								//
+//////////////////////////////////////////////////////////////////////////
+
+// r0 source, r1 destination, r2 count. each 20 byte source is origin x / y (s32, 24.8), display x / y
+// (s16), scale x / y (s16, 8.8) and the angle, each 16 byte output is pa pb pc pd then the start x / y
+bool CPU::hleBgAffineSet()
+{
+	const uint32_t count = reg[2];
+	if (count > 0x10000) return false;
+
+	const uint8_t* from = bus->readRange(reg[0], count * 20);
+	uint8_t* to = bus->writeRange(reg[1], count * 16);
+	if (!from || !to) return false;
+
+	for (uint32_t i = 0; i < count; i++, from += 20, to += 16)
+	{
+		int32_t ox = int32_t(load32(from));
+		int32_t oy = int32_t(load32(from + 4));
+		int32_t cx = int16_t(load16(from + 8));
+		int32_t cy = int16_t(load16(from + 10));
+		int32_t sx = int16_t(load16(from + 12));
+		int32_t sy = int16_t(load16(from + 14));
+		uint16_t angle = load16(from + 16);
+
+		int32_t pa = (sx * cosine(angle)) >> 14;
+		int32_t pb = -((sx * sine(angle)) >> 14);
+		int32_t pc = (sy * sine(angle)) >> 14;
+		int32_t pd = (sy * cosine(angle)) >> 14;
+
+		store16(to, uint16_t(pa));
+		store16(to + 2, uint16_t(pb));
+		store16(to + 4, uint16_t(pc));
+		store16(to + 6, uint16_t(pd));
+		store32(to + 8, uint32_t(ox - (pa * cx + pb * cy)));
+		store32(to + 12, uint32_t(oy - (pc * cx + pd * cy)));
+	}
+
+	return true;
+}
+
+// r0 source, r1 destination, r2 count, r3 byte step between outputs (2 for a plain array, 8 to land
+// in OAM). each 8 byte source is scale x / y (s16, 8.8) and the angle, four outputs per entry
+bool CPU::hleObjAffineSet()
+{
+	const uint32_t count = reg[2];
+	const uint32_t step = reg[3];
+	if (count > 0x10000 || step < 2 || step > 0x100) return false;
+
+	const uint8_t* from = bus->readRange(reg[0], count * 8);
+	uint8_t* to = bus->writeRange(reg[1], count * step * 4);
+	if (!from || !to) return false;
+
+	for (uint32_t i = 0; i < count; i++, from += 8)
+	{
+		int32_t sx = int16_t(load16(from));
+		int32_t sy = int16_t(load16(from + 2));
+		uint16_t angle = load16(from + 4);
+
+		store16(to, uint16_t((sx * cosine(angle)) >> 14)); to += step;
+		store16(to, uint16_t(-((sx * sine(angle)) >> 14))); to += step;
+		store16(to, uint16_t((sy * sine(angle)) >> 14)); to += step;
+		store16(to, uint16_t((sy * cosine(angle)) >> 14)); to += step;
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//				               DECOMPRESSION							//
+//////////////////////////////////////////////////////////////////////////
+
+// all three start with a u32 header, type in bits 4-7 and the decompressed size in bits 8-31. a
+// stream is decoded into hleScratch and only copied out once all of it has decoded, so a call the
+// real bios has to take over has not dropped any blocks or journalled anything. the output range is
+// then claimed in one go, so the code page check happens once. the VRAM flavours only differ in
+// writing halfwords, which a flat backing store does not see
+
+namespace
+{
+	// each decodes the stream after the header into out, and turns down one that runs off the end of
+	// its store or, for LZ77, points back before the start
+
+	// blocks of 8 behind a flag byte, MSB first. 0 = a literal byte, 1 = two bytes giving a length
+	// (top nibble + 3) and a distance back into what has already been written (low 12 bits + 1)
+	bool lz77Stream(const uint8_t* in, const uint8_t* inEnd, uint32_t size, uint8_t* out)
+	{
+		uint32_t pos = 0;
+
+		while (pos < size)
+		{
+			if (in >= inEnd) return false;
+			uint8_t flags = *in++;
+
+			for (int block = 0; block < 8 && pos < size; block++, flags <<= 1)
+			{
+				if (!(flags & 0x80))
+				{
+					if (in >= inEnd) return false;
+					out[pos++] = *in++;
+					continue;
+				}
+
+				if (in + 2 > inEnd) return false;
+				uint32_t length = (in[0] >> 4) + 3;
+				uint32_t distance = (((in[0] & 0xF) << 8) | in[1]) + 1;
+				in += 2;
+
+				if (distance > pos) return false; // points before the start, the bios would read junk
+				if (length > size - pos) length = size - pos;
+
+				uint8_t* copyFrom = out + pos - distance;
+				if (distance >= length) memcpy(out + pos, copyFrom, length);
+				else for (uint32_t i = 0; i < length; i++) out[pos + i] = copyFrom[i]; // repeats its own output
+
+				pos += length;
+			}
+		}
+
+		return true;
+	}
+
+	// flag byte then data. bit 7 set = the next byte repeated (flag & 0x7F) + 3 times, clear = the next
+	// (flag & 0x7F) + 1 bytes as they are
+	bool rlStream(const uint8_t* in, const uint8_t* inEnd, uint32_t size, uint8_t* out)
+	{
+		uint32_t pos = 0;
+
+		while (pos < size)
+		{
+			if (in >= inEnd) return false;
+			uint8_t flag = *in++;
+
+			if (flag & 0x80)
+			{
+				uint32_t length = (flag & 0x7F) + 3;
+				if (length > size - pos) length = size - pos;
+				if (in >= inEnd) return false;
+
+				memset(out + pos, *in++, length);
+				pos += length;
+			}
+			else
+			{
+				uint32_t length = (flag & 0x7F) + 1;
+				if (length > size - pos) length = size - pos;
+				if (in + length > inEnd) return false;
+
+				memcpy(out + pos, in, length);
+				in += length;
+				pos += length;
+			}
+		}
+
+		return true;
+	}
+
+	// in is the data at guest address src, header included, inSize what its store holds from there. a
+	// byte after the header with the tree size / 2 - 1, then the tree. each node holds an offset to its
+	// child pair in bits 0-5 and, in bits 7 / 6, whether child 0 / child 1 is a leaf. the bitstream is
+	// u32s read MSB first, symbols pack into output words LSB first
+	bool huffStream(const uint8_t* in, uint32_t src, uint32_t inSize, uint32_t size, uint32_t symbolBits, uint8_t* out)
+	{
+		// nodes are found by guest address (the pair sits at the node's address with bit 0 cleared, plus
+		// the offset), so track offsets from src rather than trusting host pointer alignment
+		const uint8_t* inEnd = in + inSize;
+		const uint32_t root = 5;
+		uint32_t node = root;
+		const uint8_t* stream = in + 4 + (uint32_t(in[4]) + 1) * 2;
+
+		uint32_t word = 0;
+		uint32_t wordBits = 0;
+		uint32_t pos = 0;
+
+		while (pos < size)
+		{
+			if (stream + 4 > inEnd) return false;
+			uint32_t bits = load32(stream);
+			stream += 4;
+
+			for (int bit = 31; bit >= 0 && pos < size; bit--)
+			{
+				uint32_t direction = (bits >> bit) & 1;
+				uint8_t entry = in[node];
+				uint32_t child = (((src + node) & ~1u) + (entry & 0x3F) * 2 + 2 + direction) - src;
+				if (child >= inSize) return false;
+
+				if (!(entry & (direction ? 0x40 : 0x80)))
+				{
+					node = child;
+					continue;
+				}
+
+				word |= uint32_t(in[child]) << wordBits;
+				wordBits += symbolBits;
+				node = root;
+
+				if (wordBits == 32)
+				{
+					store32(out + pos, word);
+					pos += 4;
+					word = 0;
+					wordBits = 0;
+				}
+			}
+		}
+
+		return true;
+	}
+}
+
+// null if size bytes from dst would not fit the store, so a stream that could never be written out
+// is not decoded (or given a scratch buffer as big as its header claims) in the first place
+uint8_t* CPU::hleUnpackTo(uint32_t dst, uint32_t size)
+{
+	if (size > bus->bytesFrom(dst)) return nullptr;
+	if (hleScratch.size() <= size) hleScratch.resize(size_t(size) + 1); // never empty, so a 0 byte stream still gets a pointer
+	return hleScratch.data();
+}
+
+bool CPU::hleLZ77(uint32_t& written)
+{
+	const uint32_t src = reg[0];
+	const uint8_t* in = bus->readRange(src, 4);
+	if (!in) return false;
+
+	const uint32_t header = load32(in);
+	const uint32_t size = header >> 8;
+	if ((header & 0xF0) != 0x10) return false;
+
+	uint8_t* scratch = hleUnpackTo(reg[1], size);
+	if (!scratch || !lz77Stream(in + 4, in + bus->bytesFrom(src), size, scratch)) return false;
+
+	uint8_t* out = bus->writeRange(reg[1], size);
+	if (!out) return false;
+
+	memcpy(out, scratch, size);
+	written = size;
+	return true;
+}
+
+bool CPU::hleRL(uint32_t& written)
+{
+	const uint32_t src = reg[0];
+	const uint8_t* in = bus->readRange(src, 4);
+	if (!in) return false;
+
+	const uint32_t header = load32(in);
+	const uint32_t size = header >> 8;
+	if ((header & 0xF0) != 0x30) return false;
+
+	uint8_t* scratch = hleUnpackTo(reg[1], size);
+	if (!scratch || !rlStream(in + 4, in + bus->bytesFrom(src), size, scratch)) return false;
+
+	uint8_t* out = bus->writeRange(reg[1], size);
+	if (!out) return false;
+
+	memcpy(out, scratch, size);
+	written = size;
+	return true;
+}
+
+// header bits 0-3 give the symbol width, 4 or 8. output goes out in whole words
+bool CPU::hleHuff(uint32_t& written)
+{
+	const uint32_t src = reg[0];
+	const uint8_t* in = bus->readRange(src, 5);
+	if (!in) return false;
+
+	const uint32_t header = load32(in);
+	const uint32_t size = header >> 8;
+	const uint32_t symbolBits = header & 0xF;
+	if ((header & 0xF0) != 0x20 || (symbolBits != 4 && symbolBits != 8)) return false;
+
+	const uint32_t dst = reg[1] & ~3u;
+	const uint32_t words = (size + 3) & ~3u;
+	uint8_t* scratch = hleUnpackTo(dst, words);
+	if (!scratch || !huffStream(in, src, bus->bytesFrom(src), size, symbolBits, scratch)) return false;
+
+	uint8_t* out = bus->writeRange(dst, words);
+	if (!out) return false;
+
+	memcpy(out, scratch, words);
+	written = size;
+	return true;
+}
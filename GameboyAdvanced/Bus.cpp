@@ -1,76 +1,186 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include "Bus.h"
+#include "CPU.h"
+#include "UndoJournal.h"
 
 
 Bus::Bus()
 {
-    memorySize = 0x10000000; 
-    biosRom = std::make_unique<uint8_t[]>(memorySize);
-    memset(biosRom.get(), 0, memorySize);
+    const uint32_t total = biosSize + ewramSize + iwramSize + ioSize + paletteSize + vramSize + oamSize + sramSize;
+    memory = std::make_unique<uint8_t[]>(total); // zeroed
+    loadedRomSize = 0;
+
+    memset(regions, 0, sizeof(regions));
+    uint8_t* store = memory.get();
+    mapRegion(0x00, store, 0x00FFFFFF, biosSize, false);                store += biosSize;
+    mapRegion(0x02, store, ewramSize - 1, ewramSize, true);            store += ewramSize;
+    mapRegion(0x03, store, iwramSize - 1, iwramSize, true);            store += iwramSize;
+    mapRegion(0x04, store, 0x00FFFFFF, ioSize, true);                  store += ioSize;
+    mapRegion(0x05, store, paletteSize - 1, paletteSize, true);        store += paletteSize;
+    mapRegion(0x06, store, 0x1FFFF, vramSize, true, 0x8000);           store += vramSize;
+    mapRegion(0x07, store, oamSize - 1, oamSize, true);                store += oamSize;
+    mapRegion(0x0E, store, sramSize - 1, sramSize, true);
+    mapRegion(0x0F, store, sramSize - 1, sramSize, true);
+    mapRom();
+
+    pages = std::make_unique<uintptr_t[]>(pageCount);
+    clearCodePages();
+    mapPages();
+}
+
+void Bus::mapRegion(uint32_t index, uint8_t* store, uint32_t mask, uint32_t size, bool writable, uint32_t fold)
+{
+    uint32_t start = index == 0x0F ? 0x0E000000 : index << 24; // SRAM's second entry is a mirror
+    regions[index] = { store, start, mask, size, fold, writable };
+}
+
+// all six ROM entries share the one image, each 32 MB mirror is two of them. a shared image is mapped
+// read only, nothing writes through the ROM entries since they are never writable
+void Bus::mapRom()
+{
+    uint8_t* store = romImage ? const_cast<uint8_t*>(romImage->data()) : rom.get();
+    for (uint32_t index = 0x08; index < 0x0E; index++)
+    {
+        regions[index] = { store, 0x08000000, romMaxSize - 1, loadedRomSize, 0, false };
+    }
+}
+
+size_t Bus::memoryFootprint() const
+{
+    return size_t(biosSize) + ewramSize + iwramSize + ioSize + paletteSize + vramSize + oamSize + sramSize + (rom ? loadedRomSize : 0)
+        + pageCount * sizeof(uintptr_t);
 }
 
 //====================
-// READ FUNCTIONS
+// PAGE TABLE
 //====================
-uint32_t Bus::read32(uint32_t addr, bool bReadOnly)
+
+void Bus::mapPages()
 {
-    if (addr < memorySize - 3)
-    {  // Ensure we can read 4 bytes
-        return (biosRom[addr + 3] << 24) |
-            (biosRom[addr + 2] << 16) |
-            (biosRom[addr + 1] << 8) |
-            biosRom[addr];
+    for (uint32_t page = 0; page < pageCount; page++) pages[page] = pageEntry(page << pageShift);
+}
+
+// a page gets an entry only if it is one piece of one store, a region that mirrors more often than
+// that or a store that ends part way through it is left to the region walk
+uintptr_t Bus::pageEntry(uint32_t addr) const
+{
+    const region& r = regionAt(addr);
+    uint32_t offset = offsetIn(r, addr);
+    if (!r.store || r.mask < pageMask || offset >= r.size || r.size - offset < pageSize) return 0;
+
+    uintptr_t entry = reinterpret_cast<uintptr_t>(r.store + offset);
+    bool fastWrites = r.writable && r.start + offset == addr && !journal;
+
+    int first = codePageIndex(addr);
+    for (int i = 0; fastWrites && first >= 0 && i < int(pageSize >> codePageShift); i++)
+    {
+        if (codePages[first + i]) fastWrites = false;
     }
-    return 0;  // Out of bounds
+    return fastWrites ? entry : entry | pageReadOnly;
 }
 
-uint16_t Bus::read16(uint32_t addr, bool bReadOnly)
+void Bus::setJournal(UndoJournal* to)
 {
-    if (addr < memorySize - 1)
+    journal = to;
+    mapPages();
+}
+
+//====================
+// READ FUNCTIONS
+//====================
+
+// an access that runs off the end of a store is put together a byte at a time, each byte wrapping
+// or going unmapped on its own
+uint32_t Bus::slowRead32(uint32_t addr)
+{
+    const region& r = regionAt(addr);
+    uint32_t offset = offsetIn(r, addr);
+    if (offset + 3 < r.size)
     {
-        return (biosRom[addr + 1] << 8) | biosRom[addr];
+        const uint8_t* at = r.store + offset;
+        return (at[3] << 24) | (at[2] << 16) | (at[1] << 8) | at[0];
     }
-    return 0;
+    return slowRead8(addr) | (slowRead8(addr + 1) << 8) | (slowRead8(addr + 2) << 16) | (uint32_t(slowRead8(addr + 3)) << 24);
 }
 
-uint8_t Bus::read8(uint32_t addr, bool bReadOnly)
+uint16_t Bus::slowRead16(uint32_t addr)
 {
-    if (addr < memorySize)
+    const region& r = regionAt(addr);
+    uint32_t offset = offsetIn(r, addr);
+    if (offset + 1 < r.size)
     {
-        return biosRom[addr];
+        return (r.store[offset + 1] << 8) | r.store[offset];
     }
-    return 0;
+    return slowRead8(addr) | (slowRead8(addr + 1) << 8);
+}
+
+uint8_t Bus::slowRead8(uint32_t addr)
+{
+    const region& r = regionAt(addr);
+    uint32_t offset = offsetIn(r, addr);
+    return offset < r.size ? r.store[offset] : 0;
 }
 
 //====================
 // WRITE FUNCTIONS
 //====================
-void Bus::write8(uint32_t addr, uint8_t data)
+bool Bus::isRomAddress(uint32_t addr)
 {
-    if (addr < memorySize)
-    {
-        biosRom[addr] = data;
-    }
+    return addr >= 0x08000000 && addr < 0x0E000000;
 }
 
-void Bus::write16(uint32_t addr, uint16_t data)
+// writes go by the address the byte has in the first mirror, so a store through any mirror still drops
+// the blocks decoded from it and undoes to the right place
+void Bus::slowWrite8(uint32_t addr, uint8_t data)
 {
-    if (addr < memorySize - 1)
+    const region& r = regionAt(addr);
+    uint32_t offset = offsetIn(r, addr);
+    if (!r.writable || offset >= r.size) return; // bios and cartridge ROM are read only, the CPU block cache relies on it
+
+    uint32_t at = r.start + offset;
+    if (codeWatcher) checkCodeWrite(at, 1);
+    if (journal) journal->saveBytes(at, 1, &r.store[offset]);
+    r.store[offset] = data;
+}
+
+void Bus::slowWrite16(uint32_t addr, uint16_t data)
+{
+    const region& r = regionAt(addr);
+    uint32_t offset = offsetIn(r, addr);
+    if (!r.writable) return;
+    if (offset + 1 >= r.size)
     {
-        biosRom[addr] = data & 0xFF;
-        biosRom[addr + 1] = (data >> 8) & 0xFF;
+        slowWrite8(addr, data & 0xFF);
+        slowWrite8(addr + 1, (data >> 8) & 0xFF);
+        return;
     }
+
+    uint32_t at = r.start + offset;
+    if (codeWatcher) checkCodeWrite(at, 2);
+    if (journal) journal->saveBytes(at, 2, &r.store[offset]);
+    r.store[offset] = data & 0xFF;
+    r.store[offset + 1] = (data >> 8) & 0xFF;
 }
 
-void Bus::write32(uint32_t addr, uint32_t data) 
+void Bus::slowWrite32(uint32_t addr, uint32_t data)
 {
-    if (addr < memorySize - 3)
+    const region& r = regionAt(addr);
+    uint32_t offset = offsetIn(r, addr);
+    if (!r.writable) return;
+    if (offset + 3 >= r.size)
     {
-        biosRom[addr] = data & 0xFF;
-        biosRom[addr + 1] = (data >> 8) & 0xFF;
-        biosRom[addr + 2] = (data >> 16) & 0xFF;
-        biosRom[addr + 3] = (data >> 24) & 0xFF;
+        for (uint32_t i = 0; i < 4; i++) slowWrite8(addr + i, (data >> (i * 8)) & 0xFF);
+    }
+    else
+    {
+        uint32_t at = r.start + offset;
+        if (codeWatcher) checkCodeWrite(at, 4);
+        if (journal) journal->saveBytes(at, 4, &r.store[offset]);
+        r.store[offset] = data & 0xFF;
+        r.store[offset + 1] = (data >> 8) & 0xFF;
+        r.store[offset + 2] = (data >> 16) & 0xFF;
+        r.store[offset + 3] = (data >> 24) & 0xFF;
     }
 
     if (addr == 0x03000000) // this is here for the arm tester
@@ -88,12 +198,72 @@ void Bus::write32(uint32_t addr, uint32_t data)
 }
 
 
+//====================
+// CODE WRITE TRACKING
+//====================
+
+int Bus::codePageIndex(uint32_t addr)
+{
+    if (addr >= 0x02000000 && addr < 0x02040000) return (addr - 0x02000000) >> codePageShift; // EWRAM
+    if (addr >= 0x03000000 && addr < 0x03008000) return (0x40000 + (addr - 0x03000000)) >> codePageShift; // IWRAM
+    return -1;
+}
+
+void Bus::markCode(uint32_t addr, bool isCode)
+{
+    int page = codePageIndex(addr);
+    if (page < 0) return;
+    codePages[page] = isCode;
+
+    // marking is once per decoded instr so it only tags the entry, unmarking has to look at the rest of the page
+    uint32_t first = addr & ~pageMask;
+    pages[first >> pageShift] = isCode ? pages[first >> pageShift] | pageReadOnly : pageEntry(first);
+}
+
+void Bus::clearCodePages()
+{
+    memset(codePages, 0, sizeof(codePages));
+    for (uint32_t addr = 0x02000000; addr < 0x02000000 + ewramSize; addr += pageSize) pages[addr >> pageShift] = pageEntry(addr);
+    for (uint32_t addr = 0x03000000; addr < 0x03000000 + iwramSize; addr += pageSize) pages[addr >> pageShift] = pageEntry(addr);
+}
+
+void Bus::checkCodeWrite(uint32_t addr, uint32_t size)
+{
+    int first = codePageIndex(addr);
+    int last = codePageIndex(addr + size - 1);
+
+    if ((first >= 0 && codePages[first]) || (last >= 0 && codePages[last]))
+    {
+        codeWatcher->invalidateCode(addr, size);
+    }
+}
+
 //====================
 // LOADROM
 //====================
 
-bool Bus::loadROM(const char* filename, uint32_t loadAddr)
+// an image for the cartridge replaces the ROM store with one its size, anything else has to fit in
+// the store of the region it is loaded into
+bool Bus::loadROM(const char* filename, uint32_t loadAddr, bool shareImage)
 {
+    if (shareImage && loadAddr == 0x08000000)
+    {
+        std::shared_ptr<const RomImage> image = RomImage::open(filename);
+        if (image && image->size() <= romMaxSize)
+        {
+            romImage = image;
+            rom.reset();
+            loadedRomSize = image->size();
+            mapRom();
+            mapPages();
+
+            if (codeWatcher) codeWatcher->flushBlockCache();
+
+            printf("rom loaded\n");
+            return true;
+        }
+    }
+
     FILE* file = fopen(filename, "rb");
     if (!file)
     {
@@ -105,13 +275,36 @@ bool Bus::loadROM(const char* filename, uint32_t loadAddr)
     size_t fileSize = ftell(file);
     fseek(file, 0, SEEK_SET);
 
-    if (fileSize > memorySize - loadAddr)
+    uint8_t* to = nullptr;
+    if (isRomAddress(loadAddr))
     {
-        fclose(file);
-        return false;
+        uint32_t offset = loadAddr & (romMaxSize - 1);
+        if (fileSize > romMaxSize - offset)
+        {
+            fclose(file);
+            return false;
+        }
+
+        loadedRomSize = uint32_t(offset + fileSize);
+        rom = std::make_unique<uint8_t[]>(loadedRomSize);
+        romImage.reset();
+        mapRom();
+        mapPages();
+        to = rom.get() + offset;
+    }
+    else
+    {
+        const region& r = regionAt(loadAddr);
+        uint32_t offset = offsetIn(r, loadAddr);
+        if (!r.store || offset > r.size || fileSize > r.size - offset)
+        {
+            fclose(file);
+            return false;
+        }
+        to = r.store + offset;
     }
 
-    size_t bytesRead = fread(&biosRom[loadAddr], 1, fileSize, file);
+    size_t bytesRead = fread(to, 1, fileSize, file);
     fclose(file);
 
     if (bytesRead != fileSize)
@@ -119,6 +312,70 @@ bool Bus::loadROM(const char* filename, uint32_t loadAddr)
         return false;
     }
 
+    if (codeWatcher) codeWatcher->flushBlockCache(); // anything decoded from the old image is stale
+
     printf("rom loaded\n");
     return true;
-}
\ No newline at end of file
+}
+
+
+//====================
+// HOST ACCESS
+//====================
+
+const uint8_t* Bus::readRange(uint32_t addr, uint32_t size) const
+{
+    const region& r = regionAt(addr);
+    uint32_t offset = offsetIn(r, addr);
+    if (!r.store || offset > r.size || size > r.size - offset) return nullptr;
+    return r.store + offset;
+}
+
+uint8_t* Bus::writeRange(uint32_t addr, uint32_t size)
+{
+    const region& r = regionAt(addr);
+    uint32_t offset = offsetIn(r, addr);
+    if (!r.store || !r.writable || offset > r.size || size > r.size - offset) return nullptr;
+    if (size == 0) return r.store + offset;
+
+    uint32_t at = r.start + offset;
+    if (codeWatcher)
+    {
+        for (uint32_t page = at >> codePageShift; page <= (at + size - 1) >> codePageShift; page++)
+        {
+            int index = codePageIndex(page << codePageShift);
+            if (index >= 0 && codePages[index])
+            {
+                codeWatcher->invalidateCode(at, size);
+                break;
+            }
+        }
+    }
+
+    if (journal) journal->saveBytes(at, size, r.store + offset);
+    return r.store + offset;
+}
+
+uint32_t Bus::bytesFrom(uint32_t addr) const
+{
+    const region& r = regionAt(addr);
+    uint32_t offset = offsetIn(r, addr);
+    return offset < r.size ? r.size - offset : 0;
+}
+
+uint8_t* Bus::plainRam(uint32_t addr, uint32_t size, bool write)
+{
+    const region& r = regionAt(addr);
+    bool ram = r.start == 0x02000000 || r.start == 0x03000000;
+    uint32_t offset = offsetIn(r, addr);
+    if (!ram || offset > r.size || size > r.size - offset) return nullptr;
+
+    uint32_t at = r.start + offset;
+    if (write)
+    {
+        if (codeWatcher) checkCodeWrite(at, size);
+        if (journal) journal->saveBytes(at, size, r.store + offset);
+    }
+
+    return r.store + offset;
+}
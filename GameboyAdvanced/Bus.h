@@ -1,25 +1,224 @@
 #pragma once
 #include <cstdint>
+#include <cstring>
 #include <memory>
+#include "RomImage.h"
+
+class CPU;
+class UndoJournal;
+
 class Bus
 {
+public: // MEMORY MAP
+
+	// only the regions the GBA has are backed, each by a store of its real size. every mirror of a
+	// region is folded onto its store by masking, anything that lands past the end of a store, or in a
+	// gap between regions, is unmapped: reads give 0 and writes are dropped. bios and ROM are read only
+	static constexpr uint32_t biosSize = 0x4000;
+	static constexpr uint32_t ewramSize = 0x40000;
+	static constexpr uint32_t iwramSize = 0x8000;
+	static constexpr uint32_t ioSize = 0x400;
+	static constexpr uint32_t paletteSize = 0x400;
+	static constexpr uint32_t vramSize = 0x18000;
+	static constexpr uint32_t oamSize = 0x400;
+	static constexpr uint32_t sramSize = 0x10000;
+	static constexpr uint32_t romMaxSize = 0x2000000;
+
+	struct region
+	{
+		uint8_t* store;  // null where nothing is mapped
+		uint32_t start;  // the address store[0] has in the first mirror, what the code pages go by
+		uint32_t mask;   // folds every mirror onto the store
+		uint32_t size;   // bytes of store, an offset masked past it is unmapped
+		uint32_t fold;   // taken off an offset past size, VRAM's last 32 KB mirror the 32 KB before them
+		bool writable;
+	};
+
+	const region& regionAt(uint32_t addr) const { return regions[addr >> 24]; }
+
+	static uint32_t offsetIn(const region& r, uint32_t addr)
+	{
+		uint32_t offset = addr & r.mask;
+		return offset >= r.size ? offset - r.fold : offset;
+	}
+
+	uint32_t romSize() const { return loadedRomSize; }
+	size_t memoryFootprint() const; // bytes of store and page table this instance holds, a shared ROM image is not its own
+
+private:
+
+	std::unique_ptr<uint8_t[]> memory; // every fixed size region, one after the other
+	std::unique_ptr<uint8_t[]> rom;             // a private copy of the cartridge, or
+	std::shared_ptr<const RomImage> romImage;   // the image shared with the rest of the process
+	uint32_t loadedRomSize;
+	region regions[256];               // by addr >> 24
+
+	void mapRegion(uint32_t index, uint8_t* store, uint32_t mask, uint32_t size, bool writable, uint32_t fold = 0);
+	void mapRom();
+
+public: // PAGE TABLE
+
+	// a host pointer per 16 KB page, so a hot access is one lookup and a native load or store (the host
+	// is little endian like the GBA). pages the table has nothing for are null and go through the region
+	// walk: IO, palette and OAM, which are smaller than a page, the end of a ROM that is not a whole
+	// page, and unmapped space. pageReadOnly keeps writes off the fast path: bios and ROM, every mirror
+	// past the first so the code pages and the journal only see first mirror addresses, any page the CPU
+	// holds blocks decoded from, and every page while the undo journal is on. unaligned accesses take the
+	// region walk too
+	static constexpr uint32_t pageShift = 14;
+	static constexpr uint32_t pageSize = 1u << pageShift;
+	static constexpr uint32_t pageMask = pageSize - 1;
+	static constexpr uint32_t pageCount = 0x10000000 >> pageShift;
+	static constexpr uintptr_t pageReadOnly = 1;
+
+	uint8_t read8(uint32_t addr)
+	{
+		uint32_t page = addr >> pageShift;
+		if (page < pageCount)
+		{
+			if (uintptr_t entry = pages[page]) return reinterpret_cast<const uint8_t*>(entry & ~pageReadOnly)[addr & pageMask];
+		}
+		return slowRead8(addr);
+	}
+
+	uint16_t read16(uint32_t addr)
+	{
+		uint32_t page = addr >> pageShift;
+		if (page < pageCount && !(addr & 1))
+		{
+			if (uintptr_t entry = pages[page])
+			{
+				uint16_t value;
+				memcpy(&value, reinterpret_cast<const uint8_t*>(entry & ~pageReadOnly) + (addr & pageMask), sizeof(value));
+				return value;
+			}
+		}
+		return slowRead16(addr);
+	}
+
+	uint32_t read32(uint32_t addr)
+	{
+		uint32_t page = addr >> pageShift;
+		if (page < pageCount && !(addr & 3))
+		{
+			if (uintptr_t entry = pages[page])
+			{
+				uint32_t value;
+				memcpy(&value, reinterpret_cast<const uint8_t*>(entry & ~pageReadOnly) + (addr & pageMask), sizeof(value));
+				return value;
+			}
+		}
+		return slowRead32(addr);
+	}
+
+	void write8(uint32_t addr, uint8_t data)
+	{
+		uint32_t page = addr >> pageShift;
+		if (page < pageCount)
+		{
+			uintptr_t entry = pages[page];
+			if (entry && !(entry & pageReadOnly))
+			{
+				reinterpret_cast<uint8_t*>(entry)[addr & pageMask] = data;
+				return;
+			}
+		}
+		slowWrite8(addr, data);
+	}
+
+	void write16(uint32_t addr, uint16_t data)
+	{
+		uint32_t page = addr >> pageShift;
+		if (page < pageCount && !(addr & 1))
+		{
+			uintptr_t entry = pages[page];
+			if (entry && !(entry & pageReadOnly))
+			{
+				memcpy(reinterpret_cast<uint8_t*>(entry) + (addr & pageMask), &data, sizeof(data));
+				return;
+			}
+		}
+		slowWrite16(addr, data);
+	}
+
+	void write32(uint32_t addr, uint32_t data)
+	{
+		uint32_t page = addr >> pageShift;
+		if (page < pageCount && !(addr & 3))
+		{
+			uintptr_t entry = pages[page];
+			if (entry && !(entry & pageReadOnly))
+			{
+				memcpy(reinterpret_cast<uint8_t*>(entry) + (addr & pageMask), &data, sizeof(data));
+				return;
+			}
+		}
+		slowWrite32(addr, data);
+	}
+
+	// the region walk on its own, for what the table does not cover
+	uint8_t slowRead8(uint32_t addr);
+	uint16_t slowRead16(uint32_t addr);
+	uint32_t slowRead32(uint32_t addr);
+
+	void slowWrite8(uint32_t addr, uint8_t data);
+	void slowWrite16(uint32_t addr, uint16_t data);
+	void slowWrite32(uint32_t addr, uint32_t data);
+
 private:
-	std::unique_ptr<uint8_t[]> biosRom;
-	size_t memorySize;
+
+	std::unique_ptr<uintptr_t[]> pages;
+
+	void mapPages();
+	uintptr_t pageEntry(uint32_t addr) const; // what the page starting at addr should hold
+
 public:
 
 	Bus();
 
-	bool loadROM(const char* filename , uint32_t loadAddr);
+	// a whole cartridge image loaded at 0x08000000 is mapped through RomImage and shared unless
+	// shareImage is false. anything else, or a file that can not be mapped, is read into a store
+	bool loadROM(const char* filename , uint32_t loadAddr, bool shareImage = true);
+
+	static bool isRomAddress(uint32_t addr); // 0x08000000 - 0x0DFFFFFF, all three wait state mirrors
+
+public: // CODE WRITE TRACKING
+
+	// one flag per 256 byte page of EWRAM and IWRAM, set while the CPU holds blocks decoded from
+	// that page. a write into a flagged page is passed to the CPU so it can drop those blocks
+	static constexpr uint32_t codePageShift = 8;
+	static constexpr int codePageCount = (0x40000 + 0x8000) >> codePageShift;
+
+	static int codePageIndex(uint32_t addr); // -1 outside EWRAM / IWRAM
+
+	CPU* codeWatcher = nullptr;
+	uint8_t codePages[codePageCount];
+
+	void markCode(uint32_t addr, bool isCode);
+	void clearCodePages();
+	void checkCodeWrite(uint32_t addr, uint32_t size);
+
+public: // UNDO JOURNAL
+
+	// set by CPU::setUndoJournal. every write that lands in a writable store hands the bytes it is
+	// about to cover to the journal first, writeRange and plainRam(write) the whole range. setting it
+	// takes every page off the fast write path until it is cleared again
+	UndoJournal* journal = nullptr;
+
+	void setJournal(UndoJournal* to);
 
+public: // HOST ACCESS
 
-	uint8_t read8(uint32_t addr, bool bReadOnly = false);
-	uint16_t read16(uint32_t addr,bool bReadOnly = false);
-	uint32_t read32(uint32_t addr, bool bReadOnly = false);
+	// straight pointers into a region's store for the HLE bios routines, null if the range runs off the
+	// end of it. writeRange also turns down bios and ROM and drops any cached blocks the whole range
+	// covers, since nothing after it goes through write8 / 16 / 32
+	const uint8_t* readRange(uint32_t addr, uint32_t size) const;
+	uint8_t* writeRange(uint32_t addr, uint32_t size);
+	uint32_t bytesFrom(uint32_t addr) const; // how much can be read from addr before the end of its store
 
-	void write8(uint32_t addr, uint8_t data);
-	void write16(uint32_t addr, uint16_t data);
-	void write32(uint32_t addr, uint32_t data);
+	// EWRAM / IWRAM only, where a transfer has no side effect past the code page check. null for
+	// anything else so block transfers touching IO, VRAM, ROM etc keep going word by word
+	uint8_t* plainRam(uint32_t addr, uint32_t size, bool write);
 
 };
 
@@ -2,16 +2,27 @@
 
 
 #include "CPU.h"
+#include "JIT.h"
+#include "AOT.h"
 #include <cstdint>
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <array>
+#include <utility>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+#define TRACE_SSE2 1
+#include <emmintrin.h>
+#else
+#define TRACE_SSE2 0
+#endif
 
 namespace Vector // use these for jumping
 {
 	constexpr uint32_t Reset = 0x00000000;
 	constexpr uint32_t Undefined = 0x00000004;
-	constexpr uint32_t SWI = 0x00000010;//0x00000008;
+	constexpr uint32_t SWI = 0x00000008;
 	constexpr uint32_t PrefetchAbort = 0x0000000C;
 	constexpr uint32_t DataAbort = 0x00000010;
 	constexpr uint32_t Reserved = 0x00000014;
@@ -20,11 +31,30 @@ namespace Vector // use these for jumping
 }
 
 
-CPU::CPU(Bus* bus) : bus(bus), sp(reg[13]), lr(reg[14]), pc(reg[15])
+CPU::CPU(Bus* bus) : CPUState(),
+	trace(buildTraceLevel == traceLevel::Records ? traceCapacityLog2 : 0), bus(bus)
 {
 	reset();
 
-	initializeOpFunctions();
+	eventPending = false;
+	lazyFlags = false;
+	hleBios = false;
+	hleCalls = 0;
+	fusion = false;
+	memset(fusedRuns, 0, sizeof(fusedRuns));
+	memset(traceRegsBefore, 0, sizeof(traceRegsBefore));
+	flagsDeferred = 0;
+	flagsMaterialized = 0;
+	pipelineRefills = 0;
+	jitEnabled = false;
+	flushBlockCache();
+	bus->codeWatcher = this;
+}
+
+CPU::~CPU()
+{
+	if (bus->codeWatcher == this) bus->codeWatcher = nullptr;
+	if (bus->journal == &undo) bus->setJournal(nullptr);
 }
 
 void CPU::reset()
@@ -35,835 +65,1323 @@ void CPU::reset()
 	CPSR = static_cast<uint8_t>(mode::Supervisor) | 0xC0;
 	for (int i = 0; i < 16; i++) reg[i] = 0;
 	reg[13] = 0x03007F00;  // SP
-	pc = 0x08000000;
 	T = 0;  // DEFAULT TO ARM
+	branchTo(0x08000000);
 	N = Z = C = V = 0;
+	pendingFlagOp = flagOp::None;
+	unbankRegisters(curMode);
+	lr() = 0x08000000;
+	undo.clear(); // nothing before a reset can be undone into
+}
+
+void CPU::powerOn()
+{
+	reset();
+	memset(reg, 0, sizeof(reg));
+	switchMode(mode::Supervisor);
+	CPSR = static_cast<uint8_t>(mode::Supervisor) | 0xC0;
+	branchTo(0x00000000);
+}
+
+// what gba_bios.bin leaves in the IO registers by the time it jumps to the cartridge, mostly from its
+// RegisterRamReset. everything else is back at zero
+static const struct { uint32_t addr; uint16_t value; } postBiosIO[] =
+{
+	{ 0x04000000, 0x0080 }, // DISPCNT, forced blank
+	{ 0x04000020, 0x0100 }, // BG2PA
+	{ 0x04000026, 0x0100 }, // BG2PD
+	{ 0x04000030, 0x0100 }, // BG3PA
+	{ 0x04000036, 0x0100 }, // BG3PD
+	{ 0x04000088, 0x0200 }, // SOUNDBIAS
+	{ 0x04000130, 0x03FF }, // KEYINPUT, nothing held
+	{ 0x04000134, 0x8000 }, // RCNT, general purpose
+	{ 0x04000300, 0x0001 }, // POSTFLG, past the first boot
+};
+
+void CPU::directBoot()
+{
+	reset();
+
+	// System mode with IRQ / FIQ on and every other register clear, the three stacks the bios sets up
+	// at the top of IWRAM under its own area
+	memset(reg, 0, sizeof(reg));
+	memset(r8FIQ, 0, sizeof(r8FIQ));
+	memset(r8User, 0, sizeof(r8User));
+	memset(r13RegBank, 0, sizeof(r13RegBank));
+	memset(r14RegBank, 0, sizeof(r14RegBank));
+	memset(spsrBank, 0, sizeof(spsrBank));
+	r13RegBank[getModeIndex(mode::System)] = 0x03007F00;
+	r13RegBank[getModeIndex(mode::IRQ)] = 0x03007FA0;
+	r13RegBank[getModeIndex(mode::Supervisor)] = 0x03007FE0;
+
+	curMode = mode::System;
+	CPSR = static_cast<uint8_t>(mode::System);
 	unbankRegisters(curMode);
-	lr = 0x08000000;
+	branchTo(0x08000000);
+
+	for (const auto& io : postBiosIO) bus->write16(io.addr, io.value);
 }
 
 
 
 uint32_t CPU::tick()
 {
-	if (!T) // if arm mode
-	{
-		instruction = read32(pc);
-		curArmInstr = decodeArm(instruction);
-		pc += 4;
+	return step<buildTraceLevel>();
+}
 
-		printf("MODE:%s ,PC: 0x%08X, Instruction: 0x%08X, Flags: %s , R12: %08X ,Opcode: %s, \n",
-			"A",
-			pc - pcOffset(), instruction, CPSRtoString(), reg[12], opcodeToString(curOP));
+template <CPU::traceLevel level>
+uint32_t CPU::step()
+{
+	// the opcode comes out of the pipeline, the one fetch is pc into the back of it. fetches go to the
+	// bus like runFor's so Records never logs them as data reads
+	const bool journaling = undo.enabled();
 
-		curOpCycles = armExecute(curArmInstr);
+	if (pipelineFlushed) refillPipeline();
 
+	if (!T) // if arm mode
+	{
+		instruction = pipeline[0];
+		pipeline[0] = pipeline[1];
+		pipeline[1] = bus->read32(pc());
+		const armDecodeEntry& entry = armLookup(instruction);
+		curArmInstr = decodeArm(instruction, entry);
+		traceArm<level>(pc() - 8, instruction);
+		if (journaling) undo.begin(*this, armWrites(curArmInstr));
+
+		curOpCycles = armDispatch(entry.execute, curArmInstr);
+		if (!pipelineFlushed) pc() += 4;
 	}
 	else // if thumb mode
 	{
-		uint16_t thumbCode = read16(pc);
-		curThumbInstr = decodeThumb(thumbCode);
-		pc += 2;
-
-		printf("MODE:%s ,PC: 0x%08X, Instruction: 0x%04X    , Flags: %08X , R12: %s ,Opcode: %s  \n",
-			"T",
-			pc - pcOffset(), thumbCode, CPSRtoString(), reg[12], thumbToStr(curThumbInstr).c_str());
+		uint16_t thumbCode = static_cast<uint16_t>(pipeline[0]);
+		pipeline[0] = pipeline[1];
+		pipeline[1] = bus->read16(pc());
+		const thumbDecodeEntry& entry = thumbLookup(thumbCode);
+		curThumbInstr = decodeThumb(thumbCode, entry);
+		traceThumb<level>(pc() - 4, thumbCode, curThumbInstr);
+		if (journaling) undo.begin(*this, thumbWrites(curThumbInstr));
 
-		curOpCycles = thumbExecute(curThumbInstr);
+		curOpCycles = (this->*entry.execute)(curThumbInstr);
+		if (!pipelineFlushed) pc() += 2;
 	}
 
 
 	cycleTotal += curOpCycles; // this could be returned and made so the ppu does this many frames too ... 
+	syncFlags();
+	if (journaling) undo.end();
 
 	return cycleTotal;// doing this for now
 }
 
+//////////////////////////////////////////////////////////////////////////
+//				                 TRACE									//
+//////////////////////////////////////////////////////////////////////////
 
+// called with the instr decoded but not yet run, the None versions are empty and inline away
 
-void CPU::initializeOpFunctions()
+template <CPU::traceLevel level>
+void CPU::traceArm(uint32_t addr, uint32_t opcode)
 {
-	for (int i = 0; i < static_cast<int>(armOperation::COUNT); i++)
+	if constexpr (level == traceLevel::Records)
 	{
-		opA_functions[i] = nullptr;
+		syncFlags();
+		if (trace.captureRegisters) traceRegisters();
+		trace.push(TraceBuffer::kind::Instr, addr, opcode, CPSR);
+	}
+	else if constexpr (level == traceLevel::Text)
+	{
+		printf("MODE:%s ,PC: 0x%08X, Instruction: 0x%08X, Flags: %s , R12: %08X ,Opcode: %s, \n",
+			"A",
+			addr, opcode, CPSRtoString(), reg[12], opcodeToString(curOP));
 	}
-
-	// DATA 
-	opA_functions[static_cast<int>(armOperation::ARM_AND)] = &CPU::opA_AND;
-	opA_functions[static_cast<int>(armOperation::ARM_EOR)] = &CPU::opA_EOR;
-	opA_functions[static_cast<int>(armOperation::ARM_SUB)] = &CPU::opA_SUB;
-	opA_functions[static_cast<int>(armOperation::ARM_RSB)] = &CPU::opA_RSB;
-	opA_functions[static_cast<int>(armOperation::ARM_ADD)] = &CPU::opA_ADD;
-	opA_functions[static_cast<int>(armOperation::ARM_ADC)] = &CPU::opA_ADC;
-	opA_functions[static_cast<int>(armOperation::ARM_SBC)] = &CPU::opA_SBC;
-	opA_functions[static_cast<int>(armOperation::ARM_RSC)] = &CPU::opA_RSC;
-	opA_functions[static_cast<int>(armOperation::ARM_TST)] = &CPU::opA_TST;
-	opA_functions[static_cast<int>(armOperation::ARM_TEQ)] = &CPU::opA_TEQ;
-	opA_functions[static_cast<int>(armOperation::ARM_CMP)] = &CPU::opA_CMP;
-	opA_functions[static_cast<int>(armOperation::ARM_CMN)] = &CPU::opA_CMN;
-	opA_functions[static_cast<int>(armOperation::ARM_ORR)] = &CPU::opA_ORR;
-	opA_functions[static_cast<int>(armOperation::ARM_MOV)] = &CPU::opA_MOV;
-	opA_functions[static_cast<int>(armOperation::ARM_BIC)] = &CPU::opA_BIC;
-	opA_functions[static_cast<int>(armOperation::ARM_MVN)] = &CPU::opA_MVN;
-
-	// PSR Transfer
-	opA_functions[static_cast<int>(armOperation::ARM_MRS)] = &CPU::opA_MRS;
-	opA_functions[static_cast<int>(armOperation::ARM_MSR)] = &CPU::opA_MSR;
-
-	// Load/Store
-	opA_functions[static_cast<int>(armOperation::ARM_LDR)] = &CPU::opA_LDR;
-	opA_functions[static_cast<int>(armOperation::ARM_STR)] = &CPU::opA_STR;
-	opA_functions[static_cast<int>(armOperation::ARM_LDRH)] = &CPU::opA_LDRH;
-	opA_functions[static_cast<int>(armOperation::ARM_STRH)] = &CPU::opA_STRH;
-	opA_functions[static_cast<int>(armOperation::ARM_LDRSB)] = &CPU::opA_LDRSB;
-	opA_functions[static_cast<int>(armOperation::ARM_LDRSH)] = &CPU::opA_LDRSH;
-	opA_functions[static_cast<int>(armOperation::ARM_LDM)] = &CPU::opA_LDM;
-	opA_functions[static_cast<int>(armOperation::ARM_STM)] = &CPU::opA_STM;
-
-	// Branch
-	opA_functions[static_cast<int>(armOperation::ARM_B)] = &CPU::opA_B;
-	opA_functions[static_cast<int>(armOperation::ARM_BL)] = &CPU::opA_BL;
-	opA_functions[static_cast<int>(armOperation::ARM_BX)] = &CPU::opA_BX;
-
-	// Multiply
-	opA_functions[static_cast<int>(armOperation::ARM_MUL)] = &CPU::opA_MUL;
-	opA_functions[static_cast<int>(armOperation::ARM_MLA)] = &CPU::opA_MLA;
-	opA_functions[static_cast<int>(armOperation::ARM_UMULL)] = &CPU::opA_UMULL;
-	opA_functions[static_cast<int>(armOperation::ARM_UMLAL)] = &CPU::opA_UMLAL;
-	opA_functions[static_cast<int>(armOperation::ARM_SMULL)] = &CPU::opA_SMULL;
-	opA_functions[static_cast<int>(armOperation::ARM_SMLAL)] = &CPU::opA_SMLAL;
-
-	// Special
-	opA_functions[static_cast<int>(armOperation::ARM_SWP)] = &CPU::opA_SWP;
-	opA_functions[static_cast<int>(armOperation::ARM_SWI)] = &CPU::opA_SWI;
-
-	// Coprocessor
-	opA_functions[static_cast<int>(armOperation::ARM_CDP)] = &CPU::opA_CDP;
-	opA_functions[static_cast<int>(armOperation::ARM_LDC)] = &CPU::opA_LDC;
-	opA_functions[static_cast<int>(armOperation::ARM_STC)] = &CPU::opA_STC;
-	opA_functions[static_cast<int>(armOperation::ARM_MRC)] = &CPU::opA_MRC;
-	opA_functions[static_cast<int>(armOperation::ARM_MCR)] = &CPU::opA_MCR;
-
-	// Undefined
-	opA_functions[static_cast<int>(armOperation::ARM_UNDEFINED)] = &CPU::opA_UNDEFINED;
-
-
-
-	///////////////////////////////////////////////////////////////////////
-	//								THUMB OPS                            //
-	///////////////////////////////////////////////////////////////////////
-
-
-	opT_functions[static_cast<int>(thumbOperation::THUMB_MOV_IMM)] = &CPU::opT_MOV_IMM;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_ADD_REG)] = &CPU::opT_ADD_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_ADD_IMM)] = &CPU::opT_ADD_IMM;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_ADD_IMM3)] = &CPU::opT_ADD_IMM3;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_SUB_REG)] = &CPU::opT_SUB_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_SUB_IMM)] = &CPU::opT_SUB_IMM;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_SUB_IMM3)] = &CPU::opT_SUB_IMM3;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_CMP_IMM)] = &CPU::opT_CMP_IMM;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LSL_IMM)] = &CPU::opT_LSL_IMM;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LSR_IMM)] = &CPU::opT_LSR_IMM;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_ASR_IMM)] = &CPU::opT_ASR_IMM;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_AND_REG)] = &CPU::opT_AND_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_EOR_REG)] = &CPU::opT_EOR_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LSL_REG)] = &CPU::opT_LSL_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LSR_REG)] = &CPU::opT_LSR_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_ASR_REG)] = &CPU::opT_ASR_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_ADC_REG)] = &CPU::opT_ADC_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_SBC_REG)] = &CPU::opT_SBC_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_ROR_REG)] = &CPU::opT_ROR_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_TST_REG)] = &CPU::opT_TST_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_NEG_REG)] = &CPU::opT_NEG_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_CMP_REG)] = &CPU::opT_CMP_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_CMN_REG)] = &CPU::opT_CMN_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_ORR_REG)] = &CPU::opT_ORR_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_MUL_REG)] = &CPU::opT_MUL_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_BIC_REG)] = &CPU::opT_BIC_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_MVN_REG)] = &CPU::opT_MVN_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_ADD_HI)] = &CPU::opT_ADD_HI;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_CMP_HI)] = &CPU::opT_CMP_HI;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_MOV_HI)] = &CPU::opT_MOV_HI;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_BX)] = &CPU::opT_BX;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_BLX_REG)] = &CPU::opT_BLX_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LDR_PC)] = &CPU::opT_LDR_PC;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LDR_REG)] = &CPU::opT_LDR_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_STR_REG)] = &CPU::opT_STR_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LDRB_REG)] = &CPU::opT_LDRB_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_STRB_REG)] = &CPU::opT_STRB_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LDRH_REG)] = &CPU::opT_LDRH_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_STRH_REG)] = &CPU::opT_STRH_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LDRSB_REG)] = &CPU::opT_LDRSB_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LDRSH_REG)] = &CPU::opT_LDRSH_REG;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LDR_IMM)] = &CPU::opT_LDR_IMM;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_STR_IMM)] = &CPU::opT_STR_IMM;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LDRB_IMM)] = &CPU::opT_LDRB_IMM;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_STRB_IMM)] = &CPU::opT_STRB_IMM;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LDRH_IMM)] = &CPU::opT_LDRH_IMM;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_STRH_IMM)] = &CPU::opT_STRH_IMM;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LDR_SP)] = &CPU::opT_LDR_SP;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_STR_SP)] = &CPU::opT_STR_SP;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_ADD_PC)] = &CPU::opT_ADD_PC;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_ADD_SP)] = &CPU::opT_ADD_SP;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_ADD_SP_IMM)] = &CPU::opT_ADD_SP_IMM;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_PUSH)] = &CPU::opT_PUSH;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_POP)] = &CPU::opT_POP;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_STMIA)] = &CPU::opT_STMIA;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_LDMIA)] = &CPU::opT_LDMIA;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_B_COND)] = &CPU::opT_B_COND;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_B)] = &CPU::opT_B;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_BL_PREFIX)] = &CPU::opT_BL_PREFIX;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_BL_SUFFIX)] = &CPU::opT_BL_SUFFIX;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_SWI)] = &CPU::opT_SWI;
-	opT_functions[static_cast<int>(thumbOperation::THUMB_UNDEFINED)] = &CPU::opT_UNDEFINED;
-}
-
-
-int CPU::armExecute(armInstr instr)
-{
-	return (this->*opA_functions[static_cast<int>(instr.type)])(instr);
 }
 
-//////////////////////////////////////////////////////////////////////////
-//				           MODE HELPER FUNCTIONS						//
-//////////////////////////////////////////////////////////////////////////
-
-const char* CPU::CPSRtoString()
+template <CPU::traceLevel level>
+void CPU::traceThumb(uint32_t addr, uint16_t thumbCode, const thumbInstr& decoded)
 {
-	static char str[8];
-
-	str[0] = N ? 'N' : '-';
-	str[1] = Z ? 'Z' : '-';
-	str[2] = C ? 'C' : '-';
-	str[3] = V ? 'V' : '-';
-	str[4] = I ? 'I' : '-';
-	str[5] = F ? 'F' : '-';
-	str[6] = T ? 'T' : '-';
-	str[7] = '\0';
-
-	return str;
+	if constexpr (level == traceLevel::Records)
+	{
+		syncFlags();
+		if (trace.captureRegisters) traceRegisters();
+		trace.push(TraceBuffer::kind::Instr, addr, thumbCode, CPSR);
+	}
+	else if constexpr (level == traceLevel::Text)
+	{
+		thumbInstr instr = decoded;
+		printf("MODE:%s ,PC: 0x%08X, Instruction: 0x%04X    , Flags: %s , R12: %08X ,Opcode: %s  \n",
+			"T",
+			addr, thumbCode, CPSRtoString(), reg[12], thumbToStr(instr).c_str());
+	}
 }
 
-std::string CPSRparser(uint32_t num)
+// Reg slots for what the previous instr changed, pushed just ahead of the next Instr slot. comparing
+// any earlier has the wide loads stall behind the handler's own register stores. pc is left out, the
+// Instr slot says where it went
+void CPU::traceRegisters()
 {
-	std::string str = "";
-
-	for (int i = 0; i <32; i++)
+	uint32_t same = 0;
+#if TRACE_SSE2
+	for (int i = 0; i < 16; i += 4)
 	{
-		str += ((num >> i) & 1)==1 ? "X" : "-";
+		__m128i now = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&reg[i]));
+		__m128i before = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&traceRegsBefore[i]));
+		same |= uint32_t(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(now, before)))) << i;
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&traceRegsBefore[i]), now);
 	}
-	str += '\0';
+#else
+	for (int i = 0; i < 16; i++)
+	{
+		same |= uint32_t(reg[i] == traceRegsBefore[i]) << i;
+		traceRegsBefore[i] = reg[i];
+	}
+#endif
 
-	return str;
+	// lowest set bit to its index with a de Bruijn multiply, stepping bit by bit mispredicts too often
+	static const uint8_t lowestBit[32] = { 0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+		31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9 };
+
+	for (uint32_t changed = ~same & 0x7FFF; changed; changed &= changed - 1)
+	{
+		uint32_t i = lowestBit[((changed & (0u - changed)) * 0x077CB531u) >> 27];
+		trace.push(TraceBuffer::kind::Reg, i, reg[i]);
+	}
 }
 
+// DebuggerCPU times all three against each other
+template uint32_t CPU::step<CPU::traceLevel::None>();
+template uint32_t CPU::step<CPU::traceLevel::Records>();
+template uint32_t CPU::step<CPU::traceLevel::Text>();
 
+//////////////////////////////////////////////////////////////////////////
+//				                RUN LOOP								//
+//////////////////////////////////////////////////////////////////////////
 
+// tick() goes back out to the caller, re-checks T and traces after every instr. runFor stays in a
+// loop per state instead, handing each decoded instr straight to the handler its table entry names,
+// and only comes out when T flips, an event is raised or the budget is spent. fetches go through the
+// pipeline the same way as in step()
 
-//std::string CPU::CPSRtoStringPASSED(uint32_t base, uint32_t finalS, uint32_t passed)
-//{
-//	static char str[8];
-//	// find the difference between
-//	// original and expected
-//	// original and passed
-//	if (passed != finalS)
-//	{
-//		return "passed and final differ, BASE " + CPSRparser(passed) + "FINAL "+ CPSRparser(finalS);
-//	}
-//	//if (base != passed)
-//	//{
-//	//	return "base and final differ, BASE " + CPSRparser(base) + "FINAL " + CPSRparser(finalS);
-//	//}
-//
-//	
-//
-//	return str;
-//}
+uint32_t CPU::runFor(int cycles)
+{
+	const int target = cycleTotal + cycles;
 
+	if (undo.enabled())
+	{
+		while (cycleTotal < target && !eventPending) tick();
+		return cycleTotal;
+	}
 
+	while (cycleTotal < target && !eventPending)
+	{
+		if (!T) runArm<buildTraceLevel>(target);
+		else runThumb<buildTraceLevel>(target);
+	}
 
-CPU::mode CPU::CPSRbitToMode(uint8_t modeBits)
-{
-	return static_cast<mode>(modeBits & 0x1F);
+	syncFlags();
+	return cycleTotal;
 }
 
-bool CPU::isPrivilegedMode() // used to quickly tell were not in user mode
+template <CPU::traceLevel level>
+void CPU::runArm(int target)
 {
-	return (curMode != mode::User);
+	do
+	{
+		if (pipelineFlushed) refillPipeline();
+		instruction = pipeline[0];
+		pipeline[0] = pipeline[1];
+		pipeline[1] = bus->read32(pc());
+		const armDecodeEntry& entry = armLookup(instruction);
+		const armInstr decoded = decodeArm(instruction, entry);
+		traceArm<level>(pc() - 8, instruction);
+		curOpCycles = armDispatch(entry.execute, decoded);
+		if (!pipelineFlushed) pc() += 4;
+		cycleTotal += curOpCycles;
+	} while (!T && cycleTotal < target && !eventPending);
 }
-uint8_t CPU::getModeIndex(mode mode) // used for register saving
+
+template <CPU::traceLevel level>
+void CPU::runThumb(int target)
 {
-	switch (mode)
+	do
 	{
-	case mode::User:	   return 0;
-	case mode::System:     return 0;
-	case mode::FIQ:        return 1;
-	case mode::IRQ:        return 2;
-	case mode::Supervisor: return 3;
-	case mode::Abort:      return 4;
-	case mode::Undefined:  return 5;
-	default:               return 0;
-	}
+		if (pipelineFlushed) refillPipeline();
+		uint16_t thumbCode = static_cast<uint16_t>(pipeline[0]);
+		pipeline[0] = pipeline[1];
+		pipeline[1] = bus->read16(pc());
+		const thumbDecodeEntry& entry = thumbLookup(thumbCode);
+		const thumbInstr decoded = decodeThumb(thumbCode, entry);
+		traceThumb<level>(pc() - 4, thumbCode, decoded);
+		curOpCycles = (this->*entry.execute)(decoded);
+		if (!pipelineFlushed) pc() += 2;
+		cycleTotal += curOpCycles;
+	} while (T && cycleTotal < target && !eventPending);
 }
 
-//reg banking
-void CPU::bankRegisters(mode mode)// save reg val to bank
+//////////////////////////////////////////////////////////////////////////
+//				               BLOCK CACHE								//
+//////////////////////////////////////////////////////////////////////////
+
+// same pc stepping as tick(), minus the trace. a miss executes and records the run as it goes, a hit
+// replays it and bails out as soon as pc or T stop matching the recorded path, or as soon as one of
+// its own instrs stores over it. neither fills the pipeline, so it is left flushed for tick / runFor
+
+uint32_t CPU::tickBlock()
 {
-	uint8_t passedModeIndex = getModeIndex(mode);
+	if (undo.enabled()) return tick(); // blocks, the JIT and AOT code do not report to the journal
 
-	r13RegBank[passedModeIndex] = reg[13]; // save 13 and 14 into the reg bank
-	r14RegBank[passedModeIndex] = reg[14];
+	uint64_t key = (uint64_t(nextInstrAddr()) << 1) | T;
 
-	if (mode == mode::FIQ) // fiq saves its own registers
+	if (aot)
 	{
-		r8FIQ[0] = reg[8];
-		r8FIQ[1] = reg[9];
-		r8FIQ[2] = reg[10];
-		r8FIQ[3] = reg[11];
-		r8FIQ[4] = reg[12];
+		if (const AOTBlock* translated = aot->lookup(key))
+		{
+			aot->run(translated);
+			pipelineFlushed = true;
+			return cycleTotal;
+		}
 	}
-	else
+
+	auto found = blockCache.find(key);
+	if (found != blockCache.end())
 	{
-		r8User[0] = reg[8];
-		r8User[1] = reg[9];
-		r8User[2] = reg[10];
-		r8User[3] = reg[11];
-		r8User[4] = reg[12];
-	}
+		blockHits++;
+		decodedBlock& block = found->second;
 
-}
-void CPU::unbankRegisters(mode mode)  // load reg vals from bank
-{
-	uint8_t passedModeIndex = getModeIndex(mode);
+		if (jitEnabled)
+		{
+			JIT::BlockFunction compiled = jit->lookup(key);
+			if (!compiled && ++block.hits >= JIT::hotThreshold) compiled = jit->compile(block, key);
 
-	reg[13] = r13RegBank[passedModeIndex]; // grab 13 and 14 from the reg bank
-	reg[14] = r14RegBank[passedModeIndex];
+			if (compiled)
+			{
+				jitAbort = 0;
+				jitLinksLeft = JIT::linkBudget;
+				compiled(this); // may invalidate its own block, found is not touched after this
+				pipelineFlushed = true;
+				return cycleTotal;
+			}
+		}
 
-	if (mode == mode::FIQ) // fiq saves its own registers
-	{
-		reg[8] = r8FIQ[0];
-		reg[9] = r8FIQ[1];
-		reg[10] = r8FIQ[2];
-		reg[11] = r8FIQ[3];
-		reg[12] = r8FIQ[4];
+		replayKey = key;
+		replaying = true;
+		replayInvalidated = false;
+
+		if (!T)
+		{
+			for (const armBlockEntry& entry : block.arm)
+			{
+				if (pc() != entry.addr + 8 || T) break;
+				instruction = entry.opcode;
+				pipelineFlushed = false;
+				curOpCycles = armDispatch(entry.execute, entry.instr);
+				if (!pipelineFlushed) pc() += 4;
+				cycleTotal += curOpCycles;
+				cachedInstrs++;
+				if (replayInvalidated) break;
+			}
+		}
+		else
+		{
+			for (const thumbBlockEntry& entry : block.thumb)
+			{
+				if (pc() != entry.addr + 4 || !T) break;
+				pipelineFlushed = false;
+				curOpCycles = (this->*entry.execute)(entry.instr);
+				if (!pipelineFlushed) pc() += 2;
+				cycleTotal += curOpCycles;
+				cachedInstrs++;
+				if (replayInvalidated) break;
+			}
+		}
+
+		replaying = false;
+		if (replayInvalidated) blockCache.erase(found);
+
+		pipelineFlushed = true;
+		syncFlags();
+		return cycleTotal;
 	}
-	else
+
+	uint32_t start = nextInstrAddr();
+	bool cacheable = isBlockCacheable(start); // anything else runs one instr per call, nothing recorded
+	bool thumb = T;
+	decodedBlock block;
+
+	if (cacheable) blockMisses++;
+
+	block.start = start;
+	block.end = start;
+	block.hits = 0;
+	recordStart = start;
+	recordEnd = start;
+	recording = cacheable;
+	recordInvalidated = false;
+
+	for (int i = 0; i < (cacheable ? maxBlockLength : 1); i++)
 	{
-		reg[8] = r8User[0];
-		reg[9] = r8User[1];
-		reg[10] = r8User[2];
-		reg[11] = r8User[3];
-		reg[12] = r8User[4];
+		uint32_t addr = nextInstrAddr();
+		bool ends;
+
+		if (!thumb)
+		{
+			instruction = read32(addr);
+			const armDecodeEntry& entry = armLookup(instruction);
+			curArmInstr = decodeArm(instruction, entry);
+			if (cacheable)
+			{
+				// flag the page before running the instr so a store into itself is already seen
+				block.arm.push_back({ addr, instruction, curArmInstr, entry.execute });
+				block.end = addr + 4;
+				recordEnd = block.end;
+				bus->markCode(addr, true);
+				bus->markCode(addr + 3, true);
+			}
+			pipelineFlushed = false;
+			curOpCycles = armDispatch(entry.execute, curArmInstr);
+			if (!pipelineFlushed) pc() += 4;
+			ends = endsArmBlock(curArmInstr);
+		}
+		else
+		{
+			uint16_t thumbCode = read16(addr);
+			const thumbDecodeEntry& entry = thumbLookup(thumbCode);
+			curThumbInstr = decodeThumb(thumbCode, entry);
+			if (cacheable)
+			{
+				block.thumb.push_back({ addr, curThumbInstr, entry.execute });
+				block.end = addr + 2;
+				recordEnd = block.end;
+				bus->markCode(addr, true);
+				bus->markCode(addr + 1, true);
+			}
+			pipelineFlushed = false;
+			curOpCycles = (this->*entry.execute)(curThumbInstr);
+			if (!pipelineFlushed) pc() += 2;
+			ends = endsThumbBlock(curThumbInstr);
+		}
+
+		cycleTotal += curOpCycles;
+		uncachedInstrs++;
+
+		if (ends || T != thumb || !isBlockCacheable(nextInstrAddr()) || recordInvalidated) break;
 	}
-}
 
-void CPU::switchMode(mode newMode) // main function used for mode switching, calls bank and unbank register etc
-{
-	mode oldMode = curMode;
-	if (oldMode != newMode) // check this first so we dont do a pointless swap
+	recording = false;
+
+	if (cacheable && !recordInvalidated)
 	{
-		curMode = newMode;
+		if (thumb && fusion && !jitEnabled) fuseThumbBlock(block.thumb);
 
-		bankRegisters(oldMode);
-		CPSR = (CPSR & ~0x1F) | static_cast<uint8_t>(newMode); // set the new modes bits (may turn this to a function later)
-		unbankRegisters(newMode);
+		// ROM can not be written, only RAM blocks need to be findable by page
+		if (Bus::codePageIndex(block.start) >= 0)
+		{
+			for (uint32_t page = block.start >> Bus::codePageShift; page <= (block.end - 1) >> Bus::codePageShift; page++)
+			{
+				codePageBlocks[page].push_back(key);
+			}
+		}
+		blockCache.emplace(key, std::move(block));
 	}
 
-
+	pipelineFlushed = true;
+	syncFlags();
+	return cycleTotal;
 }
 
-void CPU::saveIntoSpsr(uint8_t index)
+void CPU::flushBlockCache()
 {
-	if (index == 0) return; // if user or system
-	spsrBank[index - 1] = CPSR;
+	blockCache.clear();
+	codePageBlocks.clear();
+	bus->clearCodePages();
+	if (jit) jit->flush();
+	if (aot) aot->verified = false; // the image may have been swapped, rehashed before the next lookup
+	replaying = false;
+	recording = false;
+	blockHits = 0;
+	blockMisses = 0;
+	cachedInstrs = 0;
+	uncachedInstrs = 0;
+	invalidatedBlocks = 0;
 }
 
-// excpetion handling
-void CPU::enterException(CPU::mode newMode, uint32_t vectorAddr, uint32_t returnAddr)
+// called by the bus for writes into a flagged EWRAM / IWRAM page. drops every block overlapping
+// [addr, addr + size), the rest of the page stays cached
+
+void CPU::invalidateCode(uint32_t addr, uint32_t size)
 {
-	mode oldMode = curMode; // save our old mode
+	uint32_t writeEnd = addr + size;
 
-	switchMode(newMode); // switch the reg bankings , swaps curMode
+	if (recording && addr < recordEnd && writeEnd > recordStart) recordInvalidated = true;
 
-	uint8_t newModeIndex = getModeIndex(curMode); // new modes index for switching
+	for (uint32_t page = addr >> Bus::codePageShift; page <= (writeEnd - 1) >> Bus::codePageShift; page++)
+	{
+		auto listed = codePageBlocks.find(page);
+		if (listed != codePageBlocks.end())
+		{
+			std::vector<uint64_t>& keys = listed->second;
 
-	saveIntoSpsr(newModeIndex); // saves the current CPSR into the bank
+			for (size_t i = 0; i < keys.size();)
+			{
+				auto found = blockCache.find(keys[i]);
+				bool overlaps = found != blockCache.end() && addr < found->second.end && writeEnd > found->second.start;
 
-	//EXTRA FOR EXCEPTION HANDLING
-	CPSR |= 0x80;  // Disable IRQ
-	if (newMode == mode::FIQ) CPSR |= 0x40;// turn off FIQ if on FIQ
+				if (found != blockCache.end() && !overlaps)
+				{
+					i++;
+					continue;
+				}
 
-	lr = returnAddr;
-	pc = vectorAddr;
+				if (overlaps)
+				{
+					invalidatedBlocks++;
+					if (jit)
+					{
+						jit->invalidate(keys[i]);
+						jitAbort = 1;
+					}
+					if (replaying && keys[i] == replayKey) replayInvalidated = true; // tickBlock erases it once it stops
+					else blockCache.erase(found);
+				}
 
-	lr += 2;
-}
-void CPU::returnFromException()
-{
-	mode oldMode = curMode;
-	int oldModeIndex = getModeIndex(oldMode);
+				// gone, or already dropped through another page it spans
+				keys[i] = keys.back();
+				keys.pop_back();
+			}
 
-	if (oldModeIndex > 0) // if not user / system
-	{
-		uint32_t savedCPSR = spsrBank[oldModeIndex - 1];
-		curMode = CPSRbitToMode(savedCPSR & 0x1F);
+			if (!keys.empty()) continue;
+			codePageBlocks.erase(listed);
+		}
 
-		bankRegisters(oldMode);
-		CPSR = savedCPSR;
-		unbankRegisters(curMode);
+		bool recordingPage = recording && page >= (recordStart >> Bus::codePageShift) && page <= ((recordEnd - 1) >> Bus::codePageShift);
+		if (!recordingPage) bus->markCode(page << Bus::codePageShift, false);
 	}
 }
 
-//SPSR helpers
-uint32_t CPU::getSPSR()
+void CPU::setJitEnabled(bool enabled)
 {
-	uint8_t idx = getModeIndex(curMode);
-	if (idx > 0)
+	if (enabled && !JIT::isSupported())
 	{
-		return spsrBank[idx - 1];
+		printf("jit: no backend for this host, staying on the interpreter\n");
+		enabled = false;
 	}
-	return CPSR;
+
+	if (enabled && !jit) jit = std::make_unique<JIT>(this);
+	jitEnabled = enabled;
 }
-void  CPU::setSPSR(uint32_t value)
+
+bool CPU::loadAot(const char* path)
 {
-	int idx = getModeIndex(curMode);
-	if (idx > 0) spsrBank[idx - 1] = value;
+	if (!aot) aot = std::make_unique<AOT>(this);
+	return aot->load(path);
 }
-//CPSR helper
-void CPU::writeCPSR(uint32_t value)
-{
-	if (curMode == mode::User && ((value & 0x1F) != static_cast<uint8_t>(mode::User))) // if were in usre, and were trying to leave it
-	{
-		CPSR = (CPSR & 0x000000FF) | (value & 0xFFFFFF00);  // update just flags, ignore rest
-		return;
-	}
 
-	mode newMode = CPSRbitToMode(value & 0x1F);
+void CPU::unloadAot()
+{
+	if (aot) aot->unload();
+}
 
-	if (curMode != newMode) // if we should swap modes
+//////////////////////////////////////////////////////////////////////////
+//				               UNDO JOURNAL								//
+//////////////////////////////////////////////////////////////////////////
+
+void CPU::setUndoJournal(bool enabled, uint32_t capacityLog2)
+{
+	if (enabled) undo.enable(capacityLog2);
+	else undo.disable();
+	bus->setJournal(enabled ? &undo : nullptr);
+}
+
+// a superset is fine, a Reg slot for a register the instr left alone just puts the same value back
+uint32_t CPU::armWrites(const armInstr& instr)
+{
+	const uint32_t rd = 1u << instr.rd, rn = 1u << instr.rn;
+	const uint32_t writeBack = (!instr.P || instr.W) ? rn : 0;
+
+	switch (instr.type)
 	{
-		switchMode(newMode);
+	case armOperation::ARM_TST:
+	case armOperation::ARM_TEQ:
+	case armOperation::ARM_CMP:
+	case armOperation::ARM_CMN:
+		return instr.S && instr.rd == 15 ? UndoJournal::everything : 0;
+	case armOperation::ARM_ADD:
+	case armOperation::ARM_SUB:
+	case armOperation::ARM_RSB:
+	case armOperation::ARM_ADC:
+	case armOperation::ARM_SBC:
+	case armOperation::ARM_RSC:
+	case armOperation::ARM_AND:
+	case armOperation::ARM_EOR:
+	case armOperation::ARM_ORR:
+	case armOperation::ARM_BIC:
+	case armOperation::ARM_MOV:
+	case armOperation::ARM_MVN:
+		return instr.S && instr.rd == 15 ? UndoJournal::everything : rd; // SPSR back into CPSR
+	case armOperation::ARM_MUL:
+	case armOperation::ARM_MLA:
+	case armOperation::ARM_MRS:
+	case armOperation::ARM_SWP:
+		return rd;
+	case armOperation::ARM_UMULL:
+	case armOperation::ARM_UMLAL:
+	case armOperation::ARM_SMULL:
+	case armOperation::ARM_SMLAL:
+		return rd | rn; // RdHi, RdLo
+	case armOperation::ARM_LDR:
+	case armOperation::ARM_LDRH:
+	case armOperation::ARM_LDRSB:
+	case armOperation::ARM_LDRSH:
+		return rd | writeBack;
+	case armOperation::ARM_STR:
+	case armOperation::ARM_STRH:
+		return writeBack;
+	case armOperation::ARM_LDM:
+		return instr.S ? UndoJournal::everything : instr.reg_list | (instr.W ? rn : 0);
+	case armOperation::ARM_STM:
+		return instr.S ? UndoJournal::everything : (instr.W ? rn : 0);
+	case armOperation::ARM_B:
+	case armOperation::ARM_BX:
+		return 0;
+	case armOperation::ARM_BL:
+		return 1u << 14;
+	default: // MSR, SWI and everything that ends up in the undefined vector
+		return UndoJournal::everything;
 	}
-	else
+}
+
+uint32_t CPU::thumbWrites(const thumbInstr& instr)
+{
+	const uint32_t rd = 1u << instr.rd;
+
+	switch (instr.type)
 	{
-		CPSR = value;
+	case thumbOperation::THUMB_CMP_IMM:
+	case thumbOperation::THUMB_TST_REG:
+	case thumbOperation::THUMB_CMP_REG:
+	case thumbOperation::THUMB_CMN_REG:
+	case thumbOperation::THUMB_CMP_HI:
+	case thumbOperation::THUMB_BX:
+	case thumbOperation::THUMB_STR_REG:
+	case thumbOperation::THUMB_STRB_REG:
+	case thumbOperation::THUMB_STRH_REG:
+	case thumbOperation::THUMB_STR_IMM:
+	case thumbOperation::THUMB_STRB_IMM:
+	case thumbOperation::THUMB_STRH_IMM:
+	case thumbOperation::THUMB_STR_SP:
+	case thumbOperation::THUMB_B_COND:
+	case thumbOperation::THUMB_B:
+	case thumbOperation::THUMB_FUSED_CMP_BCOND:
+		return 0;
+	case thumbOperation::THUMB_ADD_SP_IMM:
+	case thumbOperation::THUMB_PUSH:
+		return 1u << 13;
+	case thumbOperation::THUMB_POP:
+		return (instr.imm & 0xFF) | (1u << 13);
+	case thumbOperation::THUMB_STMIA:
+		return 1u << instr.rs;
+	case thumbOperation::THUMB_LDMIA:
+		return (instr.imm & 0xFF) | (1u << instr.rs);
+	case thumbOperation::THUMB_BLX_REG:
+	case thumbOperation::THUMB_BL_PREFIX:
+	case thumbOperation::THUMB_BL_SUFFIX:
+	case thumbOperation::THUMB_FUSED_BL:
+		return 1u << 14;
+	case thumbOperation::THUMB_SWI:
+	case thumbOperation::THUMB_UNDEFINED:
+	case thumbOperation::THUMB_FUSED_SHIFT_ADD:
+		return UndoJournal::everything;
+	default: // the rest write rd and nothing else
+		return rd;
 	}
 }
 
+uint64_t CPU::stepBack(uint64_t instrs)
+{
+	uint64_t undone = 0;
+	while (undone < instrs && undo.undoInstr(*this, *bus)) undone++;
+	return undone;
+}
 
+uint64_t CPU::runBackToWrite(uint32_t addr)
+{
+	uint64_t instrs = undo.instrsSinceWrite(addr);
+	return instrs ? stepBack(instrs) : 0;
+}
 
-inline bool CPU::checkConditional(uint8_t cond) const
+bool CPU::isBlockCacheable(uint32_t addr)
 {
-	if ((cond == 0xE)) [[likely]] return true;
+	if (addr >= 0x08000000 && addr < 0x0E000000) return true; // cartridge ROM and its wait state mirrors
+	if (addr >= 0x02000000 && addr < 0x02040000) return true; // EWRAM, kept honest by invalidateCode
+	if (addr >= 0x03000000 && addr < 0x03008000) return true; // IWRAM
+	return false;
+}
 
-	switch (cond)
+bool CPU::endsArmBlock(const armInstr& instr)
+{
+	switch (instr.type)
 	{
-	case(0x0):return Z;					break;
-	case(0x1):return !Z;				break;
-	case(0x2):return C;					break;
-	case(0x3):return !C;				break;
-	case(0x4):return N;					break;
-	case(0x5):return !N;				break;
-	case(0x6):return V;					break;
-	case(0x7):return !V;				break;
-	case(0x8):return (C && !Z);			break;
-	case(0x9):return (!C || Z);			break;
-	case(0xA):return (N == V);			break;
-	case(0xB):return (N != V);			break;
-	case(0xC):return (!Z && (N == V));	break;
-	case(0xD):return (Z || (N != V));	break;
-	case(0xE):return true;				break;
-	case(0xF):printf("0XF INVALID CONDITIONAL CHECK   ---    ");break;
-	}
-}
+	case armOperation::ARM_B:
+	case armOperation::ARM_BL:
+	case armOperation::ARM_BX:
+	case armOperation::ARM_SWI:
+	case armOperation::ARM_MSR: // can rewrite T and the mode
+	case armOperation::ARM_CDP:
+	case armOperation::ARM_LDC:
+	case armOperation::ARM_STC:
+	case armOperation::ARM_MRC:
+	case armOperation::ARM_MCR:
+	case armOperation::ARM_UNDEFINED:
+		return true;
 
+	case armOperation::ARM_LDM:
+	case armOperation::ARM_STM:
+		return (instr.reg_list & 0x8000) || instr.rn == 15;
 
+	case armOperation::ARM_LDR:
+	case armOperation::ARM_STR:
+	case armOperation::ARM_LDRH:
+	case armOperation::ARM_STRH:
+	case armOperation::ARM_LDRSB:
+	case armOperation::ARM_LDRSH:
+		return instr.rd == 15 || (instr.rn == 15 && (!instr.P || instr.W)); // pc loads, pc writeback
 
+	case armOperation::ARM_UMULL:
+	case armOperation::ARM_UMLAL:
+	case armOperation::ARM_SMULL:
+	case armOperation::ARM_SMLAL:
+		return instr.rd == 15 || instr.rn == 15; // RdHi, RdLo
 
+	default: // data processing, multiply, swap, MRS
+		return instr.rd == 15;
+	}
+}
 
-/////////////////////////////////////////////
-///             OPCODE INSTRS()           ///
-/////////////////////////////////////////////
+bool CPU::endsThumbBlock(const thumbInstr& instr)
+{
+	switch (instr.type)
+	{
+	case thumbOperation::THUMB_B:
+	case thumbOperation::THUMB_B_COND:
+	case thumbOperation::THUMB_BL_SUFFIX:
+	case thumbOperation::THUMB_BX:
+	case thumbOperation::THUMB_BLX_REG:
+	case thumbOperation::THUMB_SWI:
+	case thumbOperation::THUMB_UNDEFINED:
+		return true;
 
-// THIS WILL ADD 2 FOR THUMB, ADD 4 OTHERWISE
+	case thumbOperation::THUMB_POP:
+		return instr.imm == 0 || (instr.imm & 0x8000);
 
-const inline uint8_t CPU::pcOffset()
-{
-	return (T) ? 2 : 4;
+	case thumbOperation::THUMB_LDMIA:
+		return (instr.imm & 0xFF) == 0;
+
+	case thumbOperation::THUMB_ADD_HI:
+	case thumbOperation::THUMB_MOV_HI:
+		return instr.rd == 15;
+
+	default:
+		return false;
+	}
 }
 
-//HELPER FUNCTIONS FOR DATA PROCESSING
+//////////////////////////////////////////////////////////////////////////
+//				                  FUSION								//
+//////////////////////////////////////////////////////////////////////////
 
-inline uint32_t SDOffset(bool u, uint32_t newAddr, uint32_t offset)
+// a fused entry sits at its first instr's address and the replay loop's pc step covers that one,
+// the handler does the second's pc += 2 itself. blocks only ever hold back to back instrs so the
+// entry after it is at +4, which is where pc is left unless the pair branched
+
+void CPU::setFusion(bool enabled)
 {
-	if (u) newAddr += offset;
-	else newAddr -= offset;
-	return newAddr;
+	fusion = enabled;
+	flushBlockCache();
 }
 
-inline int numOfRegisters(uint16_t registerList)
+void CPU::fuseThumbBlock(std::vector<thumbBlockEntry>& entries)
 {
-	int numRegs = 0;
-	for (int i = 0; i < 16; i++)
+	size_t out = 0;
+
+	for (size_t i = 0; i < entries.size(); i++)
 	{
-		if (registerList & (1 << i)) numRegs++;
+		thumbBlockEntry entry = entries[i];
+
+		if (i + 1 < entries.size() && fuseThumbPair(entries[i], entries[i + 1], entry))
+		{
+			i++;
+		}
+		else if (entry.instr.type == thumbOperation::THUMB_LDR_PC)
+		{
+			uint32_t address = ((entry.addr + 4) & ~3) + entry.instr.imm; // what opT_LDR_PC works out
+			if (Bus::isRomAddress(address) && Bus::isRomAddress(address + 3))
+			{
+				entry.instr.type = thumbOperation::THUMB_LDR_LITERAL;
+				entry.instr.imm = bus->read32(address);
+				entry.execute = &CPU::opT_LDR_LITERAL;
+			}
+		}
+
+		entries[out++] = entry;
 	}
 
-	return numRegs;
+	entries.resize(out);
 }
 
-inline uint32_t CPU::SDapplyShift(uint32_t rmVal, uint8_t type, uint8_t amount) // singledata apply shift
+bool CPU::fuseThumbPair(const thumbBlockEntry& first, const thumbBlockEntry& second, thumbBlockEntry& fused)
 {
-	switch (type) // use bits 1 and 2 of shift
+	const thumbInstr& a = first.instr;
+	const thumbInstr& b = second.instr;
+
+	if (second.addr != first.addr + 2) return false;
+
+	thumbBlockEntry pair = first;
+	pair.instr = {};
+
+	if (a.type == thumbOperation::THUMB_BL_PREFIX && b.type == thumbOperation::THUMB_BL_SUFFIX)
+	{
+		pair.instr.type = thumbOperation::THUMB_FUSED_BL;
+		pair.instr.imm = a.imm + b.imm;
+		pair.execute = &CPU::opT_FUSED_BL;
+		fused = pair;
+		return true;
+	}
+
+	if ((a.type == thumbOperation::THUMB_CMP_IMM || a.type == thumbOperation::THUMB_CMP_REG) && b.type == thumbOperation::THUMB_B_COND)
 	{
-	case 0b00: return DPshiftLSL(rmVal, amount, nullptr); break; // LSL
-	case 0b01: return DPshiftLSR(rmVal, amount, nullptr); break; // LSR
-	case 0b10: return DPshiftASR(rmVal, amount, nullptr); break; // ASR
-	case 0b11: return DPshiftROR(rmVal, amount, nullptr); break; // ROR
+		pair.instr.type = thumbOperation::THUMB_FUSED_CMP_BCOND;
+		pair.instr.rd = a.rd;
+		pair.instr.rs = a.rs;
+		pair.instr.h1 = a.type == thumbOperation::THUMB_CMP_REG;
+		pair.instr.cond = b.cond;
+		pair.instr.imm = (a.imm & 0xFF) | (b.imm << 8); // compare value below, branch offset (signed) above
+		pair.execute = &CPU::opT_FUSED_CMP_BCOND;
+		fused = pair;
+		return true;
 	}
+
+	// only when the ADD reads what the first one wrote, that is the address computation pattern
+	bool shift = a.type == thumbOperation::THUMB_LSL_IMM;
+	if ((shift || a.type == thumbOperation::THUMB_MOV_IMM) && b.type == thumbOperation::THUMB_ADD_REG && (a.rd == b.rs || a.rd == b.rn))
+	{
+		pair.instr.type = thumbOperation::THUMB_FUSED_SHIFT_ADD;
+		pair.instr.rd = b.rd;
+		pair.instr.rs = b.rs;
+		pair.instr.rn = b.rn;
+		pair.instr.cond = a.rd; // where the first result goes
+		pair.instr.h1 = !shift;
+		pair.instr.imm = shift ? (a.rs << 8) | (a.imm & 0x1F) : a.imm & 0xFF;
+		pair.execute = &CPU::opT_FUSED_SHIFT_ADD;
+		fused = pair;
+		return true;
+	}
+
+	return false;
+}
+
+
+
+namespace
+{
+	constexpr std::array<CPU::OpAFunction, static_cast<int>(CPU::armOperation::COUNT)> buildArmFunctions()
+	{
+		std::array<CPU::OpAFunction, static_cast<int>(CPU::armOperation::COUNT)> table = {};
+
+		// DATA 
+		table[static_cast<int>(CPU::armOperation::ARM_AND)] = &CPU::opA_AND;
+		table[static_cast<int>(CPU::armOperation::ARM_EOR)] = &CPU::opA_EOR;
+		table[static_cast<int>(CPU::armOperation::ARM_SUB)] = &CPU::opA_SUB;
+		table[static_cast<int>(CPU::armOperation::ARM_RSB)] = &CPU::opA_RSB;
+		table[static_cast<int>(CPU::armOperation::ARM_ADD)] = &CPU::opA_ADD;
+		table[static_cast<int>(CPU::armOperation::ARM_ADC)] = &CPU::opA_ADC;
+		table[static_cast<int>(CPU::armOperation::ARM_SBC)] = &CPU::opA_SBC;
+		table[static_cast<int>(CPU::armOperation::ARM_RSC)] = &CPU::opA_RSC;
+		table[static_cast<int>(CPU::armOperation::ARM_TST)] = &CPU::opA_TST;
+		table[static_cast<int>(CPU::armOperation::ARM_TEQ)] = &CPU::opA_TEQ;
+		table[static_cast<int>(CPU::armOperation::ARM_CMP)] = &CPU::opA_CMP;
+		table[static_cast<int>(CPU::armOperation::ARM_CMN)] = &CPU::opA_CMN;
+		table[static_cast<int>(CPU::armOperation::ARM_ORR)] = &CPU::opA_ORR;
+		table[static_cast<int>(CPU::armOperation::ARM_MOV)] = &CPU::opA_MOV;
+		table[static_cast<int>(CPU::armOperation::ARM_BIC)] = &CPU::opA_BIC;
+		table[static_cast<int>(CPU::armOperation::ARM_MVN)] = &CPU::opA_MVN;
+
+		// PSR Transfer
+		table[static_cast<int>(CPU::armOperation::ARM_MRS)] = &CPU::opA_MRS;
+		table[static_cast<int>(CPU::armOperation::ARM_MSR)] = &CPU::opA_MSR;
+
+		// Load/Store
+		table[static_cast<int>(CPU::armOperation::ARM_LDR)] = &CPU::opA_LDR;
+		table[static_cast<int>(CPU::armOperation::ARM_STR)] = &CPU::opA_STR;
+		table[static_cast<int>(CPU::armOperation::ARM_LDRH)] = &CPU::opA_LDRH;
+		table[static_cast<int>(CPU::armOperation::ARM_STRH)] = &CPU::opA_STRH;
+		table[static_cast<int>(CPU::armOperation::ARM_LDRSB)] = &CPU::opA_LDRSB;
+		table[static_cast<int>(CPU::armOperation::ARM_LDRSH)] = &CPU::opA_LDRSH;
+		table[static_cast<int>(CPU::armOperation::ARM_LDM)] = &CPU::opA_LDM;
+		table[static_cast<int>(CPU::armOperation::ARM_STM)] = &CPU::opA_STM;
+
+		// Branch
+		table[static_cast<int>(CPU::armOperation::ARM_B)] = &CPU::opA_B;
+		table[static_cast<int>(CPU::armOperation::ARM_BL)] = &CPU::opA_BL;
+		table[static_cast<int>(CPU::armOperation::ARM_BX)] = &CPU::opA_BX;
+
+		// Multiply
+		table[static_cast<int>(CPU::armOperation::ARM_MUL)] = &CPU::opA_MUL;
+		table[static_cast<int>(CPU::armOperation::ARM_MLA)] = &CPU::opA_MLA;
+		table[static_cast<int>(CPU::armOperation::ARM_UMULL)] = &CPU::opA_UMULL;
+		table[static_cast<int>(CPU::armOperation::ARM_UMLAL)] = &CPU::opA_UMLAL;
+		table[static_cast<int>(CPU::armOperation::ARM_SMULL)] = &CPU::opA_SMULL;
+		table[static_cast<int>(CPU::armOperation::ARM_SMLAL)] = &CPU::opA_SMLAL;
+
+		// Special
+		table[static_cast<int>(CPU::armOperation::ARM_SWP)] = &CPU::opA_SWP;
+		table[static_cast<int>(CPU::armOperation::ARM_SWI)] = &CPU::opA_SWI;
+
+		// Coprocessor
+		table[static_cast<int>(CPU::armOperation::ARM_CDP)] = &CPU::opA_CDP;
+		table[static_cast<int>(CPU::armOperation::ARM_LDC)] = &CPU::opA_LDC;
+		table[static_cast<int>(CPU::armOperation::ARM_STC)] = &CPU::opA_STC;
+		table[static_cast<int>(CPU::armOperation::ARM_MRC)] = &CPU::opA_MRC;
+		table[static_cast<int>(CPU::armOperation::ARM_MCR)] = &CPU::opA_MCR;
+
+		// Undefined
+		table[static_cast<int>(CPU::armOperation::ARM_UNDEFINED)] = &CPU::opA_UNDEFINED;
+
+		return table;
+	}
+
+	constexpr std::array<CPU::OpTFunction, static_cast<int>(CPU::thumbOperation::COUNT)> buildThumbFunctions()
+	{
+		std::array<CPU::OpTFunction, static_cast<int>(CPU::thumbOperation::COUNT)> table = {};
+
+		table[static_cast<int>(CPU::thumbOperation::THUMB_MOV_IMM)] = &CPU::opT_MOV_IMM;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_ADD_REG)] = &CPU::opT_ADD_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_ADD_IMM)] = &CPU::opT_ADD_IMM;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_ADD_IMM3)] = &CPU::opT_ADD_IMM3;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_SUB_REG)] = &CPU::opT_SUB_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_SUB_IMM)] = &CPU::opT_SUB_IMM;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_SUB_IMM3)] = &CPU::opT_SUB_IMM3;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_CMP_IMM)] = &CPU::opT_CMP_IMM;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LSL_IMM)] = &CPU::opT_LSL_IMM;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LSR_IMM)] = &CPU::opT_LSR_IMM;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_ASR_IMM)] = &CPU::opT_ASR_IMM;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_AND_REG)] = &CPU::opT_AND_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_EOR_REG)] = &CPU::opT_EOR_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LSL_REG)] = &CPU::opT_LSL_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LSR_REG)] = &CPU::opT_LSR_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_ASR_REG)] = &CPU::opT_ASR_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_ADC_REG)] = &CPU::opT_ADC_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_SBC_REG)] = &CPU::opT_SBC_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_ROR_REG)] = &CPU::opT_ROR_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_TST_REG)] = &CPU::opT_TST_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_NEG_REG)] = &CPU::opT_NEG_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_CMP_REG)] = &CPU::opT_CMP_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_CMN_REG)] = &CPU::opT_CMN_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_ORR_REG)] = &CPU::opT_ORR_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_MUL_REG)] = &CPU::opT_MUL_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_BIC_REG)] = &CPU::opT_BIC_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_MVN_REG)] = &CPU::opT_MVN_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_ADD_HI)] = &CPU::opT_ADD_HI;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_CMP_HI)] = &CPU::opT_CMP_HI;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_MOV_HI)] = &CPU::opT_MOV_HI;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_BX)] = &CPU::opT_BX;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_BLX_REG)] = &CPU::opT_BLX_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LDR_PC)] = &CPU::opT_LDR_PC;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LDR_REG)] = &CPU::opT_LDR_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_STR_REG)] = &CPU::opT_STR_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LDRB_REG)] = &CPU::opT_LDRB_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_STRB_REG)] = &CPU::opT_STRB_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LDRH_REG)] = &CPU::opT_LDRH_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_STRH_REG)] = &CPU::opT_STRH_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LDRSB_REG)] = &CPU::opT_LDRSB_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LDRSH_REG)] = &CPU::opT_LDRSH_REG;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LDR_IMM)] = &CPU::opT_LDR_IMM;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_STR_IMM)] = &CPU::opT_STR_IMM;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LDRB_IMM)] = &CPU::opT_LDRB_IMM;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_STRB_IMM)] = &CPU::opT_STRB_IMM;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LDRH_IMM)] = &CPU::opT_LDRH_IMM;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_STRH_IMM)] = &CPU::opT_STRH_IMM;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LDR_SP)] = &CPU::opT_LDR_SP;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_STR_SP)] = &CPU::opT_STR_SP;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_ADD_PC)] = &CPU::opT_ADD_PC;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_ADD_SP)] = &CPU::opT_ADD_SP;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_ADD_SP_IMM)] = &CPU::opT_ADD_SP_IMM;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_PUSH)] = &CPU::opT_PUSH;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_POP)] = &CPU::opT_POP;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_STMIA)] = &CPU::opT_STMIA;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LDMIA)] = &CPU::opT_LDMIA;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_B_COND)] = &CPU::opT_B_COND;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_B)] = &CPU::opT_B;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_BL_PREFIX)] = &CPU::opT_BL_PREFIX;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_BL_SUFFIX)] = &CPU::opT_BL_SUFFIX;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_SWI)] = &CPU::opT_SWI;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_UNDEFINED)] = &CPU::opT_UNDEFINED;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_FUSED_BL)] = &CPU::opT_FUSED_BL;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_FUSED_CMP_BCOND)] = &CPU::opT_FUSED_CMP_BCOND;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_FUSED_SHIFT_ADD)] = &CPU::opT_FUSED_SHIFT_ADD;
+		table[static_cast<int>(CPU::thumbOperation::THUMB_LDR_LITERAL)] = &CPU::opT_LDR_LITERAL;
+
+		return table;
+	}
+}
+
+const std::array<CPU::OpAFunction, static_cast<int>(CPU::armOperation::COUNT)> CPU::opA_functions = buildArmFunctions();
+const std::array<CPU::OpTFunction, static_cast<int>(CPU::thumbOperation::COUNT)> CPU::opT_functions = buildThumbFunctions();
+
+
+int CPU::armExecute(const armInstr& instr)
+{
+	pipelineFlushed = false;
+	int cycles = armDispatch(opA_functions[static_cast<int>(instr.type)], instr);
+	if (!pipelineFlushed) pc() += 4;
+	return cycles;
 }
 
+//////////////////////////////////////////////////////////////////////////
+//				           MODE HELPER FUNCTIONS						//
+//////////////////////////////////////////////////////////////////////////
 
+const char* CPU::CPSRtoString()
+{
+	static char str[8];
 
+	syncFlags();
+	str[0] = N ? 'N' : '-';
+	str[1] = Z ? 'Z' : '-';
+	str[2] = C ? 'C' : '-';
+	str[3] = V ? 'V' : '-';
+	str[4] = I ? 'I' : '-';
+	str[5] = F ? 'F' : '-';
+	str[6] = T ? 'T' : '-';
+	str[7] = '\0';
 
-const inline uint8_t CPU::DPgetRn() { return (instruction >> 16) & 0xF; }
-const inline uint8_t CPU::DPgetRd() { return (instruction >> 12) & 0xF; }
-const inline uint8_t CPU::DPgetRs() { return (instruction >> 8) & 0xF; }
-const inline uint8_t CPU::DPgetRm() { return instruction & 0xF; }
-const inline uint8_t CPU::DPgetShift() { return (instruction >> 4) & 0xFF; }
-const inline uint8_t CPU::DPgetImmed() { return instruction & 0xFF; }
-const inline uint8_t CPU::DPgetRotate() { return (2 * ((instruction >> 8) & 0xF)); }
-const inline bool CPU::DPs() { return (instruction >> 20) & 0b1; } // condition code
-const inline bool CPU::DPi() { return (instruction >> 25) & 0b1; } // immediate code
-const inline uint8_t CPU::DPgetShiftAmount(uint8_t shift)
+	return str;
+}
+
+std::string CPSRparser(uint32_t num)
 {
-	if (shift & 0b1) // shift amount depends on register if this is true
-	{
-		return reg[DPgetRs()] & 0xFF; // shift amount is bottom 8 bits of Rs
-	}
-	else
+	std::string str = "";
+
+	for (int i = 0; i <32; i++)
 	{
-		return (shift >> 3) & 0x1F;  // 5-bit immediate (0-31)
+		str += ((num >> i) & 1)==1 ? "X" : "-";
 	}
+	str += '\0';
+
+	return str;
 }
 
-inline uint32_t CPU::DPshiftLSL(uint32_t value, uint8_t shift_amount, bool* carry_out)
+
+
+
+//std::string CPU::CPSRtoStringPASSED(uint32_t base, uint32_t finalS, uint32_t passed)
+//{
+//	static char str[8];
+//	// find the difference between
+//	// original and expected
+//	// original and passed
+//	if (passed != finalS)
+//	{
+//		return "passed and final differ, BASE " + CPSRparser(passed) + "FINAL "+ CPSRparser(finalS);
+//	}
+//	//if (base != passed)
+//	//{
+//	//	return "base and final differ, BASE " + CPSRparser(base) + "FINAL " + CPSRparser(finalS);
+//	//}
+//
+//	
+//
+//	return str;
+//}
+
+
+
+CPU::mode CPU::CPSRbitToMode(uint8_t modeBits)
 {
-	if (shift_amount == 0)
-	{
-		return value;
-	}
-	else if (shift_amount < 32)
-	{
-		if (carry_out) *carry_out = (value >> (32 - shift_amount)) & 1;
-		return value << shift_amount;
-	}
-	else if (shift_amount == 32)
-	{
-		if (carry_out) *carry_out = value & 1;
-		return 0;
-	}
-	else
-	{
-		if (carry_out) *carry_out = 0;
-		return 0;
-	}
+	return static_cast<mode>(modeBits & 0x1F);
+}
+
+bool CPU::isPrivilegedMode() // used to quickly tell were not in user mode
+{
+	return (curMode != mode::User);
+}
+// bank index per mode bits, user / system and anything invalid share bank 0
+static constexpr std::array<uint8_t, 32> modeBankIndex = []
+{
+	std::array<uint8_t, 32> table = {};
+	table[0x11] = 1; // FIQ
+	table[0x12] = 2; // IRQ
+	table[0x13] = 3; // Supervisor
+	table[0x17] = 4; // Abort
+	table[0x1B] = 5; // Undefined
+	return table;
+}();
+
+uint8_t CPU::getModeIndex(mode mode) // used for register saving
+{
+	return modeBankIndex[static_cast<uint8_t>(mode) & 0x1F];
 }
-inline uint32_t CPU::DPshiftLSR(uint32_t value, uint8_t shift_amount, bool* carry_out)
+
+//reg banking
+void CPU::bankRegisters(mode mode)// save reg val to bank
 {
-	if (shift_amount == 0) shift_amount = 32;
-	if (shift_amount < 32)
-	{
-		if (carry_out) *carry_out = (value >> (shift_amount - 1)) & 1;
-		return value >> shift_amount;
-	}
-	else if (shift_amount == 32)
+	uint8_t passedModeIndex = getModeIndex(mode);
+
+	r13RegBank[passedModeIndex] = reg[13]; // save 13 and 14 into the reg bank
+	r14RegBank[passedModeIndex] = reg[14];
+
+	if (mode == mode::FIQ) // fiq saves its own registers
 	{
-		if (carry_out) *carry_out = (value >> 31) & 1;
-		return 0;
+		r8FIQ[0] = reg[8];
+		r8FIQ[1] = reg[9];
+		r8FIQ[2] = reg[10];
+		r8FIQ[3] = reg[11];
+		r8FIQ[4] = reg[12];
 	}
 	else
 	{
-		if (carry_out) *carry_out = 0;
-		return 0;
+		r8User[0] = reg[8];
+		r8User[1] = reg[9];
+		r8User[2] = reg[10];
+		r8User[3] = reg[11];
+		r8User[4] = reg[12];
 	}
+
 }
-inline uint32_t CPU::DPshiftASR(uint32_t value, uint8_t shift_amount, bool* carry_out)
+void CPU::unbankRegisters(mode mode)  // load reg vals from bank
 {
-	if (shift_amount == 0) shift_amount = 32;
-	if (shift_amount < 32)
+	uint8_t passedModeIndex = getModeIndex(mode);
+
+	reg[13] = r13RegBank[passedModeIndex]; // grab 13 and 14 from the reg bank
+	reg[14] = r14RegBank[passedModeIndex];
+
+	if (mode == mode::FIQ) // fiq saves its own registers
 	{
-		if (carry_out) *carry_out = (value >> (shift_amount - 1)) & 1;
-		return (int32_t)value >> shift_amount;
+		reg[8] = r8FIQ[0];
+		reg[9] = r8FIQ[1];
+		reg[10] = r8FIQ[2];
+		reg[11] = r8FIQ[3];
+		reg[12] = r8FIQ[4];
 	}
 	else
 	{
-		if (value & 0x80000000)
-		{
-			if (carry_out) *carry_out = 1;
-			return 0xFFFFFFFF;
-		}
-		else
-		{
-			if (carry_out) *carry_out = 0;
-			return 0;
-		}
+		reg[8] = r8User[0];
+		reg[9] = r8User[1];
+		reg[10] = r8User[2];
+		reg[11] = r8User[3];
+		reg[12] = r8User[4];
 	}
 }
-inline uint32_t CPU::DPshiftROR(uint32_t value, uint8_t shift_amount, bool* carry_out)
+
+// reg[] always holds the live registers, so a switch only moves what differs between the two modes:
+// r13 / r14 through their bank slots, and r8-r12 only when FIQ is on either side. r8User is
+// therefore only kept up to date while in FIQ, which is the only time anything reads it
+void CPU::swapBankedRegisters(mode oldMode, mode newMode)
 {
-	if (shift_amount == 0)
-	{
-		uint8_t old_carry = C ? 1 : 0;
-		if (carry_out) *carry_out = value & 1;
-		return (old_carry << 31) | (value >> 1);
-	}
-	else
+	uint8_t oldIndex = getModeIndex(oldMode);
+	uint8_t newIndex = getModeIndex(newMode);
+
+	r13RegBank[oldIndex] = reg[13];
+	r14RegBank[oldIndex] = reg[14];
+	reg[13] = r13RegBank[newIndex];
+	reg[14] = r14RegBank[newIndex];
+
+	if (oldMode == mode::FIQ || newMode == mode::FIQ)
 	{
-		shift_amount &= 0x1F;
-		if (shift_amount == 0) return value;
-		if (carry_out) *carry_out = (value >> (shift_amount - 1)) & 1;
-		return (value >> shift_amount) | (value << (32 - shift_amount));
+		uint32_t* saveTo = (oldMode == mode::FIQ) ? r8FIQ : r8User;
+		const uint32_t* loadFrom = (newMode == mode::FIQ) ? r8FIQ : r8User;
+		memcpy(saveTo, &reg[8], sizeof(r8FIQ));
+		memcpy(&reg[8], loadFrom, sizeof(r8FIQ));
 	}
 }
-inline uint32_t CPU::DPgetOp2(bool* carryFlag)
-{
 
-	if (DPi()) // if immediate mode bit is set
+void CPU::switchMode(mode newMode) // main function used for mode switching, swaps the banked registers etc
+{
+	mode oldMode = curMode;
+	if (oldMode != newMode) // check this first so we dont do a pointless swap
 	{
-		uint8_t immed = DPgetImmed();
-		uint8_t rotateAmt = DPgetRotate();
+		curMode = newMode;
 
-		uint32_t res = (immed >> rotateAmt) | (immed << (32 - rotateAmt)); // this shifts it to the right and wraps around
+		CPSR = (CPSR & ~0x1F) | static_cast<uint8_t>(newMode); // set the new modes bits (may turn this to a function later)
+		swapBankedRegisters(oldMode, newMode);
+	}
+}
 
-		// if were given a valid carryFlag (its being requested) , then check it , otherwise dont bother checking
-		if (carryFlag) *carryFlag = (res >> 31) & 1;
+void CPU::saveIntoSpsr(uint8_t index)
+{
+	if (index == 0) return; // if user or system
+	syncFlags();
+	spsrBank[index - 1] = CPSR;
+}
 
-		return res;
-	}
-	else // using the register shift
-	{
+// excpetion handling
+void CPU::enterException(CPU::mode newMode, uint32_t vectorAddr, uint32_t returnAddr)
+{
+	mode oldMode = curMode; // save our old mode
 
-		uint8_t rmVal = reg[DPgetRm()]; // this is the rms inside val we will shift
-		uint8_t shift = DPgetShift(); // this is a very general purpouse value we will have to extract from now
+	uint8_t newModeIndex = getModeIndex(newMode); // new modes index for switching
 
-		if (DPgetRm() == 15) rmVal += pcOffset();  // special case if we are shifting the pc
+	saveIntoSpsr(newModeIndex); // the new modes SPSR gets the CPSR from before the switch, so returning restores the old mode
 
-		switch ((shift >> 1) & 0x3)//use bits 1 and 2 of shift
-		{
-		case 0b00: return DPshiftLSL(rmVal, DPgetShiftAmount(shift), carryFlag);break; // LSL
-		case 0b01: return DPshiftLSR(rmVal, DPgetShiftAmount(shift), carryFlag);break; // LSR
-		case 0b10: return DPshiftASR(rmVal, DPgetShiftAmount(shift), carryFlag);break;// ASR
-		case 0b11: return DPshiftROR(rmVal, DPgetShiftAmount(shift), carryFlag);break; // ROR
-		}
-	}
+	switchMode(newMode); // switch the reg bankings , swaps curMode
 
-	return 0;
-}
-inline void CPU::setFlagNZC(uint32_t res, bool isCarry) // LOGICAL CHECK
-{
-	N = (res & 0x80000000) != 0;
-	Z = (res == 0);
-	C = isCarry;
+	//EXTRA FOR EXCEPTION HANDLING
+	CPSR |= 0x80;  // Disable IRQ
+	if (newMode == mode::FIQ) CPSR |= 0x40;// turn off FIQ if on FIQ
+
+	lr() = returnAddr;
+	T = 0; // vectors are ARM code
+	branchTo(vectorAddr);
 }
-inline void CPU::setFlagsAdd(uint32_t res, uint32_t op1, uint32_t op2)// ADD CHECK
+void CPU::returnFromException()
 {
-	N = (res & 0x80000000) != 0;
-	Z = (res == 0);
-	C = (res < op1);
-	V = (((op1 ^ res) & (op2 ^ res)) & 0x80000000) != 0;
+	syncFlags(); // the restored CPSR must not be overwritten by an older result
+	mode oldMode = curMode;
+	int oldModeIndex = getModeIndex(oldMode);
+
+	if (oldModeIndex > 0) // if not user / system
+	{
+		uint32_t savedCPSR = spsrBank[oldModeIndex - 1];
+		curMode = CPSRbitToMode(savedCPSR & 0x1F);
+
+		CPSR = savedCPSR;
+		swapBankedRegisters(oldMode, curMode);
+	}
 }
-inline void CPU::setFlagsSub(uint32_t res, uint32_t op1, uint32_t op2) // SUB CHECK
+
+//SPSR helpers
+uint32_t CPU::getSPSR()
 {
-	N = (res & 0x80000000) != 0;
-	Z = (res == 0);
-	C = (op1 >= op2);
-	V = (((op1 ^ op2) & (op1 ^ res)) & 0x80000000) != 0;
+	uint8_t idx = getModeIndex(curMode);
+	if (idx > 0)
+	{
+		return spsrBank[idx - 1];
+	}
+	return CPSR;
 }
-inline void CPU::setNZ(uint32_t res) // TEST CHECK
+void  CPU::setSPSR(uint32_t value)
 {
-	N = (res & 0x80000000) != 0;
-	Z = (res == 0);
+	int idx = getModeIndex(curMode);
+	if (idx > 0) spsrBank[idx - 1] = value;
 }
-
-inline void CPU::writeALUResult(uint8_t rdI, uint32_t result, bool s)
+//CPSR helper
+void CPU::writeCPSR(uint32_t value)
 {
-	if (s && rdI == 15)
+	syncFlags();
+	if (curMode == mode::User && ((value & 0x1F) != static_cast<uint8_t>(mode::User))) // if were in usre, and were trying to leave it
 	{
-		returnFromException();
-		reg[15] = result; 
+		CPSR = (CPSR & 0x000000FF) | (value & 0xFFFFFF00);  // update just flags, ignore rest
+		return;
 	}
-	else if (rdI == 15)
+
+	mode newMode = CPSRbitToMode(value & 0x1F);
+
+	if (curMode != newMode) // if we should swap modes
 	{
-		reg[15] = result; 
+		switchMode(newMode);
 	}
 	else
 	{
-		reg[rdI] = result;
+		CPSR = value;
 	}
 }
 
-//////////////////////////////////////////////////////////////////////////
-//				           CYCLE CALCULATORS							//
-//////////////////////////////////////////////////////////////////////////
-
-inline int CPU::dataProcessingCycleCalculator()
-{
-	int cycles = 1;
-
-	if (!DPi() && (DPgetShift() & 0b1)) cycles += 1;
-
-	if (DPgetRd() == 15) cycles += 3;
-
-	return cycles;
-}
 
-//////////////////////////////////////////////////////////////////////////
-//				              ARM OPERATIONS							//
-//////////////////////////////////////////////////////////////////////////
-//				             BRANCH EXCHANGE				            //
-//////////////////////////////////////////////////////////////////////////
 
-inline int CPU::opA_BX(armInstr instr)
+namespace
 {
-
-
-
-	if (!checkConditional(instr.cond)) {
-		pc += 4;
-		return 1;  // TODO check this later 
-	}
-
-	uint32_t newAddr = reg[instr.rm];
-
-	if (newAddr & 0b1) // 1 = THUMB
-	{
-		T = 1;
-		pc = ((newAddr) & 0xFFFFFFFE);// & 0xFFFFFFFE)+4; //clears bit for valid 2 jumping
-	}
-	else // 0 = arm
+	constexpr bool conditionHolds(uint8_t cond, uint8_t nzcv)
 	{
-		T = 0;
-		pc = ((newAddr+4) &0xFFFFFFFE);// &0xFFFFFFFC) + 4; // sets it to a valid num for +4 jumping 
+		bool n = nzcv & 8, z = nzcv & 4, c = nzcv & 2, v = nzcv & 1;
+		switch (cond)
+		{
+		case(0x0):return z;
+		case(0x1):return !z;
+		case(0x2):return c;
+		case(0x3):return !c;
+		case(0x4):return n;
+		case(0x5):return !n;
+		case(0x6):return v;
+		case(0x7):return !v;
+		case(0x8):return (c && !z);
+		case(0x9):return (!c || z);
+		case(0xA):return (n == v);
+		case(0xB):return (n != v);
+		case(0xC):return (!z && (n == v));
+		case(0xD):return (z || (n != v));
+		case(0xE):return true;
+		default:return false; // NV
+		}
 	}
 
-	if (instr.rm == 15) // check, this is ambigously defined, it says "undefined" in docs but seems to make it increment an extra 4
+	constexpr std::array<std::array<bool, 16>, 16> buildConditionTable()
 	{
-		pc += 4;
+		std::array<std::array<bool, 16>, 16> table = {};
+		for (uint8_t cond = 0; cond < 16; cond++)
+		{
+			for (uint8_t nzcv = 0; nzcv < 16; nzcv++) table[cond][nzcv] = conditionHolds(cond, nzcv);
+		}
+		return table;
 	}
-
-
-	return 3; // constant
 }
 
-//////////////////////////////////////////////////////////////////////////
-//				              ARM OPERATIONS							//
-//////////////////////////////////////////////////////////////////////////
-//				             BRANCH / BRANCH LINK			            //
-//////////////////////////////////////////////////////////////////////////
+const std::array<std::array<bool, 16>, 16> CPU::conditionTable = buildConditionTable();
 
-inline int CPU::opA_B(armInstr instr)
-{
 
-	if (!checkConditional(instr.cond)) {
-		pc += 4;
-		return 1;
-	}
 
-	pc = pc + instr.imm + 4+4;
-	return 3;
-}
 
-inline int CPU::opA_BL(armInstr instr)
-{
-	if (!checkConditional(instr.cond)) {
-		pc += 4;
-		return 1;
-	}
 
-	lr = pc; // ARM always uses 4
+/////////////////////////////////////////////
+///             OPCODE INSTRS()           ///
+//HELPER FUNCTIONS FOR DATA PROCESSING
 
-	pc = static_cast<int32_t>(pc) + static_cast<int32_t>(instr.imm)+8;
-	return 3;
+inline uint32_t SDOffset(bool u, uint32_t newAddr, uint32_t offset)
+{
+	if (u) newAddr += offset;
+	else newAddr -= offset;
+	return newAddr;
 }
 
-//////////////////////////////////////////////////////////////////////////
-//				              ARM OPERATIONS							//
-//////////////////////////////////////////////////////////////////////////
-//				              DATA PROCESSING							//
-//////////////////////////////////////////////////////////////////////////
-
-// Helper function to get operand 2 with shift applied
-inline uint32_t CPU::getArmOp2(armInstr instr, bool* carryOut)
+inline int numOfRegisters(uint16_t registerList)
 {
-	if (instr.I) // Immediate with rotation
+	int numRegs = 0;
+	for (int i = 0; i < 16; i++)
 	{
-		uint32_t value = instr.imm;
-		uint16_t rotation = instr.rotate * 2;
-		if (rotation != 0)
-		{
-			value = (value >> rotation) | (value << (32 - rotation));
-			if (carryOut) *carryOut = (value >> 31) & 1;
-		}
-		return value;
+		if (registerList & (1 << i)) numRegs++;
 	}
-	else 
-	{
-		uint32_t rmVal = reg[instr.rm];
-		uint16_t shiftAmount;
-
-		if (instr.shift_by_reg)
-		{
 
-			if (instr.rm == 15)
-			{
-				rmVal = reg[15] + 8;  
-			}
+	return numRegs;
+}
 
-			if (instr.shift_reg == 15)
-			{
-				shiftAmount = (reg[15] + 4) & 0xFF; 
-			}
-			else
-			{
-				shiftAmount = reg[instr.shift_reg] & 0xFF;
-			}
 
-			// new function
-			return applyRegisterShift(rmVal, instr.shift_type, shiftAmount, carryOut);
-		}
-		else
-		{
 
-			if (instr.rm == 15)
-			{
-				rmVal = (reg[15] + 4) & ~3; 
-			}
-			shiftAmount = instr.shift_amount;
 
-			switch (instr.shift_type)
-			{
-			case 0b00: return DPshiftLSL(rmVal, shiftAmount, carryOut);
-			case 0b01: return DPshiftLSR(rmVal, shiftAmount, carryOut);
-			case 0b10: return DPshiftASR(rmVal, shiftAmount, carryOut);
-			case 0b11: return DPshiftROR(rmVal, shiftAmount, carryOut);
-			}
-		}
+const inline uint8_t CPU::DPgetRn() { return (instruction >> 16) & 0xF; }
+const inline uint8_t CPU::DPgetRd() { return (instruction >> 12) & 0xF; }
+const inline uint8_t CPU::DPgetRs() { return (instruction >> 8) & 0xF; }
+const inline uint8_t CPU::DPgetRm() { return instruction & 0xF; }
+const inline uint8_t CPU::DPgetShift() { return (instruction >> 4) & 0xFF; }
+const inline uint8_t CPU::DPgetImmed() { return instruction & 0xFF; }
+const inline uint8_t CPU::DPgetRotate() { return (2 * ((instruction >> 8) & 0xF)); }
+const inline bool CPU::DPs() { return (instruction >> 20) & 0b1; } // condition code
+const inline bool CPU::DPi() { return (instruction >> 25) & 0b1; } // immediate code
+const inline uint8_t CPU::DPgetShiftAmount(uint8_t shift)
+{
+	if (shift & 0b1) // shift amount depends on register if this is true
+	{
+		return reg[DPgetRs()] & 0xFF; // shift amount is bottom 8 bits of Rs
+	}
+	else
+	{
+		return (shift >> 3) & 0x1F;  // 5-bit immediate (0-31)
 	}
-	return 0;
 }
 
-
-inline uint32_t CPU::applyRegisterShift(uint32_t value, uint8_t shift_type, uint8_t shift_amount, bool* carry_out)
+inline uint32_t CPU::DPshiftLSL(uint32_t value, uint8_t shift_amount, bool* carry_out)
 {
 	if (shift_amount == 0)
 	{
 		return value;
 	}
-
-	switch (shift_type)
-	{
-	case 0b00: // LSL
-	if (shift_amount < 32)
+	else if (shift_amount < 32)
 	{
 		if (carry_out) *carry_out = (value >> (32 - shift_amount)) & 1;
 		return value << shift_amount;
@@ -873,13 +1391,15 @@ inline uint32_t CPU::applyRegisterShift(uint32_t value, uint8_t shift_type, uint
 		if (carry_out) *carry_out = value & 1;
 		return 0;
 	}
-	else // > 32
+	else
 	{
 		if (carry_out) *carry_out = 0;
 		return 0;
 	}
-
-	case 0b01: // LSR
+}
+inline uint32_t CPU::DPshiftLSR(uint32_t value, uint8_t shift_amount, bool* carry_out)
+{
+	if (shift_amount == 0) shift_amount = 32;
 	if (shift_amount < 32)
 	{
 		if (carry_out) *carry_out = (value >> (shift_amount - 1)) & 1;
@@ -895,14 +1415,16 @@ inline uint32_t CPU::applyRegisterShift(uint32_t value, uint8_t shift_type, uint
 		if (carry_out) *carry_out = 0;
 		return 0;
 	}
-
-	case 0b10: // ASR
+}
+inline uint32_t CPU::DPshiftASR(uint32_t value, uint8_t shift_amount, bool* carry_out)
+{
+	if (shift_amount == 0) shift_amount = 32;
 	if (shift_amount < 32)
 	{
 		if (carry_out) *carry_out = (value >> (shift_amount - 1)) & 1;
 		return (int32_t)value >> shift_amount;
 	}
-	else 
+	else
 	{
 		if (value & 0x80000000)
 		{
@@ -915,437 +1437,396 @@ inline uint32_t CPU::applyRegisterShift(uint32_t value, uint8_t shift_type, uint
 			return 0;
 		}
 	}
-
-	case 0b11: // ROR
-	shift_amount &= 0x1F; 
+}
+inline uint32_t CPU::DPshiftROR(uint32_t value, uint8_t shift_amount, bool* carry_out)
+{
 	if (shift_amount == 0)
 	{
-		return value; 
+		syncFlags();
+		uint8_t old_carry = C ? 1 : 0;
+		if (carry_out) *carry_out = value & 1;
+		return (old_carry << 31) | (value >> 1);
 	}
-	if (carry_out) *carry_out = (value >> (shift_amount - 1)) & 1;
-	return (value >> shift_amount) | (value << (32 - shift_amount));
+	else
+	{
+		shift_amount &= 0x1F;
+		if (shift_amount == 0) return value;
+		if (carry_out) *carry_out = (value >> (shift_amount - 1)) & 1;
+		return (value >> shift_amount) | (value << (32 - shift_amount));
 	}
-
-	return 0;
 }
-// BIT OPERATIONS // AND, ORR EOR
-
-inline int CPU::opA_AND(armInstr instr)
+inline uint32_t CPU::DPgetOp2(bool* carryFlag)
 {
-	if (!checkConditional(instr.cond)) { pc += 4; return 1; }
-	bool isCarry = C;
-	uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, &isCarry);
 
-	if (instr.rn == 15)
+	if (DPi()) // if immediate mode bit is set
 	{
-		if (!instr.I && instr.shift_by_reg)
-		{
-			op1 += 8;
-		}
-		else
-		{
-			op1 += 4;
-		}
-	}
-	uint32_t res = op1 & op2;
-	if (instr.rd == 15) res += 4;
+		uint8_t immed = DPgetImmed();
+		uint8_t rotateAmt = DPgetRotate();
 
-	if (instr.S) { setFlagNZC(res, isCarry); }
-	pc += 4;
-	writeALUResult(instr.rd, res, instr.S);
-	return dataProcessingCycleCalculator();
-}
+		uint32_t res = (immed >> rotateAmt) | (immed << (32 - rotateAmt)); // this shifts it to the right and wraps around
 
-inline int CPU::opA_ORR(armInstr instr)
-{
-	if (!checkConditional(instr.cond)) { pc += 4; return 1; }
-	bool isCarry = C;
-	uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, &isCarry);
+		// if were given a valid carryFlag (its being requested) , then check it , otherwise dont bother checking
+		if (carryFlag) *carryFlag = (res >> 31) & 1;
 
-	if (instr.rn == 15)
-	{
-		if (!instr.I && instr.shift_by_reg)
-		{
-			op1 += 8;
-		}
-		else
-		{
-			op1 += 4;
-		}
+		return res;
 	}
-	uint32_t res = op1 | op2;
-	if (instr.rd == 15) res += 4;
+	else // using the register shift
+	{
 
-	if (instr.S) { setFlagNZC(res, isCarry); }
-	pc += 4;
-	writeALUResult(instr.rd, res, instr.S);
-	return dataProcessingCycleCalculator();
-}
+		uint8_t rmVal = reg[DPgetRm()]; // this is the rms inside val we will shift
+		uint8_t shift = DPgetShift(); // this is a very general purpouse value we will have to extract from now
 
-inline int CPU::opA_EOR(armInstr instr)
-{
-	if (!checkConditional(instr.cond)) { pc += 4; return 1; }
-	bool isCarry = C;
-	uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, &isCarry);
 
-	if (instr.rn == 15)
-	{
-		if (!instr.I && instr.shift_by_reg)
-		{
-			op1 += 8;
-		}
-		else
+		switch ((shift >> 1) & 0x3)//use bits 1 and 2 of shift
 		{
-			op1 += 4;
+		case 0b00: return DPshiftLSL(rmVal, DPgetShiftAmount(shift), carryFlag);break; // LSL
+		case 0b01: return DPshiftLSR(rmVal, DPgetShiftAmount(shift), carryFlag);break; // LSR
+		case 0b10: return DPshiftASR(rmVal, DPgetShiftAmount(shift), carryFlag);break;// ASR
+		case 0b11: return DPshiftROR(rmVal, DPgetShiftAmount(shift), carryFlag);break; // ROR
 		}
 	}
-	uint32_t res = op1 ^ op2;
-	if (instr.rd == 15) res += 4;
 
-	if (instr.S) { setFlagNZC(res, isCarry); }
-	pc += 4;
-	writeALUResult(instr.rd, res, instr.S);
-	return dataProcessingCycleCalculator();
+	return 0;
 }
-
-// ADD, SUB, ADC, SBC
-
-inline int CPU::opA_ADD(armInstr instr)
+inline void CPU::setFlagNZC(uint32_t res, bool isCarry) // LOGICAL CHECK
 {
-	if (!checkConditional(instr.cond)) { pc += 4; return 1; }
-	uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, nullptr);
-	
-
-	if (instr.rn == 15)
-	{
-		if (!instr.I && instr.shift_by_reg)
-		{
-			op1 += 8;
-		}
-		else
-		{
-			op1 += 4;
-		}
-	}
-
-
-	uint32_t res = op1 + op2;
-	if (instr.rd == 15) res += 4;
-
-	if (instr.S && instr.rd != 15) { setFlagsAdd(res, op1, op2); }
-	pc += 4;
-	writeALUResult(instr.rd, res, instr.S);
-	return dataProcessingCycleCalculator();
+	syncFlags(); // leaves V alone
+	N = (res & 0x80000000) != 0;
+	Z = (res == 0);
+	C = isCarry;
+}
+inline void CPU::setFlagsAdd(uint32_t res, uint32_t op1, uint32_t op2)// ADD CHECK
+{
+	if (lazyFlags) { deferFlags(flagOp::Add, res, op1, op2); return; }
+	N = (res & 0x80000000) != 0;
+	Z = (res == 0);
+	C = (res < op1);
+	V = (((op1 ^ res) & (op2 ^ res)) & 0x80000000) != 0;
+}
+inline void CPU::setFlagsSub(uint32_t res, uint32_t op1, uint32_t op2) // SUB CHECK
+{
+	if (lazyFlags) { deferFlags(flagOp::Sub, res, op1, op2); return; }
+	N = (res & 0x80000000) != 0;
+	Z = (res == 0);
+	C = (op1 >= op2);
+	V = (((op1 ^ op2) & (op1 ^ res)) & 0x80000000) != 0;
+}
+inline void CPU::setNZ(uint32_t res) // TEST CHECK
+{
+	syncFlags();
+	N = (res & 0x80000000) != 0;
+	Z = (res == 0);
 }
 
-inline int CPU::opA_SUB(armInstr instr)
+// same NZCV setFlagsAdd / setFlagsSub would have written for the noted op
+void CPU::materializeFlags()
 {
-	if (!checkConditional(instr.cond)){pc += 4; return 1;}
-	uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, nullptr);
+	uint32_t res = flagResult;
+	uint32_t op1 = flagOp1;
+	uint32_t op2 = flagOp2;
 
-	if (instr.rn == 15)
+	N = (res & 0x80000000) != 0;
+	Z = (res == 0);
+	if (pendingFlagOp == flagOp::Add)
 	{
-		if (!instr.I && instr.shift_by_reg)
-		{
-			op1 += 8;
-		}
-		else
-		{
-			op1 += 4;
-		}
+		C = (res < op1);
+		V = (((op1 ^ res) & (op2 ^ res)) & 0x80000000) != 0;
+	}
+	else
+	{
+		C = (op1 >= op2);
+		V = (((op1 ^ op2) & (op1 ^ res)) & 0x80000000) != 0;
 	}
 
-	uint32_t res = op1 - op2;
-	if (instr.rd == 15) res += 4;
-
-	if (instr.S && instr.rd != 15) { setFlagsSub(res, op1, op2); }
-	pc += 4;
-	writeALUResult(instr.rd, res, instr.S);
-	return dataProcessingCycleCalculator();
+	pendingFlagOp = flagOp::None;
+	flagsMaterialized++;
 }
 
-inline int CPU::opA_ADC(armInstr instr)
+void CPU::setLazyFlags(bool enabled)
 {
-	if (!checkConditional(instr.cond)) { pc += 4; return 1; }
-	uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, nullptr);
+	syncFlags();
+	lazyFlags = enabled;
+}
 
-	if (instr.rn == 15)
+inline void CPU::writeALUResult(uint8_t rdI, uint32_t result, bool s)
+{
+	if (s && rdI == 15)
 	{
-		if (!instr.I && instr.shift_by_reg)
-		{
-			op1 += 8;
-		}
-		else
-		{
-			op1 += 4;
-		}
+		returnFromException();
+		branchTo(result); // T from the restored CPSR picks the alignment
+	}
+	else if (rdI == 15)
+	{
+		branchTo(result);
+	}
+	else
+	{
+		reg[rdI] = result;
 	}
-	uint32_t res = op1 + op2 + C;
-	if (instr.rd == 15) res += 4;
-
-	if (instr.S && instr.rd != 15) { setFlagsAdd(res, op1, op2); }
-	pc += 4;
-	writeALUResult(instr.rd, res, instr.S);
-	return dataProcessingCycleCalculator();
 }
 
-inline int CPU::opA_SBC(armInstr instr)
-{
-	if (!checkConditional(instr.cond)){ pc += 4; return 1; }
-	uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, nullptr);
+//////////////////////////////////////////////////////////////////////////
+//				           CYCLE CALCULATORS							//
+//////////////////////////////////////////////////////////////////////////
 
-	if (instr.rn == 15)
-	{
-		if (!instr.I && instr.shift_by_reg)
-		{
-			op1 += 8;
-		}
-		else
-		{
-			op1 += 4;
-		}
-	}
+template <bool immediate, bool shiftByReg>
+inline int CPU::dataProcessingCycleCalculator(uint8_t rd)
+{
+	int cycles = 1;
 
+	if (!immediate && shiftByReg) cycles += 1;
 
-	uint32_t res = op1 - op2 - 1 + C;
-	if (instr.rd == 15) res += 4;
+	if (rd == 15) cycles += 3;
 
-	if (instr.S && instr.rd != 15) { setFlagsSub(res, op1, op2); }
-	pc += 4;
-	writeALUResult(instr.rd, res, instr.S);
-	return dataProcessingCycleCalculator();
+	return cycles;
 }
 
-// reverse subtract, reverse subtract with carry
+//////////////////////////////////////////////////////////////////////////
+//				              ARM OPERATIONS							//
+//////////////////////////////////////////////////////////////////////////
+//				             BRANCH EXCHANGE				            //
+//////////////////////////////////////////////////////////////////////////
 
-inline int CPU::opA_RSB(armInstr instr)
+inline int CPU::opA_BX(const armInstr& instr)
 {
-	if (!checkConditional(instr.cond)) { pc += 4; return 1; }
-	uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, nullptr);
-
-	if (instr.rn == 15)
-	{
-		if (!instr.I && instr.shift_by_reg)
-		{
-			op1 += 8;
-		}
-		else
-		{
-			op1 += 4;
-		}
-	}
+	uint32_t newAddr = reg[instr.rm]; // BX pc reads it like any other op, its own address + 8
 
-	uint32_t res = op2 -op1 ;
-	if (instr.rd == 15) res += 4;
+	T = newAddr & 0b1; // 1 = THUMB, 0 = arm
+	branchTo(newAddr);
 
-	if (instr.S && instr.rd != 15) { setFlagsSub(res, op2, op1); }
-	pc += 4;
-	writeALUResult(instr.rd, res, instr.S);
-	return dataProcessingCycleCalculator();
+	return 3; // constant
 }
 
-inline int CPU::opA_RSC(armInstr instr)
-{
-	if (!checkConditional(instr.cond)) { pc += 4; return 1; }
-	uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, nullptr);
+//////////////////////////////////////////////////////////////////////////
+//				              ARM OPERATIONS							//
+//////////////////////////////////////////////////////////////////////////
+//				             BRANCH / BRANCH LINK			            //
+//////////////////////////////////////////////////////////////////////////
 
-	if (instr.rn == 15)
-	{
-		if (!instr.I && instr.shift_by_reg)
-		{
-			op1 += 8;
-		}
-		else
-		{
-			op1 += 4;
-		}
-	}
+inline int CPU::opA_B(const armInstr& instr)
+{
+	branchTo(pc() + instr.imm);
+	return 3;
+}
 
-	uint32_t res = op2  - op1 - 1 + C;
-	if (instr.rd == 15) res += 4;
+inline int CPU::opA_BL(const armInstr& instr)
+{
+	lr() = pc() - 4; // the instr after this one
 
-	if (instr.S && instr.rd != 15) { setFlagsSub(res, op2, op1); }
-	pc += 4;
-	writeALUResult(instr.rd, res, instr.S);
-	return dataProcessingCycleCalculator();
+	branchTo(pc() + instr.imm);
+	return 3;
 }
 
-// test ops, for writing to flag
+//////////////////////////////////////////////////////////////////////////
+//				              ARM OPERATIONS							//
+//////////////////////////////////////////////////////////////////////////
+//				              DATA PROCESSING							//
+//////////////////////////////////////////////////////////////////////////
 
-inline int CPU::opA_TST(armInstr instr)
+// Helper function to get operand 2 with shift applied
+template <bool immediate, bool shiftByReg, uint8_t shiftType>
+inline uint32_t CPU::getArmOp2(const armInstr& instr, bool* carryOut)
 {
-	if (!checkConditional(instr.cond)) { pc += 4; return 1; }
-	bool isCarry = C;
-	uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, nullptr);
-
-	if (instr.rn == 15)
+	if constexpr (immediate) // rotated at decode, which also settled whether the rotation gives the carry
 	{
-		if (!instr.I && instr.shift_by_reg)
-		{
-			op1 += 8;
-		}
-		else
-		{
-			op1 += 4;
-		}
+		if constexpr (shiftType == ShiftROR) if (carryOut) *carryOut = instr.imm >> 31;
+		return instr.imm;
 	}
+	else 
+	{
+		uint32_t rmVal = reg[instr.rm];
+		uint16_t shiftAmount;
 
-	uint32_t res = op1 & op2;
-	if (instr.rd == 15) res += 4;
+		if constexpr (shiftByReg)
+		{
 
-	if (instr.S && instr.rd != 15) { setFlagNZC(res, isCarry); }
-	pc += 4;
-	return dataProcessingCycleCalculator();
-}
+			// the shift amount takes an extra cycle, pc has moved on another instr by the time rm is read
+			if (instr.rm == 15)
+			{
+				rmVal = reg[15] + 4;  
+			}
 
-inline int CPU::opA_TEQ(armInstr instr)
-{
-	if (!checkConditional(instr.cond)) { pc += 4; return 1; }
-	bool isCarry = C;
-	uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, nullptr);
+			shiftAmount = reg[instr.shift_reg] & 0xFF;
 
-	if (instr.rn == 15)
-	{
-		if (!instr.I && instr.shift_by_reg)
-		{
-			op1 += 8;
+			// new function
+			return applyRegisterShift(rmVal, shiftType, shiftAmount, carryOut);
 		}
 		else
 		{
-			op1 += 4;
+			return shiftByImmediate<shiftType>(rmVal, instr.shift_amount, carryOut);
 		}
 	}
-	uint32_t res = op1 ^ op2;
-	if (instr.rd == 15) res += 4;
-
-	if (instr.S && instr.rd != 15) { setFlagNZC(res, isCarry); }
-	pc += 4;
-	return dataProcessingCycleCalculator();
 }
 
-inline int CPU::opA_CMP(armInstr instr)
+// a shift by an immediate with the zero amount cases already told apart by the decode table, so the
+// amount here is always 1-31 and nothing is checked
+template <uint8_t form>
+inline uint32_t CPU::shiftByImmediate(uint32_t value, uint8_t amount, bool* carryOut)
 {
-	if (!checkConditional(instr.cond)) { pc += 4; return 1; }
-	uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, nullptr);
-
-	if (instr.rn == 15)
+	if constexpr (form == ShiftNone) return value;
+	else if constexpr (form == ShiftLSL)
 	{
-		if (!instr.I && instr.shift_by_reg)
-		{
-			op1 += 8;
-		}
-		else
-		{
-			op1 += 4;
-		}
+		if (carryOut) *carryOut = (value >> (32 - amount)) & 1;
+		return value << amount;
 	}
-	uint32_t res = op1 - op2;
-	if (instr.rd == 15) res += 4;
+	else if constexpr (form == ShiftLSR)
+	{
+		if (carryOut) *carryOut = (value >> (amount - 1)) & 1;
+		return value >> amount;
+	}
+	else if constexpr (form == ShiftASR)
+	{
+		if (carryOut) *carryOut = (value >> (amount - 1)) & 1;
+		return uint32_t(int32_t(value) >> amount);
+	}
+	else if constexpr (form == ShiftROR)
+	{
+		if (carryOut) *carryOut = (value >> (amount - 1)) & 1;
+		return (value >> amount) | (value << (32 - amount));
+	}
+	else if constexpr (form == ShiftLSR32)
+	{
+		if (carryOut) *carryOut = value >> 31;
+		return 0;
+	}
+	else if constexpr (form == ShiftASR32)
+	{
+		if (carryOut) *carryOut = value >> 31;
+		return uint32_t(int32_t(value) >> 31);
+	}
+	else // RRX
+	{
+		syncFlags();
+		uint32_t carryIn = C;
+		if (carryOut) *carryOut = value & 1;
+		return (carryIn << 31) | (value >> 1);
+	}
+}
 
-	if (instr.S && instr.rd != 15) { setFlagsSub(res, op1, op2); }
 
-	pc += 4;
+inline uint32_t CPU::applyRegisterShift(uint32_t value, uint8_t shift_type, uint8_t shift_amount, bool* carry_out)
+{
+	if (shift_amount == 0)
+	{
+		return value;
+	}
 
-	return dataProcessingCycleCalculator();
-}
+	switch (shift_type)
+	{
+	case 0b00: // LSL
+	if (shift_amount < 32)
+	{
+		if (carry_out) *carry_out = (value >> (32 - shift_amount)) & 1;
+		return value << shift_amount;
+	}
+	else if (shift_amount == 32)
+	{
+		if (carry_out) *carry_out = value & 1;
+		return 0;
+	}
+	else // > 32
+	{
+		if (carry_out) *carry_out = 0;
+		return 0;
+	}
 
-inline int CPU::opA_CMN(armInstr instr)
-{
-	if (!checkConditional(instr.cond)) { pc += 4; return 1; }
-	uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, nullptr);
+	case 0b01: // LSR
+	if (shift_amount < 32)
+	{
+		if (carry_out) *carry_out = (value >> (shift_amount - 1)) & 1;
+		return value >> shift_amount;
+	}
+	else if (shift_amount == 32)
+	{
+		if (carry_out) *carry_out = (value >> 31) & 1;
+		return 0;
+	}
+	else
+	{
+		if (carry_out) *carry_out = 0;
+		return 0;
+	}
 
-	if (instr.rn == 15)
+	case 0b10: // ASR
+	if (shift_amount < 32)
+	{
+		if (carry_out) *carry_out = (value >> (shift_amount - 1)) & 1;
+		return (int32_t)value >> shift_amount;
+	}
+	else 
 	{
-		if (!instr.I && instr.shift_by_reg)
+		if (value & 0x80000000)
 		{
-			op1 += 8;
+			if (carry_out) *carry_out = 1;
+			return 0xFFFFFFFF;
 		}
 		else
 		{
-			op1 += 4;
+			if (carry_out) *carry_out = 0;
+			return 0;
 		}
 	}
-	uint32_t res = op1 + op2;
-	if (instr.rd == 15) res += 4;
-
-	if (instr.S && instr.rd != 15) { setFlagsAdd(res, op1, op2); }
-	pc += 4;
-	return dataProcessingCycleCalculator();
-}
-
-// ops for writing 
-
-inline int CPU::opA_MOV(armInstr instr)
-{
-	if (!checkConditional(instr.cond)) { pc += 4; return 1; }
-	bool isCarry = C;
-	//uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, nullptr);
 
-	//if (instr.rn == 15) op1 += 4;
-	uint32_t res = op2;
-	if (instr.rd == 15) res += 4;
+	case 0b11: // ROR
+	shift_amount &= 0x1F; 
+	if (shift_amount == 0)
+	{
+		return value; 
+	}
+	if (carry_out) *carry_out = (value >> (shift_amount - 1)) & 1;
+	return (value >> shift_amount) | (value << (32 - shift_amount));
+	}
 
-	if (instr.S && instr.rd != 15) { setFlagNZC(res, isCarry); }
-	pc += 4;
-	writeALUResult(instr.rd, res, instr.S);
-	return dataProcessingCycleCalculator();
+	return 0;
 }
+// one body for all sixteen ops, everything that depends on the opcode or the encoding
+// flags is resolved per instantiation
 
-inline int CPU::opA_MVN(armInstr instr)
+template <CPU::armOperation op, bool immediate, bool setFlags, bool shiftByReg, uint8_t shiftType>
+inline int CPU::opA_DataProcessing(const armInstr& instr)
 {
-	if (!checkConditional(instr.cond)) { pc += 4; return 1; }
-	bool isCarry = C;
-	uint32_t op2 = getArmOp2(instr, nullptr);
-
-	//if (instr.rn == 15) op1 += 4;
-	uint32_t res = ~(op2);
-	if (instr.rd == 15) res += 4;
-
-	if (instr.S && instr.rd != 15) { setFlagNZC(res, isCarry); }
-	pc += 4;
-	writeALUResult(instr.rd, res, instr.S);
-	return dataProcessingCycleCalculator();
-}
+	constexpr bool logical = op == armOperation::ARM_AND || op == armOperation::ARM_EOR || op == armOperation::ARM_ORR; // carry comes from the shifter
+	constexpr bool test = op == armOperation::ARM_TST || op == armOperation::ARM_TEQ || op == armOperation::ARM_CMP || op == armOperation::ARM_CMN; // no rd write
+	constexpr bool move = op == armOperation::ARM_MOV || op == armOperation::ARM_MVN; // no rn read
+	constexpr bool arithmetic = op == armOperation::ARM_ADD || op == armOperation::ARM_SUB || op == armOperation::ARM_RSB || op == armOperation::ARM_CMP || op == armOperation::ARM_CMN; // never looks at C
 
-inline int CPU::opA_BIC(armInstr instr)
-{
-	if (!checkConditional(instr.cond)) { pc += 4; return 1; }
+	if constexpr (!arithmetic) syncFlags(); // C is read below
 	bool isCarry = C;
-	uint32_t op1 = reg[instr.rn];
-	uint32_t op2 = getArmOp2(instr, nullptr);
-
-	if (instr.rn == 15)
-	{
-		if (!instr.I && instr.shift_by_reg)
+	uint32_t op1 = move ? 0 : reg[instr.rn];
+	uint32_t op2 = getArmOp2<immediate, shiftByReg, shiftType>(instr, logical ? &isCarry : nullptr);
+
+	if (!move && instr.rn == 15 && !immediate && shiftByReg) op1 += 4; // read a cycle late, see getArmOp2
+
+	uint32_t res;
+	if constexpr (op == armOperation::ARM_AND || op == armOperation::ARM_TST) res = op1 & op2;
+	else if constexpr (op == armOperation::ARM_EOR || op == armOperation::ARM_TEQ) res = op1 ^ op2;
+	else if constexpr (op == armOperation::ARM_SUB || op == armOperation::ARM_CMP) res = op1 - op2;
+	else if constexpr (op == armOperation::ARM_ADD || op == armOperation::ARM_CMN) res = op1 + op2;
+	else if constexpr (op == armOperation::ARM_RSB) res = op2 - op1;
+	else if constexpr (op == armOperation::ARM_ADC) res = op1 + op2 + C;
+	else if constexpr (op == armOperation::ARM_SBC) res = op1 - op2 - 1 + C;
+	else if constexpr (op == armOperation::ARM_RSC) res = op2 - op1 - 1 + C;
+	else if constexpr (op == armOperation::ARM_ORR) res = op1 | op2;
+	else if constexpr (op == armOperation::ARM_MOV) res = op2;
+	else if constexpr (op == armOperation::ARM_BIC) res = op1 & ~(op2);
+	else res = ~(op2); // MVN
+
+	if constexpr (setFlags)
+	{
+		if constexpr (logical)
 		{
-			op1 += 8;
+			setFlagNZC(res, isCarry);
 		}
-		else
+		else if (instr.rd != 15)
 		{
-			op1 += 4;
+			if constexpr (op == armOperation::ARM_ADD || op == armOperation::ARM_ADC || op == armOperation::ARM_CMN) setFlagsAdd(res, op1, op2);
+			else if constexpr (op == armOperation::ARM_SUB || op == armOperation::ARM_SBC || op == armOperation::ARM_CMP) setFlagsSub(res, op1, op2);
+			else if constexpr (op == armOperation::ARM_RSB || op == armOperation::ARM_RSC) setFlagsSub(res, op2, op1);
+			else setFlagNZC(res, isCarry);
 		}
 	}
-	uint32_t res = op1 & ~(op2);
-	if (instr.rd == 15) res += 4;
-
-	if (instr.S && instr.rd != 15) { setFlagNZC(res, isCarry); }
-	pc += 4;
-	writeALUResult(instr.rd, res, instr.S);
-	return dataProcessingCycleCalculator();
+	if constexpr (!test) writeALUResult(instr.rd, res, setFlags);
+	return dataProcessingCycleCalculator<immediate, shiftByReg>(instr.rd);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -1354,8 +1835,9 @@ inline int CPU::opA_BIC(armInstr instr)
 //				      PSR TRANSFER (USED BY DATAOPS) 					//
 //////////////////////////////////////////////////////////////////////////
 
-inline int CPU::opA_MRS(armInstr instr)
+inline int CPU::opA_MRS(const armInstr& instr)
 {
+	syncFlags();
 	if (instr.B) // if true, read the spsr
 	{
 		reg[instr.rd] = getSPSR();
@@ -1368,15 +1850,14 @@ inline int CPU::opA_MRS(armInstr instr)
 	return 1;
 }
 
-inline int CPU::opA_MSR(armInstr instr)
+inline int CPU::opA_MSR(const armInstr& instr)
 {
+	syncFlags();
 	uint32_t value;
 
-	if (instr.I) // immediate mode
+	if (instr.I) // immediate mode, rotated at decode
 	{
-		uint8_t imm = instr.imm;
-		uint8_t rotate = instr.rotate * 2;
-		value = (imm >> rotate) | (imm << (32 - rotate));
+		value = instr.imm;
 	}
 	else // register mode
 	{
@@ -1405,7 +1886,7 @@ inline int CPU::opA_MSR(armInstr instr)
 //				      MULTIPLY and MULT-ACC              				//
 //////////////////////////////////////////////////////////////////////////
 
-inline int CPU::opA_MUL(armInstr instr)
+inline int CPU::opA_MUL(const armInstr& instr)
 {
 	uint32_t rm = reg[instr.rm];
 	uint32_t rs = reg[instr.rs];
@@ -1415,6 +1896,7 @@ inline int CPU::opA_MUL(armInstr instr)
 
 	if (instr.S) // set flags
 	{
+		syncFlags();
 		N = (res >> 31) & 0b1;
 		Z = (res == 0);
 	}
@@ -1429,7 +1911,7 @@ inline int CPU::opA_MUL(armInstr instr)
 	return m + 2;
 }
 
-inline int CPU::opA_MLA(armInstr instr)
+inline int CPU::opA_MLA(const armInstr& instr)
 {
 	uint32_t rm = reg[instr.rm];
 	uint32_t rs = reg[instr.rs];
@@ -1440,6 +1922,7 @@ inline int CPU::opA_MLA(armInstr instr)
 
 	if (instr.S) // set flags
 	{
+		syncFlags();
 		N = (res >> 31) & 0b1;
 		Z = (res == 0);
 	}
@@ -1459,22 +1942,22 @@ inline int CPU::opA_MLA(armInstr instr)
 //				      MULTIPLY LONG and MULT-ACC  LONG s/u        		//
 //////////////////////////////////////////////////////////////////////////
 
-inline int CPU::opA_UMULL(armInstr instr)
+inline int CPU::opA_UMULL(const armInstr& instr)
 {
 	return 1;
 }
 
-inline int CPU::opA_UMLAL(armInstr instr)
+inline int CPU::opA_UMLAL(const armInstr& instr)
 {
 	return 1;
 }
 
-inline int CPU::opA_SMULL(armInstr instr)
+inline int CPU::opA_SMULL(const armInstr& instr)
 {
 	return 1;
 }
 
-inline int CPU::opA_SMLAL(armInstr instr)
+inline int CPU::opA_SMLAL(const armInstr& instr)
 {
 	return 1;
 }
@@ -1485,35 +1968,30 @@ inline int CPU::opA_SMLAL(armInstr instr)
 //				          SINGLE DATA TRANSFER      					//
 //////////////////////////////////////////////////////////////////////////
 
-inline uint32_t CPU::getArmOffset(armInstr instr)
+template <bool regOffset, uint8_t shiftType>
+inline uint32_t CPU::getArmOffset(const armInstr& instr)
 {
-	if (!instr.I) // Immediate offset
+	if constexpr (!regOffset) // Immediate offset
 	{
 		return instr.imm;
 	}
 	else // Register with shift
 	{
-		uint32_t rmVal = reg[instr.rm];
-		return SDapplyShift(rmVal, instr.shift_type, instr.shift_amount);
+		return shiftByImmediate<shiftType>(reg[instr.rm], instr.shift_amount, nullptr);
 	}
 }
 
-inline int CPU::opA_LDR(armInstr instr)
+template <bool regOffset, bool preIndex, bool up, bool byte, bool writeBack, uint8_t shiftType>
+inline int CPU::opA_SingleLoad(const armInstr& instr)
 {
-	if (!checkConditional(instr.cond))
-	{
-		pc += 4;
-		return 1;
-	}
 	uint32_t newAddr = reg[instr.rn];
-	if (instr.rn == 15) newAddr += 4;
-	uint32_t offset = getArmOffset(instr);
-	if (instr.P)
+	uint32_t offset = getArmOffset<regOffset, shiftType>(instr);
+	if constexpr (preIndex)
 	{
-		newAddr = SDOffset(instr.U, newAddr, offset);
+		newAddr = SDOffset(up, newAddr, offset);
 	}
 	uint32_t readVal;
-	if (instr.B) // Byte
+	if constexpr (byte) // Byte
 	{
 		readVal = read8(newAddr);
 	}
@@ -1532,58 +2010,46 @@ inline int CPU::opA_LDR(armInstr instr)
 		}
 	}
 
-	if (!instr.P)
+	if constexpr (!preIndex)
 	{
-		newAddr = SDOffset(instr.U, newAddr, offset);
+		newAddr = SDOffset(up, newAddr, offset);
 	}
 
 	reg[instr.rd] = readVal;
 
-	if ((!instr.P || instr.W) &&  instr.rn != instr.rd)
+	bool baseWritten = (!preIndex || writeBack) && instr.rn != instr.rd;
+	if (baseWritten)
 	{
 		reg[instr.rn] = newAddr;
-
-		if (!instr.P && instr.rn == 15)
-		{
-			pc += 4;
-		}
 	}
 
 	if (instr.rd == 15)
 	{
-		printf("wesrdfthgyhuk\n");
 		//if (instr.S) returnFromException();
 
-		if (reg[15] & 0x1)
-		{
-			T = true;
-			//reg[15] &= ~0x1;
-		}
-		else
-		{
-			T = false;
-			//reg[15] &= ~0x3;
-		}
+		T = reg[15] & 0x1;
 	}
 
-	pc += 4;
+	if (instr.rd == 15 || (baseWritten && instr.rn == 15)) branchTo(reg[15]);
 
 	return 3;
 }
-inline int CPU::opA_STR(armInstr instr)
+
+template <bool regOffset, bool preIndex, bool up, bool byte, bool writeBack, uint8_t shiftType>
+inline int CPU::opA_SingleStore(const armInstr& instr)
 {
 	uint32_t newAddr = reg[instr.rn];
-	uint32_t offset = getArmOffset(instr);
+	uint32_t offset = getArmOffset<regOffset, shiftType>(instr);
 
-	if (instr.P) // Pre
+	if constexpr (preIndex) // Pre
 	{
-		newAddr = SDOffset(instr.U, newAddr, offset);
+		newAddr = SDOffset(up, newAddr, offset);
 	}
 
 	uint32_t valToStore = reg[instr.rd];
-	if (instr.rd == 15) valToStore += 4;
+	if (instr.rd == 15) valToStore += 4; // stored as its own address + 12
 
-	if (instr.B) // Byte
+	if constexpr (byte) // Byte
 	{
 		write8(newAddr, valToStore & 0xFF);
 	}
@@ -1592,29 +2058,30 @@ inline int CPU::opA_STR(armInstr instr)
 		write32(newAddr & ~3, valToStore);
 	}
 
-	if (!instr.P) // Post
+	if constexpr (!preIndex) // Post
 	{
-		newAddr = SDOffset(instr.U, newAddr, offset);
+		newAddr = SDOffset(up, newAddr, offset);
 	}
 
-	if (!instr.P || instr.W)
+	if constexpr (!preIndex || writeBack)
 	{
 		reg[instr.rn] = newAddr;
+		if (instr.rn == 15) branchTo(newAddr);
 	}
 
 	return 2;
 }
 
-inline int CPU::opA_LDRH(armInstr instr)
+inline int CPU::opA_LDRH(const armInstr& instr)
 {
-	uint32_t offset = instr.I ? instr.imm : reg[instr.rm];
+	uint32_t offset = instr.I ? instr.imm : instr.U ? reg[instr.rm] : 0u - reg[instr.rm]; // an immediate is signed already
 	uint32_t newAddr = reg[instr.rn];
 
-	if (instr.P) newAddr = SDOffset(instr.U, newAddr, offset);
+	if (instr.P) newAddr += offset;
 
 	uint32_t readVal = read16(newAddr);
 
-	if (!instr.P) newAddr = SDOffset(instr.U, newAddr, offset);
+	if (!instr.P) newAddr += offset;
 
 	if (!instr.P || instr.W)
 	{
@@ -1622,43 +2089,45 @@ inline int CPU::opA_LDRH(armInstr instr)
 	}
 
 	reg[instr.rd] = readVal;
+	if (instr.rd == 15 || ((!instr.P || instr.W) && instr.rn == 15)) branchTo(reg[15]);
 
 	return 3;
 }
 
-inline int CPU::opA_STRH(armInstr instr)
+inline int CPU::opA_STRH(const armInstr& instr)
 {
-	uint32_t offset = instr.I ? instr.imm : reg[instr.rm];
+	uint32_t offset = instr.I ? instr.imm : instr.U ? reg[instr.rm] : 0u - reg[instr.rm]; // an immediate is signed already
 	uint32_t newAddr = reg[instr.rn];
 
-	if (instr.P) newAddr = SDOffset(instr.U, newAddr, offset);
+	if (instr.P) newAddr += offset;
 
 	uint32_t valToStore = reg[instr.rd];
-	if (instr.rd == 15) valToStore += 4;
+	if (instr.rd == 15) valToStore += 4; // stored as its own address + 12
 
 	write16(newAddr, valToStore & 0xFFFF);
 
-	if (!instr.P) newAddr = SDOffset(instr.U, newAddr, offset);
+	if (!instr.P) newAddr += offset;
 
 	if (!instr.P || instr.W)
 	{
 		reg[instr.rn] = newAddr;
+		if (instr.rn == 15) branchTo(newAddr);
 	}
 
 	return 2;
 }
 
-inline int CPU::opA_LDRSB(armInstr instr)
+inline int CPU::opA_LDRSB(const armInstr& instr)
 {
-	uint32_t offset = instr.I ? instr.imm : reg[instr.rm];
+	uint32_t offset = instr.I ? instr.imm : instr.U ? reg[instr.rm] : 0u - reg[instr.rm]; // an immediate is signed already
 	uint32_t newAddr = reg[instr.rn];
 
-	if (instr.P) newAddr = SDOffset(instr.U, newAddr, offset);
+	if (instr.P) newAddr += offset;
 
 	int8_t byteVal = read8(newAddr);
 	uint32_t readVal = static_cast<int32_t>(byteVal);
 
-	if (!instr.P) newAddr = SDOffset(instr.U, newAddr, offset);
+	if (!instr.P) newAddr += offset;
 
 	if (!instr.P || instr.W)
 	{
@@ -1666,21 +2135,22 @@ inline int CPU::opA_LDRSB(armInstr instr)
 	}
 
 	reg[instr.rd] = readVal;
+	if (instr.rd == 15 || ((!instr.P || instr.W) && instr.rn == 15)) branchTo(reg[15]);
 
 	return 3;
 }
 
-inline int CPU::opA_LDRSH(armInstr instr)
+inline int CPU::opA_LDRSH(const armInstr& instr)
 {
-	uint32_t offset = instr.I ? instr.imm : reg[instr.rm];
+	uint32_t offset = instr.I ? instr.imm : instr.U ? reg[instr.rm] : 0u - reg[instr.rm]; // an immediate is signed already
 	uint32_t newAddr = reg[instr.rn];
 
-	if (instr.P) newAddr = SDOffset(instr.U, newAddr, offset);
+	if (instr.P) newAddr += offset;
 
 	int16_t HWVal = read16(newAddr);
 	uint32_t readVal = static_cast<int32_t>(HWVal);
 
-	if (!instr.P) newAddr = SDOffset(instr.U, newAddr, offset);
+	if (!instr.P) newAddr += offset;
 
 	if (!instr.P || instr.W)
 	{
@@ -1688,6 +2158,7 @@ inline int CPU::opA_LDRSH(armInstr instr)
 	}
 
 	reg[instr.rd] = readVal;
+	if (instr.rd == 15 || ((!instr.P || instr.W) && instr.rn == 15)) branchTo(reg[15]);
 
 	return 3;
 }
@@ -1698,15 +2169,9 @@ inline int CPU::opA_LDRSH(armInstr instr)
 //				          LOAD / STORE MULTIPLE      					//
 //////////////////////////////////////////////////////////////////////////
 
-inline int CPU::opA_LDM(armInstr instr)
+template <bool preIndex, bool up, bool userBank, bool writeBack>
+inline int CPU::opA_BlockLoad(const armInstr& instr)
 {
-
-	if (!checkConditional(instr.cond))
-	{
-		pc += 4;
-		return 1;  
-	}
-
 	uint16_t registerList = instr.reg_list;
 
 	int numRegs = numOfRegisters(registerList);
@@ -1714,60 +2179,67 @@ inline int CPU::opA_LDM(armInstr instr)
 
 	uint32_t startAddr = reg[instr.rn];
 
-	if (!instr.U) startAddr -= (numRegs * 4); // if down bit, subtract now
+	if (!up) startAddr -= (numRegs * 4); // if down bit, subtract now
 
 	bool loadPC = (registerList >> 15) & 0b1; // save if were gonna load into pc
-	bool useUserReg = instr.S && !loadPC; // if S is set, we gotta use user reg EXCEPT FOR PC
-	bool restoreCPSR = instr.S && loadPC; // we must restore CPSR instead if pc is also target
+	bool useUserReg = userBank && !loadPC; // if S is set, we gotta use user reg EXCEPT FOR PC
+	bool restoreCPSR = userBank && loadPC; // we must restore CPSR instead if pc is also target
 
 	uint32_t addr = startAddr; // use this for incrementing through list
 
-	if (instr.rn == 15) addr += 4;
-
-	if (!instr.U)
+	if (!up)
 	{
-		if(instr.P) addr -= 4;
+		if(preIndex) addr -= 4;
 		else addr += 4;
 	}
 
-	for (uint8_t i = 0; i < 16; i++)
+	// the block runs upwards from its lowest word whichever way the base moves: base for IA / DB
+	// once the down case has been taken off startAddr, plus 4 for IB / DA
+	const uint8_t* block = nullptr;
+	if (!userBank && instr.rn != 15) block = blockTransferRam(startAddr + (preIndex == up ? 4 : 0), numRegs, false);
+
+	if (block) loadRegisterBlock(registerList, numRegs, block);
+	else
 	{
-		if (!((registerList >> i) & 0b1)) continue; // skip if not set
+		for (uint8_t i = 0; i < 16; i++)
+		{
+			if (!((registerList >> i) & 0b1)) continue; // skip if not set
 
-		if (instr.P) addr += 4; // pre address increment
+			if (preIndex) addr += 4; // pre address increment
 
-		uint32_t val = read32(addr);
+			uint32_t val = read32(addr);
 
-		if (!useUserReg)
-		{
-			reg[i] = val;
-		}
-		else
-		{
-			if (i >= 8 && i <= 12 && (curMode == mode::FIQ))
-			{
-				r8User[i-8] = val; // load the values into user ?
-			}
-			else if (i == 13 && !(curMode == mode::User || curMode == mode::System))
+			if (!useUserReg)
 			{
-				r13RegBank[getModeIndex(mode::User)] = val;
+				reg[i] = val;
 			}
-			else if (i == 14 && !(curMode == mode::User || curMode == mode::System))
+			else
 			{
-				r14RegBank[getModeIndex(mode::User)] = val;
+				if (i >= 8 && i <= 12 && (curMode == mode::FIQ))
+				{
+					r8User[i-8] = val; // load the values into user ?
+				}
+				else if (i == 13 && !(curMode == mode::User || curMode == mode::System))
+				{
+					r13RegBank[getModeIndex(mode::User)] = val;
+				}
+				else if (i == 14 && !(curMode == mode::User || curMode == mode::System))
+				{
+					r14RegBank[getModeIndex(mode::User)] = val;
+				}
+				else reg[i] = val;
 			}
-			else reg[i] = val;
-		}
 
-		if (!instr.P)addr += 4;  // post address increment
+			if (!preIndex)addr += 4;  // post address increment
+		}
 	}
 
-	if (instr.W) // writeback to reg
+	if constexpr (writeBack) // writeback to reg
 	{
 		if (!((registerList >> instr.rn) & 0b1))
 		{
 			uint32_t writebackValue;
-			if (instr.U) writebackValue = startAddr + (numRegs * 4);
+			if (up) writebackValue = startAddr + (numRegs * 4);
 			else writebackValue = startAddr;
 
 			if (instr.rn >= 8 && instr.rn <= 12 && (curMode == mode::FIQ) && useUserReg)
@@ -1787,8 +2259,7 @@ inline int CPU::opA_LDM(armInstr instr)
 
 			else
 			{
-				if (instr.rn == 15) reg[15] = writebackValue + 4;
-				else reg[instr.rn] = writebackValue;
+				reg[instr.rn] = writebackValue;
 			}
 		}
 	}
@@ -1798,28 +2269,15 @@ inline int CPU::opA_LDM(armInstr instr)
 	{
 		if (restoreCPSR) returnFromException();
 		
-		if (reg[15] & 0x1) // thumb switching
-		{
-			T = true;
-			reg[15]; //&= ~0x1;
-		}
-		else
-		{
-			T = false;
-			reg[15]; //&= ~0x3;
-		}
+		T = reg[15] & 0x1; // thumb switching
 	}
-	pc += 4; // increment pc by 4 if used
+	if (loadPC || (writeBack && instr.rn == 15)) branchTo(reg[15]);
 	return 2 + numRegs;
 }
 
-inline int CPU::opA_STM(armInstr instr)
+template <bool preIndex, bool up, bool userBank, bool writeBack>
+inline int CPU::opA_BlockStore(const armInstr& instr)
 {
-	if (!checkConditional(instr.cond))
-	{
-		pc += 4;
-		return 1;
-	}
 	uint16_t registerList = instr.reg_list;
 	int numRegs = numOfRegisters(registerList);
 
@@ -1831,54 +2289,68 @@ inline int CPU::opA_STM(armInstr instr)
 	}
 
 	uint32_t startAddr = reg[instr.rn];
-	if (!instr.U) startAddr -= (numRegs * 4); // if down bit, subtract now
-	bool useUserReg = instr.S; // if S is set, we gotta use user reg
+	if (!up) startAddr -= (numRegs * 4); // if down bit, subtract now
+	bool useUserReg = userBank; // if S is set, we gotta use user reg
 	uint32_t addr = startAddr; // use this for incrementing through list
-	if (instr.rn == 15) addr += 4;
-	if (!instr.U)
+	if (!up)
 	{
-		if (instr.P) addr -= 4;
+		if (preIndex) addr -= 4;
 		else addr += 4;
 	}
-	for (uint8_t i = 0; i < 16; i++)
+	uint8_t* block = nullptr;
+	if (!userBank && instr.rn != 15 && instr.reg_list) block = blockTransferRam(startAddr + (preIndex == up ? 4 : 0), numRegs, true);
+
+	if (block)
 	{
-		if (!((registerList >> i) & 0b1)) continue; // skip if not set
-		if (instr.P) addr += 4; // pre address increment
-		uint32_t val;
-		if (!useUserReg)
+		storeRegisterBlock(registerList, numRegs, block);
+		if (registerList & 0x8000) // PC stores as PC+12, it is always the last word
 		{
-			val = reg[i];
-			if (i == 15) val += 4; // PC stores as PC+12
+			uint32_t storedPc = reg[15] + 4;
+			memcpy(block + (numRegs - 1) * 4, &storedPc, 4);
 		}
-		else
+	}
+	else
+	{
+		for (uint8_t i = 0; i < 16; i++)
 		{
-			if (i >= 8 && i <= 12 && (curMode == mode::FIQ))
-			{
-				val = r8User[i - 8]; // store the values from user
-			}
-			else if (i == 13 && !(curMode == mode::User || curMode == mode::System))
-			{
-				val = r13RegBank[getModeIndex(mode::User)];
-			}
-			else if (i == 14 && !(curMode == mode::User || curMode == mode::System))
+			if (!((registerList >> i) & 0b1)) continue; // skip if not set
+			if (preIndex) addr += 4; // pre address increment
+			uint32_t val;
+			if (!useUserReg)
 			{
-				val = r14RegBank[getModeIndex(mode::User)];
+				val = reg[i];
+				if (i == 15) val += 4; // PC stores as PC+12
 			}
 			else
 			{
-				val = reg[i];
-				if (i == 15) val += 4; 
+				if (i >= 8 && i <= 12 && (curMode == mode::FIQ))
+				{
+					val = r8User[i - 8]; // store the values from user
+				}
+				else if (i == 13 && !(curMode == mode::User || curMode == mode::System))
+				{
+					val = r13RegBank[getModeIndex(mode::User)];
+				}
+				else if (i == 14 && !(curMode == mode::User || curMode == mode::System))
+				{
+					val = r14RegBank[getModeIndex(mode::User)];
+				}
+				else
+				{
+					val = reg[i];
+					if (i == 15) val += 4; 
+				}
 			}
+			write32(addr, val);
+			if (!preIndex) addr += 4;  // post address increment
 		}
-		write32(addr, val);
-		if (!instr.P) addr += 4;  // post address increment
 	}
-	if (instr.W) // writeback to reg
+	if constexpr (writeBack) // writeback to reg
 	{
 
 			
 			uint32_t writebackValue;
-			if (instr.U) writebackValue = startAddr + (numRegs * 4);
+			if (up) writebackValue = startAddr + (numRegs * 4);
 			else writebackValue = startAddr;
 
 			if (instr.rn >= 8 && instr.rn <= 12 && (curMode == mode::FIQ) && useUserReg)
@@ -1895,513 +2367,545 @@ inline int CPU::opA_STM(armInstr instr)
 			}
 			else
 			{
-				if (instr.rn == 15) reg[15] = writebackValue + 4;
-				else reg[instr.rn] = writebackValue;
+				reg[instr.rn] = writebackValue;
 			}
 	}
-	pc += 4; // increment pc by 4
-	return 2 + numRegs;
-}
+	if (writeBack && instr.rn == 15) branchTo(reg[15]);
+	return 2 + numRegs;
+}
+
+inline int CPU::opA_SWI(const armInstr& instr)
+{
+	if constexpr (buildTraceLevel == traceLevel::Text)
+	{
+		printf("SWI #%d: r0=%08X r1=%08X r2=%08X\n", instr.imm, reg[0], reg[1], reg[2]); // debugging logger
+	}
+
+	if (hleBios)
+	{
+		int cycles = hleSwi((instr.imm >> 16) & 0xFF); // the bios only looks at the top byte of the comment field
+		if (cycles) return cycles;
+	}
+
+	enterException(mode::Supervisor, Vector::SWI, pc() - 4); // returns to the instr after it
+
+	return 3;
+}
+
+inline int CPU::opA_SWP(const armInstr& instr)
+{
+	return 1;
+}
+
+inline int CPU::opA_LDC(const armInstr& instr) { return 1; }
+inline int CPU::opA_STC(const armInstr& instr) { return 1; }
+inline int CPU::opA_CDP(const armInstr& instr) { return 1; }
+inline int CPU::opA_MRC(const armInstr& instr) { return 1; }
+inline int CPU::opA_MCR(const armInstr& instr) { return 1; }
+
+inline int CPU::opA_UNDEFINED(const armInstr& instr)
+{
+	if constexpr (buildTraceLevel == traceLevel::Text)
+	{
+		printf("Undefined instruction at PC=%08X\n", pc() - 8);
+	}
+	enterException(mode::Undefined, Vector::Undefined, pc() - 4);
+	return 1;
+}
+
+
+
+
+/////////////////////////////////////////////
+///           THUMB INSTRUCTIONS          ///
+/////////////////////////////////////////////
+///                decode                 ///
+/////////////////////////////////////////////
+CPU::thumbInstr CPU::debugDecodedInstr()
+{
+	thumbInstr debugInstr = {};
+	debugInstr.cond = NULL;
+	debugInstr.rd = NULL;
+	debugInstr.rs = NULL;
+	debugInstr.imm = NULL;
+	debugInstr.h1 = NULL;
+	debugInstr.h2 = NULL;
+
+	return debugInstr;
+}
+
+// thumb formats are fully identified by the top 10 bits, so bits 15-6 index a 1024 entry table.
+// each entry holds the operation, the routine that pulls its operand fields and the handler
+
+namespace ThumbDecode
+{
+	// Move shifted register: 000o oiii iiss sddd
+	inline void extractShiftImm(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.rd = (instr) & 0b111;
+		decodedInstr.rs = (instr >> 3) & 0b111;
+		decodedInstr.imm = (instr >> 6) & 0b11111;
+	}
+
+	// Add/subtract: 0001 1ioo ooss sddd
+	inline void extractAddSubReg(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.rd = (instr) & 0b111;
+		decodedInstr.rs = (instr >> 3) & 0b111;
+		decodedInstr.rn = (instr >> 6) & 0b111;
+	}
+
+	inline void extractAddSubImm(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.rd = (instr) & 0b111;
+		decodedInstr.rs = (instr >> 3) & 0b111;
+		decodedInstr.imm = (instr >> 6) & 0b111;
+	}
+
+	// Move/compare/add/subtract immediate: 001o oddd iiii iiii
+	inline void extractImm8(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.imm = (instr) & 0xFF;
+		decodedInstr.rd = (instr >> 8) & 0b111;
+	}
+
+	// ALU operations: 0100 00oo ooss sddd
+	inline void extractALU(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.rd = (instr) & 0b111;
+		decodedInstr.rs = (instr >> 3) & 0b111;
+	}
+
+	// Hi register operations/branch exchange: 0100 01oo HHss sddd
+	inline void extractHiReg(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.rd = (instr) & 0b111;
+		decodedInstr.rs = (instr >> 3) & 0b111;
+		decodedInstr.h1 = ((instr >> 7) & 0b1) == 1;
+		decodedInstr.h2 = ((instr >> 6) & 0b1) == 1;
+
+		if (decodedInstr.h1) decodedInstr.rd += 8;
+		if (decodedInstr.h2) decodedInstr.rs += 8;
+	}
+
+	// PC-relative load: 0100 1ddd iiii iiii
+	inline void extractPCLoad(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.imm = ((instr) & 0xFF) << 2;
+		decodedInstr.rd = (instr >> 8) & 0b111;
+	}
+
+	// Load/store with register offset or sign-extended byte/halfword: 0101 oo?o oobb bddd
+	inline void extractRegOffset(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.rd = (instr) & 0b111;
+		decodedInstr.rs = (instr >> 3) & 0b111; // where rs is used instead or rb for rbase
+		decodedInstr.rn = (instr >> 6) & 0b111; // where rn is used instad or r0
+	}
 
-inline int CPU::opA_SWI(armInstr instr)
-{
-	printf("SWI #%d: r0=%08X r1=%08X r2=%08X\n", instr.imm, reg[0], reg[1], reg[2]); // debugging logger
+	// Load/store with immediate offset: 011B Liii iibb bddd
+	inline void extractImmOffsetWord(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.rd = (instr) & 0b111;
+		decodedInstr.rs = (instr >> 3) & 0b111;
+		decodedInstr.imm = ((instr >> 6) & 0b11111) << 2;
+	}
 
-	enterException(mode::Supervisor, Vector::SWI, pc - 4);
+	inline void extractImmOffsetByte(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.rd = (instr) & 0b111;
+		decodedInstr.rs = (instr >> 3) & 0b111;
+		decodedInstr.imm = (instr >> 6) & 0b11111;
+	}
 
-	return 3;
-}
+	// Load/store halfword: 1000 Liii iibb bddd
+	inline void extractImmOffsetHalf(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.rd = (instr) & 0b111;
+		decodedInstr.rs = (instr >> 3) & 0b111;
+		decodedInstr.imm = ((instr >> 6) & 0b11111) << 1;
+	}
 
-inline int CPU::opA_SWP(armInstr instr)
-{
-	return 1;
-}
+	// SP-relative load/store: 1001 Lddd iiii iiii
+	inline void extractSPRelative(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.imm = (instr & 0xFF) << 2;
+		decodedInstr.rd = (instr >> 8) & 0b111;
+		decodedInstr.rs = 13;
+	}
 
-inline int CPU::opA_LDC(armInstr instr) { return 1; }
-inline int CPU::opA_STC(armInstr instr) { return 1; }
-inline int CPU::opA_CDP(armInstr instr) { return 1; }
-inline int CPU::opA_MRC(armInstr instr) { return 1; }
-inline int CPU::opA_MCR(armInstr instr) { return 1; }
+	// Load address: 1010 Sddd iiii iiii
+	inline void extractLoadAddress(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.imm = (instr & 0xFF) << 2;
+		decodedInstr.rd = (instr >> 8) & 0b111;
+	}
 
-inline int CPU::opA_UNDEFINED(armInstr instr)
-{
-	printf("Undefined instruction at PC=%08X\n", pc - 4);
-	enterException(mode::Undefined, Vector::Undefined, pc - 4);
-	return 1;
-}
+	// Add offset to SP: 1011 0000 Siii iiii
+	inline void extractAddSPImm(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.imm = (instr & 0b1111111) << 2;
 
+		if ((instr >> 7) & 0b1) decodedInstr.imm = -(int32_t)decodedInstr.imm;
+	}
 
+	// Push/pop registers: 1011 L10R rrrr rrrr
+	inline void extractPush(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.imm = (instr & 0xFF);
+		if ((instr >> 8) & 0b1) decodedInstr.imm |= (1 << 14);  // include lr
+	}
 
+	inline void extractPop(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.imm = (instr & 0xFF);
+		if ((instr >> 8) & 0b1) decodedInstr.imm |= (1 << 15);  // include pc
+	}
 
-/////////////////////////////////////////////
-///           THUMB INSTRUCTIONS          ///
-/////////////////////////////////////////////
-///                decode                 ///
-/////////////////////////////////////////////
-CPU::thumbInstr CPU::debugDecodedInstr()
-{
-	thumbInstr debugInstr = {};
-	debugInstr.cond = NULL;
-	debugInstr.rd = NULL;
-	debugInstr.rs = NULL;
-	debugInstr.imm = NULL;
-	debugInstr.h1 = NULL;
-	debugInstr.h2 = NULL;
+	// Multiple load/store: 1100 Lbbb rrrr rrrr
+	inline void extractMultiple(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.imm = (instr & 0xFF);
+		decodedInstr.rs = ((instr >> 8) & 0b111);//rs is always a sub for rb
+	}
 
-	return debugInstr;
-}
+	// Conditional branch: 1101 cccc oooo oooo
+	inline void extractCondBranch(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.cond = (instr >> 8) & 0b1111;
+		int8_t offset8 = (instr & 0xFF);
+		decodedInstr.imm = (int32_t)offset8 << 1;
+	}
 
-CPU::thumbInstr CPU::decodeThumb(uint16_t instr) // this returns a thumbInstr struct
-{
-	thumbInstr decodedInstr = {}; // creates empty struct for us to fill
-	decodedInstr.type = thumbOperation::THUMB_UNDEFINED;
+	// Software interrupt: 1101 1111 iiii iiii
+	inline void extractSWI(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.imm = instr & 0xFF;
+	}
 
-	//decodedInstr = debugDecodedInstr();
-	switch ((instr >> 13) & 0b111)
+	// Unconditional branch: 1110 0ooo oooo oooo
+	inline void extractBranch(CPU::thumbInstr& decodedInstr, uint16_t instr)
 	{
-	case(0b000): // either move shift register , or add/subtract
+		int16_t offset11 = (instr & 0x7FF);
+		if (offset11 & 0x400) offset11 |= 0xF800;
+		decodedInstr.imm = (int32_t)offset11 << 1;
+	}
+
+	// Long branch with link: 1111 Hooo oooo oooo
+	inline void extractBLPrefix(CPU::thumbInstr& decodedInstr, uint16_t instr)
 	{
-		if (((instr >> 11) & 0b11) != 0b11) // MOVE SHIFTED REGISTER
-		{
-			decodedInstr.rd = (instr) & 0b111;
-			decodedInstr.rs = (instr >> 3) & 0b111;
-			decodedInstr.imm = (instr >> 6) & 0b11111;
+		int32_t offset11 = (instr & 0x7FF);
+		if (offset11 & 0x400) offset11 |= 0xFFFFF800;
+		decodedInstr.imm = offset11 << 12;
+	}
+
+	inline void extractBLSuffix(CPU::thumbInstr& decodedInstr, uint16_t instr)
+	{
+		decodedInstr.imm = (instr & 0x7FF) << 1;
+	}
+
+	constexpr CPU::thumbDecodeEntry entry(CPU::thumbOperation type, CPU::ThumbExtractFunction extract, CPU::OpTFunction execute)
+	{
+		return CPU::thumbDecodeEntry{ type, extract, execute };
+	}
+
+	// top = bits 15-6 of the opcode
+	constexpr CPU::thumbDecodeEntry classify(uint16_t top)
+	{
+		const uint16_t instr = top << 6; // lets us keep the same bit positions as the manual
 
+		switch ((instr >> 13) & 0b111)
+		{
+		case(0b000): // either move shift register , or add/subtract
+		{
 			switch ((instr >> 11) & 0b11)
 			{
-			case(0):decodedInstr.type = thumbOperation::THUMB_LSL_IMM; break;
-			case(1):decodedInstr.type = thumbOperation::THUMB_LSR_IMM; break;
-			case(2):decodedInstr.type = thumbOperation::THUMB_ASR_IMM; break;
+			case(0):return entry(CPU::thumbOperation::THUMB_LSL_IMM, extractShiftImm, &CPU::opT_LSL_IMM);
+			case(1):return entry(CPU::thumbOperation::THUMB_LSR_IMM, extractShiftImm, &CPU::opT_LSR_IMM);
+			case(2):return entry(CPU::thumbOperation::THUMB_ASR_IMM, extractShiftImm, &CPU::opT_ASR_IMM);
 			}
-		}
-		else // Add/Subtract
-		{
-			decodedInstr.rd = (instr) & 0b111;
-			decodedInstr.rs = (instr >> 3) & 0b111;
 
 			switch ((instr >> 9) & 0b11)
 			{// 00 reg and, 01, reg sub, 10 immed and, 11 immed sub
-			case(0b00): decodedInstr.rn = (instr >> 6) & 0b111; decodedInstr.type = thumbOperation::THUMB_ADD_REG; break;
-			case(0b01): decodedInstr.rn = (instr >> 6) & 0b111; decodedInstr.type = thumbOperation::THUMB_SUB_REG; break;
-			case(0b10): decodedInstr.imm = (instr >> 6) & 0b111;decodedInstr.type = thumbOperation::THUMB_ADD_IMM; break;
-			case(0b11): decodedInstr.imm = (instr >> 6) & 0b111;decodedInstr.type = thumbOperation::THUMB_SUB_IMM; break;
+			case(0b00):return entry(CPU::thumbOperation::THUMB_ADD_REG, extractAddSubReg, &CPU::opT_ADD_REG);
+			case(0b01):return entry(CPU::thumbOperation::THUMB_SUB_REG, extractAddSubReg, &CPU::opT_SUB_REG);
+			case(0b10):return entry(CPU::thumbOperation::THUMB_ADD_IMM, extractAddSubImm, &CPU::opT_ADD_IMM);
+			default:   return entry(CPU::thumbOperation::THUMB_SUB_IMM, extractAddSubImm, &CPU::opT_SUB_IMM);
 			}
 		}
-	}break;
-	case(0b001): // Move/compare/add/ subtract immediate
-	{
-		decodedInstr.imm = (instr) & 0xFF;
-		decodedInstr.rd = (instr >> 8) & 0b111;
-
-		switch ((instr >> 11) & 0b11)
-		{
-		case(0):decodedInstr.type = thumbOperation::THUMB_MOV_IMM; break;
-		case(1):decodedInstr.type = thumbOperation::THUMB_CMP_IMM; break;
-		case(2):decodedInstr.type = thumbOperation::THUMB_ADD_IMM3; break;
-		case(3):decodedInstr.type = thumbOperation::THUMB_SUB_IMM3; break;
-		}
-	}break;
-	case(0b010): // (ALU) or (HI register op/bex) or (pc relative) or (load/store w/ reg-offs)  or (load/store se B/HW)
-	{
-		if (((instr >> 10) & 0b111) == 0b000) //ALU
+		case(0b001): // Move/compare/add/ subtract immediate
 		{
-			decodedInstr.rd = (instr) & 0b111;
-			decodedInstr.rs = (instr >> 3) & 0b111;
-
-			switch ((instr >> 6) & 0b1111)
+			switch ((instr >> 11) & 0b11)
 			{
-			case(0b0000):decodedInstr.type = thumbOperation::THUMB_AND_REG; break;
-			case(0b0001):decodedInstr.type = thumbOperation::THUMB_EOR_REG; break;
-			case(0b0010):decodedInstr.type = thumbOperation::THUMB_LSL_REG; break;
-			case(0b0011):decodedInstr.type = thumbOperation::THUMB_LSR_REG; break;
-			case(0b0100):decodedInstr.type = thumbOperation::THUMB_ASR_REG; break;
-			case(0b0101):decodedInstr.type = thumbOperation::THUMB_ADC_REG; break;
-			case(0b0110):decodedInstr.type = thumbOperation::THUMB_SBC_REG; break;
-			case(0b0111):decodedInstr.type = thumbOperation::THUMB_ROR_REG; break;
-			case(0b1000):decodedInstr.type = thumbOperation::THUMB_TST_REG; break;
-			case(0b1001):decodedInstr.type = thumbOperation::THUMB_NEG_REG; break;
-			case(0b1010):decodedInstr.type = thumbOperation::THUMB_CMP_REG; break;
-			case(0b1011):decodedInstr.type = thumbOperation::THUMB_CMN_REG; break;
-			case(0b1100):decodedInstr.type = thumbOperation::THUMB_ORR_REG; break;
-			case(0b1101):decodedInstr.type = thumbOperation::THUMB_MUL_REG; break;
-			case(0b1110):decodedInstr.type = thumbOperation::THUMB_BIC_REG; break;
-			case(0b1111):decodedInstr.type = thumbOperation::THUMB_MVN_REG; break;
+			case(0):return entry(CPU::thumbOperation::THUMB_MOV_IMM, extractImm8, &CPU::opT_MOV_IMM);
+			case(1):return entry(CPU::thumbOperation::THUMB_CMP_IMM, extractImm8, &CPU::opT_CMP_IMM);
+			case(2):return entry(CPU::thumbOperation::THUMB_ADD_IMM3, extractImm8, &CPU::opT_ADD_IMM3);
+			default:return entry(CPU::thumbOperation::THUMB_SUB_IMM3, extractImm8, &CPU::opT_SUB_IMM3);
 			}
 		}
-		else if (((instr >> 10) & 0b111) == 0b001) //Hi register operations/branch exchange
+		case(0b010): // (ALU) or (HI register op/bex) or (pc relative) or (load/store w/ reg-offs)  or (load/store se B/HW)
 		{
-			decodedInstr.rd = (instr) & 0b111;
-			decodedInstr.rs = (instr >> 3) & 0b111;
-			decodedInstr.h1 = ((instr >> 7) & 0b1)==1;
-			decodedInstr.h2 = ((instr >> 6) & 0b1)==1;
-
-
-			if ((((instr >> 8) & 0b11) == 0b00 || ((instr >> 8) & 0b11) == 0b01 || ((instr >> 8) & 0b11) == 0b10) && (!decodedInstr.h1 && !decodedInstr.h2))
+			if (((instr >> 10) & 0b111) == 0b000) //ALU
 			{
-				decodedInstr.type = thumbOperation::THUMB_UNDEFINED;
+				switch ((instr >> 6) & 0b1111)
+				{
+				case(0b0000):return entry(CPU::thumbOperation::THUMB_AND_REG, extractALU, &CPU::opT_AND_REG);
+				case(0b0001):return entry(CPU::thumbOperation::THUMB_EOR_REG, extractALU, &CPU::opT_EOR_REG);
+				case(0b0010):return entry(CPU::thumbOperation::THUMB_LSL_REG, extractALU, &CPU::opT_LSL_REG);
+				case(0b0011):return entry(CPU::thumbOperation::THUMB_LSR_REG, extractALU, &CPU::opT_LSR_REG);
+				case(0b0100):return entry(CPU::thumbOperation::THUMB_ASR_REG, extractALU, &CPU::opT_ASR_REG);
+				case(0b0101):return entry(CPU::thumbOperation::THUMB_ADC_REG, extractALU, &CPU::opT_ADC_REG);
+				case(0b0110):return entry(CPU::thumbOperation::THUMB_SBC_REG, extractALU, &CPU::opT_SBC_REG);
+				case(0b0111):return entry(CPU::thumbOperation::THUMB_ROR_REG, extractALU, &CPU::opT_ROR_REG);
+				case(0b1000):return entry(CPU::thumbOperation::THUMB_TST_REG, extractALU, &CPU::opT_TST_REG);
+				case(0b1001):return entry(CPU::thumbOperation::THUMB_NEG_REG, extractALU, &CPU::opT_NEG_REG);
+				case(0b1010):return entry(CPU::thumbOperation::THUMB_CMP_REG, extractALU, &CPU::opT_CMP_REG);
+				case(0b1011):return entry(CPU::thumbOperation::THUMB_CMN_REG, extractALU, &CPU::opT_CMN_REG);
+				case(0b1100):return entry(CPU::thumbOperation::THUMB_ORR_REG, extractALU, &CPU::opT_ORR_REG);
+				case(0b1101):return entry(CPU::thumbOperation::THUMB_MUL_REG, extractALU, &CPU::opT_MUL_REG);
+				case(0b1110):return entry(CPU::thumbOperation::THUMB_BIC_REG, extractALU, &CPU::opT_BIC_REG);
+				default:     return entry(CPU::thumbOperation::THUMB_MVN_REG, extractALU, &CPU::opT_MVN_REG);
+				}
 			}
-
-
-			if (decodedInstr.h1) decodedInstr.rd += 8;
-			if (decodedInstr.h2) decodedInstr.rs += 8;
-
-			//The action of H1 = 0, H2 = 0 for Op = 00 (ADD), Op = 01 (CMP) and Op = 10 (MOV)is
-			//	undefined, and should not be used
-
-
-
-			switch ((instr >> 8) & 0b11)
+			else if (((instr >> 10) & 0b111) == 0b001) //Hi register operations/branch exchange
 			{
-			case 0b00: decodedInstr.type = thumbOperation::THUMB_ADD_HI; break;
-			case 0b01: decodedInstr.type = thumbOperation::THUMB_CMP_HI; break;
-			case 0b10: decodedInstr.type = thumbOperation::THUMB_MOV_HI; break;
-			case 0b11:
-			if (decodedInstr.h1)
+				//The action of H1 = 0, H2 = 0 for Op = 00 (ADD), Op = 01 (CMP) and Op = 10 (MOV)is
+				//	undefined, and should not be used
+				switch ((instr >> 8) & 0b11)
+				{
+				case 0b00: return entry(CPU::thumbOperation::THUMB_ADD_HI, extractHiReg, &CPU::opT_ADD_HI);
+				case 0b01: return entry(CPU::thumbOperation::THUMB_CMP_HI, extractHiReg, &CPU::opT_CMP_HI);
+				case 0b10: return entry(CPU::thumbOperation::THUMB_MOV_HI, extractHiReg, &CPU::opT_MOV_HI);
+				default:   return entry(CPU::thumbOperation::THUMB_BX, extractHiReg, &CPU::opT_BX); //BLX was apparntly a figment of my imagination
+				}
+			}
+			else if (((instr >> 11) & 0b11) == 0b01) // pc relative load
 			{
-				decodedInstr.type = thumbOperation::THUMB_BX; //BLX was apparntly a figment of my imagination
+				return entry(CPU::thumbOperation::THUMB_LDR_PC, extractPCLoad, &CPU::opT_LDR_PC);
 			}
-			else decodedInstr.type = thumbOperation::THUMB_BX; // ; 
-			break;
+			else if (((instr >> 9) & 0b1) == 0) // load store w reg offset
+			{
+				switch ((instr >> 10) & 0b11)
+				{
+				case 0b00: return entry(CPU::thumbOperation::THUMB_STR_REG, extractRegOffset, &CPU::opT_STR_REG);
+				case 0b01: return entry(CPU::thumbOperation::THUMB_STRB_REG, extractRegOffset, &CPU::opT_STRB_REG);
+				case 0b10: return entry(CPU::thumbOperation::THUMB_LDR_REG, extractRegOffset, &CPU::opT_LDR_REG);
+				default:   return entry(CPU::thumbOperation::THUMB_LDRB_REG, extractRegOffset, &CPU::opT_LDRB_REG);
+				}
 			}
-		}
-		else if (((instr >> 11) & 0b11) == 0b01) // pc relative load
-		{
-			decodedInstr.imm = ((instr) & 0xFF) << 2;
-			decodedInstr.rd = (instr >> 8) & 0b111;
-
-			decodedInstr.type = thumbOperation::THUMB_LDR_PC;
-		}
-		else if (((instr >> 12) & 0b1) == 1 && ((instr >> 9) & 0b1) == 0) // load store w reg offset
-		{
-			decodedInstr.rd = (instr) & 0b111;
-			decodedInstr.rs = (instr >> 3) & 0b111; // where rs is used instead or rb for rbase
-			decodedInstr.rn = (instr >> 6) & 0b111; // where rn is used instad or r0
-
-			switch ((instr >> 10) & 0b11)
+			else // load store w sign-extended byte / halfwor
 			{
-			case 0b00: decodedInstr.type = thumbOperation::THUMB_STR_REG; break;
-			case 0b01: decodedInstr.type = thumbOperation::THUMB_STRB_REG; break;
-			case 0b10: decodedInstr.type = thumbOperation::THUMB_LDR_REG; break;
-			case 0b11: decodedInstr.type = thumbOperation::THUMB_LDRB_REG; break;
+				switch ((instr >> 10) & 0b11)
+				{
+				case 0b00: return entry(CPU::thumbOperation::THUMB_STRH_REG, extractRegOffset, &CPU::opT_STRH_REG);
+				case 0b10: return entry(CPU::thumbOperation::THUMB_LDRH_REG, extractRegOffset, &CPU::opT_LDRH_REG);
+				case 0b01: return entry(CPU::thumbOperation::THUMB_LDRSB_REG, extractRegOffset, &CPU::opT_LDRSB_REG);
+				default:   return entry(CPU::thumbOperation::THUMB_LDRSH_REG, extractRegOffset, &CPU::opT_LDRSH_REG);
+				}
 			}
 		}
-		else if (((instr >> 12) & 0b1) == 1 && ((instr >> 9) & 0b1) == 1) // load store w sign-extended byte / halfwor
+		case(0b011): // Load/store with immediate offset
 		{
-			decodedInstr.rd = (instr) & 0b111;
-			decodedInstr.rs = (instr >> 3) & 0b111; // where rs is used instead or rb for rbase
-			decodedInstr.rn = (instr >> 6) & 0b111; // where rn is used instad or r0
-
-			switch ((instr >> 10) & 0b11)
+			switch ((instr >> 11) & 0b11)
 			{
-			case 0b00: decodedInstr.type = thumbOperation::THUMB_STRH_REG; break;
-			case 0b10: decodedInstr.type = thumbOperation::THUMB_LDRH_REG; break;
-			case 0b01: decodedInstr.type = thumbOperation::THUMB_LDRSB_REG; break;
-			case 0b11: decodedInstr.type = thumbOperation::THUMB_LDRSH_REG; break;
+			case 0b00: return entry(CPU::thumbOperation::THUMB_STR_IMM, extractImmOffsetWord, &CPU::opT_STR_IMM);
+			case 0b01: return entry(CPU::thumbOperation::THUMB_LDR_IMM, extractImmOffsetWord, &CPU::opT_LDR_IMM);
+			case 0b10: return entry(CPU::thumbOperation::THUMB_STRB_IMM, extractImmOffsetByte, &CPU::opT_STRB_IMM);
+			default:   return entry(CPU::thumbOperation::THUMB_LDRB_IMM, extractImmOffsetByte, &CPU::opT_LDRB_IMM);
 			}
 		}
-	}break;
-	case(0b011): // Load/store with immediate offset
-	{
-		decodedInstr.rd = (instr) & 0b111;
-		decodedInstr.rs = (instr >> 3) & 0b111; // where rs is used instead or rb for rbase
-		decodedInstr.imm = (instr >> 6) & 0b11111;
-
-		switch ((instr >> 11) & 0b11)
-		{
-		case 0b00: decodedInstr.type = thumbOperation::THUMB_STR_IMM; decodedInstr.imm = decodedInstr.imm << 2; break;
-		case 0b01: decodedInstr.type = thumbOperation::THUMB_LDR_IMM; decodedInstr.imm = decodedInstr.imm << 2; break;
-		case 0b10: decodedInstr.type = thumbOperation::THUMB_STRB_IMM; break;
-		case 0b11: decodedInstr.type = thumbOperation::THUMB_LDRB_IMM; break;
-		}
-	}break;
-	case(0b100): //(Load/store halfword) or (SP-relative load/store)
-	{
-		if (((instr >> 12) & 0b1) == 0b0) //Load / store halfword
+		case(0b100): //(Load/store halfword) or (SP-relative load/store)
 		{
-			decodedInstr.rd = (instr) & 0b111;
-			decodedInstr.rs = (instr >> 3) & 0b111; // where rs is used instead or rb for rbase
-			decodedInstr.imm = ((instr >> 6) & 0b11111) << 1;
-
-			switch ((instr >> 11) & 0b1)
+			if (((instr >> 12) & 0b1) == 0b0) //Load / store halfword
 			{
-			case 0b0: decodedInstr.type = thumbOperation::THUMB_STRH_IMM; break;
-			case 0b1: decodedInstr.type = thumbOperation::THUMB_LDRH_IMM; break;
+				if ((instr >> 11) & 0b1) return entry(CPU::thumbOperation::THUMB_LDRH_IMM, extractImmOffsetHalf, &CPU::opT_LDRH_IMM);
+				return entry(CPU::thumbOperation::THUMB_STRH_IMM, extractImmOffsetHalf, &CPU::opT_STRH_IMM);
 			}
+
+			if ((instr >> 11) & 0b1) return entry(CPU::thumbOperation::THUMB_LDR_SP, extractSPRelative, &CPU::opT_LDR_SP);
+			return entry(CPU::thumbOperation::THUMB_STR_SP, extractSPRelative, &CPU::opT_STR_SP);
 		}
-		else // (SP-relative load/store)
+		case(0b101): // (load addr) or (add ofs to sp) or (push/pop reg)
 		{
-			decodedInstr.imm = (instr & 0xFF) << 2;
-			decodedInstr.rd = (instr >> 8) & 0b111;
-			decodedInstr.rs = 13;
-
-			switch ((instr >> 11) & 0b1)
+			if (((instr >> 12) & 0b1) == 0b0) // Load Adress
 			{
-			case 0b0: decodedInstr.type = thumbOperation::THUMB_STR_SP; break;
-			case 0b1: decodedInstr.type = thumbOperation::THUMB_LDR_SP; break;
+				if ((instr >> 11) & 0b1) return entry(CPU::thumbOperation::THUMB_ADD_SP, extractLoadAddress, &CPU::opT_ADD_SP);
+				return entry(CPU::thumbOperation::THUMB_ADD_PC, extractLoadAddress, &CPU::opT_ADD_PC);
 			}
-		}
 
-	}break;
-	case(0b101): // (load addr) or (add ofs to sp) or (push/pop reg)
-	{
-		if (((instr >> 12) & 0b1) == 0b0) // Load Adress
-		{
-			decodedInstr.imm = (instr & 0xFF) << 2;
-			decodedInstr.rd = (instr >> 8) & 0b111;
-
-			switch ((instr >> 11) & 0b1)
+			if (((instr >> 8) & 0b11111) == 0b10000) //  (add ofs to sp)
 			{
-			case 0b0: decodedInstr.type = thumbOperation::THUMB_ADD_PC; break;
-			case 0b1: decodedInstr.type = thumbOperation::THUMB_ADD_SP; break;
+				return entry(CPU::thumbOperation::THUMB_ADD_SP_IMM, extractAddSPImm, &CPU::opT_ADD_SP_IMM);
 			}
-		}
-		else if (((instr >> 8) & 0b11111) == 0b10000) //  (add ofs to sp)
-		{
-			decodedInstr.imm = (instr & 0b1111111) << 2;
 
-			if ((instr >> 7) & 0b1) decodedInstr.imm = -(int32_t)decodedInstr.imm;
-			decodedInstr.type = thumbOperation::THUMB_ADD_SP_IMM;
+			//  (push/pop reg)
+			if ((instr >> 11) & 0b1) return entry(CPU::thumbOperation::THUMB_POP, extractPop, &CPU::opT_POP);
+			return entry(CPU::thumbOperation::THUMB_PUSH, extractPush, &CPU::opT_PUSH);
 		}
-		else //  (push/pop reg)
+		case(0b110): // (multi reg load/store) , (cond branch) , (SWI)
 		{
-			decodedInstr.imm = (instr & 0xFF);
-			bool rBit = ((instr >> 8) & 0b1);
-			bool lBit = ((instr >> 11) & 0b1);
-
-			if (!lBit) // push
+			if (((instr >> 12) & 0b1) == 0b0) //(multi reg load/store)
 			{
-				if (rBit) decodedInstr.imm |= (1 << 14);  // include lr
-				decodedInstr.type = thumbOperation::THUMB_PUSH;
+				if ((instr >> 11) & 0b1) return entry(CPU::thumbOperation::THUMB_LDMIA, extractMultiple, &CPU::opT_LDMIA);
+				return entry(CPU::thumbOperation::THUMB_STMIA, extractMultiple, &CPU::opT_STMIA);
 			}
-			else // pop
+
+			if (((instr >> 8) & 0b11111) != 0b11111) //  conditional branch (done by making sure it isnt SWI first)
 			{
-				if (rBit) decodedInstr.imm |= (1 << 15);  // include pc
-				decodedInstr.type = thumbOperation::THUMB_POP;
+				return entry(CPU::thumbOperation::THUMB_B_COND, extractCondBranch, &CPU::opT_B_COND);
 			}
+
+			return entry(CPU::thumbOperation::THUMB_SWI, extractSWI, &CPU::opT_SWI);
 		}
-	}break;
-	case(0b110): // (multi reg load/store) , (cond branch) , (SWI)
-	{
-		if (((instr >> 12) & 0b1) == 0b0) //(multi reg load/store)
+		default: // (uncond branch) or (long branch w/link)
 		{
-			decodedInstr.imm = (instr & 0xFF);
-			decodedInstr.rs = ((instr >> 8) & 0b111);//rs is always a sub for rb
-			switch (((instr >> 11) & 0b1))
+			if (((instr >> 12) & 0b1) == 0b0) // (uncond branch)
 			{
-			case(0b0):decodedInstr.type = thumbOperation::THUMB_STMIA;break;
-			case(0b1):decodedInstr.type = thumbOperation::THUMB_LDMIA;break;
+				return entry(CPU::thumbOperation::THUMB_B, extractBranch, &CPU::opT_B);
 			}
-		}
-		else if (((instr >> 8) & 0b11111) != 0b11111) //  conditional branch (done by making sure it isnt SWI first)
-		{
-			decodedInstr.cond = (instr >> 8) & 0b1111;
-			int8_t offset8 = (instr & 0xFF);
-			decodedInstr.imm = (int32_t)offset8 << 1;
 
-			decodedInstr.type = thumbOperation::THUMB_B_COND;
+			if ((instr >> 11) & 0b1) return entry(CPU::thumbOperation::THUMB_BL_SUFFIX, extractBLSuffix, &CPU::opT_BL_SUFFIX);
+			return entry(CPU::thumbOperation::THUMB_BL_PREFIX, extractBLPrefix, &CPU::opT_BL_PREFIX);
 		}
-		else // SWI
-		{
-			decodedInstr.imm = instr & 0xFF;
-			decodedInstr.type = thumbOperation::THUMB_SWI;
 		}
-	}break;
-	case(0b111): // (uncond branch) or (long branch w/link)
+	}
+
+	constexpr std::array<CPU::thumbDecodeEntry, 1024> buildTable()
 	{
-		if (((instr >> 12) & 0b1) == 0b0) // (uncond branch)
-		{
-			int16_t offset11 = (instr & 0x7FF);
-			if (offset11 & 0x400) offset11 |= 0xF800;
-			decodedInstr.imm = (int32_t)offset11 << 1;
+		std::array<CPU::thumbDecodeEntry, 1024> table = {};
 
-			decodedInstr.type = thumbOperation::THUMB_B;
-		}
-		else // (long branch w/link)
+		for (int i = 0; i < 1024; i++)
 		{
-			decodedInstr.imm = (instr & 0x7FF);
-			if (!((instr >> 11) & 0b1))
-			{
-				int32_t offset11 = (instr & 0x7FF); 
-				if (offset11 & 0x400) offset11 |= 0xFFFFF800; 
-				decodedInstr.imm = offset11 << 12;
-
-				decodedInstr.type = thumbOperation::THUMB_BL_PREFIX;
-			}
-			else
-			{
-				decodedInstr.imm = decodedInstr.imm << 1;
-				decodedInstr.type = thumbOperation::THUMB_BL_SUFFIX;
-			}
+			table[i] = classify(i);
 		}
 
-	}break;
+		return table;
 	}
 
-	return decodedInstr;
+	constexpr std::array<CPU::thumbDecodeEntry, 1024> table = buildTable(); // built at compile time
 }
 
-CPU::armInstr CPU::decodeArm(uint32_t instr) // this returns a thumbInstr struct
+const CPU::thumbDecodeEntry& CPU::thumbLookup(uint16_t instr)
 {
-	armInstr decodedInstr = {}; // creates empty struct for us to fill
-	decodedInstr.type = armOperation::ARM_UNDEFINED;
+	return ThumbDecode::table[instr >> 6];
+}
 
-	decodedInstr.cond = (instr >> 28) & 0xF;
+CPU::thumbInstr CPU::decodeThumb(uint16_t instr)
+{
+	return decodeThumb(instr, thumbLookup(instr));
+}
 
-	switch ((instr >> 25) & 0x7)
-	{
-	case 0b000:  // Data processing, multiply, misc
+CPU::thumbInstr CPU::decodeThumb(uint16_t instr, const thumbDecodeEntry& entry)
+{
+	thumbInstr decodedInstr = {}; // creates empty struct for us to fill
+	decodedInstr.type = entry.type;
+
+	entry.extract(decodedInstr, instr);
+
+	return decodedInstr;
+}
+
+/////////////////////////////////////////////
+///              ARM DECODE               ///
+/////////////////////////////////////////////
+// every arm opcode is sorted by bits 27-20 and 7-4, so those 12 bits index a 4096 entry table.
+// each entry holds the operation, the format of its operand fields and the handler, so decoding
+// is one lookup + a few shifts instead of walking the mask/compare chain
+
+namespace ArmDecode
+{
+	// 8 bit immediate rotated right by twice bits 11-8, done once here instead of in every handler
+	inline uint32_t rotatedImmediate(uint32_t instr)
 	{
-		// Branch and Exchange: xxxx 0001 0010 1111 1111 1111 0001 xxxx
-		if ((instr & 0x0FFFFFF0) == 0x012FFF10)
-		{
-			decodedInstr.type = armOperation::ARM_BX;
-			decodedInstr.rm = instr & 0xF;
-			return decodedInstr;
-		}
+		uint32_t imm = instr & 0xFF;
+		uint32_t rotation = ((instr >> 8) & 0xF) * 2;
+		return rotation ? (imm >> rotation) | (imm << (32 - rotation)) : imm;
+	}
 
-		// Swap: xxxx 0001 0B00 nnnn dddd 0000 1001 mmmm
-		if ((instr & 0x0FB00FF0) == 0x01000090)
-		{
-			decodedInstr.type = armOperation::ARM_SWP;
-			decodedInstr.B = (instr >> 22) & 1;
-			decodedInstr.rn = (instr >> 16) & 0xF;
-			decodedInstr.rd = (instr >> 12) & 0xF;
-			decodedInstr.rm = instr & 0xF;
-			return decodedInstr;
-		}
-		// Multiply Long: xxxx 0000 1UAS dddd nnnn ssss 1001 mmmm
-		if ((instr & 0x0F8000F0) == 0x00800090)
-		{
-			uint8_t op = (instr >> 21) & 0x3;
-			switch (op)
-			{
-			case 0b00: decodedInstr.type = armOperation::ARM_UMULL; break;
-			case 0b01: decodedInstr.type = armOperation::ARM_UMLAL; break;
-			case 0b10: decodedInstr.type = armOperation::ARM_SMULL; break;
-			case 0b11: decodedInstr.type = armOperation::ARM_SMLAL; break;
-			}
-			decodedInstr.S = (instr >> 20) & 1;
-			decodedInstr.rd = (instr >> 16) & 0xF;  // RdHi
-			decodedInstr.rn = (instr >> 12) & 0xF;  // RdLo
-			decodedInstr.rs = (instr >> 8) & 0xF;
-			decodedInstr.rm = instr & 0xF;
-			return decodedInstr;
-		}
-		// Multiply: xxxx 0000 00AS dddd nnnn ssss 1001 mmmm
-		if ((instr & 0x0FC000F0) == 0x00000090)
-		{
-			decodedInstr.type = ((instr >> 21) & 1) ? armOperation::ARM_MLA : armOperation::ARM_MUL;
-			decodedInstr.S = (instr >> 20) & 1;
-			decodedInstr.rd = (instr >> 16) & 0xF;
-			decodedInstr.rn = (instr >> 12) & 0xF;  // Accumulate register for MLA
-			decodedInstr.rs = (instr >> 8) & 0xF;
-			decodedInstr.rm = instr & 0xF;
-			return decodedInstr;
-		}
-		// Halfword Transfer: xxxx 000P U0WL nnnn dddd oooo 1SH1 mmmm
-		if ((instr & 0x0E000090) == 0x00000090)
-		{
-			uint8_t SH = (instr >> 5) & 0x3;
-			decodedInstr.L = (instr >> 20) & 1;
+	inline void extractBX(CPU::armInstr& decodedInstr, uint32_t instr)
+	{
+		decodedInstr.rm = instr & 0xF;
+	}
 
-			if (decodedInstr.L) 
-			{
-				if (SH == 0b01) decodedInstr.type = armOperation::ARM_LDRH;
-				else if (SH == 0b10) decodedInstr.type = armOperation::ARM_LDRSB;
-				else if (SH == 0b11) decodedInstr.type = armOperation::ARM_LDRSH;
-				else decodedInstr.type = armOperation::ARM_UNDEFINED;
-			}
-			else  
-			{
-				if (SH == 0b01) decodedInstr.type = armOperation::ARM_STRH;
-				else decodedInstr.type = armOperation::ARM_UNDEFINED;
-			}
+	// Swap: xxxx 0001 0B00 nnnn dddd 0000 1001 mmmm
+	inline void extractSWP(CPU::armInstr& decodedInstr, uint32_t instr)
+	{
+		decodedInstr.B = (instr >> 22) & 1;
+		decodedInstr.rn = (instr >> 16) & 0xF;
+		decodedInstr.rd = (instr >> 12) & 0xF;
+		decodedInstr.rm = instr & 0xF;
+	}
 
-			decodedInstr.P = (instr >> 24) & 1;
-			decodedInstr.U = (instr >> 23) & 1;
-			decodedInstr.W = (instr >> 21) & 1;
-			decodedInstr.rn = (instr >> 16) & 0xF;
-			decodedInstr.rd = (instr >> 12) & 0xF;
-			decodedInstr.rm = instr & 0xF;
+	// Multiply:      xxxx 0000 00AS dddd nnnn ssss 1001 mmmm
+	// Multiply Long: xxxx 0000 1UAS dddd nnnn ssss 1001 mmmm
+	inline void extractMultiply(CPU::armInstr& decodedInstr, uint32_t instr)
+	{
+		decodedInstr.S = (instr >> 20) & 1;
+		decodedInstr.rd = (instr >> 16) & 0xF;  // RdHi for long
+		decodedInstr.rn = (instr >> 12) & 0xF;  // Accumulate register for MLA, RdLo for long
+		decodedInstr.rs = (instr >> 8) & 0xF;
+		decodedInstr.rm = instr & 0xF;
+	}
 
-			if ((instr >> 22) & 1)  // Immed
-			{
-				decodedInstr.imm = ((instr >> 4) & 0xF0) | (instr & 0xF);
-				decodedInstr.I = true;
-			}
-			else  // Reg offset
-			{
-				decodedInstr.I = false;
-			}
+	// Halfword Transfer: xxxx 000P U0WL nnnn dddd oooo 1SH1 mmmm
+	inline void extractHalfword(CPU::armInstr& decodedInstr, uint32_t instr)
+	{
+		decodedInstr.L = (instr >> 20) & 1;
+		decodedInstr.P = (instr >> 24) & 1;
+		decodedInstr.U = (instr >> 23) & 1;
+		decodedInstr.W = (instr >> 21) & 1;
+		decodedInstr.rn = (instr >> 16) & 0xF;
+		decodedInstr.rd = (instr >> 12) & 0xF;
+		decodedInstr.rm = instr & 0xF;
 
-			return decodedInstr;
+		if ((instr >> 22) & 1)  // Immed, kept signed so the handlers just add it
+		{
+			uint32_t offset = ((instr >> 4) & 0xF0) | (instr & 0xF);
+			decodedInstr.imm = decodedInstr.U ? offset : 0u - offset;
+			decodedInstr.I = true;
 		}
+	}
+
+	// MRS: xxxx 0001 0R00 1111 dddd 0000 0000 0000
+	inline void extractMRS(CPU::armInstr& decodedInstr, uint32_t instr)
+	{
+		decodedInstr.rd = (instr >> 12) & 0xF;
+		decodedInstr.B = (instr >> 22) & 1;  // Use B flag to indicate SPSR vs CPSR
+	}
 
-		// MRS: xxxx 0001 0R00 1111 dddd 0000 0000 0000
-		if ((instr & 0x0FBF0FFF) == 0x010F0000)
+	// MSR: xxxx 0001 0R10 1001 1111 0000 0000 mmmm (register)
+	//      xxxx 0011 0R10 1000 1111 rrrr iiii iiii (immediate)
+	inline void extractMSR(CPU::armInstr& decodedInstr, uint32_t instr)
+	{
+		decodedInstr.B = (instr >> 22) & 1;  // SPSR vs CPSR
+		if ((instr >> 25) & 1)  // Immediate
 		{
-			decodedInstr.type = armOperation::ARM_MRS;
-			decodedInstr.rd = (instr >> 12) & 0xF;
-			decodedInstr.B = (instr >> 22) & 1;  // Use B flag to indicate SPSR vs CPSR
-			return decodedInstr;
+			decodedInstr.I = true;
+			decodedInstr.rotate = (instr >> 8) & 0xF;
+			decodedInstr.imm = rotatedImmediate(instr);
 		}
-
-		// MSR: xxxx 0001 0R10 1001 1111 0000 0000 mmmm (register)
-		//      xxxx 0011 0R10 1000 1111 rrrr iiii iiii (immediate)
-		if ((instr & 0x0FB0FFF0) == 0x0120F000 || (instr & 0x0FB0F000) == 0x0320F000)
+		else
 		{
-			decodedInstr.type = armOperation::ARM_MSR;
-			decodedInstr.B = (instr >> 22) & 1;  // SPSR vs CPSR
-			if ((instr >> 25) & 1)  // Immediate
-			{
-				decodedInstr.I = true;
-				decodedInstr.imm = instr & 0xFF;
-				decodedInstr.rotate = (instr >> 8) & 0xF;
-			}
-			else 
-			{
-				decodedInstr.I = false;
-				decodedInstr.rm = instr & 0xF;
-			}
-			return decodedInstr;
+			decodedInstr.rm = instr & 0xF;
 		}
+	}
 
-		// Data Processing: xxxx 000a aaaa Snnn nddd diii iiii iiii (register)
-		//                  xxxx 001a aaaa Snnn nddd drrrr iiii iiii (immediate)
+	// Data Processing: xxxx 000a aaaa Snnn nddd diii iiii iiii (register)
+	//                  xxxx 001a aaaa Snnn nddd drrrr iiii iiii (immediate)
+	inline void extractDataProcessing(CPU::armInstr& decodedInstr, uint32_t instr)
+	{
 		decodedInstr.S = (instr >> 20) & 1;
 		decodedInstr.rn = (instr >> 16) & 0xF;
 		decodedInstr.rd = (instr >> 12) & 0xF;
 
-		uint8_t opcode = (instr >> 21) & 0xF;
-		switch (opcode)
-		{
-		case 0x0: decodedInstr.type = armOperation::ARM_AND; break;
-		case 0x1: decodedInstr.type = armOperation::ARM_EOR; break;
-		case 0x2: decodedInstr.type = armOperation::ARM_SUB; break;
-		case 0x3: decodedInstr.type = armOperation::ARM_RSB; break;
-		case 0x4: decodedInstr.type = armOperation::ARM_ADD; break;
-		case 0x5: decodedInstr.type = armOperation::ARM_ADC; break;
-		case 0x6: decodedInstr.type = armOperation::ARM_SBC; break;
-		case 0x7: decodedInstr.type = armOperation::ARM_RSC; break;
-		case 0x8: decodedInstr.type = armOperation::ARM_TST; break;
-		case 0x9: decodedInstr.type = armOperation::ARM_TEQ; break;
-		case 0xA: decodedInstr.type = armOperation::ARM_CMP; break;
-		case 0xB: decodedInstr.type = armOperation::ARM_CMN; break;
-		case 0xC: decodedInstr.type = armOperation::ARM_ORR; break;
-		case 0xD: decodedInstr.type = armOperation::ARM_MOV; break;
-		case 0xE: decodedInstr.type = armOperation::ARM_BIC; break;
-		case 0xF: decodedInstr.type = armOperation::ARM_MVN; break;
-		}
-
 		if ((instr >> 25) & 1)
 		{
 			decodedInstr.I = true;
-			decodedInstr.imm = instr & 0xFF;
 			decodedInstr.rotate = (instr >> 8) & 0xF;
+			decodedInstr.imm = rotatedImmediate(instr);
 		}
 		else
 		{
-			decodedInstr.I = false;
 			decodedInstr.rm = instr & 0xF;
 			decodedInstr.shift_type = (instr >> 5) & 0x3;
 
@@ -2412,69 +2916,15 @@ CPU::armInstr CPU::decodeArm(uint32_t instr) // this returns a thumbInstr struct
 			}
 			else  // Shift by immediate
 			{
-				decodedInstr.shift_by_reg = false;
 				decodedInstr.shift_amount = (instr >> 7) & 0x1F;
 			}
 		}
-
-		return decodedInstr;
-	}
-
-	case 0b001:  
-	{
-		if ((instr & 0x0FBF0FFF) == 0x010F0000)
-		{
-			decodedInstr.type = armOperation::ARM_MRS;
-			decodedInstr.rd = (instr >> 12) & 0xF;
-			decodedInstr.B = (instr >> 22) & 1;
-			return decodedInstr;
-		}
-
-		if ((instr & 0x0FB0F000) == 0x0320F000)
-		{
-			decodedInstr.type = armOperation::ARM_MSR;
-			decodedInstr.B = (instr >> 22) & 1;
-			decodedInstr.I = true;
-			decodedInstr.imm = instr & 0xFF;
-			decodedInstr.rotate = (instr >> 8) & 0xF;
-			return decodedInstr;
-		}
-
-		decodedInstr.I = true;
-		decodedInstr.S = (instr >> 20) & 1;
-		decodedInstr.rn = (instr >> 16) & 0xF;
-		decodedInstr.rd = (instr >> 12) & 0xF;
-		decodedInstr.imm = instr & 0xFF;
-		decodedInstr.rotate = (instr >> 8) & 0xF;
-
-		uint8_t opcode = (instr >> 21) & 0xF;
-		switch (opcode)
-		{
-		case 0x0: decodedInstr.type = armOperation::ARM_AND; break;
-		case 0x1: decodedInstr.type = armOperation::ARM_EOR; break;
-		case 0x2: decodedInstr.type = armOperation::ARM_SUB; break;
-		case 0x3: decodedInstr.type = armOperation::ARM_RSB; break;
-		case 0x4: decodedInstr.type = armOperation::ARM_ADD; break;
-		case 0x5: decodedInstr.type = armOperation::ARM_ADC; break;
-		case 0x6: decodedInstr.type = armOperation::ARM_SBC; break;
-		case 0x7: decodedInstr.type = armOperation::ARM_RSC; break;
-		case 0x8: decodedInstr.type = armOperation::ARM_TST; break;
-		case 0x9: decodedInstr.type = armOperation::ARM_TEQ; break;
-		case 0xA: decodedInstr.type = armOperation::ARM_CMP; break;
-		case 0xB: decodedInstr.type = armOperation::ARM_CMN; break;
-		case 0xC: decodedInstr.type = armOperation::ARM_ORR; break;
-		case 0xD: decodedInstr.type = armOperation::ARM_MOV; break;
-		case 0xE: decodedInstr.type = armOperation::ARM_BIC; break;
-		case 0xF: decodedInstr.type = armOperation::ARM_MVN; break;
-		}
-
-		return decodedInstr;
 	}
 
-	case 0b010:  // Load/Store immediate offset
+	// Load/Store: xxxx 01IP UBWL nnnn dddd oooo oooo oooo
+	inline void extractSingleTransferImm(CPU::armInstr& decodedInstr, uint32_t instr)
 	{
 		decodedInstr.L = (instr >> 20) & 1;
-		decodedInstr.type = decodedInstr.L ? armOperation::ARM_LDR : armOperation::ARM_STR;
 		decodedInstr.I = false;  // Immediate offset
 		decodedInstr.P = (instr >> 24) & 1;
 		decodedInstr.U = (instr >> 23) & 1;
@@ -2483,19 +2933,11 @@ CPU::armInstr CPU::decodeArm(uint32_t instr) // this returns a thumbInstr struct
 		decodedInstr.rn = (instr >> 16) & 0xF;
 		decodedInstr.rd = (instr >> 12) & 0xF;
 		decodedInstr.imm = instr & 0xFFF;
-		return decodedInstr;
 	}
 
-	case 0b011:  // Load/Store register offset
-	{
-		if ((instr >> 4) & 1)
-		{
-			decodedInstr.type = armOperation::ARM_UNDEFINED;
-			return decodedInstr;
-		}
-
+	inline void extractSingleTransferReg(CPU::armInstr& decodedInstr, uint32_t instr)
+	{
 		decodedInstr.L = (instr >> 20) & 1;
-		decodedInstr.type = decodedInstr.L ? armOperation::ARM_LDR : armOperation::ARM_STR;
 		decodedInstr.I = true;  // Register offset
 		decodedInstr.P = (instr >> 24) & 1;
 		decodedInstr.U = (instr >> 23) & 1;
@@ -2506,72 +2948,366 @@ CPU::armInstr CPU::decodeArm(uint32_t instr) // this returns a thumbInstr struct
 		decodedInstr.rm = instr & 0xF;
 		decodedInstr.shift_type = (instr >> 5) & 0x3;
 		decodedInstr.shift_amount = (instr >> 7) & 0x1F;
-		return decodedInstr;
 	}
 
-	case 0b100:  // Load/Store multiple
+	// Load/Store multiple: xxxx 100P USWL nnnn rrrr rrrr rrrr rrrr
+	inline void extractBlockTransfer(CPU::armInstr& decodedInstr, uint32_t instr)
 	{
 		decodedInstr.L = (instr >> 20) & 1;
-		decodedInstr.type = decodedInstr.L ? armOperation::ARM_LDM : armOperation::ARM_STM;
 		decodedInstr.P = (instr >> 24) & 1;
 		decodedInstr.U = (instr >> 23) & 1;
 		decodedInstr.S = (instr >> 22) & 1;  // PSR & force user bit
 		decodedInstr.W = (instr >> 21) & 1;
 		decodedInstr.rn = (instr >> 16) & 0xF;
 		decodedInstr.reg_list = instr & 0xFFFF;
-		return decodedInstr;
 	}
 
-	case 0b101:  // Branch and Branch with Link
+	// Branch: xxxx 101L oooo oooo oooo oooo oooo oooo
+	inline void extractBranch(CPU::armInstr& decodedInstr, uint32_t instr)
 	{
 		decodedInstr.L = (instr >> 24) & 1;
-		decodedInstr.type = decodedInstr.L ? armOperation::ARM_BL : armOperation::ARM_B;
 		int32_t offset = instr & 0xFFFFFF;
 		if (offset & 0x800000)  // Sign bit set
 			offset |= 0xFF000000;
 		decodedInstr.imm = offset << 2;  // Shift left by 2
-		return decodedInstr;
 	}
 
-	case 0b110:  // Coprocessor load/store
+	// Coprocessor load/store: xxxx 110P UNWL nnnn dddd pppp oooo oooo
+	inline void extractCoprocessorTransfer(CPU::armInstr& decodedInstr, uint32_t instr)
 	{
 		decodedInstr.L = (instr >> 20) & 1;
-		decodedInstr.type = decodedInstr.L ? armOperation::ARM_LDC : armOperation::ARM_STC;
 		decodedInstr.P = (instr >> 24) & 1;
 		decodedInstr.U = (instr >> 23) & 1;
 		decodedInstr.W = (instr >> 21) & 1;
 		decodedInstr.rn = (instr >> 16) & 0xF;
 		decodedInstr.rd = (instr >> 12) & 0xF;  // CRd
 		decodedInstr.imm = (instr & 0xFF) << 2;
-		return decodedInstr;
 	}
 
-	case 0b111:  // Coprocessor operations and SWI
+	// Coprocessor register transfer: xxxx 1110 oooL nnnn dddd pppp ooo1 mmmm
+	inline void extractCoprocessorRegister(CPU::armInstr& decodedInstr, uint32_t instr)
+	{
+		decodedInstr.L = (instr >> 20) & 1;
+		decodedInstr.rn = (instr >> 16) & 0xF;  // CRn
+		decodedInstr.rd = (instr >> 12) & 0xF;
+		decodedInstr.rm = instr & 0xF;          // CRm
+	}
+
+	inline void extractSWI(CPU::armInstr& decodedInstr, uint32_t instr)
+	{
+		decodedInstr.imm = instr & 0xFFFFFF;
+	}
+
+	constexpr CPU::armDecodeEntry entry(CPU::armOperation type, CPU::armFormat format, CPU::OpAFunction execute)
+	{
+		return CPU::armDecodeEntry{ type, format, execute };
+	}
+
+	// SPECIALIZED HANDLERS
+	// one instantiation per combination of the bits each family branches on, packed into a key
+
+	constexpr bool bit(size_t key, int n) { return (key >> n) & 1; }
+
+	constexpr CPU::armOperation dataProcessingOps[16] =
+	{
+		CPU::armOperation::ARM_AND, CPU::armOperation::ARM_EOR, CPU::armOperation::ARM_SUB, CPU::armOperation::ARM_RSB,
+		CPU::armOperation::ARM_ADD, CPU::armOperation::ARM_ADC, CPU::armOperation::ARM_SBC, CPU::armOperation::ARM_RSC,
+		CPU::armOperation::ARM_TST, CPU::armOperation::ARM_TEQ, CPU::armOperation::ARM_CMP, CPU::armOperation::ARM_CMN,
+		CPU::armOperation::ARM_ORR, CPU::armOperation::ARM_MOV, CPU::armOperation::ARM_BIC, CPU::armOperation::ARM_MVN,
+	};
+
+	// shift_type plus whether the immediate amount is 0, which turns LSL into no shift, LSR / ASR into
+	// shifts by 32 and ROR into RRX
+	constexpr uint8_t shifterForm(uint8_t shiftType, bool zeroAmount)
+	{
+		return zeroAmount ? CPU::ShiftNone + (shiftType & 0x3) : (shiftType & 0x3);
+	}
+
+	// key = opcode:4 I S shift_by_reg form:3. an immediate only keeps whether it is rotated (ShiftROR
+	// or ShiftNone), a register shift only its type
+	constexpr size_t dataProcessingKey(uint8_t opcode, bool I, bool S, bool shiftByReg, uint8_t form)
+	{
+		return (size_t(opcode) << 6) | (size_t(I) << 5) | (size_t(S) << 4) | (size_t(shiftByReg) << 3) | (form & 0x7);
+	}
+
+	constexpr uint8_t dataProcessingForm(bool I, bool shiftByReg, uint8_t form)
+	{
+		if (I) return form == CPU::ShiftNone ? CPU::ShiftNone : CPU::ShiftROR;
+		return shiftByReg ? (form & 0x3) : form;
+	}
+
+	template <size_t key>
+	constexpr CPU::OpAFunction makeDataProcessingHandler()
+	{
+		constexpr bool immediate = bit(key, 5);
+		constexpr bool shiftByReg = !immediate && bit(key, 3);
+		return &CPU::opA_DataProcessing<dataProcessingOps[key >> 6], immediate, bit(key, 4), shiftByReg, dataProcessingForm(immediate, shiftByReg, key & 0x7)>;
+	}
+
+	// key = L I P U B W form:3, the form is ignored for immediate offsets
+	constexpr size_t singleTransferKey(bool L, bool I, bool P, bool U, bool B, bool W, uint8_t form)
+	{
+		return (size_t(L) << 8) | (size_t(I) << 7) | (size_t(P) << 6) | (size_t(U) << 5) | (size_t(B) << 4) | (size_t(W) << 3) | (form & 0x7);
+	}
+
+	template <size_t key>
+	constexpr CPU::OpAFunction makeSingleTransferHandler()
+	{
+		constexpr bool regOffset = bit(key, 7);
+		constexpr uint8_t form = regOffset ? (key & 0x7) : 0;
+		if constexpr (bit(key, 8)) return &CPU::opA_SingleLoad<regOffset, bit(key, 6), bit(key, 5), bit(key, 4), bit(key, 3), form>;
+		else return &CPU::opA_SingleStore<regOffset, bit(key, 6), bit(key, 5), bit(key, 4), bit(key, 3), form>;
+	}
+
+	// key = L P U S W
+	constexpr size_t blockTransferKey(bool L, bool P, bool U, bool S, bool W)
+	{
+		return (size_t(L) << 4) | (size_t(P) << 3) | (size_t(U) << 2) | (size_t(S) << 1) | size_t(W);
+	}
+
+	template <size_t key>
+	constexpr CPU::OpAFunction makeBlockTransferHandler()
+	{
+		if constexpr (bit(key, 4)) return &CPU::opA_BlockLoad<bit(key, 3), bit(key, 2), bit(key, 1), bit(key, 0)>;
+		else return &CPU::opA_BlockStore<bit(key, 3), bit(key, 2), bit(key, 1), bit(key, 0)>;
+	}
+
+	template <size_t... keys>
+	constexpr std::array<CPU::OpAFunction, sizeof...(keys)> buildDataProcessingHandlers(std::index_sequence<keys...>) { return { makeDataProcessingHandler<keys>()... }; }
+	template <size_t... keys>
+	constexpr std::array<CPU::OpAFunction, sizeof...(keys)> buildSingleTransferHandlers(std::index_sequence<keys...>) { return { makeSingleTransferHandler<keys>()... }; }
+	template <size_t... keys>
+	constexpr std::array<CPU::OpAFunction, sizeof...(keys)> buildBlockTransferHandlers(std::index_sequence<keys...>) { return { makeBlockTransferHandler<keys>()... }; }
+
+	constexpr std::array<CPU::OpAFunction, 1024> dataProcessingHandlers = buildDataProcessingHandlers(std::make_index_sequence<1024>());
+	constexpr std::array<CPU::OpAFunction, 512> singleTransferHandlers = buildSingleTransferHandlers(std::make_index_sequence<512>());
+	constexpr std::array<CPU::OpAFunction, 32> blockTransferHandlers = buildBlockTransferHandlers(std::make_index_sequence<32>());
+
+	constexpr CPU::armDecodeEntry dataProcessingEntry(uint8_t hi, uint8_t lo, bool zeroAmount)
+	{
+		uint8_t opcode = (hi >> 1) & 0xF;
+		bool I = (hi >> 5) & 1, shiftByReg = !I && (lo & 1);
+		uint8_t form = I ? (zeroAmount ? CPU::ShiftNone : CPU::ShiftROR) : shiftByReg ? (lo >> 1) & 0x3 : shifterForm(lo >> 1, zeroAmount);
+		size_t key = dataProcessingKey(opcode, I, hi & 1, shiftByReg, form);
+		return entry(dataProcessingOps[opcode], CPU::armFormat::DataProcessing, dataProcessingHandlers[key]);
+	}
+
+	constexpr CPU::armDecodeEntry singleTransferEntry(uint8_t hi, uint8_t lo, bool zeroAmount)
+	{
+		bool I = (hi >> 5) & 1;
+		size_t key = singleTransferKey(hi & 1, I, (hi >> 4) & 1, (hi >> 3) & 1, (hi >> 2) & 1, (hi >> 1) & 1, I ? shifterForm(lo >> 1, zeroAmount) : 0);
+		return entry((hi & 1) ? CPU::armOperation::ARM_LDR : CPU::armOperation::ARM_STR,
+			I ? CPU::armFormat::SingleTransferReg : CPU::armFormat::SingleTransferImm, singleTransferHandlers[key]);
+	}
+
+	constexpr CPU::armDecodeEntry blockTransferEntry(uint8_t hi)
 	{
-		if ((instr >> 24) & 1)  // SWI
+		size_t key = blockTransferKey(hi & 1, (hi >> 4) & 1, (hi >> 3) & 1, (hi >> 2) & 1, (hi >> 1) & 1);
+		return entry((hi & 1) ? CPU::armOperation::ARM_LDM : CPU::armOperation::ARM_STM, CPU::armFormat::BlockTransfer, blockTransferHandlers[key]);
+	}
+
+	// hi = bits 27-20, lo = bits 7-4, zeroAmount = the shift amount (bits 11-7) or, for an immediate
+	// operand 2, the rotation (bits 11-8) is 0. only data processing and single transfers look at it
+	constexpr CPU::armDecodeEntry classify(uint8_t hi, uint8_t lo, bool zeroAmount)
+	{
+		const CPU::armDecodeEntry undefined = entry(CPU::armOperation::ARM_UNDEFINED, CPU::armFormat::None, &CPU::opA_UNDEFINED);
+
+		switch (hi >> 5)
+		{
+		case 0b000:  // Data processing, multiply, misc
+		{
+			if (hi == 0x12 && lo == 0x1) return entry(CPU::armOperation::ARM_BX, CPU::armFormat::BX, &CPU::opA_BX);
+
+			if (lo == 0x9)
+			{
+				if ((hi & 0xFB) == 0x10) return entry(CPU::armOperation::ARM_SWP, CPU::armFormat::SWP, &CPU::opA_SWP);
+
+				if ((hi & 0xF8) == 0x08)
+				{
+					switch ((hi >> 1) & 0x3)
+					{
+					case 0b00: return entry(CPU::armOperation::ARM_UMULL, CPU::armFormat::Multiply, &CPU::opA_UMULL);
+					case 0b01: return entry(CPU::armOperation::ARM_UMLAL, CPU::armFormat::Multiply, &CPU::opA_UMLAL);
+					case 0b10: return entry(CPU::armOperation::ARM_SMULL, CPU::armFormat::Multiply, &CPU::opA_SMULL);
+					default:   return entry(CPU::armOperation::ARM_SMLAL, CPU::armFormat::Multiply, &CPU::opA_SMLAL);
+					}
+				}
+
+				if ((hi & 0xFC) == 0x00)
+				{
+					if ((hi >> 1) & 1) return entry(CPU::armOperation::ARM_MLA, CPU::armFormat::Multiply, &CPU::opA_MLA);
+					return entry(CPU::armOperation::ARM_MUL, CPU::armFormat::Multiply, &CPU::opA_MUL);
+				}
+			}
+
+			if ((lo & 0x9) == 0x9)  // 1SH1, anything left here is a halfword transfer
+			{
+				uint8_t SH = (lo >> 1) & 0x3;
+				CPU::armOperation type = CPU::armOperation::ARM_UNDEFINED;
+
+				if (hi & 1)
+				{
+					if (SH == 0b01) type = CPU::armOperation::ARM_LDRH;
+					else if (SH == 0b10) type = CPU::armOperation::ARM_LDRSB;
+					else if (SH == 0b11) type = CPU::armOperation::ARM_LDRSH;
+				}
+				else if (SH == 0b01) type = CPU::armOperation::ARM_STRH;
+
+				switch (type)
+				{
+				case CPU::armOperation::ARM_LDRH:  return entry(type, CPU::armFormat::Halfword, &CPU::opA_LDRH);
+				case CPU::armOperation::ARM_LDRSB: return entry(type, CPU::armFormat::Halfword, &CPU::opA_LDRSB);
+				case CPU::armOperation::ARM_LDRSH: return entry(type, CPU::armFormat::Halfword, &CPU::opA_LDRSH);
+				case CPU::armOperation::ARM_STRH:  return entry(type, CPU::armFormat::Halfword, &CPU::opA_STRH);
+				default:                           return entry(type, CPU::armFormat::Halfword, &CPU::opA_UNDEFINED);
+				}
+			}
+
+			if ((hi & 0xFB) == 0x10 && lo == 0x0) return entry(CPU::armOperation::ARM_MRS, CPU::armFormat::MRS, &CPU::opA_MRS);
+			if ((hi & 0xFB) == 0x12 && lo == 0x0) return entry(CPU::armOperation::ARM_MSR, CPU::armFormat::MSR, &CPU::opA_MSR);
+
+			return dataProcessingEntry(hi, lo, zeroAmount);
+		}
+
+		case 0b001:  // Data processing immediate, MSR immediate
+		{
+			if ((hi & 0xFB) == 0x32) return entry(CPU::armOperation::ARM_MSR, CPU::armFormat::MSR, &CPU::opA_MSR);
+
+			return dataProcessingEntry(hi, lo, zeroAmount);
+		}
+
+		case 0b010:  // Load/Store immediate offset
+		{
+			return singleTransferEntry(hi, lo, zeroAmount);
+		}
+
+		case 0b011:  // Load/Store register offset
+		{
+			if (lo & 1) return undefined;
+
+			return singleTransferEntry(hi, lo, zeroAmount);
+		}
+
+		case 0b100:  // Load/Store multiple
+		{
+			return blockTransferEntry(hi);
+		}
+
+		case 0b101:  // Branch and Branch with Link
 		{
-			decodedInstr.type = armOperation::ARM_SWI;
-			decodedInstr.imm = instr & 0xFFFFFF;
-			return decodedInstr;
+			if ((hi >> 4) & 1) return entry(CPU::armOperation::ARM_BL, CPU::armFormat::Branch, &CPU::opA_BL);
+			return entry(CPU::armOperation::ARM_B, CPU::armFormat::Branch, &CPU::opA_B);
 		}
-		else if ((instr >> 4) & 1)  // Coprocessor register transfer
+
+		case 0b110:  // Coprocessor load/store
+		{
+			if (hi & 1) return entry(CPU::armOperation::ARM_LDC, CPU::armFormat::CoprocessorTransfer, &CPU::opA_LDC);
+			return entry(CPU::armOperation::ARM_STC, CPU::armFormat::CoprocessorTransfer, &CPU::opA_STC);
+		}
+
+		default:  // Coprocessor operations and SWI
 		{
-			decodedInstr.L = (instr >> 20) & 1;
-			decodedInstr.type = decodedInstr.L ? armOperation::ARM_MRC : armOperation::ARM_MCR;
-			decodedInstr.rn = (instr >> 16) & 0xF;  // CRn
-			decodedInstr.rd = (instr >> 12) & 0xF;
-			decodedInstr.rm = instr & 0xF;          // CRm
-			return decodedInstr;
+			if ((hi >> 4) & 1) return entry(CPU::armOperation::ARM_SWI, CPU::armFormat::SWI, &CPU::opA_SWI);
+
+			if (lo & 1)  // Coprocessor register transfer
+			{
+				if (hi & 1) return entry(CPU::armOperation::ARM_MRC, CPU::armFormat::CoprocessorRegister, &CPU::opA_MRC);
+				return entry(CPU::armOperation::ARM_MCR, CPU::armFormat::CoprocessorRegister, &CPU::opA_MCR);
+			}
+
+			return entry(CPU::armOperation::ARM_CDP, CPU::armFormat::None, &CPU::opA_CDP);
 		}
-		else  // Coprocessor data operation
+		}
+	}
+
+	constexpr std::array<CPU::armDecodeEntry, 8192> buildTable()
+	{
+		std::array<CPU::armDecodeEntry, 8192> table = {};
+
+		for (int i = 0; i < 8192; i++)
 		{
-			decodedInstr.type = armOperation::ARM_CDP;
-			return decodedInstr;
+			table[i] = classify((i >> 4) & 0xFF, i & 0xF, (i >> 12) & 1);
 		}
+
+		return table;
+	}
+
+	constexpr std::array<CPU::armDecodeEntry, 8192> table = buildTable(); // built at compile time
+
+	// same resolution for an already decoded instr
+	inline uint8_t dataProcessingForm(const CPU::armInstr& instr)
+	{
+		if (instr.I) return instr.rotate ? CPU::ShiftROR : CPU::ShiftNone;
+		return instr.shift_by_reg ? instr.shift_type : shifterForm(instr.shift_type, instr.shift_amount == 0);
+	}
+
+	inline uint8_t singleTransferForm(const CPU::armInstr& instr)
+	{
+		return instr.I ? shifterForm(instr.shift_type, instr.shift_amount == 0) : 0;
 	}
+}
+
+const CPU::armDecodeEntry& CPU::armLookup(uint32_t instr)
+{
+	uint32_t amount = ((instr >> 25) & 0x7) == 0b001 ? instr & 0xF00 : instr & 0xF80;
+	return ArmDecode::table[(uint32_t(amount == 0) << 12) | ((instr >> 16) & 0xFF0) | ((instr >> 4) & 0xF)];
+}
+
+// entry points for an already decoded instr (armExecute), these pick the specialization at runtime
+
+inline int CPU::opA_AND(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0x0, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_EOR(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0x1, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_SUB(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0x2, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_RSB(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0x3, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_ADD(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0x4, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_ADC(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0x5, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_SBC(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0x6, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_RSC(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0x7, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_TST(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0x8, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_TEQ(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0x9, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_CMP(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0xA, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_CMN(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0xB, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_ORR(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0xC, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_MOV(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0xD, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_BIC(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0xE, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+inline int CPU::opA_MVN(const armInstr& instr) { return (this->*ArmDecode::dataProcessingHandlers[ArmDecode::dataProcessingKey(0xF, instr.I, instr.S, instr.shift_by_reg, ArmDecode::dataProcessingForm(instr))])(instr); }
+
+inline int CPU::opA_LDR(const armInstr& instr) { return (this->*ArmDecode::singleTransferHandlers[ArmDecode::singleTransferKey(true, instr.I, instr.P, instr.U, instr.B, instr.W, ArmDecode::singleTransferForm(instr))])(instr); }
+inline int CPU::opA_STR(const armInstr& instr) { return (this->*ArmDecode::singleTransferHandlers[ArmDecode::singleTransferKey(false, instr.I, instr.P, instr.U, instr.B, instr.W, ArmDecode::singleTransferForm(instr))])(instr); }
+
+inline int CPU::opA_LDM(const armInstr& instr) { return (this->*ArmDecode::blockTransferHandlers[ArmDecode::blockTransferKey(true, instr.P, instr.U, instr.S, instr.W)])(instr); }
+inline int CPU::opA_STM(const armInstr& instr) { return (this->*ArmDecode::blockTransferHandlers[ArmDecode::blockTransferKey(false, instr.P, instr.U, instr.S, instr.W)])(instr); }
+
+CPU::armInstr CPU::decodeArm(uint32_t instr)
+{
+	return decodeArm(instr, armLookup(instr));
+}
+
+CPU::armInstr CPU::decodeArm(uint32_t instr, const armDecodeEntry& entry)
+{
+	armInstr decodedInstr = {}; // creates empty struct for us to fill
+	decodedInstr.type = entry.type;
+	decodedInstr.cond = (instr >> 28) & 0xF;
+
+	switch (entry.format)
+	{
+	case armFormat::None:                break;
+	case armFormat::BX:                  ArmDecode::extractBX(decodedInstr, instr); break;
+	case armFormat::SWP:                 ArmDecode::extractSWP(decodedInstr, instr); break;
+	case armFormat::Multiply:            ArmDecode::extractMultiply(decodedInstr, instr); break;
+	case armFormat::Halfword:            ArmDecode::extractHalfword(decodedInstr, instr); break;
+	case armFormat::MRS:                 ArmDecode::extractMRS(decodedInstr, instr); break;
+	case armFormat::MSR:                 ArmDecode::extractMSR(decodedInstr, instr); break;
+	case armFormat::DataProcessing:      ArmDecode::extractDataProcessing(decodedInstr, instr); break;
+	case armFormat::SingleTransferImm:   ArmDecode::extractSingleTransferImm(decodedInstr, instr); break;
+	case armFormat::SingleTransferReg:   ArmDecode::extractSingleTransferReg(decodedInstr, instr); break;
+	case armFormat::BlockTransfer:       ArmDecode::extractBlockTransfer(decodedInstr, instr); break;
+	case armFormat::Branch:              ArmDecode::extractBranch(decodedInstr, instr); break;
+	case armFormat::CoprocessorTransfer: ArmDecode::extractCoprocessorTransfer(decodedInstr, instr); break;
+	case armFormat::CoprocessorRegister: ArmDecode::extractCoprocessorRegister(decodedInstr, instr); break;
+	case armFormat::SWI:                 ArmDecode::extractSWI(decodedInstr, instr); break;
 	}
 
-	decodedInstr.type = armOperation::ARM_UNDEFINED;
 	return decodedInstr;
 }
 
@@ -2583,6 +3319,7 @@ CPU::armInstr CPU::decodeArm(uint32_t instr) // this returns a thumbInstr struct
 
 inline void CPU::updateFlagsNZCV_Add(uint32_t result, uint32_t op1, uint32_t op2)
 {
+	if (lazyFlags) { deferFlags(flagOp::Add, result, op1, op2); return; }
 	N = (result >> 31) & 0x1;
 	Z = result == 0;
 	C = result < op1;
@@ -2592,6 +3329,7 @@ inline void CPU::updateFlagsNZCV_Add(uint32_t result, uint32_t op1, uint32_t op2
 
 inline void CPU::updateFlagsNZCV_Sub(uint32_t result, uint32_t op1, uint32_t op2)
 {
+	if (lazyFlags) { deferFlags(flagOp::Sub, result, op1, op2); return; }
 	N = (result >> 31) & 0x1;
 	Z = result == 0;
 	C = op1 >= op2;
@@ -2615,20 +3353,24 @@ inline int countSetBits(uint32_t value)
 //////////////////////////////////////////////////////////////////////////////////////////
 
 
-int CPU::thumbExecute(thumbInstr instr)
+int CPU::thumbExecute(const thumbInstr& instr)
 {
-	return (this->*opT_functions[static_cast<int>(instr.type)])(instr);
+	pipelineFlushed = false;
+	int cycles = (this->*opT_functions[static_cast<int>(instr.type)])(instr);
+	if (!pipelineFlushed) pc() += 2;
+	return cycles;
 }
 
-inline int CPU::opT_MOV_IMM(thumbInstr instr)
+inline int CPU::opT_MOV_IMM(const thumbInstr& instr)
 {
+	syncFlags();
 	reg[instr.rd] = instr.imm;
 	N = instr.imm & 0x80000000;
 	Z = instr.imm == 0;
 	return 1;
 }
 
-inline int CPU::opT_ADD_REG(thumbInstr instr)
+inline int CPU::opT_ADD_REG(const thumbInstr& instr)
 {
 	uint32_t op1 = reg[instr.rs];
 	uint32_t op2 = reg[instr.rn];
@@ -2638,7 +3380,7 @@ inline int CPU::opT_ADD_REG(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_ADD_IMM(thumbInstr instr)
+inline int CPU::opT_ADD_IMM(const thumbInstr& instr)
 {
 	uint32_t op1 = reg[instr.rs];
 	uint32_t op2 = instr.imm;
@@ -2648,7 +3390,7 @@ inline int CPU::opT_ADD_IMM(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_ADD_IMM3(thumbInstr instr)
+inline int CPU::opT_ADD_IMM3(const thumbInstr& instr)
 {
 	uint32_t op1 = reg[instr.rd];
 	uint32_t op2 = instr.imm;
@@ -2658,7 +3400,7 @@ inline int CPU::opT_ADD_IMM3(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_SUB_REG(thumbInstr instr)
+inline int CPU::opT_SUB_REG(const thumbInstr& instr)
 {
 	uint32_t op1 = reg[instr.rs];
 	uint32_t op2 = reg[instr.rn];
@@ -2668,7 +3410,7 @@ inline int CPU::opT_SUB_REG(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_SUB_IMM(thumbInstr instr)
+inline int CPU::opT_SUB_IMM(const thumbInstr& instr)
 {
 	uint32_t op1 = reg[instr.rs];
 	uint32_t op2 = instr.imm;
@@ -2678,7 +3420,7 @@ inline int CPU::opT_SUB_IMM(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_SUB_IMM3(thumbInstr instr)
+inline int CPU::opT_SUB_IMM3(const thumbInstr& instr)
 {
 	uint32_t op1 = reg[instr.rd];
 	uint32_t op2 = instr.imm;
@@ -2688,7 +3430,7 @@ inline int CPU::opT_SUB_IMM3(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_CMP_IMM(thumbInstr instr)
+inline int CPU::opT_CMP_IMM(const thumbInstr& instr)
 {
 	uint32_t op1 = reg[instr.rd];
 	uint32_t op2 = instr.imm;
@@ -2697,8 +3439,9 @@ inline int CPU::opT_CMP_IMM(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_LSL_IMM(thumbInstr instr)
+inline int CPU::opT_LSL_IMM(const thumbInstr& instr)
 {
+	syncFlags();
 	uint32_t value = reg[instr.rs];
 	uint32_t shift = instr.imm;
 	if (shift == 0)
@@ -2715,8 +3458,9 @@ inline int CPU::opT_LSL_IMM(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_LSR_IMM(thumbInstr instr)
+inline int CPU::opT_LSR_IMM(const thumbInstr& instr)
 {
+	syncFlags();
 	uint32_t value = reg[instr.rs];
 	uint32_t shift = instr.imm;
 	if (shift == 0) shift = 32;
@@ -2727,8 +3471,9 @@ inline int CPU::opT_LSR_IMM(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_ASR_IMM(thumbInstr instr)
+inline int CPU::opT_ASR_IMM(const thumbInstr& instr)
 {
+	syncFlags();
 	int32_t value = (int32_t)reg[instr.rs];
 	uint32_t shift = instr.imm;
 	if (shift == 0) shift = 32;
@@ -2739,24 +3484,27 @@ inline int CPU::opT_ASR_IMM(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_AND_REG(thumbInstr instr)
+inline int CPU::opT_AND_REG(const thumbInstr& instr)
 {
+	syncFlags();
 	reg[instr.rd] = reg[instr.rd] & reg[instr.rs];
 	N = reg[instr.rd] & 0x80000000;
 	Z = reg[instr.rd] == 0;
 	return 1;
 }
 
-inline int CPU::opT_EOR_REG(thumbInstr instr)
+inline int CPU::opT_EOR_REG(const thumbInstr& instr)
 {
+	syncFlags();
 	reg[instr.rd] = reg[instr.rd] ^ reg[instr.rs];
 	N = reg[instr.rd] & 0x80000000;
 	Z = reg[instr.rd] == 0;
 	return 1;
 }
 
-inline int CPU::opT_LSL_REG(thumbInstr instr)
+inline int CPU::opT_LSL_REG(const thumbInstr& instr)
 {
+	syncFlags();
 	uint32_t shift = reg[instr.rs] & 0xFF;
 	if (shift == 0) {}
 	else if (shift < 32)
@@ -2779,8 +3527,9 @@ inline int CPU::opT_LSL_REG(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_LSR_REG(thumbInstr instr)
+inline int CPU::opT_LSR_REG(const thumbInstr& instr)
 {
+	syncFlags();
 	uint32_t shift = reg[instr.rs] & 0xFF;
 	if (shift == 0) {}
 	else if (shift < 32)
@@ -2803,8 +3552,9 @@ inline int CPU::opT_LSR_REG(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_ASR_REG(thumbInstr instr)
+inline int CPU::opT_ASR_REG(const thumbInstr& instr)
 {
+	syncFlags();
 	uint32_t shift = reg[instr.rs] & 0xFF;
 	int32_t value = (int32_t)reg[instr.rd];
 	if (shift == 0) {}
@@ -2823,8 +3573,9 @@ inline int CPU::opT_ASR_REG(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_ADC_REG(thumbInstr instr)
+inline int CPU::opT_ADC_REG(const thumbInstr& instr)
 {
+	syncFlags();
 	uint32_t op1 = reg[instr.rd];
 	uint32_t op2 = reg[instr.rs];
 	uint32_t carry = C ? 1 : 0;
@@ -2834,8 +3585,9 @@ inline int CPU::opT_ADC_REG(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_SBC_REG(thumbInstr instr)
+inline int CPU::opT_SBC_REG(const thumbInstr& instr)
 {
+	syncFlags();
 	uint32_t op1 = reg[instr.rd];
 	uint32_t op2 = reg[instr.rs];
 	uint32_t carry = C ? 0 : 1;
@@ -2845,8 +3597,9 @@ inline int CPU::opT_SBC_REG(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_ROR_REG(thumbInstr instr)
+inline int CPU::opT_ROR_REG(const thumbInstr& instr)
 {
+	syncFlags();
 	uint32_t shift = reg[instr.rs] & 0xFF;
 	if (shift == 0) {}
 	else
@@ -2867,15 +3620,16 @@ inline int CPU::opT_ROR_REG(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_TST_REG(thumbInstr instr)
+inline int CPU::opT_TST_REG(const thumbInstr& instr)
 {
+	syncFlags();
 	uint32_t result = reg[instr.rd] & reg[instr.rs];
 	N = result & 0x80000000;
 	Z = result == 0;
 	return 1;
 }
 
-inline int CPU::opT_NEG_REG(thumbInstr instr)
+inline int CPU::opT_NEG_REG(const thumbInstr& instr)
 {
 	uint32_t op2 = reg[instr.rs];
 	uint32_t result = 0 - op2;
@@ -2884,7 +3638,7 @@ inline int CPU::opT_NEG_REG(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_CMP_REG(thumbInstr instr)
+inline int CPU::opT_CMP_REG(const thumbInstr& instr)
 {
 	uint32_t op1 = reg[instr.rd];
 	uint32_t op2 = reg[instr.rs];
@@ -2893,7 +3647,7 @@ inline int CPU::opT_CMP_REG(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_CMN_REG(thumbInstr instr)
+inline int CPU::opT_CMN_REG(const thumbInstr& instr)
 {
 	uint32_t op1 = reg[instr.rd];
 	uint32_t op2 = reg[instr.rs];
@@ -2902,47 +3656,51 @@ inline int CPU::opT_CMN_REG(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_ORR_REG(thumbInstr instr)
+inline int CPU::opT_ORR_REG(const thumbInstr& instr)
 {
+	syncFlags();
 	reg[instr.rd] = reg[instr.rd] | reg[instr.rs];
 	N = reg[instr.rd] & 0x80000000;
 	Z = reg[instr.rd] == 0;
 	return 1;
 }
 
-inline int CPU::opT_MUL_REG(thumbInstr instr)
+inline int CPU::opT_MUL_REG(const thumbInstr& instr)
 {
+	syncFlags();
 	reg[instr.rd] = reg[instr.rd] * reg[instr.rs];
 	N = reg[instr.rd] & 0x80000000;
 	Z = reg[instr.rd] == 0;
 	return 1;
 }
 
-inline int CPU::opT_BIC_REG(thumbInstr instr)
+inline int CPU::opT_BIC_REG(const thumbInstr& instr)
 {
+	syncFlags();
 	reg[instr.rd] = reg[instr.rd] & ~reg[instr.rs];
 	N = reg[instr.rd] & 0x80000000;
 	Z = reg[instr.rd] == 0;
 	return 1;
 }
 
-inline int CPU::opT_MVN_REG(thumbInstr instr)
+inline int CPU::opT_MVN_REG(const thumbInstr& instr)
 {
+	syncFlags();
 	reg[instr.rd] = ~reg[instr.rs];
 	N = reg[instr.rd] & 0x80000000;
 	Z = reg[instr.rd] == 0;
 	return 1;
 }
 
-inline int CPU::opT_ADD_HI(thumbInstr instr)
+inline int CPU::opT_ADD_HI(const thumbInstr& instr)
 {
 	reg[instr.rd] = reg[instr.rd] + reg[instr.rs];
-	if (instr.rd == 15) reg[15] = (reg[15] & ~1) + 2;
+	if (instr.rd == 15) branchTo(reg[15]);
 
 	return 1;
 }
 
-inline int CPU::opT_CMP_HI(thumbInstr instr)
+inline int CPU::opT_CMP_HI(const thumbInstr& instr)
 {
 	uint32_t op1 = reg[instr.rd];
 	uint32_t op2 = reg[instr.rs];
@@ -2951,35 +3709,29 @@ inline int CPU::opT_CMP_HI(thumbInstr instr)
 	return 1;
 }
 
-inline int CPU::opT_MOV_HI(thumbInstr instr)
+inline int CPU::opT_MOV_HI(const thumbInstr& instr)
 {
 	reg[instr.rd] = reg[instr.rs];
 
-	if (instr.rd == 15) reg[15] = (reg[15] & ~1) + 2;
+	if (instr.rd == 15) branchTo(reg[15]);
 
 	return 1;
 }
 
-inline int CPU::opT_BX(thumbInstr instr)
+inline int CPU::opT_BX(const thumbInstr& instr)
 {
 	uint32_t target = reg[instr.rs];
-	if (target & 1)
-	{
-		T = 1;
-		pc = (target+2) & ~1; // keep thumb
-
-	}
-	else
-	{
-		T = 0;  //swap arm
-		pc = (target + 6)&~1;
-	}
+	T = target & 1; // 0 swaps to arm
+	branchTo(target);
 	return 3;
 }
 
-inline int CPU::opT_BLX_REG(thumbInstr instr) // so this doesnt exist for thumb, gonna keep t ion for now
+inline int CPU::opT_BLX_REG(const thumbInstr& instr) // so this doesnt exist for thumb, gonna keep t ion for now
 {
-	printf("CALLING LBX THUMB, THIS SHOULD BE UNCALLABLE!!!!");
+	if constexpr (buildTraceLevel == traceLevel::Text)
+	{
+		printf("CALLING LBX THUMB, THIS SHOULD BE UNCALLABLE!!!!");
+	}
 	//uint32_t regI = instr.rs;
 	//
 	//uint32_t target = reg[regI];
@@ -2997,42 +3749,42 @@ inline int CPU::opT_BLX_REG(thumbInstr instr) // so this doesnt exist for thumb,
 	return 3;
 }
 
-inline int CPU::opT_LDR_PC(thumbInstr instr)
+inline int CPU::opT_LDR_PC(const thumbInstr& instr)
 {
-	uint32_t address = ((pc) & ~2) + instr.imm;
+	uint32_t address = (pc() & ~3) + instr.imm;
 	reg[instr.rd] = read32(address);
 	return 3;
 }
 
-inline int CPU::opT_LDR_REG(thumbInstr instr)
+inline int CPU::opT_LDR_REG(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs] + reg[instr.rn];
 	reg[instr.rd] = read32(address);
 	return 3;
 }
 
-inline int CPU::opT_STR_REG(thumbInstr instr)
+inline int CPU::opT_STR_REG(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs] + reg[instr.rn];
 	write32(address, reg[instr.rd]);
 	return 2;
 }
 
-inline int CPU::opT_LDRB_REG(thumbInstr instr)
+inline int CPU::opT_LDRB_REG(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs] + reg[instr.rn];
 	reg[instr.rd] = read8(address);
 	return 3;
 }
 
-inline int CPU::opT_STRB_REG(thumbInstr instr)
+inline int CPU::opT_STRB_REG(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs] + reg[instr.rn];
 	write8(address, reg[instr.rd] & 0xFF);
 	return 2;
 }
 
-inline int CPU::opT_LDRH_REG(thumbInstr instr)
+inline int CPU::opT_LDRH_REG(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs] + reg[instr.rn];
 
@@ -3048,14 +3800,14 @@ inline int CPU::opT_LDRH_REG(thumbInstr instr)
 	return 3;
 }
 
-inline int CPU::opT_STRH_REG(thumbInstr instr)
+inline int CPU::opT_STRH_REG(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs] + reg[instr.rn];
 	write16(address, reg[instr.rd] & 0xFFFF);
 	return 2;
 }
 
-inline int CPU::opT_LDRSB_REG(thumbInstr instr)
+inline int CPU::opT_LDRSB_REG(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs] + reg[instr.rn];
 	int8_t value = (int8_t)read8(address);
@@ -3063,7 +3815,7 @@ inline int CPU::opT_LDRSB_REG(thumbInstr instr)
 	return 3;
 }
 
-inline int CPU::opT_LDRSH_REG(thumbInstr instr)
+inline int CPU::opT_LDRSH_REG(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs] + reg[instr.rn];
 	uint16_t value = read16(address);
@@ -3101,35 +3853,35 @@ inline int CPU::opT_LDRSH_REG(thumbInstr instr)
 	return 3;
 }
 
-inline int CPU::opT_LDR_IMM(thumbInstr instr)
+inline int CPU::opT_LDR_IMM(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs] + instr.imm;
 	reg[instr.rd] = read32(address);
 	return 3;
 }
 
-inline int CPU::opT_STR_IMM(thumbInstr instr)
+inline int CPU::opT_STR_IMM(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs] + instr.imm;
 	write32(address, reg[instr.rd]);
 	return 2;
 }
 
-inline int CPU::opT_LDRB_IMM(thumbInstr instr)
+inline int CPU::opT_LDRB_IMM(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs] + instr.imm;
 	reg[instr.rd] = read8(address);
 	return 3;
 }
 
-inline int CPU::opT_STRB_IMM(thumbInstr instr)
+inline int CPU::opT_STRB_IMM(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs] + instr.imm;
 	write8(address, reg[instr.rd] & 0xFF);
 	return 2;
 }
 
-inline int CPU::opT_LDRH_IMM(thumbInstr instr)
+inline int CPU::opT_LDRH_IMM(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs] + instr.imm;
 	uint32_t value = read16(address); 
@@ -3144,195 +3896,288 @@ inline int CPU::opT_LDRH_IMM(thumbInstr instr)
 	reg[instr.rd] = value;
 	return 3;
 }
-inline int CPU::opT_STRH_IMM(thumbInstr instr)
+inline int CPU::opT_STRH_IMM(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs] + instr.imm;
 	write16(address, reg[instr.rd] & 0xFFFF);
 	return 2;
 }
 
-inline int CPU::opT_LDR_SP(thumbInstr instr)
+inline int CPU::opT_LDR_SP(const thumbInstr& instr)
 {
-	uint32_t address = sp + instr.imm;
+	uint32_t address = sp() + instr.imm;
 	reg[instr.rd] = read32(address);
 	return 3;
 }
 
-inline int CPU::opT_STR_SP(thumbInstr instr)
+inline int CPU::opT_STR_SP(const thumbInstr& instr)
 {
-	uint32_t address = sp + instr.imm;
+	uint32_t address = sp() + instr.imm;
 	write32(address, reg[instr.rd]);
 	return 2;
 }
 
-inline int CPU::opT_ADD_PC(thumbInstr instr)
+inline int CPU::opT_ADD_PC(const thumbInstr& instr)
 {
-	reg[instr.rd] = (pc & ~2) + instr.imm;
+	reg[instr.rd] = (pc() & ~3) + instr.imm;
 	return 1;
 }
 
-inline int CPU::opT_ADD_SP(thumbInstr instr)
+inline int CPU::opT_ADD_SP(const thumbInstr& instr)
 {
 	//sp += instr.imm;
-	reg[instr.rd] = sp+ instr.imm;
+	reg[instr.rd] = sp()+ instr.imm;
 	return 1;
 }
 
-inline int CPU::opT_ADD_SP_IMM(thumbInstr instr)
+inline int CPU::opT_ADD_SP_IMM(const thumbInstr& instr)
 {
-	sp = sp + (int32_t)instr.imm;
+	sp() = sp() + (int32_t)instr.imm;
 	//reg[instr.rd] = sp; so i guess this isnt needed ???
 	return 1;
 }
 
-inline int CPU::opT_PUSH(thumbInstr instr)
+inline int CPU::opT_PUSH(const thumbInstr& instr)
 {
 
 	if (instr.imm == 0) // nothing in reg list
 	{
-		sp -= 4;
-		write32(sp, reg[15]);
-		sp -= 0x3C;
+		sp() -= 4;
+		write32(sp(), reg[15] + 2);
+		sp() -= 0x3C;
 		return 1;
 	}
 
+	int numRegs = countSetBits(instr.imm);
+	if (uint8_t* block = blockTransferRam(sp() - numRegs * 4, numRegs, true))
+	{
+		storeRegisterBlock(instr.imm, numRegs, block);
+		sp() -= numRegs * 4;
+		return 1 + numRegs;
+	}
+
 	for (int i = 15; i >= 0; i--)
 	{
 		if (instr.imm & (1 << i))
 		{
-			sp -= 4;
-			write32(sp, reg[i]);
+			sp() -= 4;
+			write32(sp(), reg[i]);
 		}
 	}
-	return 1 + countSetBits(instr.imm);
+	return 1 + numRegs;
 }
 
-inline int CPU::opT_POP(thumbInstr instr)
+inline int CPU::opT_POP(const thumbInstr& instr)
 {
 
 	if (instr.imm == 0)
 	{
-		reg[15] = (read32(sp) ) + 2;  
-		sp += 0x40; 
+		branchTo(read32(sp()));
+		sp() += 0x40; 
 		return 1;
 	}
 
+	int numRegs = countSetBits(instr.imm);
+	if (const uint8_t* block = blockTransferRam(sp(), numRegs, false))
+	{
+		loadRegisterBlock(instr.imm, numRegs, block);
+		sp() += numRegs * 4;
+
+		if (instr.imm & 0x8000) branchTo(reg[15]);
+		return 1 + numRegs;
+	}
+
 	for (int i = 0; i < 16; i++)
 	{
 		if (instr.imm & (1 << i))
 		{
-			reg[i] = read32(sp);
-			sp += 4;
+			reg[i] = read32(sp());
+			sp() += 4;
 
-			if (i == 15) reg[15] = (reg[15]+2)&~1; // Clear bit 0 for THUMB mode
+			if (i == 15) branchTo(reg[15]); // stays THUMB, bit 0 is dropped
 		}
 	}
-	return 1 + countSetBits(instr.imm);
+	return 1 + numRegs;
 }
 
-inline int CPU::opT_STMIA(thumbInstr instr)
+inline int CPU::opT_STMIA(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs];
 
 
 	if ((instr.imm & 0xFF) == 0) // if loading from an empty list
 	{
-		write32(address, reg[15]);
+		write32(address, reg[15] + 2);
 		reg[instr.rs] = address + 0x40;
 		return 1;
 	}
 
-	for (int i = 0; i < 8; i++)
+	int numRegs = countSetBits(instr.imm & 0xFF);
+
+	if (uint8_t* block = blockTransferRam(address, numRegs, true))
 	{
-		if (instr.imm & (1 << i))
+		storeRegisterBlock(instr.imm & 0xFF, numRegs, block);
+		address += numRegs * 4;
+	}
+	else
+	{
+		for (int i = 0; i < 8; i++)
 		{
-			write32(address, reg[i]);
-			address += 4;
+			if (instr.imm & (1 << i))
+			{
+				write32(address, reg[i]);
+				address += 4;
+			}
 		}
 	}
 
 	reg[instr.rs] = address;
-	return 1 + countSetBits(instr.imm & 0xFF);
+	return 1 + numRegs;
 }
 
 
-inline int CPU::opT_LDMIA(thumbInstr instr)
+inline int CPU::opT_LDMIA(const thumbInstr& instr)
 {
 	uint32_t address = reg[instr.rs];
 
 
 	if ((instr.imm & 0xFF) == 0) // if loading from an empty list
 	{
-		reg[15] = read32(address)+2;  
+		branchTo(read32(address));
 		reg[instr.rs] = address + 0x40;  
 		return 1;
 	}
 
 	bool baseInList = instr.imm & (1 << instr.rs);
+	int numRegs = countSetBits(instr.imm & 0xFF);
 
-	for (int i = 0; i < 8; i++)
+	if (const uint8_t* block = blockTransferRam(address, numRegs, false))
 	{
-		if (instr.imm & (1 << i))
+		loadRegisterBlock(instr.imm & 0xFF, numRegs, block);
+		address += numRegs * 4;
+	}
+	else
+	{
+		for (int i = 0; i < 8; i++)
 		{
-			reg[i] = read32(address);
-			address += 4;
+			if (instr.imm & (1 << i))
+			{
+				reg[i] = read32(address);
+				address += 4;
+			}
 		}
 	}
 
 	if (!baseInList) reg[instr.rs] = address;
 
-	return 1 + countSetBits(instr.imm & 0xFF);
+	return 1 + numRegs;
 }
 
-inline int CPU::opT_B_COND(thumbInstr instr)
+inline int CPU::opT_B_COND(const thumbInstr& instr)
 {
 	if (checkConditional((uint8_t)instr.cond & 0xFF))
 	{
-		pc = pc + 2 + (int32_t)instr.imm;
+		branchTo(pc() + (int32_t)instr.imm);
 	}
 
 	return 3;
 }
 
-inline int CPU::opT_B(thumbInstr instr)
+inline int CPU::opT_B(const thumbInstr& instr)
 {
 
-	pc = pc + 2 + (int32_t)instr.imm;
+	branchTo(pc() + (int32_t)instr.imm);
 	return 3;
 }
 
-inline int CPU::opT_BL_PREFIX(thumbInstr instr)
+inline int CPU::opT_BL_PREFIX(const thumbInstr& instr)
 {
 
-	lr = pc + (int32_t)instr.imm;
+	lr() = pc() + (int32_t)instr.imm;
 	return 1;
 }
 
-inline int CPU::opT_BL_SUFFIX(thumbInstr instr)
+inline int CPU::opT_BL_SUFFIX(const thumbInstr& instr)
 {
 
-	uint32_t target = lr + (int32_t)instr.imm;
+	uint32_t target = lr() + (int32_t)instr.imm;
 
-	lr = (pc - 2) | 1;
-	pc = target+2 & ~1;
+	lr() = (pc() - 2) | 1;
+	branchTo(target);
 	return 3;
 }
 
-inline int CPU::opT_SWI(thumbInstr instr)
+inline int CPU::opT_SWI(const thumbInstr& instr)
 {
 
 	//printf("SWI #%d: r0=%08X r1=%08X r2=%08X\n", instr.imm, reg[0], reg[1], reg[2]); // debugging logger
-	enterException(mode::Supervisor, Vector::SWI, pc - 4);
-	pc -= 2;
+	if (hleBios)
+	{
+		int cycles = hleSwi(instr.imm & 0xFF);
+		if (cycles) return cycles;
+	}
+
+	enterException(mode::Supervisor, Vector::SWI, pc() - 2); // returns to the instr after it
 	return 3;
 }
 
-inline int CPU::opT_UNDEFINED(thumbInstr instr)
+inline int CPU::opT_UNDEFINED(const thumbInstr& instr)
 {
 	//printf("UNDEFINED TRIGGERED, REPLACE LATER WITH PROPER VECTOR HANDLER");
 	return 1;
 }
 
+// fused pairs, see fuseThumbBlock. each one leaves registers, flags and pc exactly as the two
+// handlers it replaces would, and charges both their cycles
+
+inline int CPU::opT_FUSED_BL(const thumbInstr& instr)
+{
+	uint32_t target = pc() + (int32_t)instr.imm; // lr after the prefix, plus the suffix offset
+	pc() += 2;
+
+	lr() = (pc() - 2) | 1;
+	branchTo(target);
+	fusedRuns[static_cast<int>(fusionPattern::BL)]++;
+	return 4;
+}
+
+inline int CPU::opT_FUSED_CMP_BCOND(const thumbInstr& instr)
+{
+	uint32_t op1 = reg[instr.rd];
+	uint32_t op2 = instr.h1 ? reg[instr.rs] : instr.imm & 0xFF;
+	updateFlagsNZCV_Sub(op1 - op2, op1, op2);
+	pc() += 2;
+
+	if (checkConditional(instr.cond))
+	{
+		branchTo(pc() + ((int32_t)instr.imm >> 8));
+	}
+	fusedRuns[static_cast<int>(fusionPattern::CmpBranch)]++;
+	return 4;
+}
+
+// the ADD rewrites all of NZCV, so the LSL / MOV flags are never seen and are not worked out
+inline int CPU::opT_FUSED_SHIFT_ADD(const thumbInstr& instr)
+{
+	reg[instr.cond] = instr.h1 ? instr.imm & 0xFF : reg[(instr.imm >> 8) & 0x7] << (instr.imm & 0x1F);
+
+	uint32_t op1 = reg[instr.rs];
+	uint32_t op2 = reg[instr.rn];
+	uint32_t result = op1 + op2;
+	reg[instr.rd] = result;
+	updateFlagsNZCV_Add(result, op1, op2);
+	pc() += 2;
+	fusedRuns[static_cast<int>(fusionPattern::ShiftAdd)]++;
+	return 2;
+}
+
+inline int CPU::opT_LDR_LITERAL(const thumbInstr& instr)
+{
+	reg[instr.rd] = instr.imm;
+	fusedRuns[static_cast<int>(fusionPattern::Literal)]++;
+	return 3;
+}
+
 
 /////////////////////////////////////////////
 ///             READ FUNCTIONS            ///
@@ -3347,61 +4192,125 @@ std::vector<Transaction> currentTransactions;
 
 uint32_t curTestBaseAddr;
 uint16_t curTestOpTHUMB;
+bool inTestHarness = false; // only while runThumbTests runs, loads anywhere else never look at the above
 
+uint8_t* CPU::blockTransferRam(uint32_t addr, int numRegs, bool write)
+{
+	if ((addr & 3) || inTestHarness) return nullptr; // the test harness feeds loads from its transaction list
+	if (buildTraceLevel == traceLevel::Records && trace.captureMemory) return nullptr; // one slot per word
+	return bus->plainRam(addr, numRegs * 4, write);
+}
+
+// lowest register at the lowest address. a list with no gaps (r4-r11, r0-r7, ...) is one memcpy
+// straight over reg[], anything else goes bit by bit
+void CPU::loadRegisterBlock(uint16_t registerList, int numRegs, const uint8_t* from)
+{
+	int lowest = 0;
+	while (!((registerList >> lowest) & 1)) lowest++;
+
+	if ((uint32_t(registerList) >> lowest) == (1u << numRegs) - 1)
+	{
+		memcpy(&reg[lowest], from, numRegs * 4);
+		return;
+	}
+
+	for (int i = lowest; i < 16; i++)
+	{
+		if (!((registerList >> i) & 1)) continue;
+		memcpy(&reg[i], from, 4);
+		from += 4;
+	}
+}
+
+void CPU::storeRegisterBlock(uint16_t registerList, int numRegs, uint8_t* to)
+{
+	int lowest = 0;
+	while (!((registerList >> lowest) & 1)) lowest++;
+
+	if ((uint32_t(registerList) >> lowest) == (1u << numRegs) - 1)
+	{
+		memcpy(to, &reg[lowest], numRegs * 4);
+		return;
+	}
+
+	for (int i = lowest; i < 16; i++)
+	{
+		if (!((registerList >> i) & 1)) continue;
+		memcpy(to, &reg[i], 4);
+		to += 4;
+	}
+}
 
 
-uint8_t CPU::read8(uint32_t inputAddr, bool bReadOnly)
+
+uint8_t CPU::read8(uint32_t inputAddr)
 {
 
 	uint32_t addr = inputAddr; //;& ~3;
-	for (const auto& transaction : currentTransactions)
+	if (inTestHarness)
 	{
-		//printf("%0x  \n", transaction.addr);
-		if (transaction.kind == 1 && transaction.addr == addr && transaction.size == 1)
+		for (const auto& transaction : currentTransactions)
 		{
+			//printf("%0x  \n", transaction.addr);
+			if (transaction.kind == 1 && transaction.addr == addr && transaction.size == 1)
+			{
 
-			return (uint8_t)transaction.data;
+				return (uint8_t)transaction.data;
+			}
+		}
+		if (addr == curTestBaseAddr)
+		{
+			return curTestOpTHUMB;
+		}
+		if constexpr (buildTraceLevel == traceLevel::Text)
+		{
+			printf("read8: No transaction found for addr 0x%08x (aligned 0x%08x), %d transactions available\n",
+				inputAddr, addr, (int)currentTransactions.size());
 		}
 	}
-	if (addr == curTestBaseAddr)
-	{
-		return curTestOpTHUMB;
-	}
-	printf("read8: No transaction found for addr 0x%08x (aligned 0x%08x), %d transactions available\n",
-		inputAddr, addr, (int)currentTransactions.size());
 
-	return bus->read8(addr);
+	uint8_t value = bus->read8(addr);
+	traceAccess(TraceBuffer::kind::Read, addr, value, 1);
+	return value;
 
 }
-uint16_t CPU::read16(uint32_t inputAddr, bool bReadOnly)
+uint16_t CPU::read16(uint32_t inputAddr)
 {
 	uint32_t addr = inputAddr; //;& ~3;
-	for (const auto& transaction : currentTransactions)
+	if (inTestHarness)
 	{
-		if (transaction.kind == 1 && transaction.addr == addr && transaction.size == 2)
+		for (const auto& transaction : currentTransactions)
 		{
-			uint32_t value = transaction.data;
-
-			if (addr & 1)
+			if (transaction.kind == 1 && transaction.addr == addr && transaction.size == 2)
 			{
-				value = ((value >> 8) | (value << 8)) & 0xFFFF;
-			}
+				uint32_t value = transaction.data;
+
+				if (addr & 1)
+				{
+					value = ((value >> 8) | (value << 8)) & 0xFFFF;
+				}
 
-			return (uint16_t)value;
+				return (uint16_t)value;
+			}
+		}
+		if (addr == curTestBaseAddr)
+		{
+			return curTestOpTHUMB;
+		}
+		if constexpr (buildTraceLevel == traceLevel::Text)
+		{
+			printf("read8: No transaction found for addr 0x%08x (aligned 0x%08x), %d transactions available\n",
+				inputAddr, addr, (int)currentTransactions.size());
 		}
 	}
-	if (addr == curTestBaseAddr)
-	{
-		return curTestOpTHUMB;
-	}
-	printf("read8: No transaction found for addr 0x%08x (aligned 0x%08x), %d transactions available\n",
-		inputAddr, addr, (int)currentTransactions.size());
 
-	return bus->read16(inputAddr);
+	uint16_t value = bus->read16(inputAddr);
+	traceAccess(TraceBuffer::kind::Read, inputAddr, value, 2);
+	return value;
 }
 
 
-uint32_t CPU::read32(uint32_t inputAddr, bool bReadOnly)
+uint32_t CPU::read32(uint32_t inputAddr)
 {
 
 	// FOR WHEN REMOVING TEST HARNESS
@@ -3410,35 +4319,43 @@ uint32_t CPU::read32(uint32_t inputAddr, bool bReadOnly)
 
 
 	uint32_t addr = inputAddr; //;& ~3;
-	for (const auto& transaction : currentTransactions)
+	if (inTestHarness)
 	{
-		//printf("%u , looking for %u \n", transaction.addr , inputAddr);
-		if (transaction.kind == 1 && transaction.addr == addr && transaction.size == 4)
+		for (const auto& transaction : currentTransactions)
 		{
+			//printf("%u , looking for %u \n", transaction.addr , inputAddr);
+			if (transaction.kind == 1 && transaction.addr == addr && transaction.size == 4)
+			{
 
-			uint32_t value = transaction.data;
-
-			//uint32_t misalignment = addr & 3;
-			//if (misalignment != 0)
-			//{
-			//	uint32_t rotation = misalignment * 8;
-			//	value = (value >> rotation) | (value << (32 - rotation));
-			//}
-			//printf("val %u found\n" , inputAddr);
-			return value;
-			
+				uint32_t value = transaction.data;
+
+				//uint32_t misalignment = addr & 3;
+				//if (misalignment != 0)
+				//{
+				//	uint32_t rotation = misalignment * 8;
+				//	value = (value >> rotation) | (value << (32 - rotation));
+				//}
+				//printf("val %u found\n" , inputAddr);
+				return value;
+				
+			}
 		}
-	}
 
-	if (addr == curTestBaseAddr)
-	{
-		return curTestOpTHUMB;
+		if (addr == curTestBaseAddr)
+		{
+			return curTestOpTHUMB;
+		}
+		if constexpr (buildTraceLevel == traceLevel::Text)
+		{
+			printf("read32: No transaction found for addr 0x%08x (aligned 0x%08x), %d transactions available\n",
+				inputAddr , addr,(int)currentTransactions.size());
+		}
 	}
-	printf("read32: No transaction found for addr 0x%08x (aligned 0x%08x), %d transactions available\n",
-		inputAddr , addr,(int)currentTransactions.size());
 
 
-	return bus->read32(inputAddr);
+	uint32_t value = bus->read32(inputAddr);
+	traceAccess(TraceBuffer::kind::Read, inputAddr, value, 4);
+	return value;
 }
 
 
@@ -3459,16 +4376,20 @@ uint32_t CPU::read32(uint32_t inputAddr, bool bReadOnly)
 
 void CPU::write8(uint32_t addr, uint8_t data)
 {
+	traceAccess(TraceBuffer::kind::Write, addr, data, 1);
 	bus->write8(addr, data);
 }
 void CPU::write16(uint32_t addr, uint16_t data)
 {
+	traceAccess(TraceBuffer::kind::Write, addr, data, 2);
 	bus->write16(addr, data);
 }
 void CPU::write32(uint32_t addr, uint32_t data)
 {
 	addr = addr & ~3;
-	bus->write32(addr, data);
+	traceAccess(TraceBuffer::kind::Write, addr, data, 4);
+	if (inTestHarness && addr == 0x03000000) bus->slowWrite32(addr, data); // the arm tester's result word, reported there
+	else bus->write32(addr, data);
 }
 
 std::string CPU::thumbToStr(CPU::thumbInstr& instr)
@@ -3479,11 +4400,11 @@ std::string CPU::thumbToStr(CPU::thumbInstr& instr)
 		{
 			std::stringstream rs;
 			if (regNum == 13)
-				rs << "sp[0x" << std::hex << sp << "]" << std::dec;
+				rs << "sp[0x" << std::hex << sp() << "]" << std::dec;
 			else if (regNum == 14)
-				rs << "lr[0x" << std::hex << lr << "]" << std::dec;
+				rs << "lr[0x" << std::hex << lr() << "]" << std::dec;
 			else if (regNum == 15)
-				rs << "pc[0x" << std::hex << pc << "]" << std::dec;
+				rs << "pc[0x" << std::hex << pc() << "]" << std::dec;
 			else
 				rs << "r" << regNum << "[0x" << std::hex << reg[regNum] << "]" << std::dec;
 			return rs.str();
@@ -3633,7 +4554,7 @@ std::string CPU::thumbToStr(CPU::thumbInstr& instr)
 
 	case thumbOperation::THUMB_LDR_PC:
 	{
-		uint32_t addr = (pc & ~2)  + instr.imm;
+		uint32_t addr = (pc() & ~3)  + instr.imm;
 		ss << "ldr  PC " << regStr(instr.rd) << ", [pc, #0x" << std::hex << instr.imm << "]" << std::dec;
 		ss << "    | " << regStr(instr.rd) << " = [0x" << std::hex << addr << "]" << std::dec;
 		break;
@@ -3766,7 +4687,7 @@ std::string CPU::thumbToStr(CPU::thumbInstr& instr)
 			"hi", "ls", "ge", "lt", "gt", "le", "al", "nv"
 		};
 		int32_t offset = (int32_t)instr.imm;
-		uint32_t target = (pc + 4 + offset) & ~1;
+		uint32_t target = (pc() + offset) & ~1;
 		ss << "b" << condNames[instr.cond] << "     0x" << std::hex << target << std::dec;
 		ss << "    | if " << condNames[instr.cond] << " then pc = 0x" << std::hex << target << std::dec;
 		break;
@@ -3775,7 +4696,7 @@ std::string CPU::thumbToStr(CPU::thumbInstr& instr)
 	case thumbOperation::THUMB_B:
 	{
 		int32_t offset = (int32_t)instr.imm;
-		uint32_t target = (pc + 4 + offset) & ~1;
+		uint32_t target = (pc() + offset) & ~1;
 		ss << "b       0x" << std::hex << target << std::dec;
 		ss << "    | pc = 0x" << std::hex << target << std::dec;
 		break;
@@ -3787,9 +4708,9 @@ std::string CPU::thumbToStr(CPU::thumbInstr& instr)
 	break;
 	case thumbOperation::THUMB_BL_SUFFIX:
 	{
-		uint32_t target = (lr + instr.imm) & ~1;
+		uint32_t target = (lr() + instr.imm) & ~1;
 		ss << "bl_lo   0x" << std::hex << target << std::dec;
-		ss << "    | pc = 0x" << std::hex << target << ", lr = 0x" << (pc + 2) << std::dec;
+		ss << "    | pc = 0x" << std::hex << target << ", lr = 0x" << (pc() - 2) << std::dec;
 		break;
 	}
 
@@ -3801,6 +4722,25 @@ std::string CPU::thumbToStr(CPU::thumbInstr& instr)
 	ss << "undefined";
 	break;
 
+	case thumbOperation::THUMB_FUSED_BL:
+	ss << "bl      (fused) +0x" << std::hex << instr.imm << std::dec;
+	break;
+
+	case thumbOperation::THUMB_FUSED_CMP_BCOND:
+	ss << "cmp/b   (fused) " << regStr(instr.rd) << ", ";
+	if (instr.h1) ss << regStr(instr.rs);
+	else ss << "#" << (instr.imm & 0xFF);
+	ss << ", cond " << (int)instr.cond << ", " << ((int32_t)instr.imm >> 8);
+	break;
+
+	case thumbOperation::THUMB_FUSED_SHIFT_ADD:
+	ss << "lsl/add (fused) " << regStr(instr.cond) << ", then " << regStr(instr.rd) << " = " << regStr(instr.rs) << " + " << regStr(instr.rn);
+	break;
+
+	case thumbOperation::THUMB_LDR_LITERAL:
+	ss << "ldr     (literal) " << regStr(instr.rd) << ", =0x" << std::hex << instr.imm << std::dec;
+	break;
+
 	default:
 	ss << "unknown";
 	break;
@@ -3817,11 +4757,11 @@ std::string CPU::armToStr(CPU::armInstr& instr)
 		{
 			std::stringstream rs;
 			if (regNum == 13)
-				rs << "sp[0x" << std::hex << sp << "]" << std::dec;
+				rs << "sp[0x" << std::hex << sp() << "]" << std::dec;
 			else if (regNum == 14)
-				rs << "lr[0x" << std::hex << lr << "]" << std::dec;
+				rs << "lr[0x" << std::hex << lr() << "]" << std::dec;
 			else if (regNum == 15)
-				rs << "pc[0x" << std::hex << pc << "]" << std::dec;
+				rs << "pc[0x" << std::hex << pc() << "]" << std::dec;
 			else
 				rs << "r" << regNum << "[0x" << std::hex << reg[regNum] << "]" << std::dec;
 			return rs.str();
@@ -3874,7 +4814,7 @@ std::string CPU::armToStr(CPU::armInstr& instr)
 
 		if (instr.I)
 		{
-			ss << ", #0x" << std::hex << instr.imm << std::dec;
+			ss << ", #0x" << std::hex << instr.encodedImm() << std::dec;
 			if (instr.rotate) ss << " ror #" << (instr.rotate * 2);
 		}
 		else
@@ -4098,7 +5038,7 @@ std::string CPU::armToStr(CPU::armInstr& instr)
 			ss << ", ";
 			if (!instr.U) ss << "-";
 			if (instr.I)
-				ss << "#0x" << std::hex << instr.imm << std::dec;
+				ss << "#0x" << std::hex << (instr.U ? instr.imm : 0u - instr.imm) << std::dec;
 			else
 				ss << regStr(instr.rm);
 			ss << "]" << (instr.W ? "!" : "");
@@ -4108,7 +5048,7 @@ std::string CPU::armToStr(CPU::armInstr& instr)
 			ss << "], ";
 			if (!instr.U) ss << "-";
 			if (instr.I)
-				ss << "#0x" << std::hex << instr.imm << std::dec;
+				ss << "#0x" << std::hex << (instr.U ? instr.imm : 0u - instr.imm) << std::dec;
 			else
 				ss << regStr(instr.rm);
 		}
@@ -4153,7 +5093,7 @@ std::string CPU::armToStr(CPU::armInstr& instr)
 	// Branch
 	case armOperation::ARM_B:
 	{
-		uint32_t target = (pc + 8 + instr.imm) & ~3;
+		uint32_t target = (pc() + instr.imm) & ~3;
 		ss << addCond("b ") << "       0x" << std::hex << target << std::dec;
 		ss << "    | pc = 0x" << std::hex << target << std::dec;
 		break;
@@ -4161,7 +5101,7 @@ std::string CPU::armToStr(CPU::armInstr& instr)
 
 	case armOperation::ARM_BL:
 	{
-		uint32_t target = (pc + 8 + instr.imm) & ~3;
+		uint32_t target = (pc() + instr.imm) & ~3;
 		ss << addCond("bl ") << "      0x" << std::hex << target << std::dec;
 		ss << "    | lr = pc+4, pc = 0x" << std::hex << target << std::dec;
 		break;
@@ -4248,6 +5188,7 @@ void CPU::runThumbTests() //also runs arm
 		printf("ERROR: Could not open test file!\n");
 		return;
 	}
+	inTestHarness = true;
 
 	int passed = 0;
 	int failed = 0;
@@ -4361,7 +5302,7 @@ void CPU::runThumbTests() //also runs arm
 			for (int r = 0; r < 16; r++)
 				reg[r] = R_init[r];
 
-			pc = base_addr + 4;
+			pc() = base_addr + 8; // r15 as the instr sees it
 			CPSR = CPSR_init; //load cspr
 			for (int r = 0; r < 5; r++) // load spsr
 				spsrBank[r] = SPSR_init[r];
@@ -4396,8 +5337,8 @@ void CPU::runThumbTests() //also runs arm
 			
 			//armInstr decoded = decodeArm(opcode);
 			std::string decodedStr = armToStr(decoded);
-			curOpCycles = armExecute(decoded);
-			pc += 4; 
+			curOpCycles = jitEnabled ? jit->stepArm(base_addr, opcode, decoded) : armExecute(decoded); // leaves pc on the next instr
+			syncFlags();
 
 
 			// Check results - compare ALL registers including PC
@@ -4554,5 +5495,7 @@ void CPU::runThumbTests() //also runs arm
 	printf("========================================\n");
 
 	fclose(f);
+	inTestHarness = false;
+	currentTransactions.clear();
 }
 
@@ -1,12 +1,108 @@
 #pragma once
 #include "Bus.h"
+#include "TraceBuffer.h"
+#include "UndoJournal.h"
 #include <cstdint>
 #include <map>
 #include <unordered_map>
 #include <string>
 #include <sstream>
+#include <vector>
+#include <memory>
+#include <array>
+#include <type_traits>
+
+// 0 none, 1 records, 2 text, see CPU::traceLevel
+#ifndef GBA_TRACE_LEVEL
+#define GBA_TRACE_LEVEL 0
+#endif
+
+class JIT;
+class AOT;
+struct AOTBlock;
+
+// everything the guest can see of the cpu, split out of CPU so it is trivially copyable: a snapshot,
+// a rewind point or a forked copy for running many instances in bulk is a plain assignment (or memcpy)
+// of this and nothing else. no pointers or references live in here, sp() / lr() / pc() read and write
+// reg[13..15] directly. reg fills the first cache line on its own and the per instr scalars
+// share the second, the banks only touched on a mode switch come after. the block cache, the JIT and
+// the counters stay in CPU, nothing in them is needed for a copy of this to be right
+struct alignas(64) CPUState
+{
+	enum class mode : uint8_t
+	{
+		User = 0x10,
+		FIQ = 0x11,
+		IRQ = 0x12,
+		Supervisor = 0x13,
+		Abort = 0x17,
+		Undefined = 0x1B,
+		System = 0x1F
+	};
+
+	enum class flagOp : uint8_t { None, Add, Sub }; // see CPU's LAZY FLAGS
+
+	uint32_t reg[16];
+
+	uint32_t& sp() { return reg[13]; } // stack pointer ~ r13
+	uint32_t& lr() { return reg[14]; } // link register ~ r14
+	uint32_t& pc() { return reg[15]; } // program counter ~ r15
+	uint32_t sp() const { return reg[13]; }
+	uint32_t lr() const { return reg[14]; }
+	uint32_t pc() const { return reg[15]; }
+
+	//current program status registers
+	union
+	{
+		struct
+		{
+			uint32_t M0 : 1;
+			uint32_t M1 : 1;
+			uint32_t M2 : 1;
+			uint32_t M3 : 1;
+			uint32_t M4 : 1;
+			uint32_t T : 1;
+			uint32_t F : 1;
+			uint32_t I : 1;
+
+			uint32_t RESERVED : 20;
+			uint32_t V : 1;
+			uint32_t C : 1;
+			uint32_t Z : 1;
+			uint32_t N : 1;
+		};
+		uint32_t CPSR;
+	};
+
+	int cycleTotal; // this is how we find out how many cycles have passed
+	int curOpCycles; // this is defaulted to 0 every time
+
+	uint32_t pipeline[2];  // [0] runs next, [1] after it, see CPU's PIPELINE
+	bool pipelineFlushed;  // set by branchTo, pc is not stepped past the instr that did it
+
+	mode curMode = mode::Supervisor; // curMode should default to Supervisor
+
+	// NZCV still owed by the last add / sub while lazy flags are on, it is part of the state because
+	// the CPSR bits are stale until it is worked out
+	flagOp pendingFlagOp;
+	uint32_t flagResult;
+	uint32_t flagOp1;
+	uint32_t flagOp2;
+
+	// bank system so when we swap modes, we can store old modes inhere 
+	uint32_t r8FIQ[5];   // 8 9 10 11 12 registers stored for just fiq
+	uint32_t r8User[5]; // used for swaping back from fiq
+
+	uint32_t r13RegBank[6];  // individual SP for everone except usr/sys which share
+	uint32_t r14RegBank[6]; // individual LR for everone except usr/sys which share
+	uint32_t spsrBank[5]; // individual LR for everone except usr/sys have 0
+};
+
+static_assert(std::is_trivially_copyable<CPUState>::value, "CPUState has to stay copyable as raw bytes");
+static_assert(std::is_standard_layout<CPUState>::value, "CPUState has to stay standard layout");
+static_assert(sizeof(CPUState) <= 256, "CPUState should stay a few cache lines");
 
-class CPU
+class CPU : public CPUState
 {
 
 
@@ -115,6 +211,12 @@ public:
 		THUMB_SWI,
 		THUMB_UNDEFINED,
 
+		// super-instructions fuseThumbBlock builds out of cached blocks, decodeThumb never produces these
+		THUMB_FUSED_BL,
+		THUMB_FUSED_CMP_BCOND,
+		THUMB_FUSED_SHIFT_ADD,
+		THUMB_LDR_LITERAL,
+
 
 
 
@@ -186,115 +288,408 @@ public:
 		COUNT
 	};
 
+	// both decoded forms pack into 8 bytes so a cached block of them stays a few cache lines long,
+	// fields keep their old names so everything reading them is unchanged
+
 	struct thumbInstr
 	{
-		thumbOperation type;
+		thumbOperation type : 8;
 
-		uint8_t rd;
-		uint8_t rs;
-		uint8_t rn;
+		uint32_t rd : 4;
+		uint32_t rs : 4;
+		uint32_t rn : 4;
 
-		uint32_t imm;
+		uint32_t cond : 4;
 
-		uint8_t cond;
+		uint32_t h1 : 1;         // hi register f1
+		uint32_t h2 : 1;         // hi register f2
 
-		bool h1;         // hi register f1
-		bool h2;         // hi register f2
+		uint32_t imm;
 	};
 
 	struct armInstr
 	{
-		armOperation type;
+		armOperation type : 8;
 
-		uint8_t rd;
-		uint8_t rn;
-		uint8_t rs;
-		uint8_t rm;
+		uint32_t cond : 4;
 
-		uint32_t imm;
-		uint8_t rotate;
+		uint32_t rd : 4;
+		uint32_t rn : 4;
 
-		uint8_t cond;
+		uint32_t rotate : 4;     // imm is stored already rotated, this is kept for the carry out and armToStr
 
-		bool S;          // set condition codes
-		bool L;          // 1 is load, 0 is store
-		bool W;          // write back
-		bool P;          // 1 is pre index, 0 is post
-		bool U;          // 1 is add offs, 0 is sub
-		bool B;          // 1 for byte, 0 for word
-		bool H;          // is halfword or byte
-		bool I;          // immed operand
+		uint32_t S : 1;          // set condition codes
+		uint32_t L : 1;          // 1 is load, 0 is store
+		uint32_t W : 1;          // write back
+		uint32_t P : 1;          // 1 is pre index, 0 is post
+		uint32_t U : 1;          // 1 is add offs, 0 is sub
+		uint32_t B : 1;          // 1 for byte, 0 for word
+		uint32_t H : 1;          // is halfword or byte
+		uint32_t I : 1;          // immed operand
 
-		// shift info
-		uint8_t shift_type;    // 00=LSL, 01=LSR, 10=ASR, 11=ROR
-		uint8_t shift_amount;  // immed shift amount (0-31)
-		uint8_t shift_reg;     // reg containing shift amount
-		bool shift_by_reg;     // true if shift amount in register
+		// no format has an immediate alongside a register operand, so they share the second word
+		union
+		{
+			uint32_t imm;
+
+			struct
+			{
+				uint32_t rm : 4;
+				uint32_t rs : 4;
 
+				// shift info
+				uint32_t shift_type : 2;    // 00=LSL, 01=LSR, 10=ASR, 11=ROR
+				uint32_t shift_amount : 5;  // immed shift amount (0-31)
+				uint32_t shift_reg : 4;     // reg containing shift amount
+				uint32_t shift_by_reg : 1;  // true if shift amount in register
+			};
+
+			uint32_t reg_list : 16; // reg list (for load multiple etc)
+		};
 
-		uint16_t reg_list;// reg list (for load multiple etc)
+		uint32_t encodedImm() const { return rotate ? (imm << (rotate * 2)) | (imm >> (32 - rotate * 2)) : imm; } // imm as it sat in the opcode
 	};
 
+	static_assert(sizeof(thumbInstr) <= 8, "decoded thumb instr should stay packed");
+	static_assert(sizeof(armInstr) <= 8, "decoded arm instr should stay packed");
+
 	armInstr curArmInstr;
 
 public: // FUNCTION ARRAYS
 
-	using OpAFunction = int (CPU::*)(armInstr);
-	OpAFunction opA_functions[static_cast<int>(Operation::COUNT)];
+	// shared by every instance, built at compile time
+	using OpAFunction = int (CPU::*)(const armInstr&);
+	static const std::array<OpAFunction, static_cast<int>(armOperation::COUNT)> opA_functions;
+
+	using OpTFunction = int (CPU::*)(const thumbInstr&);
+	static const std::array<OpTFunction, static_cast<int>(thumbOperation::COUNT)> opT_functions;
+
+public: // DECODE TABLES
+
+	// which operand fields an encoding has. decodeArm switches on it so the field extraction is
+	// inlined into the decode instead of being a call through the table
+	enum class armFormat : uint8_t
+	{
+		None, BX, SWP, Multiply, Halfword, MRS, MSR, DataProcessing, SingleTransferImm, SingleTransferReg,
+		BlockTransfer, Branch, CoprocessorTransfer, CoprocessorRegister, SWI,
+	};
+
+	struct armDecodeEntry
+	{
+		armOperation type;
+		armFormat format;
+		OpAFunction execute;
+	};
+
+	static const armDecodeEntry& armLookup(uint32_t instr); // indexed by bits 27-20 and 7-4 and a zero shift amount
+
+	// [cond][NZCV] -> passes, NV (0xF) never does. ARM conditions are resolved here before the handler
+	// is called, so handlers only hold the work for an instr that runs
+	static const std::array<std::array<bool, 16>, 16> conditionTable;
+
+	// a failed condition costs the lookup and one cycle, pc is stepped by the caller like any other instr
+	int armDispatch(OpAFunction execute, const armInstr& instr)
+	{
+		if (!checkConditional(instr.cond)) return 1;
+		return (this->*execute)(instr);
+	}
+
+	using ThumbExtractFunction = void (*)(thumbInstr&, uint16_t);
+
+	struct thumbDecodeEntry
+	{
+		thumbOperation type;
+		ThumbExtractFunction extract; // pulls the operand fields for this format
+		OpTFunction execute;
+	};
+
+	static const thumbDecodeEntry& thumbLookup(uint16_t instr); // indexed by bits 15-6
+
+public: // PIPELINE
+
+	// the fetch / decode / execute pipeline. while an instr runs pc (r15) is the address being fetched,
+	// its own address plus two instrs (+8 ARM, +4 THUMB), so handlers read it as it is with no offset
+	// added. between instrs it stays that way for the next one, which is why anything outside the cpu
+	// wanting the next instr's address goes through nextInstrAddr(). pipeline holds the opcodes already
+	// fetched for the two instrs in front of pc, each instr makes exactly one fetch (pc, into the back)
+	// and sequential code is never fetched twice. anything that writes pc goes through branchTo, which
+	// flushes: pc moves past the target and the refill happens lazily before the next fetched instr,
+	// so the block cache and the JIT, which never look at pipeline, do not pay for it. pipeline and
+	// pipelineFlushed are in CPUState
+	uint64_t pipelineRefills;
+
+	void branchTo(uint32_t target)
+	{
+		pc() = T ? (target & ~1u) + 4 : (target & ~3u) + 8;
+		pipelineFlushed = true;
+	}
+
+	uint32_t nextInstrAddr() const { return pc() - (T ? 4 : 8); }
+
+	// the nonsequential fetch of the target and the sequential one after it
+	void refillPipeline()
+	{
+		uint32_t addr = nextInstrAddr();
+		pipeline[0] = T ? bus->read16(addr) : bus->read32(addr);
+		pipeline[1] = T ? bus->read16(addr + 2) : bus->read32(addr + 4);
+		pipelineFlushed = false;
+		pipelineRefills++;
+	}
+
+public: // BLOCK CACHE
+
+	// runs of already decoded instrs, replayed back to back without refetching. keyed by the
+	// address of the first instr and CPSR.T, a run ends at the first instr that can move pc or T
+	struct armBlockEntry
+	{
+		uint32_t addr;
+		uint32_t opcode; // kept for handlers that still read `instruction`
+		armInstr instr;
+		OpAFunction execute;
+	};
+
+	struct thumbBlockEntry
+	{
+		uint32_t addr;
+		thumbInstr instr;
+		OpTFunction execute;
+	};
+
+	struct decodedBlock
+	{
+		std::vector<armBlockEntry> arm;
+		std::vector<thumbBlockEntry> thumb;
+		uint32_t start; // bytes the block was decoded from, [start, end)
+		uint32_t end;
+		uint32_t hits;  // counts up to JIT::hotThreshold
+	};
+
+	static constexpr int maxBlockLength = 64;
+
+	std::unordered_map<uint64_t, decodedBlock> blockCache;
+
+	uint64_t blockHits;
+	uint64_t blockMisses;
+	uint64_t cachedInstrs;   // replayed from a block
+	uint64_t uncachedInstrs; // fetched and decoded
 
-	using OpTFunction = int (CPU::*)(thumbInstr);
-	OpTFunction opT_functions[static_cast<int>(thumbOperation::COUNT)];
+	uint32_t tickBlock(); // runs one block, returns cycleTotal like tick()
+	void flushBlockCache();
+
+	// EWRAM / IWRAM blocks are listed under every 256 byte page they touch, the bus flags those
+	// pages and calls invalidateCode on a write into one so only the overlapping blocks get dropped
+	std::unordered_map<uint32_t, std::vector<uint64_t>> codePageBlocks;
+
+	uint64_t replayKey;       // block tickBlock is running, erased only once it is done with it
+	bool replaying;
+	bool replayInvalidated;   // it wrote over itself, stop before the next entry
+	uint32_t recordStart;     // block still being recorded, not in blockCache yet
+	uint32_t recordEnd;
+	bool recording;
+	bool recordInvalidated;   // it wrote over itself, do not keep it
+	uint64_t invalidatedBlocks;
+
+	void invalidateCode(uint32_t addr, uint32_t size);
+
+	static bool isBlockCacheable(uint32_t addr);
+	static bool endsArmBlock(const armInstr& instr);
+	static bool endsThumbBlock(const thumbInstr& instr);
+
+public: // FUSION
+
+	// off by default, turned on with setFusion. when a thumb block goes into the cache, common pairs are merged into one entry
+	// with its own handler and the second entry dropped, so replay runs both in a single dispatch:
+	//   BL prefix + suffix         -> one call with the offset already summed
+	//   CMP Rd, #imm / Rs + Bcc    -> compare and branch
+	//   LSL #imm / MOV #imm + ADD  -> the shifted or constant operand and the add, only the ADD's flags kept
+	//   LDR Rd, [pc, #imm] from ROM -> a constant load, the literal is read once when the block is built
+	// the JIT compiles from the plain entries, so nothing is fused while it is on
+	enum class fusionPattern : uint8_t { BL, CmpBranch, ShiftAdd, Literal, Count };
+
+	bool fusion;
+	uint64_t fusedRuns[static_cast<int>(fusionPattern::Count)]; // times each fused entry was executed
+
+	void setFusion(bool enabled); // flushes the block cache so the change applies to every block
+	void fuseThumbBlock(std::vector<thumbBlockEntry>& entries);
+	bool fuseThumbPair(const thumbBlockEntry& first, const thumbBlockEntry& second, thumbBlockEntry& fused);
+
+public: // JIT
+
+	// off by default, tickBlock hands hot blocks to the x86-64 backend once switched on
+	std::unique_ptr<JIT> jit;
+	bool jitEnabled;
+	uint8_t jitAbort;     // set by invalidateCode, compiled code stops after the handler that caused it
+	int32_t jitLinksLeft; // block links compiled code may still follow before returning
+
+	void setJitEnabled(bool enabled);
+
+public: // AOT
+
+	// a module AOT::recompile made for the loaded image. its blocks are run ahead of the block cache and
+	// the JIT, addresses it does not cover carry on as before. false if it would not load
+	std::unique_ptr<AOT> aot;
+
+	bool loadAot(const char* path);
+	void unloadAot();
+
+public: // UNDO JOURNAL
+
+	// off by default. once on, tick() brackets every instr with undo.begin / end and the bus hands the
+	// journal the old bytes under each write, so the last instrs can be taken back without a snapshot.
+	// runFor and tickBlock go instr by instr through tick() while it is on. undoing leaves the pipeline
+	// flushed, so an instr that ran from a prefetch a store had gone over since runs the stored bytes
+	// when it comes round again
+	static constexpr uint32_t undoCapacityLog2 = 20; // 16 MB of slots
+
+	UndoJournal undo;
+
+	void setUndoJournal(bool enabled, uint32_t capacityLog2 = undoCapacityLog2);
+
+	// what undo.begin is told the instr can write: a bit per register r0-r14, or UndoJournal::everything
+	// for one that can switch mode or write an SPSR
+	static uint32_t armWrites(const armInstr& instr);
+	static uint32_t thumbWrites(const thumbInstr& instr);
+	uint64_t stepBack(uint64_t instrs); // how many it took back, fewer once the journal runs out
+
+	// takes back every instr since the last one that wrote addr and that one too, leaving the cpu about
+	// to run it again. 0 if none of the instrs still in the journal wrote it
+	uint64_t runBackToWrite(uint32_t addr);
+
+public: // LAZY FLAGS
+
+	// off by default. once on, the add / sub flag helpers only note their result and operands and NZCV
+	// is worked out the first time something looks at it: MRS / MSR, an SPSR save, an exception return,
+	// or an op that only writes some of the flags. a condition check works the bits out from the pending
+	// op without writing them back, so a compare and branch loop never settles them. tick, tickBlock and
+	// runFor always return with it settled, so code outside the CPU can keep reading and writing the
+	// bits directly. it pays off in add / sub heavy loops closed by a conditional branch, code full of
+	// logical ops that set only N and Z settles most of what it defers and gains little
+	// the pending op and its operands are in CPUState
+	bool lazyFlags;
+
+	uint64_t flagsDeferred;     // add / sub flag updates noted instead of computed
+	uint64_t flagsMaterialized; // how many of those were written back into CPSR
+
+	void setLazyFlags(bool enabled);
+	void materializeFlags();
+
+	void syncFlags() { if (pendingFlagOp != flagOp::None) materializeFlags(); }
+
+	// NZCV the way CPSR >> 28 will hold it once the pending op is settled
+	uint32_t pendingNZCV() const
+	{
+		const bool add = pendingFlagOp == flagOp::Add;
+		uint32_t c = add ? flagResult < flagOp1 : flagOp1 >= flagOp2;
+		uint32_t v = (add ? (flagOp1 ^ flagResult) & (flagOp2 ^ flagResult) : (flagOp1 ^ flagOp2) & (flagOp1 ^ flagResult)) >> 31;
+		return ((flagResult >> 31) << 3) | (uint32_t(flagResult == 0) << 2) | (c << 1) | v;
+	}
+
+	void deferFlags(flagOp op, uint32_t result, uint32_t op1, uint32_t op2)
+	{
+		pendingFlagOp = op;
+		flagResult = result;
+		flagOp1 = op1;
+		flagOp2 = op2;
+		flagsDeferred++;
+	}
+
+public: // HLE BIOS
+
+	// off by default. once on, SWI numbers the table in BiosHLE.cpp knows are run natively instead of
+	// vectoring into gba_bios.bin: Div, Sqrt, ArcTan / ArcTan2, CpuSet / CpuFastSet, the affine setups
+	// and the LZ77 / RL / Huffman decompressors. the instr is charged a cost from that table so guest
+	// timing stays in the right ballpark, anything it does not know still takes the exception
+	bool hleBios;
+	uint64_t hleCalls;
+
+	void setHleBios(bool enabled);
+	int hleSwi(uint8_t number); // cycles taken, 0 if the real bios has to do it
+
+private:
+
+	bool hleCpuSet();
+	bool hleCpuFastSet();
+	bool hleBgAffineSet();
+	bool hleObjAffineSet();
+	bool hleLZ77(uint32_t& written);
+	bool hleRL(uint32_t& written);
+	bool hleHuff(uint32_t& written);
+	uint8_t* hleUnpackTo(uint32_t dst, uint32_t size); // the scratch buffer the decompressors decode into
+
+	std::vector<uint8_t> hleScratch;
+
+public: // TRACE
+
+	// what tick() and runFor leave behind for each instr. it is picked at compile time through
+	// GBA_TRACE_LEVEL so a None build has no trace code in it at all. Records fills trace with an Instr
+	// slot per instr plus, when asked for, the registers it changed and its data accesses. Text is the
+	// old console line per instr plus the read helpers reporting test transaction misses
+	enum class traceLevel { None, Records, Text };
+	static constexpr traceLevel buildTraceLevel = static_cast<traceLevel>(GBA_TRACE_LEVEL);
+	static constexpr uint32_t traceCapacityLog2 = 20; // 16 MB, a single slot in any other build
+
+	TraceBuffer trace;
+
+	template <traceLevel level> uint32_t step(); // tick() at any level, for comparing them
+
+private:
+
+	uint32_t traceRegsBefore[16]; // as of the last Instr slot, for working out the Reg slots
+
+	template <traceLevel level> void traceArm(uint32_t addr, uint32_t opcode);
+	template <traceLevel level> void traceThumb(uint32_t addr, uint16_t thumbCode, const thumbInstr& decoded);
+	void traceRegisters();
+
+	void traceAccess(TraceBuffer::kind type, uint32_t addr, uint32_t value, uint32_t size)
+	{
+		if constexpr (buildTraceLevel == traceLevel::Records)
+		{
+			if (trace.captureMemory) trace.push(type, addr, value, size);
+		}
+	}
+
+public: // RUN LOOP
+
+	uint32_t runFor(int cycles); // runs until the budget is spent, returns cycleTotal like tick()
+
+	// set by whatever needs the cpu back before its budget is up (irq, dma, ppu), runFor stops at
+	// the next instr boundary and keeps returning straight away until the caller clears it
+	bool eventPending;
+
+private:
+
+	template <traceLevel level> void runArm(int target); // stay in ARM state until cycleTotal reaches target
+	template <traceLevel level> void runThumb(int target);
 
 public:
 
 	Bus* bus;
 	CPU(Bus*);
+	~CPU();
 	void reset();
 
-	void initializeOpFunctions(); // this is for initing the list of enums to funcs
+	// reset() is the state the tools here have always started from. powerOn is the real one, Supervisor
+	// at the reset vector with IRQ / FIQ masked, for running gba_bios.bin's intro. directBoot skips the
+	// intro: the registers, each mode's stack and the IO registers as the bios leaves them when it jumps
+	// to the cartridge, so the cartridge runs from 0x08000000 on the first cycle
+	void powerOn();
+	void directBoot();
 
-	uint16_t curOpCycles; // this is defaulted to 0 every time
-	int cycleTotal; // this is how we find out how many cycles have passed
+	// the architectural part on its own, copying it across is a snapshot / restore
+	CPUState& state() { return *this; }
+	const CPUState& state() const { return *this; }
 
 	uint32_t tick();
 	//Operation decode(uint32_t passedIns);
 	armInstr decodeArm(uint32_t instr);
-	int armExecute(armInstr instr);
-
-	uint32_t reg[16];
-
-	uint32_t& sp; // stack pointer ~ points to 13
-	uint32_t& lr; // link register ~ points to 14
-	uint32_t& pc; // program counter ~ points to 15
+	armInstr decodeArm(uint32_t instr, const armDecodeEntry& entry);
+	int armExecute(const armInstr& instr); // pc as the run loop has it for this instr, left on the next one
 
 	// instruction to take
 	uint32_t instruction;
 	//decoded operation
 	Operation curOP;
 
-	//current program status registers
-	union
-	{
-		struct
-		{
-			uint32_t M0 : 1;
-			uint32_t M1 : 1;
-			uint32_t M2 : 1;
-			uint32_t M3 : 1;
-			uint32_t M4 : 1;
-			uint32_t T : 1;
-			uint32_t F : 1;
-			uint32_t I : 1;
-
-			uint32_t RESERVED : 20;
-			uint32_t V : 1;
-			uint32_t C : 1;
-			uint32_t Z : 1;
-			uint32_t N : 1;
-		};
-		uint32_t CPSR;
-	};
-
 	//SPSR
 
 
@@ -304,40 +699,27 @@ public:
 	const char* CPSRtoString();
 	std::string CPSRtoStringPASSED(uint32_t base, uint32_t final, uint32_t passed);
 	uint32_t ThumbToARM(uint16_t thumbInstr, uint32_t pc, uint16_t nextThumbInstr);
-	inline bool checkConditional(uint8_t cond) const;
-
+	bool checkConditional(uint8_t cond)
+	{
+		if (cond == 0xE) return true;
+		if (pendingFlagOp != flagOp::None) return conditionTable[cond][pendingNZCV()];
+		return conditionTable[cond][CPSR >> 28];
+	}
 
-	const inline uint8_t pcOffset();
 
-	uint8_t read8(uint32_t addr, bool bReadOnly = false);
-	uint16_t read16(uint32_t addr, bool bReadOnly = false);
-	uint32_t read32(uint32_t addr, bool bReadOnly = false);
+	uint8_t read8(uint32_t addr);
+	uint16_t read16(uint32_t addr);
+	uint32_t read32(uint32_t addr);
 
 	void write8(uint32_t addr, uint8_t data);
 	void write16(uint32_t addr, uint16_t data);
 	void write32(uint32_t addr, uint32_t data);
 
-public:
-	enum class mode : uint8_t
-	{
-		User = 0x10,
-		FIQ = 0x11,
-		IRQ = 0x12,
-		Supervisor = 0x13,
-		Abort = 0x17,
-		Undefined = 0x1B,
-		System = 0x1F
-	};
-
 public:
 	//OPS FOR MODE SWITCHING / EXCEPTION HANDLING
 
 
 
-	mode curMode = mode::Supervisor; // curMode should default to Supervisor
-
-
-
 	bool isPrivilegedMode(); // used to quickly tell were not in user mode
 	uint8_t getModeIndex(CPU::mode mode); // used for register saving
 
@@ -345,7 +727,8 @@ public:
 	void bankRegisters(CPU::mode mode); // save reg val to bank
 	void unbankRegisters(CPU::mode mode); // load reg vals from bank
 
-	void switchMode(CPU::mode newMode); // main function used for mode switching, calls bank and unbank register etc
+	void swapBankedRegisters(CPU::mode oldMode, CPU::mode newMode); // only moves the registers the two modes don't share
+	void switchMode(CPU::mode newMode); // main function used for mode switching, swaps the banked registers etc
 	void saveIntoSpsr(uint8_t index);
 
 	// excpetion handling
@@ -361,14 +744,6 @@ public:
 	void writeCPSR(uint32_t value);
 	mode CPSRbitToMode(uint8_t modeBits);
 
-	// bank system so when we swap modes, we can store old modes inhere 
-	uint32_t r8FIQ[5];   // 8 9 10 11 12 registers stored for just fiq
-	uint32_t r8User[5]; // used for swaping back from fiq
-
-	uint32_t r13RegBank[6];  // individual SP for everone except usr/sys which share
-	uint32_t r14RegBank[6]; // individual LR for everone except usr/sys which share
-	uint32_t spsrBank[5]; // individual LR for everone except usr/sys have 0
-
 public:
 
 	//////////////////////////////////////////////////////////////////
@@ -383,7 +758,8 @@ public:
 	CPU::thumbInstr debugDecodedInstr(); //used to create a struct full of nulls , usefull for printig debugs
 
 	thumbInstr decodeThumb(uint16_t instruction); // this returns a thumbInstr struct
-	int thumbExecute(struct thumbInstr);
+	thumbInstr decodeThumb(uint16_t instruction, const thumbDecodeEntry& entry);
+	int thumbExecute(const thumbInstr& instr); // same as armExecute
 
 	//THUMB HELPERS
 	inline void updateFlagsNZCV_Add(uint32_t result, uint32_t op1, uint32_t op2);
@@ -398,126 +774,160 @@ public:
 	//////////////////////////////////////////////////////////////////
 
 
-	inline int opT_MOV_IMM(thumbInstr instr);
-	inline int opT_ADD_REG(thumbInstr instr);
-	inline int opT_ADD_IMM(thumbInstr instr);
-	inline int opT_ADD_IMM3(thumbInstr instr);
-	inline int opT_SUB_REG(thumbInstr instr);
-	inline int opT_SUB_IMM(thumbInstr instr);
-	inline int opT_SUB_IMM3(thumbInstr instr);
-	inline int opT_CMP_IMM(thumbInstr instr);
-	inline int opT_LSL_IMM(thumbInstr instr);
-	inline int opT_LSR_IMM(thumbInstr instr);
-	inline int opT_ASR_IMM(thumbInstr instr);
-	inline int opT_AND_REG(thumbInstr instr);
-	inline int opT_EOR_REG(thumbInstr instr);
-	inline int opT_LSL_REG(thumbInstr instr);
-	inline int opT_LSR_REG(thumbInstr instr);
-	inline int opT_ASR_REG(thumbInstr instr);
-	inline int opT_ADC_REG(thumbInstr instr);
-	inline int opT_SBC_REG(thumbInstr instr);
-	inline int opT_ROR_REG(thumbInstr instr);
-	inline int opT_TST_REG(thumbInstr instr);
-	inline int opT_NEG_REG(thumbInstr instr);
-	inline int opT_CMP_REG(thumbInstr instr);
-	inline int opT_CMN_REG(thumbInstr instr);
-	inline int opT_ORR_REG(thumbInstr instr);
-	inline int opT_MUL_REG(thumbInstr instr);
-	inline int opT_BIC_REG(thumbInstr instr);
-	inline int opT_MVN_REG(thumbInstr instr);
-	inline int opT_ADD_HI(thumbInstr instr);
-	inline int opT_CMP_HI(thumbInstr instr);
-	inline int opT_MOV_HI(thumbInstr instr);
-	inline int opT_BX(thumbInstr instr);
-	inline int opT_BLX_REG(thumbInstr instr);
-	inline int opT_LDR_PC(thumbInstr instr);
-	inline int opT_LDR_REG(thumbInstr instr);
-	inline int opT_STR_REG(thumbInstr instr);
-	inline int opT_LDRB_REG(thumbInstr instr);
-	inline int opT_STRB_REG(thumbInstr instr);
-	inline int opT_LDRH_REG(thumbInstr instr);
-	inline int opT_STRH_REG(thumbInstr instr);
-	inline int opT_LDRSB_REG(thumbInstr instr);
-	inline int opT_LDRSH_REG(thumbInstr instr);
-
-	inline int opT_LDR_IMM(thumbInstr instr);
-	inline int opT_STR_IMM(thumbInstr instr);
-	inline int opT_LDRB_IMM(thumbInstr instr);
-	inline int opT_STRB_IMM(thumbInstr instr);
-	inline int opT_LDRH_IMM(thumbInstr instr);
-	inline int opT_STRH_IMM(thumbInstr instr);
-	inline int opT_LDR_SP(thumbInstr instr);
-	inline int opT_STR_SP(thumbInstr instr);
-	inline int opT_ADD_PC(thumbInstr instr);
-	inline int opT_ADD_SP(thumbInstr instr);
-	inline int opT_ADD_SP_IMM(thumbInstr instr);
-	inline int opT_PUSH(thumbInstr instr);
-	inline int opT_POP(thumbInstr instr);
-	inline int opT_STMIA(thumbInstr instr);
-	inline int opT_LDMIA(thumbInstr instr);
-	inline int opT_B_COND(thumbInstr instr);
-	inline int opT_B(thumbInstr instr);
-	inline int opT_BL_PREFIX(thumbInstr instr);
-	inline int opT_BL_SUFFIX(thumbInstr instr);
-	inline int opT_SWI(thumbInstr instr);
-	inline int opT_UNDEFINED(thumbInstr instr);
+	inline int opT_MOV_IMM(const thumbInstr& instr);
+	inline int opT_ADD_REG(const thumbInstr& instr);
+	inline int opT_ADD_IMM(const thumbInstr& instr);
+	inline int opT_ADD_IMM3(const thumbInstr& instr);
+	inline int opT_SUB_REG(const thumbInstr& instr);
+	inline int opT_SUB_IMM(const thumbInstr& instr);
+	inline int opT_SUB_IMM3(const thumbInstr& instr);
+	inline int opT_CMP_IMM(const thumbInstr& instr);
+	inline int opT_LSL_IMM(const thumbInstr& instr);
+	inline int opT_LSR_IMM(const thumbInstr& instr);
+	inline int opT_ASR_IMM(const thumbInstr& instr);
+	inline int opT_AND_REG(const thumbInstr& instr);
+	inline int opT_EOR_REG(const thumbInstr& instr);
+	inline int opT_LSL_REG(const thumbInstr& instr);
+	inline int opT_LSR_REG(const thumbInstr& instr);
+	inline int opT_ASR_REG(const thumbInstr& instr);
+	inline int opT_ADC_REG(const thumbInstr& instr);
+	inline int opT_SBC_REG(const thumbInstr& instr);
+	inline int opT_ROR_REG(const thumbInstr& instr);
+	inline int opT_TST_REG(const thumbInstr& instr);
+	inline int opT_NEG_REG(const thumbInstr& instr);
+	inline int opT_CMP_REG(const thumbInstr& instr);
+	inline int opT_CMN_REG(const thumbInstr& instr);
+	inline int opT_ORR_REG(const thumbInstr& instr);
+	inline int opT_MUL_REG(const thumbInstr& instr);
+	inline int opT_BIC_REG(const thumbInstr& instr);
+	inline int opT_MVN_REG(const thumbInstr& instr);
+	inline int opT_ADD_HI(const thumbInstr& instr);
+	inline int opT_CMP_HI(const thumbInstr& instr);
+	inline int opT_MOV_HI(const thumbInstr& instr);
+	inline int opT_BX(const thumbInstr& instr);
+	inline int opT_BLX_REG(const thumbInstr& instr);
+	inline int opT_LDR_PC(const thumbInstr& instr);
+	inline int opT_LDR_REG(const thumbInstr& instr);
+	inline int opT_STR_REG(const thumbInstr& instr);
+	inline int opT_LDRB_REG(const thumbInstr& instr);
+	inline int opT_STRB_REG(const thumbInstr& instr);
+	inline int opT_LDRH_REG(const thumbInstr& instr);
+	inline int opT_STRH_REG(const thumbInstr& instr);
+	inline int opT_LDRSB_REG(const thumbInstr& instr);
+	inline int opT_LDRSH_REG(const thumbInstr& instr);
+
+	inline int opT_LDR_IMM(const thumbInstr& instr);
+	inline int opT_STR_IMM(const thumbInstr& instr);
+	inline int opT_LDRB_IMM(const thumbInstr& instr);
+	inline int opT_STRB_IMM(const thumbInstr& instr);
+	inline int opT_LDRH_IMM(const thumbInstr& instr);
+	inline int opT_STRH_IMM(const thumbInstr& instr);
+	inline int opT_LDR_SP(const thumbInstr& instr);
+	inline int opT_STR_SP(const thumbInstr& instr);
+	inline int opT_ADD_PC(const thumbInstr& instr);
+	inline int opT_ADD_SP(const thumbInstr& instr);
+	inline int opT_ADD_SP_IMM(const thumbInstr& instr);
+	inline int opT_PUSH(const thumbInstr& instr);
+	inline int opT_POP(const thumbInstr& instr);
+	inline int opT_STMIA(const thumbInstr& instr);
+	inline int opT_LDMIA(const thumbInstr& instr);
+	inline int opT_B_COND(const thumbInstr& instr);
+	inline int opT_B(const thumbInstr& instr);
+	inline int opT_BL_PREFIX(const thumbInstr& instr);
+	inline int opT_BL_SUFFIX(const thumbInstr& instr);
+	inline int opT_SWI(const thumbInstr& instr);
+	inline int opT_UNDEFINED(const thumbInstr& instr);
+	inline int opT_FUSED_BL(const thumbInstr& instr);
+	inline int opT_FUSED_CMP_BCOND(const thumbInstr& instr);
+	inline int opT_FUSED_SHIFT_ADD(const thumbInstr& instr);
+	inline int opT_LDR_LITERAL(const thumbInstr& instr);
 public:
 
 	//////////////////////////////////////////////////////////////////
 	//							EVERY ARM FUNC					    //
 	//////////////////////////////////////////////////////////////////
 
-	inline int opA_AND(armInstr instr);
-	inline int opA_EOR(armInstr instr);
-	inline int opA_SUB(armInstr instr);
-	inline int opA_RSB(armInstr instr);
-	inline int opA_ADD(armInstr instr);
-	inline int opA_ADC(armInstr instr);
-	inline int opA_SBC(armInstr instr);
-	inline int opA_RSC(armInstr instr);
-	inline int opA_TST(armInstr instr);
-	inline int opA_TEQ(armInstr instr);
-	inline int opA_CMP(armInstr instr);
-	inline int opA_CMN(armInstr instr);
-	inline int opA_ORR(armInstr instr);
-	inline int opA_MOV(armInstr instr);
-	inline int opA_BIC(armInstr instr);
-	inline int opA_MVN(armInstr instr);
-	inline int opA_MRS(armInstr instr);
-	inline int opA_MSR(armInstr instr);
-	inline int opA_LDR(armInstr instr);
-	inline int opA_STR(armInstr instr);
-	inline int opA_LDRH(armInstr instr);
-	inline int opA_STRH(armInstr instr);
-	inline int opA_LDRSB(armInstr instr);
-	inline int opA_LDRSH(armInstr instr);
-	inline int opA_LDM(armInstr instr);
-	inline int opA_STM(armInstr instr);
-	inline int opA_B(armInstr instr);
-	inline int opA_BL(armInstr instr);
-	inline int opA_BX(armInstr instr);
-	inline int opA_MUL(armInstr instr);
-	inline int opA_MLA(armInstr instr);
-	inline int opA_UMULL(armInstr instr);
-	inline int opA_UMLAL(armInstr instr);
-	inline int opA_SMULL(armInstr instr);
-	inline int opA_SMLAL(armInstr instr);
-	inline int opA_SWP(armInstr instr);
-	inline int opA_SWI(armInstr instr);
-	inline int opA_CDP(armInstr instr);
-	inline int opA_LDC(armInstr instr);
-	inline int opA_STC(armInstr instr);
-	inline int opA_MRC(armInstr instr);
-	inline int opA_MCR(armInstr instr);
-	inline int opA_UNDEFINED(armInstr instr);
+	inline int opA_AND(const armInstr& instr);
+	inline int opA_EOR(const armInstr& instr);
+	inline int opA_SUB(const armInstr& instr);
+	inline int opA_RSB(const armInstr& instr);
+	inline int opA_ADD(const armInstr& instr);
+	inline int opA_ADC(const armInstr& instr);
+	inline int opA_SBC(const armInstr& instr);
+	inline int opA_RSC(const armInstr& instr);
+	inline int opA_TST(const armInstr& instr);
+	inline int opA_TEQ(const armInstr& instr);
+	inline int opA_CMP(const armInstr& instr);
+	inline int opA_CMN(const armInstr& instr);
+	inline int opA_ORR(const armInstr& instr);
+	inline int opA_MOV(const armInstr& instr);
+	inline int opA_BIC(const armInstr& instr);
+	inline int opA_MVN(const armInstr& instr);
+	inline int opA_MRS(const armInstr& instr);
+	inline int opA_MSR(const armInstr& instr);
+	inline int opA_LDR(const armInstr& instr);
+	inline int opA_STR(const armInstr& instr);
+	inline int opA_LDRH(const armInstr& instr);
+	inline int opA_STRH(const armInstr& instr);
+	inline int opA_LDRSB(const armInstr& instr);
+	inline int opA_LDRSH(const armInstr& instr);
+	inline int opA_LDM(const armInstr& instr);
+	inline int opA_STM(const armInstr& instr);
+	inline int opA_B(const armInstr& instr);
+	inline int opA_BL(const armInstr& instr);
+	inline int opA_BX(const armInstr& instr);
+	inline int opA_MUL(const armInstr& instr);
+	inline int opA_MLA(const armInstr& instr);
+	inline int opA_UMULL(const armInstr& instr);
+	inline int opA_UMLAL(const armInstr& instr);
+	inline int opA_SMULL(const armInstr& instr);
+	inline int opA_SMLAL(const armInstr& instr);
+	inline int opA_SWP(const armInstr& instr);
+	inline int opA_SWI(const armInstr& instr);
+	inline int opA_CDP(const armInstr& instr);
+	inline int opA_LDC(const armInstr& instr);
+	inline int opA_STC(const armInstr& instr);
+	inline int opA_MRC(const armInstr& instr);
+	inline int opA_MCR(const armInstr& instr);
+	inline int opA_UNDEFINED(const armInstr& instr);
+
+	// the shifter operand as the decode table resolves it, the shiftType these are instantiated with.
+	// the first four shift by an immediate of 1-31 (or by a register), the rest are what an immediate
+	// amount of 0 really means. an immediate operand 2 is ShiftROR when its rotation gives the carry,
+	// ShiftNone when it is unrotated and C is left alone
+	enum shifterForm : uint8_t { ShiftLSL, ShiftLSR, ShiftASR, ShiftROR, ShiftNone, ShiftLSR32, ShiftASR32, ShiftRRX };
+
+	// specialized families, the flag bits of the encoding are template parameters so every
+	// instantiation is branch free on them. the decode table points straight at these, the
+	// opA_ entry points above pick the matching instantiation for an already decoded instr
+	template <armOperation op, bool immediate, bool setFlags, bool shiftByReg, uint8_t shiftType>
+	inline int opA_DataProcessing(const armInstr& instr);
+	template <bool regOffset, bool preIndex, bool up, bool byte, bool writeBack, uint8_t shiftType>
+	inline int opA_SingleLoad(const armInstr& instr);
+	template <bool regOffset, bool preIndex, bool up, bool byte, bool writeBack, uint8_t shiftType>
+	inline int opA_SingleStore(const armInstr& instr);
+	template <bool preIndex, bool up, bool userBank, bool writeBack>
+	inline int opA_BlockLoad(const armInstr& instr);
+	template <bool preIndex, bool up, bool userBank, bool writeBack>
+	inline int opA_BlockStore(const armInstr& instr);
+
+	// LDM / STM / PUSH / POP whose whole block sits in plain RAM move it in one go instead of a
+	// read32 / write32 per register. null from blockTransferRam means take the per register path
+	uint8_t* blockTransferRam(uint32_t addr, int numRegs, bool write);
+	void loadRegisterBlock(uint16_t registerList, int numRegs, const uint8_t* from);
+	void storeRegisterBlock(uint16_t registerList, int numRegs, uint8_t* to);
 
 public: // helper for data rpocessing
 
 	inline void writeALUResult(uint8_t rdI, uint32_t result, bool s);
 
 	// new arm ops
-	inline uint32_t getArmOp2(armInstr instr, bool* carryOut);
-	inline uint32_t getArmOffset(armInstr instr);
+	template <bool immediate, bool shiftByReg, uint8_t shiftType>
+	inline uint32_t getArmOp2(const armInstr& instr, bool* carryOut);
+	template <bool regOffset, uint8_t shiftType>
+	inline uint32_t getArmOffset(const armInstr& instr);
+	template <uint8_t form>
+	inline uint32_t shiftByImmediate(uint32_t value, uint8_t amount, bool* carryOut);
 
 	const inline uint8_t DPgetRn();
 	const inline uint8_t DPgetRd();
@@ -538,7 +948,8 @@ public: // helper for data rpocessing
 
 	// cycle calculation helpers
 
-	inline int dataProcessingCycleCalculator();
+	template <bool immediate, bool shiftByReg>
+	inline int dataProcessingCycleCalculator(uint8_t rd);
 
 	// shift helpers
 
@@ -548,7 +959,6 @@ public: // helper for data rpocessing
 	inline uint32_t DPshiftROR(uint32_t value, uint8_t shift_amount, bool* carry_out);
 
 	//shift for memory
-	inline uint32_t SDapplyShift(uint32_t rmVal, uint8_t type, uint8_t amount); // singledata apply shift
 	inline uint32_t applyRegisterShift(uint32_t value, uint8_t shift_type, uint8_t shift_amount, bool* carry_out);
 
 	//flag related helper
@@ -1,11 +1,25 @@
 #include "DebuggerCPU.h"
 #include "CPU.h"
+#include "JIT.h"
+#include "AOT.h"
 #include <cstdint>
+#include <cstddef>
 #include <string>
 #include <sstream>
 
 #include <iomanip>
 #include <iostream>
+#include <vector>
+#include <chrono>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
 
 DebuggerCPU::DebuggerCPU(CPU* cpu)
 {
@@ -187,6 +201,14 @@ void printTestResult(const char* testName, bool passed)
     }
 }
 
+// where the pipeline has things when a thumb handler at addr runs: THUMB state, r15 two halfwords on.
+// the tests call handlers directly, so the branch checks look at cpu.nextInstrAddr() afterwards
+void atThumbInstr(CPU& cpu, uint32_t addr)
+{
+    cpu.T = 1;
+    cpu.pc() = addr + 4;
+}
+
 // ============================================================
 // FORMAT 1: MOVE SHIFTED REGISTER
 // ============================================================
@@ -1113,9 +1135,9 @@ bool testBX(CPU& cpu)
         return false;
     }
 
-    if (cpu.pc != 0x08000100)
+    if (cpu.nextInstrAddr() != 0x08000100)
     {
-        std::cout << "  Expected PC=0x08000100, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000100, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
 
@@ -1129,7 +1151,7 @@ bool testBX(CPU& cpu)
 bool testLDR_PC(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
 
     // Calculate target address: (PC + 2 + 2) & ~2 + offset
     uint32_t targetAddr = 0x0800010C;
@@ -1542,7 +1564,7 @@ bool testLDR_SP(CPU& cpu)
 bool testADD_PC(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
 
     CPU::thumbInstr instr;
     instr.rd = 0;
@@ -1693,9 +1715,9 @@ bool testPOP_PC(CPU& cpu)
     CPU::thumbInstr instr;
     instr.imm = (1 << 15); 
     cpu.opT_POP(instr);
-    if (cpu.pc != 0x08000100)
+    if (cpu.nextInstrAddr() != 0x08000100)
     {
-        std::cout << "  Expected PC=0x08000100, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000100, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -1821,16 +1843,16 @@ bool testPUSH_All(CPU& cpu)
 bool testBEQ_Taken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.Z = 1;  // Condition true
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0x0;  // EQ condition
     instr.imm = 0x04 << 1;  // Already shifted by decoder (8 bytes)
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x0800010C)  // 0x100 + 4 + 8
+    if (cpu.nextInstrAddr() != 0x0800010C)  // 0x100 + 4 + 8
     {
-        std::cout << "  Expected PC=0x0800010C, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x0800010C, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -1839,15 +1861,15 @@ bool testBEQ_Taken(CPU& cpu)
 bool testBEQ_NotTaken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.Z = 0;  // Condition false
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0x0;  // EQ
     instr.imm = 0x04 << 1;
-    uint32_t oldPC = cpu.pc;
+    uint32_t oldPC = cpu.pc();
     cpu.opT_B_COND(instr);
-    if (cpu.pc != oldPC && cpu.pc != oldPC + 2)
+    if (cpu.pc() != oldPC && cpu.pc() != oldPC + 2)
     {
         std::cout << "  Branch should not be taken, PC changed incorrectly" << std::endl;
         return false;
@@ -1859,16 +1881,16 @@ bool testBEQ_NotTaken(CPU& cpu)
 bool testBNE_Taken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.Z = 0;  // Condition true
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0x1;  // NE condition
     instr.imm = 0x08 << 1;  // Already shifted (16 bytes)
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000114)  // 0x100 + 4 + 0x10
+    if (cpu.nextInstrAddr() != 0x08000114)  // 0x100 + 4 + 0x10
     {
-        std::cout << "  Expected PC=0x08000114, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000114, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -1877,15 +1899,15 @@ bool testBNE_Taken(CPU& cpu)
 bool testBNE_NotTaken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.Z = 1;  // Condition false
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0x1;  // NE
     instr.imm = 0x08 << 1;
-    uint32_t oldPC = cpu.pc;
+    uint32_t oldPC = cpu.pc();
     cpu.opT_B_COND(instr);
-    if (cpu.pc != oldPC && cpu.pc != oldPC + 2)
+    if (cpu.pc() != oldPC && cpu.pc() != oldPC + 2)
     {
         std::cout << "  Branch should not be taken" << std::endl;
         return false;
@@ -1897,16 +1919,16 @@ bool testBNE_NotTaken(CPU& cpu)
 bool testBCS_Taken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.C = 1;  // Condition true
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0x2;  // CS/HS condition
     instr.imm = 0x02 << 1;  // Already shifted
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -1915,15 +1937,15 @@ bool testBCS_Taken(CPU& cpu)
 bool testBCS_NotTaken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.C = 0;  // Condition false
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0x2;  // CS/HS
     instr.imm = 0x02 << 1;
-    uint32_t oldPC = cpu.pc;
+    uint32_t oldPC = cpu.pc();
     cpu.opT_B_COND(instr);
-    if (cpu.pc != oldPC && cpu.pc != oldPC + 2)
+    if (cpu.pc() != oldPC && cpu.pc() != oldPC + 2)
     {
         std::cout << "  Branch should not be taken" << std::endl;
         return false;
@@ -1935,16 +1957,16 @@ bool testBCS_NotTaken(CPU& cpu)
 bool testBCC_Taken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.C = 0;  // Condition true
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0x3;  // CC/LO condition
     instr.imm = 0x02 << 1;
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -1954,16 +1976,16 @@ bool testBCC_Taken(CPU& cpu)
 bool testBMI_Taken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.N = 1;  // Condition true
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0x4;  // MI condition
     instr.imm = 0x02 << 1;
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -1973,16 +1995,16 @@ bool testBMI_Taken(CPU& cpu)
 bool testBPL_Taken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.N = 0;  // Condition true
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0x5;  // PL condition
     instr.imm = 0x02 << 1;
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -1992,16 +2014,16 @@ bool testBPL_Taken(CPU& cpu)
 bool testBVS_Taken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.V = 1;  // Condition true
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0x6;  // VS condition
     instr.imm = 0x02 << 1;
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2011,16 +2033,16 @@ bool testBVS_Taken(CPU& cpu)
 bool testBVC_Taken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.V = 0;  // Condition true
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0x7;  // VC condition
     instr.imm = 0x02 << 1;
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2030,7 +2052,7 @@ bool testBVC_Taken(CPU& cpu)
 bool testBHI_Taken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.C = 1;
     cpu.Z = 0;  // Condition true
     CPU::thumbInstr instr;
@@ -2038,9 +2060,9 @@ bool testBHI_Taken(CPU& cpu)
     instr.cond = 0x8;  // HI condition
     instr.imm = 0x02 << 1;
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2049,16 +2071,16 @@ bool testBHI_Taken(CPU& cpu)
 bool testBHI_NotTaken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.C = 1;
     cpu.Z = 1;  // Condition false (Z=1 means equal)
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0x8;  // HI
     instr.imm = 0x02 << 1;
-    uint32_t oldPC = cpu.pc;
+    uint32_t oldPC = cpu.pc();
     cpu.opT_B_COND(instr);
-    if (cpu.pc != oldPC && cpu.pc != oldPC + 2)
+    if (cpu.pc() != oldPC && cpu.pc() != oldPC + 2)
     {
         std::cout << "  Branch should not be taken" << std::endl;
         return false;
@@ -2070,7 +2092,7 @@ bool testBHI_NotTaken(CPU& cpu)
 bool testBLS_Taken_Carry(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.C = 0;  // Condition true (carry clear)
     cpu.Z = 0;
     CPU::thumbInstr instr;
@@ -2078,9 +2100,9 @@ bool testBLS_Taken_Carry(CPU& cpu)
     instr.cond = 0x9;  // LS condition
     instr.imm = 0x02 << 1;
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2089,7 +2111,7 @@ bool testBLS_Taken_Carry(CPU& cpu)
 bool testBLS_Taken_Zero(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.C = 1;
     cpu.Z = 1;  // Condition true (zero set)
     CPU::thumbInstr instr;
@@ -2097,9 +2119,9 @@ bool testBLS_Taken_Zero(CPU& cpu)
     instr.cond = 0x9;  // LS
     instr.imm = 0x02 << 1;
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2108,16 +2130,16 @@ bool testBLS_Taken_Zero(CPU& cpu)
 bool testBLS_NotTaken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.C = 1;  // Both conditions false
     cpu.Z = 0;
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0x9;  // LS
     instr.imm = 0x02 << 1;
-    uint32_t oldPC = cpu.pc;
+    uint32_t oldPC = cpu.pc();
     cpu.opT_B_COND(instr);
-    if (cpu.pc != oldPC && cpu.pc != oldPC + 2)
+    if (cpu.pc() != oldPC && cpu.pc() != oldPC + 2)
     {
         std::cout << "  Branch should not be taken" << std::endl;
         return false;
@@ -2129,7 +2151,7 @@ bool testBLS_NotTaken(CPU& cpu)
 bool testBGE_Taken_BothSet(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.N = 1;
     cpu.V = 1;  // N=V, condition true
     CPU::thumbInstr instr;
@@ -2137,9 +2159,9 @@ bool testBGE_Taken_BothSet(CPU& cpu)
     instr.cond = 0xA;  // GE condition
     instr.imm = 0x02 << 1;
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2148,7 +2170,7 @@ bool testBGE_Taken_BothSet(CPU& cpu)
 bool testBGE_Taken_BothClear(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.N = 0;
     cpu.V = 0;  // N=V, condition true
     CPU::thumbInstr instr;
@@ -2156,9 +2178,9 @@ bool testBGE_Taken_BothClear(CPU& cpu)
     instr.cond = 0xA;  // GE
     instr.imm = 0x02 << 1;
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2167,16 +2189,16 @@ bool testBGE_Taken_BothClear(CPU& cpu)
 bool testBGE_NotTaken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.N = 1;
     cpu.V = 0;  // N!=V, condition false
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0xA;  // GE
     instr.imm = 0x02 << 1;
-    uint32_t oldPC = cpu.pc;
+    uint32_t oldPC = cpu.pc();
     cpu.opT_B_COND(instr);
-    if (cpu.pc != oldPC && cpu.pc != oldPC + 2)
+    if (cpu.pc() != oldPC && cpu.pc() != oldPC + 2)
     {
         std::cout << "  Branch should not be taken" << std::endl;
         return false;
@@ -2188,7 +2210,7 @@ bool testBGE_NotTaken(CPU& cpu)
 bool testBLT_Taken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.N = 1;
     cpu.V = 0;  // N!=V, condition true
     CPU::thumbInstr instr;
@@ -2196,9 +2218,9 @@ bool testBLT_Taken(CPU& cpu)
     instr.cond = 0xB;  // LT condition
     instr.imm = 0x02 << 1;
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2207,16 +2229,16 @@ bool testBLT_Taken(CPU& cpu)
 bool testBLT_NotTaken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.N = 1;
     cpu.V = 1;  // N=V, condition false
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0xB;  // LT
     instr.imm = 0x02 << 1;
-    uint32_t oldPC = cpu.pc;
+    uint32_t oldPC = cpu.pc();
     cpu.opT_B_COND(instr);
-    if (cpu.pc != oldPC && cpu.pc != oldPC + 2)
+    if (cpu.pc() != oldPC && cpu.pc() != oldPC + 2)
     {
         std::cout << "  Branch should not be taken" << std::endl;
         return false;
@@ -2228,7 +2250,7 @@ bool testBLT_NotTaken(CPU& cpu)
 bool testBGT_Taken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.Z = 0;
     cpu.N = 1;
     cpu.V = 1;  // Z=0 and N=V, condition true
@@ -2237,9 +2259,9 @@ bool testBGT_Taken(CPU& cpu)
     instr.cond = 0xC;  // GT condition
     instr.imm = 0x02 << 1;
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2248,7 +2270,7 @@ bool testBGT_Taken(CPU& cpu)
 bool testBGT_NotTaken_Zero(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.Z = 1;  // Zero set, condition false
     cpu.N = 1;
     cpu.V = 1;
@@ -2256,9 +2278,9 @@ bool testBGT_NotTaken_Zero(CPU& cpu)
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0xC;  // GT
     instr.imm = 0x02 << 1;
-    uint32_t oldPC = cpu.pc;
+    uint32_t oldPC = cpu.pc();
     cpu.opT_B_COND(instr);
-    if (cpu.pc != oldPC && cpu.pc != oldPC + 2)
+    if (cpu.pc() != oldPC && cpu.pc() != oldPC + 2)
     {
         std::cout << "  Branch should not be taken (Z=1)" << std::endl;
         return false;
@@ -2269,7 +2291,7 @@ bool testBGT_NotTaken_Zero(CPU& cpu)
 bool testBGT_NotTaken_NV(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.Z = 0;
     cpu.N = 1;
     cpu.V = 0;  // N!=V, condition false
@@ -2277,9 +2299,9 @@ bool testBGT_NotTaken_NV(CPU& cpu)
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0xC;  // GT
     instr.imm = 0x02 << 1;
-    uint32_t oldPC = cpu.pc;
+    uint32_t oldPC = cpu.pc();
     cpu.opT_B_COND(instr);
-    if (cpu.pc != oldPC && cpu.pc != oldPC + 2)
+    if (cpu.pc() != oldPC && cpu.pc() != oldPC + 2)
     {
         std::cout << "  Branch should not be taken (N!=V)" << std::endl;
         return false;
@@ -2291,7 +2313,7 @@ bool testBGT_NotTaken_NV(CPU& cpu)
 bool testBLE_Taken_Zero(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.Z = 1;  // Condition true (zero set)
     cpu.N = 0;
     cpu.V = 0;
@@ -2300,9 +2322,9 @@ bool testBLE_Taken_Zero(CPU& cpu)
     instr.cond = 0xD;  // LE condition
     instr.imm = 0x02 << 1;
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2311,7 +2333,7 @@ bool testBLE_Taken_Zero(CPU& cpu)
 bool testBLE_Taken_NV(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.Z = 0;
     cpu.N = 1;
     cpu.V = 0;  // N!=V, condition true
@@ -2320,9 +2342,9 @@ bool testBLE_Taken_NV(CPU& cpu)
     instr.cond = 0xD;  // LE
     instr.imm = 0x02 << 1;
     cpu.opT_B_COND(instr);
-    if (cpu.pc != 0x08000108)
+    if (cpu.nextInstrAddr() != 0x08000108)
     {
-        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000108, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2331,7 +2353,7 @@ bool testBLE_Taken_NV(CPU& cpu)
 bool testBLE_NotTaken(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.Z = 0;  // Both conditions false
     cpu.N = 1;
     cpu.V = 1;
@@ -2339,9 +2361,9 @@ bool testBLE_NotTaken(CPU& cpu)
     instr.type = CPU::thumbOperation::THUMB_B_COND;
     instr.cond = 0xD;  // LE
     instr.imm = 0x02 << 1;
-    uint32_t oldPC = cpu.pc;
+    uint32_t oldPC = cpu.pc();
     cpu.opT_B_COND(instr);
-    if (cpu.pc != oldPC && cpu.pc != oldPC + 2)
+    if (cpu.pc() != oldPC && cpu.pc() != oldPC + 2)
     {
         std::cout << "  Branch should not be taken" << std::endl;
         return false;
@@ -2353,7 +2375,7 @@ bool testBLE_NotTaken(CPU& cpu)
 bool testBEQ_Backward(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.Z = 1;
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
@@ -2361,9 +2383,9 @@ bool testBEQ_Backward(CPU& cpu)
     instr.imm = (int32_t)(-4 << 1);  // Already shifted: -8 bytes
     cpu.opT_B_COND(instr);
     // PC = 0x100 + 4 + (-8) = 0xFC
-    if (cpu.pc != 0x080000FC)
+    if (cpu.nextInstrAddr() != 0x080000FC)
     {
-        std::cout << "  Expected PC=0x080000FC, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x080000FC, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2373,7 +2395,7 @@ bool testBEQ_Backward(CPU& cpu)
 bool testBranch_MaxForward(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.Z = 1;
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
@@ -2381,9 +2403,9 @@ bool testBranch_MaxForward(CPU& cpu)
     instr.imm = 127 << 1;  // Already shifted: 254 bytes
     cpu.opT_B_COND(instr);
     // PC = 0x100 + 4 + 254 = 0x1FE
-    if (cpu.pc != 0x8000202)
+    if (cpu.nextInstrAddr() != 0x8000202)
     {
-        std::cout << "  Expected PC=0x080001FE, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x080001FE, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2393,7 +2415,7 @@ bool testBranch_MaxForward(CPU& cpu)
 bool testBranch_MaxBackward(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     cpu.Z = 1;
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B_COND;
@@ -2401,9 +2423,9 @@ bool testBranch_MaxBackward(CPU& cpu)
     instr.imm = (int32_t)(-128 << 1);  // Already shifted: -256 bytes
     cpu.opT_B_COND(instr);
     // PC = 0x100 + 4 + (-256) = 0x04
-    if (cpu.pc != 0x08000004)
+    if (cpu.nextInstrAddr() != 0x08000004)
     {
-        std::cout << "  Expected PC=0x08000004, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000004, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2416,15 +2438,15 @@ bool testBranch_MaxBackward(CPU& cpu)
 bool testB_Forward(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B;
     instr.imm = 0x100 << 1;  // Already shifted: 512 bytes
     cpu.opT_B(instr);
     // PC = 0x100 + 4 + 0x200 = 0x304
-    if (cpu.pc != 0x08000304)
+    if (cpu.nextInstrAddr() != 0x08000304)
     {
-        std::cout << "  Expected PC=0x08000304, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000304, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2433,15 +2455,15 @@ bool testB_Forward(CPU& cpu)
 bool testB_Backward(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B;
     instr.imm = (int32_t)(-256 << 1);  // Already shifted: -512 bytes
     cpu.opT_B(instr);
     // PC = 0x100 + 4 + (-0x200) = 0x7FFFF04
-    if (cpu.pc != 0x07FFFF04)
+    if (cpu.nextInstrAddr() != 0x07FFFF04)
     {
-        std::cout << "  Expected PC=0x07FFFF04, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x07FFFF04, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2450,15 +2472,15 @@ bool testB_Backward(CPU& cpu)
 bool testB_MaxRange(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_B;
     instr.imm = 1023 << 1;  // Already shifted: 2046 bytes
     cpu.opT_B(instr);
     // PC = 0x100 + 4 + 0x7FE = 0x902
-    if (cpu.pc != 0x08000902)
+    if (cpu.nextInstrAddr() != 0x08000902)
     {
-        std::cout << "  Expected PC=0x08000902, got 0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x08000902, got 0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2471,16 +2493,16 @@ bool testB_MaxRange(CPU& cpu)
 bool testBL_Prefix(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_BL_PREFIX;
     instr.imm = 0x400 << 12;  // Already shifted by 12: 0x400000
     cpu.opT_BL_PREFIX(instr);
     // LR = PC + 4 + 0x400000 = 0x08400104
     uint32_t expected = 0x08400104;
-    if (cpu.lr != expected)
+    if (cpu.lr() != expected)
     {
-        std::cout << "  Expected LR=0x" << std::hex << expected << ", got 0x" << cpu.lr << std::dec << std::endl;
+        std::cout << "  Expected LR=0x" << std::hex << expected << ", got 0x" << cpu.lr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2489,25 +2511,25 @@ bool testBL_Prefix(CPU& cpu)
 bool testBL_Suffix(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000102;  // After BL prefix instruction
-    cpu.lr = 0x08400104;  // From BL prefix
+    atThumbInstr(cpu, 0x08000102);  // After BL prefix instruction
+    cpu.lr() = 0x08400104;  // From BL prefix
     CPU::thumbInstr instr;
     instr.type = CPU::thumbOperation::THUMB_BL_SUFFIX;
     instr.imm = 0x200 << 1;  // Already shifted by 1: 0x400
-    uint32_t oldPC = cpu.pc;
+    uint32_t oldPC = cpu.nextInstrAddr();
     cpu.opT_BL_SUFFIX(instr);
     // PC = LR + 0x400 = 0x08400504
     uint32_t expectedPC = 0x08400504;
-    if (cpu.pc != expectedPC)
+    if (cpu.nextInstrAddr() != expectedPC)
     {
-        std::cout << "  Expected PC=0x" << std::hex << expectedPC << ", got 0x" << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected PC=0x" << std::hex << expectedPC << ", got 0x" << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     // LR = (oldPC + 2) | 1 = 0x08000105
     uint32_t expectedLR = (oldPC + 2) | 1;
-    if (cpu.lr != expectedLR)
+    if (cpu.lr() != expectedLR)
     {
-        std::cout << "  Expected LR=0x" << std::hex << expectedLR << ", got 0x" << cpu.lr << std::dec << std::endl;
+        std::cout << "  Expected LR=0x" << std::hex << expectedLR << ", got 0x" << cpu.lr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2516,7 +2538,7 @@ bool testBL_Suffix(CPU& cpu)
 bool testBL_NegativeOffset(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000100;
+    atThumbInstr(cpu, 0x08000100);
     // First instruction: BL prefix with negative offset
     CPU::thumbInstr instr1;
     instr1.type = CPU::thumbOperation::THUMB_BL_PREFIX;
@@ -2524,16 +2546,16 @@ bool testBL_NegativeOffset(CPU& cpu)
     instr1.imm = (int32_t)(-1 << 12);  // 0xFFFFF000
     cpu.opT_BL_PREFIX(instr1);
 
-    cpu.pc = 0x08000102;
+    atThumbInstr(cpu, 0x08000102);
     CPU::thumbInstr instr2;
     instr2.type = CPU::thumbOperation::THUMB_BL_SUFFIX;
     instr2.imm = 0x400 << 1;  // Already shifted
     cpu.opT_BL_SUFFIX(instr2);
 
     // Should branch backward
-    if (cpu.pc >= 0x08000100)
+    if (cpu.nextInstrAddr() >= 0x08000100)
     {
-        std::cout << "  Branch should go backward, got PC=0x" << std::hex << cpu.pc << std::dec << std::endl;
+        std::cout << "  Branch should go backward, got PC=0x" << std::hex << cpu.nextInstrAddr() << std::dec << std::endl;
         return false;
     }
     return true;
@@ -2543,28 +2565,331 @@ bool testBL_NegativeOffset(CPU& cpu)
 bool testBL_MaxRange(CPU& cpu)
 {
     cpu.reset();
-    cpu.pc = 0x08000000;
+    atThumbInstr(cpu, 0x08000000);
 
     CPU::thumbInstr instr1;
     instr1.type = CPU::thumbOperation::THUMB_BL_PREFIX;
     instr1.imm = 0x7FF << 12; 
     cpu.opT_BL_PREFIX(instr1);
 
-    cpu.pc = 0x08000002;
+    atThumbInstr(cpu, 0x08000002);
     CPU::thumbInstr instr2;
     instr2.type = CPU::thumbOperation::THUMB_BL_SUFFIX;
     instr2.imm = 0x7FF << 1; 
     cpu.opT_BL_SUFFIX(instr2);
 
     uint32_t expected = 0x08800002;
-    if (cpu.pc != expected)
+    if (cpu.nextInstrAddr() != expected)
+    {
+        std::cout << "  Expected PC=0x" << std::hex << expected << ", got 0x" << cpu.nextInstrAddr() << std::dec << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// ============================================================
+// BLOCK CACHE: SELF MODIFYING CODE IN IWRAM
+// ============================================================
+
+// MOV r0,#imm / ADD r1,r1,r0 / B base, with the MOV immediate patched from outside between runs
+bool testBlockCache_PatchIWRAM(CPU& cpu)
+{
+    const uint32_t base = 0x03000100;
+    cpu.reset();
+    cpu.flushBlockCache();
+    cpu.T = 1;
+    cpu.branchTo(base);
+
+    cpu.bus->write16(base + 2, 0x1809); // ADD r1, r1, r0
+    cpu.bus->write16(base + 4, 0xE7FC); // B base
+
+    for (uint32_t imm = 1; imm < 200; imm++)
+    {
+        cpu.bus->write16(base, 0x2000 | imm); // MOV r0, #imm
+        cpu.tickBlock();
+
+        if (cpu.reg[0] != imm || cpu.nextInstrAddr() != base)
+        {
+            std::cout << "  Expected R0=" << imm << ", got " << cpu.reg[0] << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// a write into the same page but outside the block must leave the block cached
+bool testBlockCache_WriteBesideBlock(CPU& cpu)
+{
+    const uint32_t base = 0x03000100;
+    cpu.reset();
+    cpu.flushBlockCache();
+    cpu.T = 1;
+    cpu.branchTo(base);
+
+    cpu.bus->write16(base, 0x2007);     // MOV r0, #7
+    cpu.bus->write16(base + 2, 0x1809); // ADD r1, r1, r0
+    cpu.bus->write16(base + 4, 0xE7FC); // B base
+
+    cpu.tickBlock();
+    cpu.bus->write32(base + 0x40, 0x12345678);
+    cpu.tickBlock();
+    cpu.tickBlock();
+
+    if (cpu.blockHits != 2 || cpu.reg[1] != 21)
+    {
+        std::cout << "  Expected 2 hits and R1=21, got " << cpu.blockHits << " hits and R1=" << cpu.reg[1] << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// the block stores over its own first instr while being replayed, the next pass has to run the new one
+bool testBlockCache_SelfModify(CPU& cpu)
+{
+    const uint32_t base = 0x03000100;
+    cpu.reset();
+    cpu.flushBlockCache();
+    cpu.T = 1;
+    cpu.branchTo(base);
+
+    cpu.bus->write16(base, 0x2001);     // MOV r0, #1
+    cpu.bus->write16(base + 2, 0x1809); // ADD r1, r1, r0
+    cpu.bus->write16(base + 4, 0x801A); // STRH r2, [r3, #0]
+    cpu.bus->write16(base + 6, 0xE7FB); // B base
+
+    cpu.reg[2] = 0x2005;       // MOV r0, #5
+    cpu.reg[3] = base + 0x80;  // first few passes store beside the block
+
+    for (int i = 0; i < 4; i++) cpu.tickBlock();
+
+    cpu.reg[3] = base;
+    for (int i = 0; i < 4; i++) cpu.tickBlock();
+
+    if (cpu.reg[0] != 5 || cpu.bus->read16(base) != 0x2005)
     {
-        std::cout << "  Expected PC=0x" << std::hex << expected << ", got 0x" << cpu.pc << std::dec << std::endl;
+        std::cout << "  Expected R0=5, got " << cpu.reg[0] << std::endl;
         return false;
     }
+
     return true;
 }
 
+// same patch as PatchIWRAM, but after the loop is hot enough to be compiled and linked to itself
+bool testJit_PatchHotIWRAM(CPU& cpu)
+{
+    if (!JIT::isSupported()) return true;
+
+    const uint32_t base = 0x03000100;
+    cpu.reset();
+    cpu.flushBlockCache();
+    cpu.setJitEnabled(true);
+    cpu.T = 1;
+    cpu.branchTo(base);
+
+    cpu.bus->write16(base, 0x2001);     // MOV r0, #1
+    cpu.bus->write16(base + 2, 0x1809); // ADD r1, r1, r0
+    cpu.bus->write16(base + 4, 0xE7FC); // B base
+
+    for (int i = 0; i < 32; i++) cpu.tickBlock();
+    bool compiled = cpu.jit->compiledBlocks > 0;
+
+    cpu.bus->write16(base, 0x2009);     // MOV r0, #9
+    cpu.tickBlock();
+
+    bool passed = compiled && cpu.reg[0] == 9 && cpu.nextInstrAddr() == base;
+    if (!passed)
+    {
+        std::cout << "  Expected a compiled block and R0=9, got " << cpu.jit->compiledBlocks << " blocks and R0=" << cpu.reg[0] << std::endl;
+    }
+
+    cpu.setJitEnabled(false);
+    return passed;
+}
+
+// FUSED THUMB PAIRS
+// a block is run twice with fusion off and twice with it on. the first pass records and the second
+// replays, so only the second fused pass goes through the fused entries, and it has to leave the
+// registers, flags, cycles and pc exactly where the plain replay did
+
+struct fusionRun
+{
+    uint32_t regs[16];
+    uint32_t cpsr;
+    int cycles;
+    uint32_t next;
+    uint64_t fused;
+};
+
+static fusionRun runThumbBlockTwice(CPU& cpu, bool fusion, uint32_t base, const std::vector<uint32_t>& startRegs, CPU::fusionPattern pattern)
+{
+    fusionRun run = {};
+    cpu.reset();
+    cpu.setFusion(fusion);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        cpu.T = 1;
+        for (size_t i = 0; i < startRegs.size(); i++) cpu.reg[i] = startRegs[i];
+        cpu.branchTo(base);
+
+        int cycles = cpu.cycleTotal;
+        uint64_t fused = cpu.fusedRuns[static_cast<int>(pattern)];
+        cpu.tickBlock();
+        run.cycles = cpu.cycleTotal - cycles;
+        run.fused = cpu.fusedRuns[static_cast<int>(pattern)] - fused;
+    }
+
+    for (int i = 0; i < 16; i++) run.regs[i] = cpu.reg[i];
+    run.cpsr = cpu.CPSR;
+    run.next = cpu.nextInstrAddr();
+    return run;
+}
+
+static bool checkFusedBlock(CPU& cpu, const char* name, uint32_t base, const std::vector<uint32_t>& startRegs, CPU::fusionPattern pattern)
+{
+    bool fusion = cpu.fusion;
+    fusionRun plain = runThumbBlockTwice(cpu, false, base, startRegs, pattern);
+    fusionRun fused = runThumbBlockTwice(cpu, true, base, startRegs, pattern);
+    cpu.setFusion(fusion);
+
+    bool passed = plain.fused == 0 && fused.fused > 0;
+    if (!passed)
+    {
+        std::cout << "  " << name << ": expected fused runs, got " << fused.fused << std::endl;
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        if (plain.regs[i] != fused.regs[i])
+        {
+            std::cout << "  " << name << ": R" << i << " plain 0x" << std::hex << plain.regs[i] << ", fused 0x" << fused.regs[i] << std::dec << std::endl;
+            passed = false;
+        }
+    }
+    if (plain.cpsr != fused.cpsr)
+    {
+        std::cout << "  " << name << ": CPSR plain 0x" << std::hex << plain.cpsr << ", fused 0x" << fused.cpsr << std::dec << std::endl;
+        passed = false;
+    }
+    if (plain.cycles != fused.cycles)
+    {
+        std::cout << "  " << name << ": cycles plain " << plain.cycles << ", fused " << fused.cycles << std::endl;
+        passed = false;
+    }
+    if (plain.next != fused.next)
+    {
+        std::cout << "  " << name << ": next instr plain 0x" << std::hex << plain.next << ", fused 0x" << fused.next << std::dec << std::endl;
+        passed = false;
+    }
+
+    return passed;
+}
+
+bool testFusion_BL(CPU& cpu)
+{
+    const uint32_t base = 0x03000100;
+    bool passed = true;
+
+    cpu.bus->write16(base, 0xF000);     // BL base + 0x40
+    cpu.bus->write16(base + 2, 0xF81E);
+    passed &= checkFusedBlock(cpu, "forward", base, {}, CPU::fusionPattern::BL);
+
+    cpu.bus->write16(base, 0xF7FF);     // BL base - 0x100
+    cpu.bus->write16(base + 2, 0xFF7E);
+    passed &= checkFusedBlock(cpu, "backward", base, {}, CPU::fusionPattern::BL);
+
+    return passed;
+}
+
+bool testFusion_CmpImmBranch(CPU& cpu)
+{
+    const uint32_t base = 0x03000100;
+    bool passed = true;
+
+    cpu.bus->write16(base, 0x2805);     // CMP r0, #5
+    cpu.bus->write16(base + 2, 0xD004); // BEQ base + 14
+    passed &= checkFusedBlock(cpu, "BEQ taken", base, { 5 }, CPU::fusionPattern::CmpBranch);
+    passed &= checkFusedBlock(cpu, "BEQ not taken", base, { 6 }, CPU::fusionPattern::CmpBranch);
+
+    cpu.bus->write16(base + 2, 0xDB04); // BLT base + 14
+    passed &= checkFusedBlock(cpu, "BLT taken", base, { 0x80000000 }, CPU::fusionPattern::CmpBranch);
+    passed &= checkFusedBlock(cpu, "BLT not taken", base, { 0x7FFFFFFF }, CPU::fusionPattern::CmpBranch);
+
+    return passed;
+}
+
+bool testFusion_CmpRegBranch(CPU& cpu)
+{
+    const uint32_t base = 0x03000100;
+    bool passed = true;
+
+    cpu.bus->write16(base, 0x4291);     // CMP r1, r2
+    cpu.bus->write16(base + 2, 0xD304); // BCC base + 14
+    passed &= checkFusedBlock(cpu, "BCC taken", base, { 0, 3, 7 }, CPU::fusionPattern::CmpBranch);
+    passed &= checkFusedBlock(cpu, "BCC not taken", base, { 0, 7, 3 }, CPU::fusionPattern::CmpBranch);
+
+    cpu.bus->write16(base + 2, 0xDCFC); // BGT base - 2
+    passed &= checkFusedBlock(cpu, "BGT taken", base, { 0, 1, 0x80000000 }, CPU::fusionPattern::CmpBranch);
+    passed &= checkFusedBlock(cpu, "BGT not taken", base, { 0, 0x80000000, 1 }, CPU::fusionPattern::CmpBranch);
+
+    return passed;
+}
+
+bool testFusion_ShiftAdd(CPU& cpu)
+{
+    const uint32_t base = 0x03000100;
+    bool passed = true;
+
+    cpu.bus->write16(base, 0x0081);     // LSL r1, r0, #2
+    cpu.bus->write16(base + 2, 0x18CA); // ADD r2, r1, r3
+    cpu.bus->write16(base + 4, 0xE7FE); // B base + 4
+    passed &= checkFusedBlock(cpu, "LSL + ADD", base, { 0x40000001, 0, 0, 0x7FFFFFFF }, CPU::fusionPattern::ShiftAdd);
+
+    cpu.bus->write16(base, 0x00C9);     // LSL r1, r1, #3
+    cpu.bus->write16(base + 2, 0x1849); // ADD r1, r1, r1
+    passed &= checkFusedBlock(cpu, "LSL + ADD, rd = rs = rn", base, { 0, 0x10000001 }, CPU::fusionPattern::ShiftAdd);
+
+    cpu.bus->write16(base, 0x2340);     // MOV r3, #0x40
+    cpu.bus->write16(base + 2, 0x18C3); // ADD r3, r0, r3
+    passed &= checkFusedBlock(cpu, "MOV + ADD, rd = rn", base, { 0xFFFFFFF0, 0, 0, 0x1234 }, CPU::fusionPattern::ShiftAdd);
+
+    return passed;
+}
+
+// literals are only folded out of ROM, so this maps a small cartridge of its own and leaves it loaded
+bool testFusion_LdrLiteral(CPU& cpu)
+{
+    const char* path = "fusion_literal_test.gba";
+    const uint16_t code[] = {
+        0x4801,         // LDR r0, [pc, #4]
+        0x4902,         // LDR r1, [pc, #8]
+        0xE7FE,         // B 0x08000004
+        0x0000,
+        0x5678, 0x1234, // 0x12345678
+        0xBABE, 0xCAFE, // 0xCAFEBABE
+    };
+
+    FILE* f = fopen(path, "wb");
+    if (!f)
+    {
+        std::cout << "  Could not write " << path << std::endl;
+        return false;
+    }
+    fwrite(code, sizeof(code), 1, f);
+    fclose(f);
+
+    bool loaded = cpu.bus->loadROM(path, 0x08000000, false);
+    remove(path);
+    if (!loaded)
+    {
+        std::cout << "  Could not load " << path << std::endl;
+        return false;
+    }
+
+    return checkFusedBlock(cpu, "LDR pc", 0x08000000, { 0xFFFFFFFF, 0xFFFFFFFF }, CPU::fusionPattern::Literal);
+}
+
 
 // ============================================================
 // MAIN TEST RUNNER
@@ -2846,6 +3171,30 @@ void DebuggerCPU::runAllThumbTests(CPU& cpu)
     if (testPUSH_All(cpu)) { printTestResult("PUSH_All", true); passCount++; }
     else { printTestResult("PUSH_All", false); failCount++; }
 
+    // Block cache over writable memory
+    std::cout << "\n--- Block Cache: Self Modifying Code ---" << std::endl;
+    if (testBlockCache_PatchIWRAM(cpu)) { printTestResult("BlockCache_PatchIWRAM", true); passCount++; }
+    else { printTestResult("BlockCache_PatchIWRAM", false); failCount++; }
+    if (testBlockCache_WriteBesideBlock(cpu)) { printTestResult("BlockCache_WriteBesideBlock", true); passCount++; }
+    else { printTestResult("BlockCache_WriteBesideBlock", false); failCount++; }
+    if (testBlockCache_SelfModify(cpu)) { printTestResult("BlockCache_SelfModify", true); passCount++; }
+    else { printTestResult("BlockCache_SelfModify", false); failCount++; }
+    if (testJit_PatchHotIWRAM(cpu)) { printTestResult("Jit_PatchHotIWRAM", true); passCount++; }
+    else { printTestResult("Jit_PatchHotIWRAM", false); failCount++; }
+
+    // Fused THUMB pairs, each against the same block replayed without fusion
+    std::cout << "\n--- Block Cache: Fused THUMB Pairs ---" << std::endl;
+    if (testFusion_BL(cpu)) { printTestResult("Fusion_BL", true); passCount++; }
+    else { printTestResult("Fusion_BL", false); failCount++; }
+    if (testFusion_CmpImmBranch(cpu)) { printTestResult("Fusion_CmpImmBranch", true); passCount++; }
+    else { printTestResult("Fusion_CmpImmBranch", false); failCount++; }
+    if (testFusion_CmpRegBranch(cpu)) { printTestResult("Fusion_CmpRegBranch", true); passCount++; }
+    else { printTestResult("Fusion_CmpRegBranch", false); failCount++; }
+    if (testFusion_ShiftAdd(cpu)) { printTestResult("Fusion_ShiftAdd", true); passCount++; }
+    else { printTestResult("Fusion_ShiftAdd", false); failCount++; }
+    if (testFusion_LdrLiteral(cpu)) { printTestResult("Fusion_LdrLiteral", true); passCount++; }
+    else { printTestResult("Fusion_LdrLiteral", false); failCount++; }
+
     // Print summary
     std::cout << "\n========================================" << std::endl;
     std::cout << "PASSED: " << passCount << std::endl;
@@ -2861,4 +3210,1506 @@ void DebuggerCPU::runAllThumbTests(CPU& cpu)
     {
         std::cout << "\n " << failCount << " tests failed" << std::endl;
     }
-}
\ No newline at end of file
+}
+
+// ============================================================
+// BENCHMARKS
+// ============================================================
+
+std::vector<uint32_t> loadWords(const char* filename)
+{
+    std::vector<uint32_t> words;
+
+    FILE* f = fopen(filename, "rb");
+    if (!f)
+    {
+        printf("ERROR: Could not open %s\n", filename);
+        return words;
+    }
+
+    uint32_t word;
+    while (fread(&word, 4, 1, f) == 1) words.push_back(word);
+    fclose(f);
+
+    return words;
+}
+
+// decode + handler lookup over every word in the file, nothing is executed
+// the mask / compare cascade decodeArm was before the decode table, kept as the reference the table is
+// timed against. fields are filled in the same way the cascade did, the handler is then looked up by type
+static CPU::armInstr cascadeDecodeArm(uint32_t instr)
+{
+    using op = CPU::armOperation;
+    static const op dataOps[16] = { op::ARM_AND, op::ARM_EOR, op::ARM_SUB, op::ARM_RSB, op::ARM_ADD, op::ARM_ADC, op::ARM_SBC, op::ARM_RSC,
+        op::ARM_TST, op::ARM_TEQ, op::ARM_CMP, op::ARM_CMN, op::ARM_ORR, op::ARM_MOV, op::ARM_BIC, op::ARM_MVN };
+
+    CPU::armInstr d = {};
+    d.type = op::ARM_UNDEFINED;
+    d.cond = (instr >> 28) & 0xF;
+
+    switch ((instr >> 25) & 0x7)
+    {
+    case 0b000:
+        if ((instr & 0x0FFFFFF0) == 0x012FFF10) { d.type = op::ARM_BX; d.rm = instr & 0xF; return d; }
+        if ((instr & 0x0FB00FF0) == 0x01000090)
+        {
+            d.type = op::ARM_SWP; d.B = (instr >> 22) & 1; d.rn = (instr >> 16) & 0xF; d.rd = (instr >> 12) & 0xF; d.rm = instr & 0xF;
+            return d;
+        }
+        if ((instr & 0x0F8000F0) == 0x00800090)
+        {
+            static const op longOps[4] = { op::ARM_UMULL, op::ARM_UMLAL, op::ARM_SMULL, op::ARM_SMLAL };
+            d.type = longOps[(instr >> 21) & 0x3];
+            d.S = (instr >> 20) & 1; d.rd = (instr >> 16) & 0xF; d.rn = (instr >> 12) & 0xF; d.rs = (instr >> 8) & 0xF; d.rm = instr & 0xF;
+            return d;
+        }
+        if ((instr & 0x0FC000F0) == 0x00000090)
+        {
+            d.type = ((instr >> 21) & 1) ? op::ARM_MLA : op::ARM_MUL;
+            d.S = (instr >> 20) & 1; d.rd = (instr >> 16) & 0xF; d.rn = (instr >> 12) & 0xF; d.rs = (instr >> 8) & 0xF; d.rm = instr & 0xF;
+            return d;
+        }
+        if ((instr & 0x0E000090) == 0x00000090)
+        {
+            uint32_t SH = (instr >> 5) & 0x3;
+            d.L = (instr >> 20) & 1;
+            if (d.L) d.type = SH == 1 ? op::ARM_LDRH : SH == 2 ? op::ARM_LDRSB : SH == 3 ? op::ARM_LDRSH : op::ARM_UNDEFINED;
+            else d.type = SH == 1 ? op::ARM_STRH : op::ARM_UNDEFINED;
+            d.P = (instr >> 24) & 1; d.U = (instr >> 23) & 1; d.W = (instr >> 21) & 1; d.rn = (instr >> 16) & 0xF; d.rd = (instr >> 12) & 0xF;
+            d.I = (instr >> 22) & 1;
+            if (d.I) d.imm = ((instr >> 4) & 0xF0) | (instr & 0xF);
+            else d.rm = instr & 0xF;
+            return d;
+        }
+        if ((instr & 0x0FBF0FFF) == 0x010F0000) { d.type = op::ARM_MRS; d.rd = (instr >> 12) & 0xF; d.B = (instr >> 22) & 1; return d; }
+        if ((instr & 0x0FB0FFF0) == 0x0120F000) { d.type = op::ARM_MSR; d.B = (instr >> 22) & 1; d.rm = instr & 0xF; return d; }
+
+        d.type = dataOps[(instr >> 21) & 0xF];
+        d.S = (instr >> 20) & 1; d.rn = (instr >> 16) & 0xF; d.rd = (instr >> 12) & 0xF;
+        d.rm = instr & 0xF; d.shift_type = (instr >> 5) & 0x3;
+        d.shift_by_reg = (instr >> 4) & 1;
+        if (d.shift_by_reg) d.shift_reg = (instr >> 8) & 0xF;
+        else d.shift_amount = (instr >> 7) & 0x1F;
+        return d;
+
+    case 0b001:
+        if ((instr & 0x0FB0F000) == 0x0320F000) d.type = op::ARM_MSR;
+        else
+        {
+            d.type = dataOps[(instr >> 21) & 0xF];
+            d.S = (instr >> 20) & 1; d.rn = (instr >> 16) & 0xF; d.rd = (instr >> 12) & 0xF;
+        }
+        d.B = (instr >> 22) & 1; d.I = true; d.imm = instr & 0xFF; d.rotate = (instr >> 8) & 0xF;
+        return d;
+
+    case 0b010:
+    case 0b011:
+        if (((instr >> 25) & 1) && ((instr >> 4) & 1)) return d;
+        d.L = (instr >> 20) & 1;
+        d.type = d.L ? op::ARM_LDR : op::ARM_STR;
+        d.P = (instr >> 24) & 1; d.U = (instr >> 23) & 1; d.B = (instr >> 22) & 1; d.W = (instr >> 21) & 1;
+        d.rn = (instr >> 16) & 0xF; d.rd = (instr >> 12) & 0xF;
+        d.I = (instr >> 25) & 1;
+        if (d.I) { d.rm = instr & 0xF; d.shift_type = (instr >> 5) & 0x3; d.shift_amount = (instr >> 7) & 0x1F; }
+        else d.imm = instr & 0xFFF;
+        return d;
+
+    case 0b100:
+        d.L = (instr >> 20) & 1;
+        d.type = d.L ? op::ARM_LDM : op::ARM_STM;
+        d.P = (instr >> 24) & 1; d.U = (instr >> 23) & 1; d.S = (instr >> 22) & 1; d.W = (instr >> 21) & 1;
+        d.rn = (instr >> 16) & 0xF; d.reg_list = instr & 0xFFFF;
+        return d;
+
+    case 0b101:
+    {
+        d.L = (instr >> 24) & 1;
+        d.type = d.L ? op::ARM_BL : op::ARM_B;
+        int32_t offset = instr & 0xFFFFFF;
+        if (offset & 0x800000) offset |= 0xFF000000;
+        d.imm = uint32_t(offset) << 2;
+        return d;
+    }
+
+    case 0b110:
+        d.L = (instr >> 20) & 1;
+        d.type = d.L ? op::ARM_LDC : op::ARM_STC;
+        d.P = (instr >> 24) & 1; d.U = (instr >> 23) & 1; d.W = (instr >> 21) & 1;
+        d.rn = (instr >> 16) & 0xF; d.rd = (instr >> 12) & 0xF; d.imm = (instr & 0xFF) << 2;
+        return d;
+
+    default:
+        if ((instr >> 24) & 1) { d.type = op::ARM_SWI; d.imm = instr & 0xFFFFFF; }
+        else if ((instr >> 4) & 1)
+        {
+            d.L = (instr >> 20) & 1;
+            d.type = d.L ? op::ARM_MRC : op::ARM_MCR;
+            d.rn = (instr >> 16) & 0xF; d.rd = (instr >> 12) & 0xF; d.rm = instr & 0xF;
+        }
+        else d.type = op::ARM_CDP;
+        return d;
+    }
+}
+
+void DebuggerCPU::runArmDecodeBenchmark(const char* filename)
+{
+    std::vector<uint32_t> words = loadWords(filename);
+    if (words.empty()) return;
+
+    const int passes = 500;
+    double ns[2];
+    uint32_t checksum[2] = {};
+    uintptr_t handlers[2] = {}; // folded from every handler picked so neither lookup is optimised away
+
+    for (int table = 1; table >= 0; table--)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int p = 0; p < passes; p++)
+        {
+            for (uint32_t word : words)
+            {
+                CPU::OpAFunction handler;
+                CPU::armInstr decoded;
+                if (table)
+                {
+                    const CPU::armDecodeEntry& entry = CPU::armLookup(word);
+                    decoded = cpu->decodeArm(word, entry);
+                    handler = entry.execute;
+                }
+                else
+                {
+                    decoded = cascadeDecodeArm(word);
+                    handler = CPU::opA_functions[static_cast<int>(decoded.type)];
+                }
+                checksum[table] += static_cast<uint32_t>(decoded.type) + decoded.rd + decoded.imm;
+                handlers[table] += handler != nullptr;
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        ns[table] = std::chrono::duration<double, std::nano>(end - start).count() / (words.size() * passes);
+    }
+
+    printf("ARM decode+dispatch %s: %zu instrs x %d\n", filename, words.size(), passes);
+    printf("  cascade %.2f ns/instr   table %.2f ns/instr   (%.2fx, checksum %08x)\n",
+        ns[0], ns[1], ns[0] / ns[1], uint32_t(checksum[0] ^ checksum[1] ^ (handlers[0] + handlers[1])));
+}
+
+// executes a short straight line ARM sequence through the decode table handlers, registers are
+// reset every pass so addressing stays inside IWRAM
+void runArmExecuteLoop(CPU* cpu, const char* name, const std::vector<uint32_t>& words)
+{
+    std::vector<CPU::OpAFunction> handlers;
+    std::vector<CPU::armInstr> decoded;
+    for (uint32_t word : words)
+    {
+        const CPU::armDecodeEntry& entry = CPU::armLookup(word);
+        handlers.push_back(entry.execute);
+        decoded.push_back(cpu->decodeArm(word, entry));
+    }
+
+    const int passes = 2000000;
+    uint64_t cycles = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int p = 0; p < passes; p++)
+    {
+        for (int i = 0; i < 13; i++) cpu->reg[i] = 0x10 + i * 3;
+        cpu->reg[11] = 0x03001000;
+        cpu->reg[12] = 1;
+        cpu->pc() = 0x03000100;
+
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            cycles += cpu->armDispatch(handlers[i], decoded[i]);
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double count = double(words.size()) * passes;
+    printf("ARM execute %s: %zu instrs x %d, %.1f M instr/s (%.2f ns/instr, %llu cycles)\n",
+        name, words.size(), passes, count / seconds / 1e6, seconds * 1e9 / count, (unsigned long long)cycles);
+}
+
+void DebuggerCPU::runArmExecuteBenchmark()
+{
+    std::vector<uint32_t> dataProcessing =
+    {
+        0xE0900001, // ADDS r0, r0, r1
+        0xE2422001, // SUB  r2, r2, #1
+        0xE0003181, // AND  r3, r0, r1, LSL #3
+        0xE1834532, // ORR  r4, r3, r2, LSR r5
+        0xE23450FF, // EORS r5, r4, #0xFF
+        0xE1500001, // CMP  r0, r1
+        0xE1A063E0, // MOV  r6, r0, ROR #7
+        0xE2667000, // RSB  r7, r6, #0
+        0xE0A88000, // ADC  r8, r8, r0
+        0xE3C0900F, // BIC  r9, r0, #0xF
+        0xE1F0A141, // MVNS r10, r1, ASR #2
+        0xE3100001, // TST  r0, #1
+    };
+
+    // stores only, the read helpers still trace every miss against the test harness
+    std::vector<uint32_t> loadStore =
+    {
+        0xE58B0000, // STR   r0, [r11]
+        0xE58B1004, // STR   r1, [r11, #4]
+        0xE5CB2008, // STRB  r2, [r11, #8]
+        0xE78B310C, // STR   r3, [r11, r12, LSL #2]
+        0xE48B4004, // STR   r4, [r11], #4
+        0xE52B5004, // STR   r5, [r11, #-4]!
+        0xE88B000F, // STMIA r11, {r0-r3}
+        0xE92B00F0, // STMDB r11!, {r4-r7}
+        0xE8AB00F0, // STMIA r11!, {r4-r7}
+        0xE7CB2001, // STRB  r2, [r11, r1]
+    };
+
+    // r0 != r1 after the CMP, so every other instr fails its condition in the dispatcher
+    std::vector<uint32_t> conditional =
+    {
+        0xE1500001, // CMP   r0, r1
+        0x03A02001, // MOVEQ r2, #1
+        0x13A02002, // MOVNE r2, #2
+        0x00833002, // ADDEQ r3, r3, r2
+        0x10833002, // ADDNE r3, r3, r2
+        0x058B3000, // STREQ r3, [r11]
+        0x158B3000, // STRNE r3, [r11]
+        0xC2444001, // SUBGT r4, r4, #1
+        0xB2844001, // ADDLT r4, r4, #1
+        0x01A05004, // MOVEQ r5, r4
+    };
+
+    runArmExecuteLoop(cpu, "data processing", dataProcessing);
+    runArmExecuteLoop(cpu, "load/store", loadStore);
+    runArmExecuteLoop(cpu, "conditional", conditional);
+}
+
+// runs the rom from reset twice, once fetching and decoding every instr on its own (no pipeline, no
+// trace) and once through the block cache. both fetch through the CPU read helpers
+void DebuggerCPU::runBlockCacheBenchmark(const char* filename, uint64_t instrs)
+{
+    if (!cpu->bus->loadROM(filename, 0x08000000)) return;
+
+    cpu->reset();
+    cpu->cycleTotal = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint64_t i = 0; i < instrs; i++)
+    {
+        if (!cpu->T)
+        {
+            cpu->instruction = cpu->read32(cpu->nextInstrAddr());
+            const CPU::armDecodeEntry& entry = CPU::armLookup(cpu->instruction);
+            CPU::armInstr decoded = cpu->decodeArm(cpu->instruction, entry);
+            cpu->pipelineFlushed = false;
+            cpu->cycleTotal += cpu->armDispatch(entry.execute, decoded);
+            if (!cpu->pipelineFlushed) cpu->pc() += 4;
+        }
+        else
+        {
+            uint16_t thumbCode = cpu->read16(cpu->nextInstrAddr());
+            const CPU::thumbDecodeEntry& entry = CPU::thumbLookup(thumbCode);
+            CPU::thumbInstr decoded = cpu->decodeThumb(thumbCode, entry);
+            cpu->pipelineFlushed = false;
+            cpu->cycleTotal += (cpu->*entry.execute)(decoded);
+            if (!cpu->pipelineFlushed) cpu->pc() += 2;
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double uncachedSeconds = std::chrono::duration<double>(end - start).count();
+
+    cpu->reset();
+    cpu->cycleTotal = 0;
+    cpu->flushBlockCache();
+
+    start = std::chrono::high_resolution_clock::now();
+    while (cpu->cachedInstrs + cpu->uncachedInstrs < instrs) cpu->tickBlock();
+    end = std::chrono::high_resolution_clock::now();
+    double cachedSeconds = std::chrono::duration<double>(end - start).count();
+
+    uint64_t executed = cpu->cachedInstrs + cpu->uncachedInstrs;
+    printf("BLOCK CACHE %s: %llu blocks, %llu hits / %llu misses, %.1f%% of %llu instrs from cache\n",
+        filename, (unsigned long long)cpu->blockCache.size(), (unsigned long long)cpu->blockHits,
+        (unsigned long long)cpu->blockMisses, 100.0 * cpu->cachedInstrs / executed, (unsigned long long)executed);
+    printf("  fetch+decode %.2f ns/instr, cached %.2f ns/instr, speedup %.2fx\n",
+        uncachedSeconds * 1e9 / instrs, cachedSeconds * 1e9 / executed,
+        (uncachedSeconds / instrs) / (cachedSeconds / executed));
+}
+
+// runs the rom from reset for the same cycle budget three ways: tick() as GBA::tick drives it (at the
+// build's trace level), the same one instr per call loop written out here, and runFor. all three see
+// the same instr stream so the tick() pass's instr count is used for every MIPS figure
+void DebuggerCPU::runRunForBenchmark(const char* filename, int cycles)
+{
+    if (!cpu->bus->loadROM(filename, 0x08000000)) return;
+
+    cpu->reset();
+    cpu->cycleTotal = 0;
+    uint64_t instrs = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    while (cpu->cycleTotal < cycles)
+    {
+        cpu->tick();
+        instrs++;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double tickSeconds = std::chrono::duration<double>(end - start).count();
+
+    cpu->reset();
+    cpu->cycleTotal = 0;
+
+    start = std::chrono::high_resolution_clock::now();
+    while (cpu->cycleTotal < cycles)
+    {
+        if (!cpu->T)
+        {
+            cpu->instruction = cpu->bus->read32(cpu->nextInstrAddr());
+            const CPU::armDecodeEntry& entry = CPU::armLookup(cpu->instruction);
+            CPU::armInstr decoded = cpu->decodeArm(cpu->instruction, entry);
+            cpu->pipelineFlushed = false;
+            cpu->cycleTotal += cpu->armDispatch(entry.execute, decoded);
+            if (!cpu->pipelineFlushed) cpu->pc() += 4;
+        }
+        else
+        {
+            uint16_t thumbCode = cpu->bus->read16(cpu->nextInstrAddr());
+            const CPU::thumbDecodeEntry& entry = CPU::thumbLookup(thumbCode);
+            CPU::thumbInstr decoded = cpu->decodeThumb(thumbCode, entry);
+            cpu->pipelineFlushed = false;
+            cpu->cycleTotal += (cpu->*entry.execute)(decoded);
+            if (!cpu->pipelineFlushed) cpu->pc() += 2;
+        }
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double stepSeconds = std::chrono::duration<double>(end - start).count();
+
+    cpu->reset();
+    cpu->cycleTotal = 0;
+    cpu->eventPending = false;
+
+    start = std::chrono::high_resolution_clock::now();
+    cpu->runFor(cycles);
+    end = std::chrono::high_resolution_clock::now();
+    double runSeconds = std::chrono::duration<double>(end - start).count();
+
+    printf("RUN LOOP %s: %d cycles, %llu instrs\n", filename, cycles, (unsigned long long)instrs);
+    printf("  tick() %.2f MIPS, untraced step %.2f MIPS, runFor %.2f MIPS (%.2fx over tick, %.2fx over step)\n",
+        instrs / tickSeconds / 1e6, instrs / stepSeconds / 1e6, instrs / runSeconds / 1e6,
+        tickSeconds / runSeconds, stepSeconds / runSeconds);
+}
+
+// random thumb ALU op from formats 1-4, or a Bcc that lands on the next instr either way
+uint16_t randomThumbAluOp(uint32_t& seed)
+{
+    seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+    uint16_t rd = seed & 7, rs = (seed >> 3) & 7, rn = (seed >> 6) & 7, imm = (seed >> 9) & 0xFF;
+
+    switch ((seed >> 20) % 5)
+    {
+    case 0:  return ((seed >> 24) % 3) << 11 | (imm & 0x1F) << 6 | rs << 3 | rd;     // LSL/LSR/ASR #imm
+    case 1:  return 0x1800 | ((seed >> 24) & 3) << 9 | rn << 6 | rs << 3 | rd;      // ADD/SUB reg/imm3
+    case 2:  return 0x2000 | ((seed >> 24) & 3) << 11 | rd << 8 | imm;              // MOV/CMP/ADD/SUB #imm8
+    case 3:  return 0x4000 | ((seed >> 24) & 0xF) << 6 | rs << 3 | rd;              // ALU ops
+    default: return 0xD0FF | ((seed >> 24) % 14) << 8;                             // Bcc +0
+    }
+}
+
+// runs thumb code in IWRAM through runFor with eager and lazy flags and compares where they end up.
+// first a sweep of random ALU heavy sequences, then two loops timed each way: the same random mix
+// going round, and a counted loop where only the SUB feeding BNE ever has its flags read
+void DebuggerCPU::runLazyFlagsBenchmark()
+{
+    const uint32_t base = 0x03000000;
+    const int length = 64;
+    uint32_t seed = 0x1234567;
+    int mismatches = 0;
+
+    auto start = [&](uint32_t regSeed)
+    {
+        cpu->reset();
+        for (int r = 0; r < 8; r++)
+        {
+            regSeed ^= regSeed << 13; regSeed ^= regSeed >> 17; regSeed ^= regSeed << 5;
+            cpu->reg[r] = (r & 1) ? regSeed : regSeed & 0xFF;
+        }
+        cpu->CPSR = (cpu->CPSR & 0x0FFFFFFF) | (regSeed & 0xF0000000);
+        cpu->T = 1;
+        cpu->branchTo(base);
+        cpu->cycleTotal = 0;
+        cpu->eventPending = false;
+    };
+
+    const int sequences = 20000;
+    for (int n = 0; n < sequences; n++)
+    {
+        for (int i = 0; i < length; i++) cpu->bus->write16(base + i * 2, randomThumbAluOp(seed));
+        cpu->bus->write16(base + length * 2, 0xE7FE); // B .
+
+        uint32_t eager[17], lazy[17];
+        for (int pass = 0; pass < 2; pass++)
+        {
+            start(seed);
+            cpu->setLazyFlags(pass == 1);
+            cpu->runFor(length * 8);
+
+            uint32_t* out = pass ? lazy : eager;
+            for (int r = 0; r < 16; r++) out[r] = cpu->reg[r];
+            out[16] = cpu->CPSR;
+        }
+
+        if (memcmp(eager, lazy, sizeof(eager)) != 0 && mismatches++ < 5)
+        {
+            printf("LAZY FLAGS mismatch in sequence %d: CPSR %08X eager, %08X lazy\n", n, eager[16], lazy[16]);
+        }
+    }
+    printf("LAZY FLAGS sweep: %d random sequences of %d thumb ALU ops, %d mismatches\n", sequences, length, mismatches);
+
+    const int cycles = 50000000;
+    auto timeLoop = [&](const char* name)
+    {
+        double seconds[2];
+        for (int pass = 0; pass < 2; pass++)
+        {
+            start(0xBEEF);
+            cpu->reg[2] = 0xFFFFFFFF; // loop counter for the counted loop
+            cpu->setLazyFlags(pass == 1);
+            cpu->flagsDeferred = 0;
+            cpu->flagsMaterialized = 0;
+
+            auto begin = std::chrono::high_resolution_clock::now();
+            cpu->runFor(cycles);
+            auto end = std::chrono::high_resolution_clock::now();
+            seconds[pass] = std::chrono::duration<double>(end - begin).count();
+        }
+        printf("  %s: eager %.2f ns/cycle, lazy %.2f ns/cycle, %.2fx, %.1f%% of %llu deferred add/sub flag updates written back\n",
+            name, seconds[0] * 1e9 / cycles, seconds[1] * 1e9 / cycles, seconds[0] / seconds[1],
+            100.0 * cpu->flagsMaterialized / (cpu->flagsDeferred ? cpu->flagsDeferred : 1), (unsigned long long)cpu->flagsDeferred);
+    };
+
+    printf("LAZY FLAGS benchmark, %d cycles per run\n", cycles);
+
+    for (int i = 0; i < length; i++) cpu->bus->write16(base + i * 2, randomThumbAluOp(seed));
+    cpu->bus->write16(base + length * 2, 0xE000 | ((-(length * 2 + 4) >> 1) & 0x7FF)); // B base
+    timeLoop("random ALU mix");
+
+    const uint16_t countedLoop[] =
+    {
+        0x1840, // ADD r0, r0, r1
+        0x3107, // ADD r1, #7
+        0x1A1B, // SUB r3, r3, r0
+        0x18E4, // ADD r4, r4, r3
+        0x3A01, // SUB r2, #1
+        0xD1F9, // BNE base
+        0xE7FE, // B .
+    };
+    for (int i = 0; i < 7; i++) cpu->bus->write16(base + i * 2, countedLoop[i]);
+    timeLoop("counted loop");
+
+    cpu->setLazyFlags(false);
+}
+
+// exception entry straight back out again the way an IRQ handler's SUBS pc, lr, #4 would, from
+// system mode, plus the same through FIQ and a plain MSR style mode write there and back
+void DebuggerCPU::runModeSwitchBenchmark()
+{
+    const int roundTrips = 10000000;
+
+    auto time = [&](const char* name, auto&& roundTrip)
+    {
+        cpu->reset(); // curMode comes back as system but the mode bits as supervisor, line them up
+        cpu->CPSR = (cpu->CPSR & ~0x1F) | static_cast<uint8_t>(CPU::mode::System);
+        cpu->reg[13] = 0x03007F00;
+        uint32_t sp = cpu->reg[13];
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < roundTrips; i++) roundTrip();
+        auto end = std::chrono::high_resolution_clock::now();
+
+        bool intact = cpu->curMode == CPU::mode::System && cpu->reg[13] == sp;
+        printf("  %s: %.2f ns per round trip%s\n", name,
+            std::chrono::duration<double, std::nano>(end - start).count() / roundTrips, intact ? "" : " (state not restored!)");
+    };
+
+    printf("MODE SWITCH, %d round trips each\n", roundTrips);
+
+    time("IRQ entry + return", [&]
+    {
+        cpu->enterException(CPU::mode::IRQ, 0x00000018, cpu->pc());
+        cpu->returnFromException();
+    });
+
+    time("FIQ entry + return", [&]
+    {
+        cpu->enterException(CPU::mode::FIQ, 0x0000001C, cpu->pc());
+        cpu->returnFromException();
+    });
+
+    time("writeCPSR system -> IRQ -> system", [&]
+    {
+        cpu->writeCPSR((cpu->CPSR & ~0x1F) | 0x12);
+        cpu->writeCPSR((cpu->CPSR & ~0x1F) | 0x1F);
+    });
+}
+
+// packers for the bios decompressors, header included. LZ77 is a greedy search of the last 4KB, RL
+// takes runs of 3 or more, the Huffman one uses a fixed 4 symbol tree (codes 0, 10, 110, 111) so only
+// bytes 0-3 can go in
+std::vector<uint8_t> packLZ77(const std::vector<uint8_t>& data)
+{
+    std::vector<uint8_t> out = { 0x10, uint8_t(data.size()), uint8_t(data.size() >> 8), uint8_t(data.size() >> 16) };
+    size_t pos = 0;
+
+    while (pos < data.size())
+    {
+        size_t flagAt = out.size();
+        out.push_back(0);
+
+        for (int block = 0; block < 8 && pos < data.size(); block++)
+        {
+            size_t bestLength = 0, bestDistance = 0;
+            for (size_t distance = 1; distance <= 0x1000 && distance <= pos; distance++)
+            {
+                size_t length = 0;
+                while (length < 18 && pos + length < data.size() && data[pos + length] == data[pos + length - distance]) length++;
+                if (length > bestLength) { bestLength = length; bestDistance = distance; }
+            }
+
+            if (bestLength >= 3)
+            {
+                out[flagAt] |= 0x80 >> block;
+                out.push_back(uint8_t(((bestLength - 3) << 4) | ((bestDistance - 1) >> 8)));
+                out.push_back(uint8_t(bestDistance - 1));
+                pos += bestLength;
+            }
+            else
+            {
+                out.push_back(data[pos++]);
+            }
+        }
+    }
+
+    while (out.size() & 3) out.push_back(0);
+    return out;
+}
+
+std::vector<uint8_t> packRL(const std::vector<uint8_t>& data)
+{
+    std::vector<uint8_t> out = { 0x30, uint8_t(data.size()), uint8_t(data.size() >> 8), uint8_t(data.size() >> 16) };
+    size_t pos = 0;
+
+    while (pos < data.size())
+    {
+        size_t run = 1;
+        while (run < 130 && pos + run < data.size() && data[pos + run] == data[pos]) run++;
+
+        if (run >= 3)
+        {
+            out.push_back(uint8_t(0x80 | (run - 3)));
+            out.push_back(data[pos]);
+            pos += run;
+            continue;
+        }
+
+        size_t literal = 0;
+        while (literal < 128 && pos + literal < data.size())
+        {
+            if (pos + literal + 2 < data.size() && data[pos + literal] == data[pos + literal + 1] && data[pos + literal] == data[pos + literal + 2]) break;
+            literal++;
+        }
+        out.push_back(uint8_t(literal - 1));
+        out.insert(out.end(), data.begin() + pos, data.begin() + pos + literal);
+        pos += literal;
+    }
+
+    while (out.size() & 3) out.push_back(0);
+    return out;
+}
+
+std::vector<uint8_t> packHuff4(const std::vector<uint8_t>& data)
+{
+    // header, then the tree: size / 2 - 1, root, then the child pairs
+    std::vector<uint8_t> out = { 0x28, uint8_t(data.size()), uint8_t(data.size() >> 8), uint8_t(data.size() >> 16),
+        3, 0x80, 0, 0x80, 1, 0xC0, 2, 3 };
+
+    const uint32_t codes[4] = { 0x0, 0x2, 0x6, 0x7 };
+    const int lengths[4] = { 1, 2, 3, 3 };
+    uint32_t word = 0;
+    int used = 0;
+
+    auto emit = [&](uint32_t w) { for (int i = 0; i < 4; i++) out.push_back(uint8_t(w >> (i * 8))); };
+
+    for (uint8_t symbol : data)
+    {
+        for (int bit = lengths[symbol] - 1; bit >= 0; bit--)
+        {
+            word |= ((codes[symbol] >> bit) & 1) << (31 - used);
+            if (++used == 32) { emit(word); word = 0; used = 0; }
+        }
+    }
+    if (used) emit(word);
+
+    return out;
+}
+
+// checks each HLE bios service against a plain C++ reference (the packers above for the
+// decompressors) going through a thumb SWI in IWRAM, then times the native routine on its own and
+// prints the cycles it charges the guest for the call
+void DebuggerCPU::runHleBiosBenchmark()
+{
+    const uint32_t stub = 0x03007000;
+    const uint32_t src = 0x02000000;
+    const uint32_t dst = 0x06000000;
+    const uint32_t size = 0x2000;
+    int failures = 0;
+
+    uint32_t seed = 0xC0FFEE;
+    auto next = [&] { seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5; return seed; };
+
+    std::vector<uint8_t> tiles(size); // runs and repeats like tile data, symbols 0-3 so Huffman can take it too
+    uint8_t value = 0;
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        if (next() % 6 == 0) value = next() & 3;
+        tiles[i] = (i & 0x40) ? tiles[i - 0x40] : value;
+    }
+
+    auto load = [&](uint32_t addr, const std::vector<uint8_t>& bytes)
+    {
+        for (size_t i = 0; i < bytes.size(); i++) cpu->bus->write8(addr + uint32_t(i), bytes[i]);
+    };
+
+    auto callSwi = [&](uint8_t number, std::initializer_list<uint32_t> args)
+    {
+        cpu->reset();
+        cpu->CPSR = (cpu->CPSR & ~0x1F) | static_cast<uint8_t>(CPU::mode::System);
+        cpu->T = 1;
+        cpu->branchTo(stub);
+        cpu->cycleTotal = 0;
+        cpu->eventPending = false;
+
+        int r = 0;
+        for (uint32_t arg : args) cpu->reg[r++] = arg;
+
+        cpu->bus->write16(stub, 0xDF00 | number);     // SWI number
+        cpu->bus->write16(stub + 2, 0xE7FE);          // B .
+        cpu->runFor(1);
+        return cpu->nextInstrAddr() == stub + 2 && cpu->T; // handled in place, no trip through the vector
+    };
+
+    auto check = [&](const char* name, bool passed)
+    {
+        printTestResult(name, passed);
+        if (!passed) failures++;
+    };
+
+    auto matches = [&](uint32_t addr, const std::vector<uint8_t>& expected)
+    {
+        for (size_t i = 0; i < expected.size(); i++) if (cpu->bus->read8(addr + uint32_t(i)) != expected[i]) return false;
+        return true;
+    };
+
+    auto clearDst = [&] { for (uint32_t i = 0; i < size + 0x100; i += 4) cpu->bus->write32(dst + i, 0xDEADBEEF); };
+
+    cpu->setHleBios(true);
+
+    check("HLE Div", callSwi(0x06, { uint32_t(-1234567), 89 }) &&
+        cpu->reg[0] == uint32_t(-1234567 / 89) && cpu->reg[1] == uint32_t(-1234567 % 89) && cpu->reg[3] == uint32_t(1234567 / 89));
+    check("HLE DivArm", callSwi(0x07, { 89, uint32_t(-1234567) }) && cpu->reg[0] == uint32_t(-1234567 / 89));
+    check("HLE Sqrt", callSwi(0x08, { 0x12345678 }) && cpu->reg[0] == 0x4444);
+    check("HLE ArcTan2 axes", callSwi(0x0A, { 0, 0x100 }) && cpu->reg[0] == 0x4000 && callSwi(0x0A, { uint32_t(-0x100), 0 }) && cpu->reg[0] == 0x8000);
+    check("HLE ArcTan2 diagonal", callSwi(0x0A, { 0x100, 0x100 }) && cpu->reg[0] >= 0x1FF0 && cpu->reg[0] <= 0x2010);
+
+    load(src, tiles);
+    std::vector<uint8_t> fill32(size, 0);
+    for (size_t i = 0; i < size; i++) fill32[i] = tiles[i & 3];
+    std::vector<uint8_t> fill16(size, 0);
+    for (size_t i = 0; i < size; i++) fill16[i] = tiles[i & 1];
+
+    clearDst();
+    check("HLE CpuSet copy 16", callSwi(0x0B, { src, dst, size / 2 }) && matches(dst, tiles) && cpu->bus->read32(dst + size) == 0xDEADBEEF);
+    clearDst();
+    check("HLE CpuSet fill 16", callSwi(0x0B, { src, dst, (size / 2) | (1 << 24) }) && matches(dst, fill16));
+    clearDst();
+    check("HLE CpuSet fill 32", callSwi(0x0B, { src, dst, (size / 4) | (1 << 24) | (1 << 26) }) && matches(dst, fill32));
+    clearDst();
+    check("HLE CpuFastSet copy", callSwi(0x0C, { src, dst, size / 4 }) && matches(dst, tiles));
+    clearDst();
+    check("HLE CpuFastSet rounds up to 8 words", callSwi(0x0C, { src, dst, 3 | (1 << 24) }) &&
+        matches(dst, std::vector<uint8_t>(fill32.begin(), fill32.begin() + 32)) && cpu->bus->read32(dst + 32) == 0xDEADBEEF);
+
+    std::vector<uint8_t> lz = packLZ77(tiles), rl = packRL(tiles), huff = packHuff4(tiles);
+    const uint32_t packed = 0x02010000;
+
+    load(packed, lz);
+    clearDst();
+    check("HLE LZ77UnCompVram", callSwi(0x12, { packed, dst }) && matches(dst, tiles));
+    load(packed, rl);
+    clearDst();
+    check("HLE RLUnCompWram", callSwi(0x14, { packed, dst }) && matches(dst, tiles));
+    load(packed, huff);
+    clearDst();
+    check("HLE HuffUnComp", callSwi(0x13, { packed, dst }) && matches(dst, tiles));
+
+    // scale 1.0 at 90 degrees: pa 0, pb -1, pc 1, pd 0. BG start puts screen (16, 8) on texture (64, 32)
+    load(src, { 0x00, 0x01, 0x00, 0x01, 0x00, 0x40, 0x00, 0x00 });
+    clearDst();
+    check("HLE ObjAffineSet", callSwi(0x0F, { src, dst, 1, 8 }) &&
+        cpu->bus->read16(dst) == 0 && cpu->bus->read16(dst + 8) == 0xFF00 && cpu->bus->read16(dst + 16) == 0x0100 && cpu->bus->read16(dst + 24) == 0);
+
+    load(src, { 0x00, 0x40, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x10, 0x00, 0x08, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x40, 0x00, 0x00 });
+    clearDst();
+    check("HLE BgAffineSet", callSwi(0x0E, { src, dst, 1 }) &&
+        cpu->bus->read16(dst + 2) == 0xFF00 && cpu->bus->read16(dst + 4) == 0x0100 &&
+        cpu->bus->read32(dst + 8) == uint32_t((64 + 8) << 8) && cpu->bus->read32(dst + 12) == uint32_t((32 - 16) << 8));
+
+    cpu->setHleBios(false);
+    check("HLE off takes the SWI vector", !callSwi(0x06, { 100, 7 }) && cpu->reg[0] == 100);
+
+    printf("HLE BIOS: %d failures, %llu calls handled\n", failures, (unsigned long long)cpu->hleCalls);
+
+    auto time = [&](const char* name, uint8_t number, std::initializer_list<uint32_t> args, int calls)
+    {
+        int cycles = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < calls; i++)
+        {
+            int r = 0;
+            for (uint32_t arg : args) cpu->reg[r++] = arg;
+            cycles = cpu->hleSwi(number);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        printf("  %-22s %10.1f ns per call, %7d guest cycles charged\n", name,
+            std::chrono::duration<double, std::nano>(end - start).count() / calls, cycles);
+    };
+
+    printf("HLE BIOS native cost, %u byte buffers\n", size);
+    load(src, tiles);
+    time("Div", 0x06, { uint32_t(-1234567), 89 }, 1000000);
+    time("Sqrt", 0x08, { 0x12345678 }, 1000000);
+    time("ArcTan2", 0x0A, { 0x100, 0x80 }, 1000000);
+    time("CpuSet copy 16", 0x0B, { src, dst, size / 2 }, 20000);
+    time("CpuSet fill 32", 0x0B, { src, dst, (size / 4) | (1 << 24) | (1 << 26) }, 20000);
+    time("CpuFastSet copy", 0x0C, { src, dst, size / 4 }, 20000);
+    load(packed, lz);
+    time("LZ77UnCompVram", 0x12, { packed, dst }, 5000);
+    load(packed, rl);
+    time("RLUnCompWram", 0x14, { packed, dst }, 5000);
+    load(packed, huff);
+    time("HuffUnComp", 0x13, { packed, dst }, 5000);
+}
+
+// the same push / pop pairs with the stack in IWRAM, where they take the single copy path, and in
+// VRAM, where they still go a register at a time through read32 / write32
+void DebuggerCPU::runBlockTransferBenchmark()
+{
+    const int pairs = 2000000;
+
+    const CPU::armInstr stmdb = cpu->decodeArm(0xE92D5FFF); // STMDB sp!, {r0-r12, lr}
+    const CPU::armInstr ldmia = cpu->decodeArm(0xE8BD5FFF); // LDMIA sp!, {r0-r12, lr}
+    const CPU::thumbInstr push = cpu->decodeThumb(0xB5FF);  // PUSH {r0-r7, lr}
+    const CPU::thumbInstr pop = cpu->decodeThumb(0xBCFF);   // POP {r0-r7}
+    const CPU::thumbInstr drop = cpu->decodeThumb(0xB001);  // ADD sp, #4
+
+    auto time = [&](const char* name, uint32_t stack, bool thumb)
+    {
+        cpu->reset();
+        cpu->CPSR = (cpu->CPSR & ~0x1F) | static_cast<uint8_t>(CPU::mode::System);
+        for (int r = 0; r < 13; r++) cpu->reg[r] = 0x01010101 * r;
+        cpu->sp() = stack;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < pairs; i++)
+        {
+            if (thumb)
+            {
+                cpu->thumbExecute(push);
+                cpu->thumbExecute(pop);
+                cpu->thumbExecute(drop);
+            }
+            else
+            {
+                cpu->armExecute(stmdb);
+                cpu->armExecute(ldmia);
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+
+        bool intact = cpu->sp() == stack && cpu->reg[7] == 0x07070707;
+        printf("  %-28s %7.2f ns per push + pop%s\n", name,
+            std::chrono::duration<double, std::nano>(end - start).count() / pairs, intact ? "" : " (registers not restored!)");
+        return std::chrono::duration<double>(end - start).count();
+    };
+
+    printf("BLOCK TRANSFER, %d push / pop pairs each\n", pairs);
+    double armRam = time("ARM 14 regs, IWRAM stack", 0x03007F00, false);
+    double armVram = time("ARM 14 regs, VRAM stack", 0x06010000, false);
+    double thumbRam = time("THUMB 9 / 8 regs, IWRAM stack", 0x03007F00, true);
+    double thumbVram = time("THUMB 9 / 8 regs, VRAM stack", 0x06010000, true);
+    printf("  plain RAM path %.2fx faster for ARM, %.2fx for THUMB\n", armVram / armRam, thumbVram / thumbRam);
+}
+
+// runs the rom through tickBlock with fusion off and then on, RAM put back in between, and checks both
+// end in the same place: registers, CPSR, cycle count and a hash of EWRAM / IWRAM. each run starts
+// from the cartridge's own ARM entry the way directBoot leaves it, so fusion only gets a say once the
+// rom has switched itself to THUMB. prints when that happened and how often each fused pattern ran
+void DebuggerCPU::runFusionBenchmark(const char* filename, int cycles)
+{
+    if (!cpu->bus->loadROM(filename, 0x08000000)) return;
+
+    bool wasFused = cpu->fusion;
+    const uint32_t ewram = 0x02000000, ewramSize = 0x40000, iwram = 0x03000000, iwramSize = 0x8000;
+    std::vector<uint8_t> savedEwram(cpu->bus->readRange(ewram, ewramSize), cpu->bus->readRange(ewram, ewramSize) + ewramSize);
+    std::vector<uint8_t> savedIwram(cpu->bus->readRange(iwram, iwramSize), cpu->bus->readRange(iwram, iwramSize) + iwramSize);
+
+    struct endState { uint32_t reg[16]; uint32_t cpsr; uint64_t cycles; uint64_t ram; double seconds; int64_t firstThumb; };
+
+    auto run = [&](bool fused)
+    {
+        memcpy(cpu->bus->writeRange(ewram, ewramSize), savedEwram.data(), ewramSize);
+        memcpy(cpu->bus->writeRange(iwram, iwramSize), savedIwram.data(), iwramSize);
+        cpu->directBoot();
+        cpu->cycleTotal = 0;
+        cpu->setFusion(fused);
+        memset(cpu->fusedRuns, 0, sizeof(cpu->fusedRuns));
+
+        endState state;
+        state.firstThumb = -1;
+        auto start = std::chrono::high_resolution_clock::now();
+        while (cpu->cycleTotal < cycles)
+        {
+            cpu->tickBlock();
+            if (state.firstThumb < 0 && cpu->T) state.firstThumb = cpu->cycleTotal;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+
+        for (int i = 0; i < 16; i++) state.reg[i] = cpu->reg[i];
+        state.cpsr = cpu->CPSR;
+        state.cycles = cpu->cycleTotal;
+        state.ram = 1469598103934665603ULL; // FNV-1a
+        for (uint32_t region : { ewram, iwram })
+        {
+            uint32_t size = region == ewram ? ewramSize : iwramSize;
+            const uint8_t* mem = cpu->bus->readRange(region, size);
+            for (uint32_t i = 0; i < size; i++) state.ram = (state.ram ^ mem[i]) * 1099511628211ULL;
+        }
+        state.seconds = std::chrono::duration<double>(end - start).count();
+        return state;
+    };
+
+    endState plain = run(false);
+    endState fused = run(true);
+    bool same = memcmp(plain.reg, fused.reg, sizeof(plain.reg)) == 0 && plain.cpsr == fused.cpsr
+        && plain.cycles == fused.cycles && plain.ram == fused.ram;
+
+    // the same pass over the whole image read as THUMB, for how many sites each pattern could fire at
+    // whether or not this run gets to them
+    uint32_t romSize = 0;
+    if (FILE* rom = fopen(filename, "rb"))
+    {
+        fseek(rom, 0, SEEK_END);
+        romSize = (uint32_t)ftell(rom) & ~1u;
+        fclose(rom);
+    }
+    std::vector<CPU::thumbBlockEntry> image;
+    for (uint32_t addr = 0x08000000; addr < 0x08000000 + romSize; addr += 2)
+    {
+        uint16_t thumbCode = cpu->bus->read16(addr);
+        const CPU::thumbDecodeEntry& entry = CPU::thumbLookup(thumbCode);
+        image.push_back({ addr, cpu->decodeThumb(thumbCode, entry), entry.execute });
+    }
+    cpu->fuseThumbBlock(image);
+    uint64_t sites[static_cast<int>(CPU::fusionPattern::Count)] = {};
+    for (const CPU::thumbBlockEntry& entry : image)
+    {
+        switch (entry.instr.type)
+        {
+        case CPU::thumbOperation::THUMB_FUSED_BL:        sites[static_cast<int>(CPU::fusionPattern::BL)]++; break;
+        case CPU::thumbOperation::THUMB_FUSED_CMP_BCOND: sites[static_cast<int>(CPU::fusionPattern::CmpBranch)]++; break;
+        case CPU::thumbOperation::THUMB_FUSED_SHIFT_ADD: sites[static_cast<int>(CPU::fusionPattern::ShiftAdd)]++; break;
+        case CPU::thumbOperation::THUMB_LDR_LITERAL:     sites[static_cast<int>(CPU::fusionPattern::Literal)]++; break;
+        default: break;
+        }
+    }
+
+    static const char* names[] = { "BL prefix + suffix", "CMP + Bcc", "shift / MOV + ADD", "LDR pc literal" };
+    printf("FUSION %s: %llu cycles, end state %s\n", filename, (unsigned long long)fused.cycles, same ? "matches" : "DIFFERS");
+    if (fused.firstThumb < 0) printf("  never left ARM, no THUMB block was built so nothing could fuse\n");
+    else printf("  first THUMB block at cycle %lld\n", (long long)fused.firstThumb);
+
+    uint64_t total = 0;
+    for (int i = 0; i < static_cast<int>(CPU::fusionPattern::Count); i++)
+    {
+        total += cpu->fusedRuns[i];
+        printf("  %-20s %10llu runs, %6llu sites in image\n", names[i], (unsigned long long)cpu->fusedRuns[i], (unsigned long long)sites[i]);
+    }
+    if (!total) printf("  no fused entry ran in this stretch, both runs executed the same blocks so the timing gap is noise\n");
+    printf("  %.2f ns per cycle unfused, %.2f fused (%.2fx)\n", plain.seconds * 1e9 / plain.cycles,
+        fused.seconds * 1e9 / fused.cycles, plain.seconds / fused.seconds);
+    cpu->setFusion(wasFused);
+}
+
+// tick() at each trace level over the same stretch of the rom. Text goes to the console so keep the
+// budget small. Records is timed with the Instr slots alone and again with register capture on, memory
+// capture only exists in a Records build
+void DebuggerCPU::runTraceBenchmark(const char* filename, int cycles)
+{
+    if (!cpu->bus->loadROM(filename, 0x08000000)) return;
+
+    cpu->trace.resize(CPU::traceCapacityLog2);
+
+    auto time = [&](auto step)
+    {
+        cpu->reset();
+        cpu->cycleTotal = 0;
+        cpu->trace.clear();
+        uint64_t instrs = 0;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        while (cpu->cycleTotal < cycles)
+        {
+            (cpu->*step)();
+            instrs++;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count() / instrs;
+    };
+
+    double none = time(&CPU::step<CPU::traceLevel::None>);
+    double records = time(&CPU::step<CPU::traceLevel::Records>);
+    cpu->trace.captureRegisters = true;
+    double withRegs = time(&CPU::step<CPU::traceLevel::Records>);
+    uint64_t slots = cpu->trace.count();
+    cpu->trace.captureRegisters = false;
+    double text = time(&CPU::step<CPU::traceLevel::Text>);
+
+    printf("TRACE %s: %d cycles, built at level %d\n", filename, cycles, static_cast<int>(CPU::buildTraceLevel));
+    printf("  None %.2f ns/instr, Records %.2f (%.2fx), Records + registers %.2f (%.2fx, %llu slots), Text %.2f (%.2fx)\n",
+        none, records, records / none, withRegs, withRegs / none, (unsigned long long)slots, text, text / none);
+
+    if (CPU::buildTraceLevel != CPU::traceLevel::Records) cpu->trace.resize(0);
+}
+
+// takes a CPUState snapshot halfway through a run, finishes it, then puts the snapshot (and the RAM it
+// had) back and finishes it again, the two ends have to match. the copy cost is timed on its own by
+// forking the snapshot into a batch of states the way a bulk runner would
+void DebuggerCPU::runSnapshotBenchmark(const char* filename, int cycles)
+{
+    if (!cpu->bus->loadROM(filename, 0x08000000)) return;
+
+    const uint32_t ewram = 0x02000000, ewramSize = 0x40000, iwram = 0x03000000, iwramSize = 0x8000;
+
+    cpu->reset();
+    cpu->cycleTotal = 0;
+    cpu->eventPending = false;
+    cpu->runFor(cycles / 2);
+
+    // memcpy rather than assignment so the padding comes along too and the ends compare as raw bytes
+    CPUState snapshot, first, second;
+    memcpy(&snapshot, &cpu->state(), sizeof(CPUState));
+    std::vector<uint8_t> savedEwram(cpu->bus->readRange(ewram, ewramSize), cpu->bus->readRange(ewram, ewramSize) + ewramSize);
+    std::vector<uint8_t> savedIwram(cpu->bus->readRange(iwram, iwramSize), cpu->bus->readRange(iwram, iwramSize) + iwramSize);
+
+    cpu->runFor(cycles - cpu->cycleTotal);
+    memcpy(&first, &cpu->state(), sizeof(CPUState));
+
+    memcpy(cpu->bus->writeRange(ewram, ewramSize), savedEwram.data(), ewramSize);
+    memcpy(cpu->bus->writeRange(iwram, iwramSize), savedIwram.data(), iwramSize);
+    memcpy(&cpu->state(), &snapshot, sizeof(CPUState));
+    cpu->runFor(cycles - cpu->cycleTotal);
+    memcpy(&second, &cpu->state(), sizeof(CPUState));
+
+    bool same = memcmp(&first, &second, sizeof(CPUState)) == 0;
+
+    const int forks = 4096, rounds = 1000;
+    std::vector<CPUState> batch(forks);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int round = 0; round < rounds; round++)
+    {
+        snapshot.cycleTotal = round; // so the copies are not hoisted out of the loop
+        for (CPUState& fork : batch) memcpy(&fork, &snapshot, sizeof(CPUState));
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / (double(forks) * rounds);
+
+    printf("SNAPSHOT %s: %d cycles, restored run %s\n", filename, cycles, same ? "matches" : "DIFFERS");
+    printf("  CPUState %zu bytes (CPU %zu), %.2f ns per copy, last fork at cycle %d\n",
+        sizeof(CPUState), sizeof(CPU), ns, batch[forks - 1].cycleTotal);
+}
+
+// turns a TraceBuffer::dump file back into text, one line per instr with the registers it changed and
+// the accesses it made under it. slots before the first Instr belong to one that was overwritten. the
+// register values thumbToStr / armToStr print in brackets are this cpu's, not the traced one's
+bool DebuggerCPU::decodeTrace(const char* dumpPath, const char* outPath)
+{
+    FILE* in = fopen(dumpPath, "rb");
+    if (!in) return false;
+
+    TraceBuffer::fileHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != TraceBuffer::fileMagic || header.version != TraceBuffer::fileVersion)
+    {
+        fclose(in);
+        return false;
+    }
+
+    FILE* out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out)
+    {
+        fclose(in);
+        return false;
+    }
+
+    fprintf(out, "%u slots, %llu written, %llu lost to wrapping\n", header.slots, (unsigned long long)header.written,
+        (unsigned long long)(header.written - header.slots));
+
+    static const char* sizes[] = { "", "8", "16", "", "32" };
+    bool started = false;
+    TraceBuffer::slot slot;
+    for (uint32_t i = 0; i < header.slots && fread(&slot, sizeof(slot), 1, in) == 1; i++)
+    {
+        switch (slot.type)
+        {
+        case TraceBuffer::kind::Instr:
+        {
+            started = true;
+            bool thumb = (slot.c >> 5) & 1;
+            char flags[5] = { (slot.c >> 31) & 1 ? 'N' : '-', (slot.c >> 30) & 1 ? 'Z' : '-',
+                (slot.c >> 29) & 1 ? 'C' : '-', (slot.c >> 28) & 1 ? 'V' : '-', '\0' };
+            std::string text;
+            if (thumb)
+            {
+                CPU::thumbInstr instr = cpu->decodeThumb(uint16_t(slot.b));
+                text = cpu->thumbToStr(instr);
+                fprintf(out, "%08X  %04X      %s %02X  %s\n", slot.a, slot.b, flags, slot.c & 0x1F, text.c_str());
+            }
+            else
+            {
+                CPU::armInstr instr = cpu->decodeArm(slot.b);
+                text = cpu->armToStr(instr);
+                fprintf(out, "%08X  %08X  %s %02X  %s\n", slot.a, slot.b, flags, slot.c & 0x1F, text.c_str());
+            }
+            break;
+        }
+        case TraceBuffer::kind::Reg:
+            if (started) fprintf(out, "            r%u = %08X\n", slot.a, slot.b);
+            break;
+        case TraceBuffer::kind::Read:
+        case TraceBuffer::kind::Write:
+            if (started && slot.c <= 4)
+            {
+                fprintf(out, "            %s%s [%08X] %s %08X\n", slot.type == TraceBuffer::kind::Read ? "read" : "write",
+                    sizes[slot.c], slot.a, slot.type == TraceBuffer::kind::Read ? "->" : "<-", slot.b);
+            }
+            break;
+        }
+    }
+
+    fclose(in);
+    if (out != stdout) fclose(out);
+    return true;
+}
+
+// the offline half of AOT: walks filename from its entry point and writes the reachable blocks to outPath
+// as C++, to be built into a shared library (it only needs AOT.h / CPU.h) and handed to CPU::loadAot
+bool DebuggerCPU::recompileROM(const char* filename, const char* outPath)
+{
+    if (!cpu->bus->loadROM(filename, 0x08000000)) return false;
+
+    FILE* file = fopen(filename, "rb");
+    if (!file) return false;
+    fseek(file, 0, SEEK_END);
+    uint32_t romSize = uint32_t(ftell(file));
+    fclose(file);
+
+    AOT::report report;
+    auto start = std::chrono::high_resolution_clock::now();
+    bool ok = AOT::recompile(*cpu, romSize, outPath, report);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    if (!ok)
+    {
+        printf("AOT %s: could not write %s\n", filename, outPath);
+        return false;
+    }
+
+    printf("AOT %s -> %s: %u blocks, %u instrs (%u inline, %u through a handler), %.1f%% of %u bytes reached, %.1f ms\n",
+        filename, outPath, report.blocks, report.instrs, report.nativeInstrs, report.fallbackInstrs,
+        100.0 * report.bytesCovered / romSize, romSize, std::chrono::duration<double, std::milli>(end - start).count());
+    return true;
+}
+
+// runs filename to cycles on the block cache with and without the module recompileROM made for it, then
+// steps the interpreter to the cycle the module run stopped on and checks registers, CPSR and work RAM
+// agree. the fraction is of every instr tickBlock ran, translated or not
+void DebuggerCPU::runAotBenchmark(const char* filename, const char* modulePath, int cycles)
+{
+    if (!cpu->bus->loadROM(filename, 0x08000000)) return;
+
+    const uint32_t ewram = 0x02000000, ewramSize = 0x40000, iwram = 0x03000000, iwramSize = 0x8000;
+    std::vector<uint8_t> cleanEwram(cpu->bus->readRange(ewram, ewramSize), cpu->bus->readRange(ewram, ewramSize) + ewramSize);
+    std::vector<uint8_t> cleanIwram(cpu->bus->readRange(iwram, iwramSize), cpu->bus->readRange(iwram, iwramSize) + iwramSize);
+
+    auto restart = [&]()
+    {
+        memcpy(cpu->bus->writeRange(ewram, ewramSize), cleanEwram.data(), ewramSize);
+        memcpy(cpu->bus->writeRange(iwram, iwramSize), cleanIwram.data(), iwramSize);
+        cpu->flushBlockCache();
+        cpu->reset();
+        cpu->cycleTotal = 0;
+        cpu->eventPending = false;
+    };
+
+    auto timedRun = [&]()
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        while (cpu->cycleTotal < cycles) cpu->tickBlock();
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double>(end - start).count();
+    };
+
+    if (!cpu->loadAot(modulePath)) return;
+
+    restart();
+    cpu->aot->ranInstrs = cpu->aot->ranFallbacks = cpu->aot->ranBlocks = 0;
+    double aotSeconds = timedRun();
+    cpu->syncFlags();
+
+    uint64_t translated = cpu->aot->ranInstrs, fallbacks = cpu->aot->ranFallbacks;
+    uint64_t total = translated + cpu->cachedInstrs + cpu->uncachedInstrs;
+    int stoppedAt = cpu->cycleTotal;
+    uint32_t regs[16];
+    memcpy(regs, cpu->reg, sizeof(regs));
+    uint32_t cpsr = cpu->CPSR;
+    std::vector<uint8_t> ewramAfter(cpu->bus->readRange(ewram, ewramSize), cpu->bus->readRange(ewram, ewramSize) + ewramSize);
+    std::vector<uint8_t> iwramAfter(cpu->bus->readRange(iwram, iwramSize), cpu->bus->readRange(iwram, iwramSize) + iwramSize);
+
+    cpu->unloadAot();
+
+    restart();
+    double cacheSeconds = timedRun();
+
+    restart();
+    while (cpu->cycleTotal < stoppedAt) cpu->tick();
+    cpu->syncFlags();
+
+    bool same = cpu->cycleTotal == stoppedAt && memcmp(regs, cpu->reg, sizeof(regs)) == 0 && cpsr == cpu->CPSR
+        && memcmp(ewramAfter.data(), cpu->bus->readRange(ewram, ewramSize), ewramSize) == 0
+        && memcmp(iwramAfter.data(), cpu->bus->readRange(iwram, iwramSize), iwramSize) == 0;
+
+    printf("AOT %s: %d cycles, end state %s the interpreter's\n", filename, cycles, same ? "matches" : "DIFFERS from");
+    printf("  %.1f%% of %llu dynamic instrs ran from translated code (%.1f%% of those through a handler)\n",
+        total ? 100.0 * translated / total : 0.0, (unsigned long long)total, translated ? 100.0 * fallbacks / translated : 0.0);
+    printf("  block cache %.3f s, with the module %.3f s (%.2fx)\n", cacheSeconds, aotSeconds, cacheSeconds / aotSeconds);
+}
+
+// what the undo journal costs per instr, and whether it really takes instrs back: a run is stopped
+// some way in, carried on for a stretch, stepped back over that stretch and compared with where it
+// stopped, then run forward again and compared with where the stretch ended. runBackToWrite is tried
+// on a byte the stretch changed, running the instr it stops in front of has to write the final value
+void DebuggerCPU::runUndoBenchmark(const char* filename, int cycles)
+{
+    if (!cpu->bus->loadROM(filename, 0x08000000)) return;
+
+    // the memory compared after undoing: EWRAM, IWRAM and VRAM
+    const uint32_t regions[3][2] = { { 0x02000000, 0x40000 }, { 0x03000000, 0x8000 }, { 0x06000000, 0x18000 } };
+    const uint64_t stretch = 100000;
+
+    auto restart = [&]()
+    {
+        cpu->reset();
+        cpu->cycleTotal = 0;
+        cpu->eventPending = false;
+    };
+
+    auto time = [&]()
+    {
+        restart();
+        uint64_t instrs = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        while (cpu->cycleTotal < cycles)
+        {
+            cpu->tick();
+            instrs++;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::make_pair(std::chrono::duration<double, std::nano>(end - start).count() / instrs, instrs);
+    };
+
+    // everything undo puts back, the pipeline and the handlers' scratch are left out
+    struct capture
+    {
+        CPUState state;
+        std::vector<uint8_t> memory[3];
+    };
+
+    auto take = [&]()
+    {
+        capture out;
+        memcpy(&out.state, &cpu->state(), sizeof(CPUState));
+        for (int i = 0; i < 3; i++)
+        {
+            const uint8_t* from = cpu->bus->readRange(regions[i][0], regions[i][1]);
+            out.memory[i].assign(from, from + regions[i][1]);
+        }
+        return out;
+    };
+
+    auto matches = [&](const capture& saved)
+    {
+        const CPUState& now = cpu->state();
+        const size_t banks = offsetof(CPUState, r8FIQ), banksEnd = offsetof(CPUState, spsrBank) + sizeof(CPUState::spsrBank);
+        bool same = memcmp(now.reg, saved.state.reg, sizeof(now.reg)) == 0 && now.CPSR == saved.state.CPSR
+            && now.cycleTotal == saved.state.cycleTotal && now.curMode == saved.state.curMode
+            && memcmp(reinterpret_cast<const uint8_t*>(&now) + banks, reinterpret_cast<const uint8_t*>(&saved.state) + banks, banksEnd - banks) == 0;
+        for (int i = 0; i < 3; i++)
+        {
+            same = same && memcmp(saved.memory[i].data(), cpu->bus->readRange(regions[i][0], regions[i][1]), regions[i][1]) == 0;
+        }
+        return same;
+    };
+
+    cpu->setUndoJournal(false);
+    auto off = time();
+    cpu->setUndoJournal(true);
+    auto on = time();
+    double slotsPerInstr = double(cpu->undo.count()) / on.second;
+
+    // stop a stretch short of the end so the whole stretch is still in the journal
+    restart();
+    uint64_t stopAt = on.second > stretch ? on.second - stretch : 0;
+    for (uint64_t i = 0; i < stopAt; i++) cpu->tick();
+    capture stopped = take();
+    for (uint64_t i = 0; i < stretch; i++) cpu->tick();
+    capture ended = take();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    uint64_t undone = cpu->stepBack(stretch);
+    auto end = std::chrono::high_resolution_clock::now();
+    double undoNs = std::chrono::duration<double, std::nano>(end - start).count() / (undone ? undone : 1);
+
+    bool backSame = undone == stretch && matches(stopped);
+    for (uint64_t i = 0; i < undone; i++) cpu->tick();
+    bool forwardSame = matches(ended);
+
+    // the first byte the stretch left different
+    uint32_t changed = 0;
+    uint8_t after = 0;
+    for (int i = 0; i < 3 && !changed; i++)
+    {
+        for (uint32_t at = 0; at < regions[i][1]; at++)
+        {
+            if (stopped.memory[i][at] == ended.memory[i][at]) continue;
+            changed = regions[i][0] + at;
+            after = ended.memory[i][at];
+            break;
+        }
+    }
+
+    if (changed)
+    {
+        uint64_t back = cpu->runBackToWrite(changed);
+        cpu->tick();
+        printf("  last write to 0x%08X was %llu instrs back, rerunning it %s\n", changed, (unsigned long long)back,
+            back && cpu->bus->read8(changed) == after ? "writes the same byte" : "DOES NOT write the same byte");
+    }
+
+    cpu->setUndoJournal(false);
+
+    printf("UNDO %s: %d cycles, %llu instrs\n", filename, cycles, (unsigned long long)off.second);
+    printf("  off %.2f ns/instr, on %.2f ns/instr (+%.2f), %.2f slots (%.1f bytes) per instr\n",
+        off.first, on.first, on.first - off.first, slotsPerInstr, slotsPerInstr * sizeof(UndoJournal::slot));
+    printf("  stepping back %llu instrs %s, forward again %s, %.2f ns per instr undone\n", (unsigned long long)undone,
+        backSame ? "matches" : "DIFFERS", forwardSame ? "matches" : "DIFFERS", undoNs);
+}
+
+// what directBoot saves: the real intro is run from powerOn for up to biosCycles, stopping the moment it
+// reaches the cartridge, against the cost of setting the same state up directly
+void DebuggerCPU::runDirectBootBenchmark(const char* filename, int biosCycles)
+{
+    if (!cpu->bus->loadROM("gba_bios.bin", 0x00000000)) return;
+    if (!cpu->bus->loadROM(filename, 0x08000000)) return;
+
+    cpu->powerOn();
+    cpu->cycleTotal = 0;
+    cpu->eventPending = false;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    while (cpu->cycleTotal < biosCycles && !Bus::isRomAddress(cpu->nextInstrAddr())) cpu->tick();
+    auto end = std::chrono::high_resolution_clock::now();
+    double biosMs = std::chrono::duration<double, std::milli>(end - start).count();
+    uint32_t biosStop = cpu->nextInstrAddr();
+    int biosSpent = cpu->cycleTotal;
+
+    const int boots = 100000;
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < boots; i++) cpu->directBoot();
+    end = std::chrono::high_resolution_clock::now();
+    double bootNs = std::chrono::duration<double, std::nano>(end - start).count() / boots;
+
+    printf("DIRECT BOOT %s\n", filename);
+    if (Bus::isRomAddress(biosStop)) printf("  bios reached the cartridge after %d cycles, %.1f ms\n", biosSpent, biosMs);
+    else printf("  bios still at 0x%08X after %d cycles, %.1f ms\n", biosStop, biosSpent, biosMs);
+    printf("  directBoot %.1f ns, first instr at 0x%08X, CPSR 0x%08X, sp 0x%08X\n", bootNs, cpu->nextInstrAddr(), cpu->CPSR, cpu->sp());
+}
+
+// what a Bus costs to make and keep: construction time with and without a cartridge loaded, and the
+// bytes each instance holds, against allocating and clearing the 256 MB flat array it used to be. the
+// region stores and the page table are printed apart, the table is a fixed pageCount pointers
+void DebuggerCPU::runBusBenchmark(const char* filename)
+{
+    const int instances = 1000;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < instances; i++) Bus bus;
+    auto end = std::chrono::high_resolution_clock::now();
+    double emptyUs = std::chrono::duration<double, std::micro>(end - start).count() / instances;
+
+    size_t romBytes = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < instances / 10; i++)
+    {
+        Bus bus;
+        if (!bus.loadROM(filename, 0x08000000)) return;
+        romBytes = bus.memoryFootprint();
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double loadedUs = std::chrono::duration<double, std::micro>(end - start).count() / (instances / 10);
+
+    const size_t flatSize = 0x10000000;
+    const int flats = 4;
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < flats; i++)
+    {
+        std::unique_ptr<uint8_t[]> flat = std::make_unique<uint8_t[]>(flatSize);
+        memset(flat.get(), 0, flatSize);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double flatUs = std::chrono::duration<double, std::micro>(end - start).count() / flats;
+
+    Bus bus;
+    const size_t pageTable = Bus::pageCount * sizeof(uintptr_t);
+    printf("BUS %s\n", filename);
+    printf("  empty: %zu bytes (%zu of stores, %zu of page table), %.2f us to construct\n", bus.memoryFootprint(),
+        bus.memoryFootprint() - pageTable, pageTable, emptyUs);
+    printf("  with the cartridge: %zu bytes (%zu of stores, the shared ROM image not counted), %.2f us to construct and load\n",
+        romBytes, romBytes - pageTable, loadedUs);
+    printf("  the flat map: %zu bytes, %.2f us to allocate and clear (%.0fx)\n", flatSize, flatUs, flatUs / emptyUs);
+}
+
+// every width through the page table and through the region walk it falls back on. reads are spread
+// over EWRAM, IWRAM and the cartridge, writes over EWRAM and IWRAM, at addresses picked up front so
+// the loop is only the access
+void DebuggerCPU::runBusAccessBenchmark(const char* filename)
+{
+    Bus bus;
+    if (!bus.loadROM(filename, 0x08000000)) return;
+
+    const int addrCount = 4096;
+    const int passes = 500;
+    uint32_t readAddrs[addrCount];
+    uint32_t writeAddrs[addrCount];
+    uint32_t seed = 0x12345678;
+    for (int i = 0; i < addrCount; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        const uint32_t bases[3] = { 0x02000000, 0x03000000, 0x08000000 };
+        const uint32_t sizes[3] = { Bus::ewramSize, Bus::iwramSize, bus.romSize() };
+        int which = (seed >> 8) % 3;
+        readAddrs[i] = bases[which] + (seed >> 4) % sizes[which];
+        writeAddrs[i] = bases[which % 2] + (seed >> 4) % sizes[which % 2];
+    }
+
+    auto time = [&](auto access) {
+        auto start = std::chrono::high_resolution_clock::now();
+        uint32_t sum = 0;
+        for (int pass = 0; pass < passes; pass++)
+        {
+            for (int i = 0; i < addrCount; i++) sum += access(i, pass);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        volatile uint32_t sink = sum;
+        (void)sink;
+        return std::chrono::duration<double, std::nano>(end - start).count() / (double(passes) * addrCount);
+    };
+
+    double ns[2][6];
+    ns[0][0] = time([&](int i, int) -> uint32_t { return bus.read8(readAddrs[i]); });
+    ns[1][0] = time([&](int i, int) -> uint32_t { return bus.slowRead8(readAddrs[i]); });
+    ns[0][1] = time([&](int i, int) -> uint32_t { return bus.read16(readAddrs[i] & ~1u); });
+    ns[1][1] = time([&](int i, int) -> uint32_t { return bus.slowRead16(readAddrs[i] & ~1u); });
+    ns[0][2] = time([&](int i, int) -> uint32_t { return bus.read32(readAddrs[i] & ~3u); });
+    ns[1][2] = time([&](int i, int) -> uint32_t { return bus.slowRead32(readAddrs[i] & ~3u); });
+    ns[0][3] = time([&](int i, int pass) -> uint32_t { bus.write8(writeAddrs[i], uint8_t(pass)); return 0; });
+    ns[1][3] = time([&](int i, int pass) -> uint32_t { bus.slowWrite8(writeAddrs[i], uint8_t(pass)); return 0; });
+    ns[0][4] = time([&](int i, int pass) -> uint32_t { bus.write16(writeAddrs[i] & ~1u, uint16_t(pass)); return 0; });
+    ns[1][4] = time([&](int i, int pass) -> uint32_t { bus.slowWrite16(writeAddrs[i] & ~1u, uint16_t(pass)); return 0; });
+    ns[0][5] = time([&](int i, int pass) -> uint32_t { bus.write32((writeAddrs[i] & ~3u) | 4, uint32_t(pass)); return 0; });
+    ns[1][5] = time([&](int i, int pass) -> uint32_t { bus.slowWrite32((writeAddrs[i] & ~3u) | 4, uint32_t(pass)); return 0; });
+
+    const char* names[6] = { "read8", "read16", "read32", "write8", "write16", "write32" };
+    printf("BUS ACCESS %s (%d accesses each)\n", filename, passes * addrCount);
+    for (int w = 0; w < 6; w++)
+    {
+        printf("  %-8s page table %6.2f ns   region walk %6.2f ns   (%.2fx)\n", names[w], ns[0][w], ns[1][w], ns[1][w] / ns[0][w]);
+    }
+}
+
+// resident set of the whole process, 0 where there is no way to ask
+static size_t residentBytes()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.WorkingSetSize : 0;
+#elif defined(__linux__)
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (!statm) return 0;
+    unsigned long total = 0, resident = 0;
+    int got = fscanf(statm, "%lu %lu", &total, &resident);
+    fclose(statm);
+    return got == 2 ? resident * size_t(sysconf(_SC_PAGESIZE)) : 0;
+#else
+    return 0;
+#endif
+}
+
+// instances instances of one cartridge up at once, each reading every page of it the way a running
+// game would, with the image shared and then with a private copy each. the first shared load maps and
+// hashes the file, the rest are cache hits
+void DebuggerCPU::runRomLoadBenchmark(const char* filename, int instances)
+{
+    double us[2] = {};
+    double firstUs = 0;
+    size_t resident[2] = {};
+    size_t footprint = 0;
+
+    for (int shared = 1; shared >= 0; shared--)
+    {
+        std::vector<std::unique_ptr<Bus>> buses;
+        buses.reserve(instances);
+        size_t before = residentBytes();
+        uint32_t sum = 0;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < instances; i++)
+        {
+            auto one = std::chrono::high_resolution_clock::now();
+            buses.push_back(std::make_unique<Bus>());
+            if (!buses.back()->loadROM(filename, 0x08000000, shared != 0)) return;
+            if (i == 0 && shared) firstUs = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - one).count();
+
+            for (uint32_t offset = 0; offset < buses.back()->romSize(); offset += 4096) sum += buses.back()->read8(0x08000000 + offset);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+
+        volatile uint32_t sink = sum;
+        (void)sink;
+        us[shared] = std::chrono::duration<double, std::micro>(end - start).count() / instances;
+        resident[shared] = residentBytes() - before;
+        if (shared) footprint = buses.back()->memoryFootprint();
+    }
+
+    printf("ROM LOAD %s, %d instances\n", filename, instances);
+    printf("  shared image:  %.2f us per instance (the first %.2f us), %.2f MB more resident\n", us[1], firstUs, resident[1] / 1048576.0);
+    printf("  private copy:  %.2f us per instance, %.2f MB more resident\n", us[0], resident[0] / 1048576.0);
+    printf("  each instance holds %zu bytes of its own besides the cartridge\n", footprint);
+}
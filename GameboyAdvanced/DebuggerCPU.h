@@ -21,5 +21,25 @@ public:
 
 
 	void runAllThumbTests(CPU& cpu);
+
+	void runArmDecodeBenchmark(const char* filename);
+	void runArmExecuteBenchmark();
+	void runBlockCacheBenchmark(const char* filename, uint64_t instrs);
+	void runRunForBenchmark(const char* filename, int cycles);
+	void runLazyFlagsBenchmark();
+	void runModeSwitchBenchmark();
+	void runHleBiosBenchmark();
+	void runBlockTransferBenchmark();
+	void runFusionBenchmark(const char* filename, int cycles);
+	void runTraceBenchmark(const char* filename, int cycles);
+	void runSnapshotBenchmark(const char* filename, int cycles);
+	void runUndoBenchmark(const char* filename, int cycles);
+	void runDirectBootBenchmark(const char* filename, int biosCycles);
+	void runBusBenchmark(const char* filename);
+	void runBusAccessBenchmark(const char* filename);
+	void runRomLoadBenchmark(const char* filename, int instances);
+	bool decodeTrace(const char* dumpPath, const char* outPath); // outPath null for the console
+	bool recompileROM(const char* filename, const char* outPath);
+	void runAotBenchmark(const char* filename, const char* modulePath, int cycles);
 };
 
@@ -1,6 +1,8 @@
 #include "GBA.h"
 #include "CPU.h"
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 
 //BUGS TO FIX WITH DECODER
 
@@ -11,21 +13,107 @@
 //const char* rom = "thumb.gba";
 const char* rom = "gba_bios.bin";
 
-GBA::GBA(): cpu(&bus) //, debuggerCPU(&cpu)
+GBA::GBA(bool directBoot, const char* cartridge): cpu(&bus), debuggerCPU(&cpu)
 {
+	// direct boot still needs the bios image: every SWI and the IRQ vector at 0x18 go into it
 	if (!bus.loadROM(rom, 0x00000000))
 	{
-		printf("error with loading the binary tester");
+		if (directBoot) printf("no %s, not direct booting: SWIs and IRQs would run through an empty bios", rom);
+		else printf("error with loading the binary tester");
 		return;
 	}
 
-	//debuggerCPU.runAllThumbTests(cpu);
+	if (directBoot)
+	{
+		if (!bus.loadROM(cartridge, 0x08000000))
+		{
+			printf("error with loading the cartridge");
+			return;
+		}
+
+		cpu.directBoot();
+		return;
+	}
 
-	//debuggerCPU.DecodeIns(0x00000000, 0x000120);
+	// the DebuggerCPU tests and benchmarks run from the command line instead, see runTool
+
+	//cpu.setJitEnabled(true); // hot blocks go through the x86-64 backend, runThumbTests included
+	//cpu.loadAot("armwrestler_aot.dll"); // translated ROM blocks run ahead of the block cache and the JIT
+	//cpu.setHleBios(true); // bios SWIs it knows run natively instead of through gba_bios.bin
+	//TraceBuffer::dumpOnCrash(&cpu.trace, "trace.bin"); // with GBA_TRACE_LEVEL 1, decodeTrace reads it back
 
 	cpu.runThumbTests();
 }
 
+GBA::GBA(bare): cpu(&bus), debuggerCPU(&cpu)
+{
+}
+
+//////////////////////////////////////////////////////////////////////////
+//				               DEBUG TOOLS								//
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+	// the args after the tool name, or the fallback where one is left off
+	struct toolArgs
+	{
+		int count;
+		char** values;
+
+		const char* text(int i, const char* fallback) const { return i < count ? values[i] : fallback; }
+		int number(int i, int fallback) const { return i < count ? atoi(values[i]) : fallback; }
+	};
+
+	struct debugTool
+	{
+		const char* name;
+		const char* usage;
+		void (*run)(GBA& gba, const toolArgs& args);
+	};
+
+	const debugTool debugTools[] =
+	{
+		{ "thumbTests", "", [](GBA& gba, const toolArgs&) { gba.debuggerCPU.runAllThumbTests(gba.cpu); } },
+		{ "decodeBios", "", [](GBA& gba, const toolArgs&) { if (gba.bus.loadROM("gba_bios.bin", 0x00000000)) gba.debuggerCPU.DecodeIns(0x00000000, 0x000120); } },
+		{ "armDecode", "[rom]", [](GBA& gba, const toolArgs& a) { gba.debuggerCPU.runArmDecodeBenchmark(a.text(0, "gba_bios.bin")); } },
+		{ "armExecute", "", [](GBA& gba, const toolArgs&) { gba.debuggerCPU.runArmExecuteBenchmark(); } },
+		{ "blockCache", "[rom] [instrs]", [](GBA& gba, const toolArgs& a) { gba.debuggerCPU.runBlockCacheBenchmark(a.text(0, "armwrestler.gba"), a.number(1, 10000000)); } },
+		{ "runFor", "[rom] [cycles]", [](GBA& gba, const toolArgs& a) { gba.debuggerCPU.runRunForBenchmark(a.text(0, "armwrestler.gba"), a.number(1, 2000000)); } },
+		{ "lazyFlags", "", [](GBA& gba, const toolArgs&) { gba.debuggerCPU.runLazyFlagsBenchmark(); } },
+		{ "modeSwitch", "", [](GBA& gba, const toolArgs&) { gba.debuggerCPU.runModeSwitchBenchmark(); } },
+		{ "hleBios", "", [](GBA& gba, const toolArgs&) { gba.debuggerCPU.runHleBiosBenchmark(); } },
+		{ "blockTransfer", "", [](GBA& gba, const toolArgs&) { gba.debuggerCPU.runBlockTransferBenchmark(); } },
+		{ "fusion", "[rom] [cycles]", [](GBA& gba, const toolArgs& a) { gba.debuggerCPU.runFusionBenchmark(a.text(0, "thumb.gba"), a.number(1, 2000000)); } },
+		{ "trace", "[rom] [cycles]", [](GBA& gba, const toolArgs& a) { gba.debuggerCPU.runTraceBenchmark(a.text(0, "armwrestler.gba"), a.number(1, 200000)); } },
+		{ "snapshot", "[rom] [cycles]", [](GBA& gba, const toolArgs& a) { gba.debuggerCPU.runSnapshotBenchmark(a.text(0, "armwrestler.gba"), a.number(1, 2000000)); } },
+		{ "undo", "[rom] [cycles]", [](GBA& gba, const toolArgs& a) { gba.debuggerCPU.runUndoBenchmark(a.text(0, "armwrestler.gba"), a.number(1, 2000000)); } },
+		{ "directBoot", "[rom] [bios cycles]", [](GBA& gba, const toolArgs& a) { gba.debuggerCPU.runDirectBootBenchmark(a.text(0, "armwrestler.gba"), a.number(1, 20000000)); } },
+		{ "bus", "[rom]", [](GBA& gba, const toolArgs& a) { gba.debuggerCPU.runBusBenchmark(a.text(0, "armwrestler.gba")); } },
+		{ "busAccess", "[rom]", [](GBA& gba, const toolArgs& a) { gba.debuggerCPU.runBusAccessBenchmark(a.text(0, "armwrestler.gba")); } },
+		{ "romLoad", "[rom] [instances]", [](GBA& gba, const toolArgs& a) { gba.debuggerCPU.runRomLoadBenchmark(a.text(0, "armwrestler.gba"), a.number(1, 100)); } },
+		{ "decodeTrace", "[dump] [out]", [](GBA& gba, const toolArgs& a) { gba.debuggerCPU.decodeTrace(a.text(0, "trace.bin"), a.text(1, "trace.txt")); } },
+		{ "recompile", "[rom] [out]", [](GBA& gba, const toolArgs& a) { gba.debuggerCPU.recompileROM(a.text(0, "armwrestler.gba"), a.text(1, "armwrestler_aot.cpp")); } }, // build that into armwrestler_aot.dll
+		{ "aot", "[rom] [module] [cycles]", [](GBA& gba, const toolArgs& a) { gba.debuggerCPU.runAotBenchmark(a.text(0, "armwrestler.gba"), a.text(1, "armwrestler_aot.dll"), a.number(2, 2000000)); } },
+	};
+}
+
+bool GBA::runTool(int argc, char** argv)
+{
+	for (const debugTool& tool : debugTools)
+	{
+		if (argc < 1 || strcmp(argv[0], tool.name) != 0) continue;
+
+		GBA gba{ bare{} };
+		tool.run(gba, { argc - 1, argv + 1 });
+		return true;
+	}
+
+	printf("tools:\n");
+	for (const debugTool& tool : debugTools) printf("  %s %s\n", tool.name, tool.usage);
+	return false;
+}
+
 void GBA::tick()
 {
 	//uint32_t cycles = cpu.tick();
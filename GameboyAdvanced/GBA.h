@@ -1,7 +1,7 @@
 #pragma once
 #include "CPU.h"
 #include "Bus.h"
-#include "DebuggerCPU.h";
+#include "DebuggerCPU.h"
 
 class GBA
 {
@@ -10,9 +10,22 @@ public:
 
 	Bus bus;
 	CPU cpu;
-	//DebuggerCPU debuggerCPU;
+	DebuggerCPU debuggerCPU;
 
-	GBA();
+	// directBoot skips the bios intro: gba_bios.bin is still loaded for the SWIs and the IRQ vector,
+	// cartridge starts at 0x08000000 in the state the intro would leave it in (CPU::directBoot). it
+	// refuses to start without the bios file. the HLE stays off unless cpu.setHleBios turns it on
+	GBA(bool directBoot = false, const char* cartridge = "armwrestler.gba");
+
+	// "GameboyAdvanced <tool> [args]": runs one of the DebuggerCPU tests or benchmarks on a GBA with
+	// nothing loaded, in place of the normal start up. args left off default to what each was written
+	// against, see the table in GBA.cpp. false, with the list printed, for a name it does not know
+	static bool runTool(int argc, char** argv);
 
 	void tick();
+
+private:
+
+	struct bare {};
+	explicit GBA(bare);
 };
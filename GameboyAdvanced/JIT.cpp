@@ -0,0 +1,920 @@
+#include "JIT.h"
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define JIT_X64 1
+#else
+#define JIT_X64 0
+#endif
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//				               X86-64 EMITTER							//
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+	enum : uint8_t { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+	enum : uint8_t { CC_O = 0x0, CC_C = 0x2, CC_NC = 0x3, CC_Z = 0x4, CC_NZ = 0x5, CC_S = 0x8 };
+
+	enum aluOp : uint8_t { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7 };
+
+	enum shiftOp : uint8_t { SHIFT_SHL = 4, SHIFT_SHR = 5, SHIFT_SAR = 7 };
+
+#if defined(_WIN32)
+	constexpr uint8_t ARG0 = RCX;
+	constexpr uint8_t ARG1 = RDX;
+#else
+	constexpr uint8_t ARG0 = RDI;
+	constexpr uint8_t ARG1 = RSI;
+#endif
+
+	// rbx holds the CPU, guest registers are cached in the callee saved registers both ABIs agree on.
+	// rax rcx rdx r8 r9 are scratch inside an instr
+	constexpr uint8_t cachePool[] = { RBP, R12, R13, R14, R15 };
+	constexpr int cacheSlots = sizeof(cachePool);
+
+	constexpr uint32_t flagN = 0x80000000;
+	constexpr uint32_t flagZ = 0x40000000;
+	constexpr uint32_t flagC = 0x20000000;
+	constexpr uint32_t flagV = 0x10000000;
+
+	constexpr int carryKeep = -1;  // logical op leaves C alone
+	constexpr int carryShift = 2;  // C is the x86 carry left by the shift
+
+	struct Emitter
+	{
+		uint8_t* p;
+
+		void byte(uint8_t v) { *p++ = v; }
+		void dword(uint32_t v) { memcpy(p, &v, 4); p += 4; }
+		void qword(uint64_t v) { memcpy(p, &v, 8); p += 8; }
+
+		void rex(bool w, uint8_t reg, uint8_t rm)
+		{
+			uint8_t prefix = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+			if (prefix != 0x40) byte(prefix);
+		}
+		void modrm(uint8_t reg, uint8_t rm) { byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+		void mem(uint8_t reg, int32_t disp) { byte(0x80 | ((reg & 7) << 3) | RBX); dword(disp); } // [rbx + disp32]
+
+		void movRR(uint8_t dst, uint8_t src) { rex(false, src, dst); byte(0x89); modrm(src, dst); }
+		void movRI(uint8_t dst, uint32_t imm) { rex(false, 0, dst); byte(0xB8 | (dst & 7)); dword(imm); }
+		void movRM(uint8_t dst, int32_t disp) { rex(false, dst, RBX); byte(0x8B); mem(dst, disp); }
+		void movMR(int32_t disp, uint8_t src) { rex(false, src, RBX); byte(0x89); mem(src, disp); }
+		void movMI(int32_t disp, uint32_t imm) { byte(0xC7); mem(0, disp); dword(imm); }
+		void movM16R(int32_t disp, uint8_t src) { byte(0x66); rex(false, src, RBX); byte(0x89); mem(src, disp); }
+		void movM16I(int32_t disp, uint16_t imm) { byte(0x66); byte(0xC7); mem(0, disp); byte(imm & 0xFF); byte(imm >> 8); }
+		void movR64I(uint8_t dst, uint64_t imm) { rex(true, 0, dst); byte(0xB8 | (dst & 7)); qword(imm); }
+		void movR64R64(uint8_t dst, uint8_t src) { rex(true, src, dst); byte(0x89); modrm(src, dst); }
+
+		void aluRR(aluOp op, uint8_t dst, uint8_t src) { rex(false, src, dst); byte(0x01 | (op << 3)); modrm(src, dst); }
+		void aluRI(aluOp op, uint8_t dst, uint32_t imm) { rex(false, 0, dst); byte(0x81); modrm(op, dst); dword(imm); }
+		void aluMI(aluOp op, int32_t disp, uint32_t imm) { byte(0x81); mem(op, disp); dword(imm); }
+		void aluMR(aluOp op, int32_t disp, uint8_t src) { rex(false, src, RBX); byte(0x01 | (op << 3)); mem(src, disp); }
+		void addM64I(int32_t disp, uint32_t imm) { rex(true, 0, RBX); byte(0x81); mem(0, disp); dword(imm); }
+		void decM(int32_t disp) { byte(0xFF); mem(1, disp); }
+		void cmpM8I(int32_t disp, uint8_t imm) { byte(0x80); mem(ALU_CMP, disp); byte(imm); }
+
+		void testRR(uint8_t a, uint8_t b) { rex(false, b, a); byte(0x85); modrm(b, a); }
+		void notR(uint8_t r) { rex(false, 0, r); byte(0xF7); modrm(2, r); }
+		void shiftRI(shiftOp op, uint8_t r, uint8_t amount) { rex(false, 0, r); byte(0xC1); modrm(op, r); byte(amount); }
+		void setcc(uint8_t cc, uint8_t r) { rex(false, 0, r); byte(0x0F); byte(0x90 | cc); modrm(0, r); }
+		void movzx8(uint8_t dst, uint8_t src) { rex(false, dst, src); byte(0x0F); byte(0xB6); modrm(dst, src); }
+		void btRR(uint8_t base, uint8_t bit) { rex(false, bit, base); byte(0x0F); byte(0xA3); modrm(bit, base); }
+
+		void push(uint8_t r) { rex(false, 0, r); byte(0x50 | (r & 7)); }
+		void pop(uint8_t r) { rex(false, 0, r); byte(0x58 | (r & 7)); }
+
+		// jumps return the end of the instr, patch() fills in the rel32 once the target is known
+		uint8_t* jcc(uint8_t cc) { byte(0x0F); byte(0x80 | cc); dword(0); return p; }
+		uint8_t* jmp() { byte(0xE9); dword(0); return p; }
+		static void patch(uint8_t* end, const uint8_t* target) { int32_t rel = int32_t(target - end); memcpy(end - 4, &rel, 4); }
+		void jccTo(uint8_t cc, const uint8_t* target) { patch(jcc(cc), target); }
+		void jmpTo(const uint8_t* target) { patch(jmp(), target); }
+
+		void callAbs(const void* fn) { movR64I(RAX, reinterpret_cast<uint64_t>(fn)); byte(0xFF); byte(0xD0); }
+		void jmpRax() { byte(0xFF); byte(0xE0); }
+	};
+
+	// compiled code reads and writes the flag bits itself, so nothing is left pending past a handler call
+	int callArm(CPU* cpu, const CPU::armBlockEntry* entry)
+	{
+		cpu->pipelineFlushed = false;
+		int cycles = cpu->armDispatch(entry->execute, entry->instr);
+		if (!cpu->pipelineFlushed) cpu->pc() += 4;
+		cpu->syncFlags();
+		return cycles;
+	}
+
+	int callThumb(CPU* cpu, const CPU::thumbBlockEntry* entry)
+	{
+		cpu->pipelineFlushed = false;
+		int cycles = (cpu->*entry->execute)(entry->instr);
+		if (!cpu->pipelineFlushed) cpu->pc() += 2;
+		cpu->syncFlags();
+		return cycles;
+	}
+
+	// bit n set when the condition passes with NZCV == n
+	uint16_t conditionMask(uint8_t cond)
+	{
+		uint16_t mask = 0;
+		for (int nzcv = 0; nzcv < 16; nzcv++)
+		{
+			if (CPU::conditionTable[cond][nzcv]) mask |= 1 << nzcv;
+		}
+		return mask;
+	}
+
+	// guest register -> host register mapping for the straight line part of a block. anything that leaves
+	// compiled code (handler call, exit) writes the dirty ones back first
+	struct RegisterCache
+	{
+		Emitter& e;
+		int32_t regOffset;
+		int8_t slotOf[16];
+		bool dirty[16];
+		int8_t owner[cacheSlots];
+		uint32_t lastUse[cacheSlots];
+		uint32_t clock;
+		uint32_t pinned; // slots the current instr already holds
+
+		RegisterCache(Emitter& e, int32_t regOffset) : e(e), regOffset(regOffset) { reset(); }
+
+		void reset()
+		{
+			for (int i = 0; i < 16; i++) { slotOf[i] = -1; dirty[i] = false; }
+			for (int i = 0; i < cacheSlots; i++) { owner[i] = -1; lastUse[i] = 0; }
+			clock = 0;
+			pinned = 0;
+		}
+
+		uint8_t get(uint8_t guest, bool load)
+		{
+			clock++;
+			int slot = slotOf[guest];
+			if (slot < 0)
+			{
+				slot = -1;
+				for (int i = 0; i < cacheSlots; i++)
+				{
+					if (pinned & (1 << i)) continue;
+					if (owner[i] < 0) { slot = i; break; }
+					if (slot < 0 || lastUse[i] < lastUse[slot]) slot = i;
+				}
+
+				if (owner[slot] >= 0)
+				{
+					uint8_t evicted = owner[slot];
+					if (dirty[evicted]) e.movMR(regOffset + 4 * evicted, cachePool[slot]);
+					slotOf[evicted] = -1;
+					dirty[evicted] = false;
+				}
+
+				owner[slot] = guest;
+				slotOf[guest] = slot;
+				dirty[guest] = false;
+				if (load) e.movRM(cachePool[slot], regOffset + 4 * guest);
+			}
+
+			lastUse[slot] = clock;
+			pinned |= 1 << slot;
+			return cachePool[slot];
+		}
+
+		uint8_t use(uint8_t guest) { return get(guest, true); }
+		uint8_t def(uint8_t guest) { uint8_t host = get(guest, false); dirty[guest] = true; return host; }
+		uint8_t modify(uint8_t guest) { uint8_t host = get(guest, true); dirty[guest] = true; return host; }
+
+		void endInstr() { pinned = 0; }
+
+		void writeBack()
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				if (slotOf[i] >= 0 && dirty[i])
+				{
+					e.movMR(regOffset + 4 * i, cachePool[slotOf[i]]);
+					dirty[i] = false;
+				}
+			}
+		}
+
+		void drop()
+		{
+			writeBack();
+			reset();
+		}
+	};
+}
+
+//////////////////////////////////////////////////////////////////////////
+//				               BLOCK COMPILER							//
+//////////////////////////////////////////////////////////////////////////
+
+// walks one decodedBlock front to back. pc is only known statically between handler calls, so it is
+// written to the CPU right before each call and at each exit, never per native instr. it is always
+// the pipeline's r15, an instr's address + 8 / + 4, the same value native code uses for a pc read
+
+class BlockCompiler
+{
+public:
+
+	BlockCompiler(JIT& jit, uint8_t* out, bool thumb, bool link)
+		: jit(jit), off(jit.offsets), e{ out }, cache(e, jit.offsets.reg), thumb(thumb), link(link) {}
+
+	uint8_t* run(const CPU::decodedBlock& block, uint8_t** body);
+	uint8_t* end() const { return e.p; }
+
+private:
+
+	struct pendingExit
+	{
+		uint8_t* patch;
+		uint32_t cycles;
+		uint32_t instrs;
+	};
+
+	JIT& jit;
+	const JIT::cpuOffsets& off;
+	Emitter e;
+	RegisterCache cache;
+	bool thumb;
+	bool link;
+
+	uint32_t pendingCycles = 0;  // static cycles not yet added to cycleTotal
+	uint32_t pendingInstrs = 0;
+	int lastCycles = -1;         // curOpCycles of the last native instr, -1 when a handler already stored it
+	bool lastArmNative = false;
+	uint32_t lastOpcode = 0;
+	std::vector<pendingExit> dynamicExits;
+
+	void storeCounters(uint32_t cycles, uint32_t instrs, int curCycles);
+	void exitTo(uint32_t target);
+	void exitDynamic();
+	void finishInstr(uint32_t cycles);
+
+	void flagsArith(uint8_t carryCC);
+	void flagsLogical(bool realN, int carry);
+	void testCondition(uint8_t cond);
+
+	bool thumbNative(const CPU::thumbBlockEntry& entry, bool& ends);
+	bool armNative(const CPU::armBlockEntry& entry);
+	void fallback(bool isThumb, const void* entry, uint32_t addr, uint32_t opcode);
+};
+
+void BlockCompiler::storeCounters(uint32_t cycles, uint32_t instrs, int curCycles)
+{
+	if (cycles) e.aluMI(ALU_ADD, off.cycleTotal, cycles);
+	if (curCycles >= 0) e.movM16I(off.curOpCycles, static_cast<uint16_t>(curCycles));
+	if (curCycles >= 0 && lastArmNative) e.movMI(off.instruction, lastOpcode);
+	if (instrs) e.addM64I(off.cachedInstrs, instrs);
+}
+
+// static exit: pc is known, so with linking on jump straight into the target block if it is compiled
+void BlockCompiler::exitTo(uint32_t target)
+{
+	cache.writeBack();
+	e.movMI(off.pc, target + (thumb ? 4 : 8));
+	storeCounters(pendingCycles, pendingInstrs, lastCycles);
+
+	if (link)
+	{
+		uint64_t key = (uint64_t(target) << 1) | thumb;
+		e.decM(off.jitLinksLeft);
+		e.jccTo(CC_Z, jit.epilogue);
+		e.movR64I(RAX, reinterpret_cast<uint64_t>(&jit.blocks[key].body));
+		e.byte(0x48); e.byte(0x8B); e.byte(0x00); // mov rax, [rax]
+		e.byte(0x48); e.byte(0x85); e.byte(0xC0); // test rax, rax
+		e.jccTo(CC_Z, jit.epilogue);
+		e.addM64I(off.blockHits, 1);
+		e.jmpRax();
+	}
+	else
+	{
+		e.jmpTo(jit.epilogue);
+	}
+}
+
+// after a handler call pc is whatever the handler left, nothing to link against
+void BlockCompiler::exitDynamic()
+{
+	storeCounters(pendingCycles, pendingInstrs, -1);
+	e.jmpTo(jit.epilogue);
+}
+
+void BlockCompiler::finishInstr(uint32_t cycles)
+{
+	pendingCycles += cycles;
+	pendingInstrs++;
+	lastCycles = cycles;
+	cache.endInstr();
+	jit.nativeInstrs++;
+}
+
+// NZCV straight from the x86 flags of the add / sub that produced eax. ARM C is x86 C for adds
+// and the inverted borrow for subs
+void BlockCompiler::flagsArith(uint8_t carryCC)
+{
+	e.setcc(carryCC, RCX);
+	e.setcc(CC_O, RDX);
+	e.setcc(CC_S, R8);
+	e.setcc(CC_Z, R9);
+	e.movzx8(RCX, RCX);
+	e.shiftRI(SHIFT_SHL, RCX, 29);
+	e.movzx8(RDX, RDX);
+	e.shiftRI(SHIFT_SHL, RDX, 28);
+	e.aluRR(ALU_OR, RCX, RDX);
+	e.movzx8(RDX, R8);
+	e.shiftRI(SHIFT_SHL, RDX, 31);
+	e.aluRR(ALU_OR, RCX, RDX);
+	e.movzx8(RDX, R9);
+	e.shiftRI(SHIFT_SHL, RDX, 30);
+	e.aluRR(ALU_OR, RCX, RDX);
+	e.aluMI(ALU_AND, off.cpsr, ~(flagN | flagZ | flagC | flagV));
+	e.aluMR(ALU_OR, off.cpsr, RCX);
+}
+
+// NZ from eax, C kept / constant / from the last shift. realN is false for the thumb handlers that
+// assign `res & 0x80000000` to the one bit N field, which always stores 0
+void BlockCompiler::flagsLogical(bool realN, int carry)
+{
+	uint32_t clear = flagN | flagZ;
+	if (carry != carryKeep) clear |= flagC;
+
+	if (carry == carryShift) e.setcc(CC_C, R8);
+	e.testRR(RAX, RAX);
+	e.setcc(CC_Z, RCX);
+	if (realN) e.setcc(CC_S, RDX);
+	e.movzx8(RCX, RCX);
+	e.shiftRI(SHIFT_SHL, RCX, 30);
+	if (realN)
+	{
+		e.movzx8(RDX, RDX);
+		e.shiftRI(SHIFT_SHL, RDX, 31);
+		e.aluRR(ALU_OR, RCX, RDX);
+	}
+	if (carry == carryShift)
+	{
+		e.movzx8(RDX, R8);
+		e.shiftRI(SHIFT_SHL, RDX, 29);
+		e.aluRR(ALU_OR, RCX, RDX);
+	}
+	else if (carry == 1)
+	{
+		e.aluRI(ALU_OR, RCX, flagC);
+	}
+	e.aluMI(ALU_AND, off.cpsr, ~clear);
+	e.aluMR(ALU_OR, off.cpsr, RCX);
+}
+
+// leaves x86 C set when cond passes, same table checkConditional reads
+void BlockCompiler::testCondition(uint8_t cond)
+{
+	e.movRM(RCX, off.cpsr);
+	e.shiftRI(SHIFT_SHR, RCX, 28);
+	e.movRI(RAX, conditionMask(cond));
+	e.btRR(RAX, RCX);
+}
+
+void BlockCompiler::fallback(bool isThumb, const void* entry, uint32_t addr, uint32_t opcode)
+{
+	cache.drop();
+
+	e.movMI(off.pc, addr + (isThumb ? 4 : 8));
+	if (!isThumb) e.movMI(off.instruction, opcode);
+
+	e.movR64R64(ARG0, RBX);
+	e.movR64I(ARG1, reinterpret_cast<uint64_t>(entry));
+	e.callAbs(isThumb ? reinterpret_cast<const void*>(&callThumb) : reinterpret_cast<const void*>(&callArm));
+	e.aluMR(ALU_ADD, off.cycleTotal, RAX);
+	e.movM16R(off.curOpCycles, RAX);
+
+	pendingInstrs++;
+	lastCycles = -1;
+	lastArmNative = false;
+	jit.fallbackInstrs++;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//				               NATIVE THUMB								//
+//////////////////////////////////////////////////////////////////////////
+
+// mirrors the opT_ handlers exactly, quirks included. returns false for anything left to the handler
+
+bool BlockCompiler::thumbNative(const CPU::thumbBlockEntry& entry, bool& ends)
+{
+	const CPU::thumbInstr& instr = entry.instr;
+	ends = false;
+
+	switch (instr.type)
+	{
+	case CPU::thumbOperation::THUMB_MOV_IMM:
+	{
+		e.movRI(cache.def(instr.rd), instr.imm);
+		e.aluMI(ALU_AND, off.cpsr, ~(flagN | flagZ));
+		if (instr.imm == 0) e.aluMI(ALU_OR, off.cpsr, flagZ);
+		break;
+	}
+
+	case CPU::thumbOperation::THUMB_ADD_REG:
+	case CPU::thumbOperation::THUMB_SUB_REG:
+	{
+		uint8_t rs = cache.use(instr.rs);
+		uint8_t rn = cache.use(instr.rn);
+		bool sub = instr.type == CPU::thumbOperation::THUMB_SUB_REG;
+		e.movRR(RAX, rs);
+		e.aluRR(sub ? ALU_SUB : ALU_ADD, RAX, rn);
+		flagsArith(sub ? CC_NC : CC_C);
+		e.movRR(cache.def(instr.rd), RAX);
+		break;
+	}
+
+	case CPU::thumbOperation::THUMB_ADD_IMM:
+	case CPU::thumbOperation::THUMB_SUB_IMM:
+	case CPU::thumbOperation::THUMB_ADD_IMM3:
+	case CPU::thumbOperation::THUMB_SUB_IMM3:
+	case CPU::thumbOperation::THUMB_CMP_IMM:
+	{
+		bool fromRd = instr.type == CPU::thumbOperation::THUMB_ADD_IMM3 || instr.type == CPU::thumbOperation::THUMB_SUB_IMM3 || instr.type == CPU::thumbOperation::THUMB_CMP_IMM;
+		bool sub = instr.type == CPU::thumbOperation::THUMB_SUB_IMM || instr.type == CPU::thumbOperation::THUMB_SUB_IMM3 || instr.type == CPU::thumbOperation::THUMB_CMP_IMM;
+		e.movRR(RAX, cache.use(fromRd ? instr.rd : instr.rs));
+		e.aluRI(sub ? ALU_SUB : ALU_ADD, RAX, instr.imm);
+		flagsArith(sub ? CC_NC : CC_C);
+		if (instr.type != CPU::thumbOperation::THUMB_CMP_IMM) e.movRR(cache.def(instr.rd), RAX);
+		break;
+	}
+
+	case CPU::thumbOperation::THUMB_CMP_REG:
+	case CPU::thumbOperation::THUMB_CMN_REG:
+	case CPU::thumbOperation::THUMB_CMP_HI:
+	{
+		if (instr.rd == 15 || instr.rs == 15) return false;
+		bool add = instr.type == CPU::thumbOperation::THUMB_CMN_REG;
+		uint8_t rs = cache.use(instr.rs);
+		e.movRR(RAX, cache.use(instr.rd));
+		e.aluRR(add ? ALU_ADD : ALU_SUB, RAX, rs);
+		flagsArith(add ? CC_C : CC_NC);
+		break;
+	}
+
+	case CPU::thumbOperation::THUMB_NEG_REG:
+	{
+		uint8_t rs = cache.use(instr.rs);
+		e.movRI(RAX, 0);
+		e.aluRR(ALU_SUB, RAX, rs);
+		flagsArith(CC_NC);
+		e.movRR(cache.def(instr.rd), RAX);
+		break;
+	}
+
+	case CPU::thumbOperation::THUMB_AND_REG:
+	case CPU::thumbOperation::THUMB_EOR_REG:
+	case CPU::thumbOperation::THUMB_ORR_REG:
+	case CPU::thumbOperation::THUMB_BIC_REG:
+	case CPU::thumbOperation::THUMB_TST_REG:
+	{
+		uint8_t rs = cache.use(instr.rs);
+		e.movRR(RAX, cache.use(instr.rd));
+		switch (instr.type)
+		{
+		case CPU::thumbOperation::THUMB_EOR_REG: e.aluRR(ALU_XOR, RAX, rs); break;
+		case CPU::thumbOperation::THUMB_ORR_REG: e.aluRR(ALU_OR, RAX, rs); break;
+		case CPU::thumbOperation::THUMB_BIC_REG: e.movRR(RCX, rs); e.notR(RCX); e.aluRR(ALU_AND, RAX, RCX); break;
+		default: e.aluRR(ALU_AND, RAX, rs); break;
+		}
+		flagsLogical(false, carryKeep);
+		if (instr.type != CPU::thumbOperation::THUMB_TST_REG) e.movRR(cache.def(instr.rd), RAX);
+		break;
+	}
+
+	case CPU::thumbOperation::THUMB_MVN_REG:
+	{
+		e.movRR(RAX, cache.use(instr.rs));
+		e.notR(RAX);
+		flagsLogical(false, carryKeep);
+		e.movRR(cache.def(instr.rd), RAX);
+		break;
+	}
+
+	case CPU::thumbOperation::THUMB_LSL_IMM:
+	case CPU::thumbOperation::THUMB_LSR_IMM:
+	case CPU::thumbOperation::THUMB_ASR_IMM:
+	{
+		uint32_t shift = instr.imm & 0x1F;
+		if (instr.type == CPU::thumbOperation::THUMB_ASR_IMM && shift == 0) return false;
+
+		e.movRR(RAX, cache.use(instr.rs));
+		if (instr.type == CPU::thumbOperation::THUMB_LSL_IMM)
+		{
+			if (shift) e.shiftRI(SHIFT_SHL, RAX, shift);
+			flagsLogical(false, shift ? carryShift : carryKeep);
+		}
+		else if (instr.type == CPU::thumbOperation::THUMB_LSR_IMM && shift == 0)
+		{
+			e.shiftRI(SHIFT_SHL, RAX, 1); // LSR #32, C = bit 31 and the result is 0
+			e.movRI(RAX, 0);
+			flagsLogical(false, carryShift);
+		}
+		else
+		{
+			e.shiftRI(instr.type == CPU::thumbOperation::THUMB_LSR_IMM ? SHIFT_SHR : SHIFT_SAR, RAX, shift);
+			flagsLogical(false, carryShift);
+		}
+		e.movRR(cache.def(instr.rd), RAX);
+		break;
+	}
+
+	case CPU::thumbOperation::THUMB_MOV_HI:
+	case CPU::thumbOperation::THUMB_ADD_HI:
+	{
+		if (instr.rd == 15 || instr.rs == 15) return false;
+		uint8_t rs = cache.use(instr.rs);
+		if (instr.type == CPU::thumbOperation::THUMB_MOV_HI) e.movRR(cache.def(instr.rd), rs);
+		else e.aluRR(ALU_ADD, cache.modify(instr.rd), rs);
+		break;
+	}
+
+	case CPU::thumbOperation::THUMB_BL_PREFIX:
+	{
+		e.movRI(cache.def(14), entry.addr + 4 + instr.imm);
+		break;
+	}
+
+	case CPU::thumbOperation::THUMB_B:
+	{
+		ends = true;
+		finishInstr(3);
+		exitTo(entry.addr + 4 + instr.imm);
+		return true;
+	}
+
+	case CPU::thumbOperation::THUMB_B_COND:
+	{
+		uint8_t cond = instr.cond & 0xF;
+		if (cond >= 0xE) return false;
+
+		ends = true;
+		finishInstr(3);
+		cache.writeBack();
+		testCondition(cond);
+		uint8_t* taken = e.jcc(CC_C);
+		exitTo(entry.addr + 2);
+		Emitter::patch(taken, e.p);
+		exitTo(entry.addr + 4 + instr.imm);
+		return true;
+	}
+
+	default:
+		return false;
+	}
+
+	finishInstr(1);
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//				                NATIVE ARM								//
+//////////////////////////////////////////////////////////////////////////
+
+// data processing with an immediate or an unshifted register operand, rd / rn / rm all below 15.
+// same sequence opA_DataProcessing runs, including C staying put for the non logical S ops
+
+bool BlockCompiler::armNative(const CPU::armBlockEntry& entry)
+{
+	const CPU::armInstr& instr = entry.instr;
+	uint32_t opcode = entry.opcode;
+
+	bool arith = false, sub = false, reverse = false, logical = false, test = false, move = false;
+	aluOp op = ALU_AND;
+
+	switch (instr.type)
+	{
+	case CPU::armOperation::ARM_AND: op = ALU_AND; logical = true; break;
+	case CPU::armOperation::ARM_EOR: op = ALU_XOR; logical = true; break;
+	case CPU::armOperation::ARM_ORR: op = ALU_OR; logical = true; break;
+	case CPU::armOperation::ARM_BIC: op = ALU_AND; break;
+	case CPU::armOperation::ARM_TST: op = ALU_AND; test = true; break;
+	case CPU::armOperation::ARM_TEQ: op = ALU_XOR; test = true; break;
+	case CPU::armOperation::ARM_ADD: op = ALU_ADD; arith = true; break;
+	case CPU::armOperation::ARM_CMN: op = ALU_ADD; arith = true; test = true; break;
+	case CPU::armOperation::ARM_SUB: op = ALU_SUB; arith = sub = true; break;
+	case CPU::armOperation::ARM_CMP: op = ALU_SUB; arith = sub = true; test = true; break;
+	case CPU::armOperation::ARM_RSB: op = ALU_SUB; arith = sub = reverse = true; break;
+	case CPU::armOperation::ARM_MOV: move = true; break;
+	case CPU::armOperation::ARM_MVN: move = true; break;
+	default: return false;
+	}
+
+	bool immediate = (opcode >> 25) & 1;
+	bool setFlags = (opcode >> 20) & 1;
+	uint8_t cond = instr.cond & 0xF;
+
+	if (cond == 0xF) return false;
+	if (instr.rd == 15) return false; // a branch, and the test ops skip their flags
+	if (!immediate && (((opcode >> 4) & 0xFF) != 0 || instr.rm == 15)) return false; // LSL #0 only
+
+	uint32_t op2Imm = 0;
+	int carry = carryKeep;
+	if (immediate)
+	{
+		op2Imm = instr.imm; // rotated at decode
+		if (instr.rotate != 0 && logical) carry = (op2Imm >> 31) & 1;
+	}
+
+	// r15 as rn is known here, the instr's address + 8, so it goes in as a constant instead of a register
+	bool pcBase = !move && instr.rn == 15;
+
+	// everything the body touches is mapped before the condition test, so both paths leave the cache alike
+	uint8_t rn = move || pcBase ? 0 : cache.use(instr.rn);
+	uint8_t rm = immediate ? 0 : cache.use(instr.rm);
+	uint8_t rd = test ? 0 : (cond == 0xE ? cache.def(instr.rd) : cache.modify(instr.rd));
+
+	uint8_t* skip = nullptr;
+	if (cond != 0xE)
+	{
+		testCondition(cond);
+		skip = e.jcc(CC_NC);
+	}
+
+	auto loadOp2 = [&](uint8_t dst)
+	{
+		if (immediate) e.movRI(dst, op2Imm);
+		else e.movRR(dst, rm);
+	};
+
+	if (move)
+	{
+		loadOp2(RAX);
+		if (instr.type == CPU::armOperation::ARM_MVN) e.notR(RAX);
+	}
+	else if (reverse)
+	{
+		loadOp2(RAX);
+		if (pcBase) e.aluRI(ALU_SUB, RAX, entry.addr + 8);
+		else e.aluRR(ALU_SUB, RAX, rn);
+	}
+	else
+	{
+		if (pcBase) e.movRI(RAX, entry.addr + 8);
+		else e.movRR(RAX, rn);
+		loadOp2(RCX);
+		if (instr.type == CPU::armOperation::ARM_BIC) e.notR(RCX);
+		e.aluRR(op, RAX, RCX);
+	}
+
+	if (setFlags)
+	{
+		if (arith) flagsArith(sub ? CC_NC : CC_C);
+		else flagsLogical(true, carry);
+	}
+
+	if (!test) e.movRR(rd, RAX);
+
+	if (skip) Emitter::patch(skip, e.p);
+
+	finishInstr(1);
+	lastArmNative = true;
+	lastOpcode = opcode;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//				                 WHOLE BLOCK							//
+//////////////////////////////////////////////////////////////////////////
+
+uint8_t* BlockCompiler::run(const CPU::decodedBlock& block, uint8_t** body)
+{
+	uint8_t* entry = e.p;
+
+	// prologue, 6 pushes + 40 keeps rsp 16 byte aligned and covers the win64 shadow space
+	e.push(RBX); e.push(RBP); e.push(R12); e.push(R13); e.push(R14); e.push(R15);
+	e.byte(0x48); e.byte(0x83); e.byte(0xEC); e.byte(40); // sub rsp, 40
+	e.movR64R64(RBX, ARG0);
+
+	*body = e.p;
+
+	size_t count = thumb ? block.thumb.size() : block.arm.size();
+	bool exited = false;
+
+	for (size_t i = 0; i < count && !exited; i++)
+	{
+		bool last = i + 1 == count;
+		uint32_t addr = thumb ? block.thumb[i].addr : block.arm[i].addr;
+		uint32_t next = last ? 0 : (thumb ? block.thumb[i + 1].addr : block.arm[i + 1].addr);
+
+		if (thumb)
+		{
+			bool ends = false;
+			lastArmNative = false;
+			if (thumbNative(block.thumb[i], ends))
+			{
+				if (ends)
+				{
+					exited = true; // branches emit their own exits
+				}
+				else if (last || next != addr + 2)
+				{
+					exitTo(addr + 2);
+					exited = true;
+				}
+				continue;
+			}
+
+			jit.thumbEntries.push_back(block.thumb[i]);
+			fallback(true, &jit.thumbEntries.back(), addr, 0);
+		}
+		else
+		{
+			if (armNative(block.arm[i]))
+			{
+				if (last || next != addr + 4)
+				{
+					exitTo(addr + 4);
+					exited = true;
+				}
+				continue;
+			}
+
+			jit.armEntries.push_back(block.arm[i]);
+			fallback(false, &jit.armEntries.back(), addr, block.arm[i].opcode);
+		}
+
+		if (last)
+		{
+			exitDynamic();
+			exited = true;
+			continue;
+		}
+
+		// same checks the replay loop in tickBlock makes before the next entry, plus a store into code
+		e.aluMI(ALU_CMP, off.pc, next + (thumb ? 4 : 8));
+		dynamicExits.push_back({ e.jcc(CC_NZ), pendingCycles, pendingInstrs });
+		e.movRM(RCX, off.cpsr);
+		e.aluRI(ALU_AND, RCX, 0x20);
+		e.aluRI(ALU_CMP, RCX, thumb ? 0x20 : 0);
+		dynamicExits.push_back({ e.jcc(CC_NZ), pendingCycles, pendingInstrs });
+		e.cmpM8I(off.jitAbort, 0);
+		dynamicExits.push_back({ e.jcc(CC_NZ), pendingCycles, pendingInstrs });
+	}
+
+	for (const pendingExit& exit : dynamicExits)
+	{
+		Emitter::patch(exit.patch, e.p);
+		storeCounters(exit.cycles, exit.instrs, -1);
+		e.jmpTo(jit.epilogue);
+	}
+
+	return entry;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//				                   JIT									//
+//////////////////////////////////////////////////////////////////////////
+
+JIT::JIT(CPU* cpu) : cpu(cpu), code(nullptr), codeUsed(0), epilogue(nullptr)
+{
+	auto offsetOf = [cpu](const void* member)
+	{
+		return static_cast<int32_t>(static_cast<const uint8_t*>(member) - reinterpret_cast<const uint8_t*>(cpu));
+	};
+
+	offsets.reg = offsetOf(&cpu->reg[0]);
+	offsets.pc = offsetOf(&cpu->reg[15]);
+	offsets.cpsr = offsetOf(&cpu->CPSR);
+	offsets.cycleTotal = offsetOf(&cpu->cycleTotal);
+	offsets.curOpCycles = offsetOf(&cpu->curOpCycles);
+	offsets.instruction = offsetOf(&cpu->instruction);
+	offsets.cachedInstrs = offsetOf(&cpu->cachedInstrs);
+	offsets.blockHits = offsetOf(&cpu->blockHits);
+	offsets.jitAbort = offsetOf(&cpu->jitAbort);
+	offsets.jitLinksLeft = offsetOf(&cpu->jitLinksLeft);
+
+#if JIT_X64
+#if defined(_WIN32)
+	code = static_cast<uint8_t*>(VirtualAlloc(nullptr, codeSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE));
+#else
+	void* mapped = mmap(nullptr, codeSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	code = mapped == MAP_FAILED ? nullptr : static_cast<uint8_t*>(mapped);
+#endif
+	if (!code) printf("jit: could not map %zu bytes of code memory\n", codeSize);
+#endif
+
+	flush();
+}
+
+JIT::~JIT()
+{
+	if (!code) return;
+#if defined(_WIN32)
+	VirtualFree(code, 0, MEM_RELEASE);
+#else
+	munmap(code, codeSize);
+#endif
+}
+
+bool JIT::isSupported()
+{
+	return JIT_X64;
+}
+
+void JIT::emitEpilogue()
+{
+	Emitter e{ code + codeUsed };
+	epilogue = e.p;
+	e.byte(0x48); e.byte(0x83); e.byte(0xC4); e.byte(40); // add rsp, 40
+	e.pop(R15); e.pop(R14); e.pop(R13); e.pop(R12); e.pop(RBP); e.pop(RBX);
+	e.byte(0xC3);
+	codeUsed = e.p - code;
+}
+
+void JIT::flush()
+{
+	blocks.clear();
+	armEntries.clear();
+	thumbEntries.clear();
+	codeUsed = 0;
+	compiledBlocks = 0;
+	nativeInstrs = 0;
+	fallbackInstrs = 0;
+	if (code) emitEpilogue();
+}
+
+JIT::BlockFunction JIT::lookup(uint64_t key) const
+{
+	auto found = blocks.find(key);
+	if (found == blocks.end() || !found->second.entry) return nullptr;
+	return reinterpret_cast<BlockFunction>(found->second.entry);
+}
+
+uint8_t* JIT::emit(const CPU::decodedBlock& block, bool thumb, bool link, uint8_t** body)
+{
+	if (codeUsed + maxBlockCode > codeSize) flush(); // nothing can be running, tickBlock only compiles between blocks
+
+	BlockCompiler compiler(*this, code + codeUsed, thumb, link);
+	uint8_t* entry = compiler.run(block, body);
+	codeUsed = compiler.end() - code;
+	return entry;
+}
+
+JIT::BlockFunction JIT::compile(const CPU::decodedBlock& block, uint64_t key)
+{
+	if (!code) return nullptr;
+
+	uint8_t* body;
+	uint8_t* entry = emit(block, key & 1, true, &body);
+
+	compiledBlock& compiled = blocks[key];
+	compiled.entry = entry;
+	compiled.body = body;
+	compiledBlocks++;
+
+	return reinterpret_cast<BlockFunction>(entry);
+}
+
+void JIT::invalidate(uint64_t key)
+{
+	auto found = blocks.find(key);
+	if (found == blocks.end()) return;
+	found->second.entry = nullptr;
+	found->second.body = nullptr; // linked code falls back to tickBlock from now on
+}
+
+int JIT::stepArm(uint32_t addr, uint32_t opcode, const CPU::armInstr& instr)
+{
+	if (!code) return cpu->armExecute(instr);
+
+	CPU::decodedBlock block;
+	block.arm.push_back({ addr, opcode, instr, CPU::armLookup(opcode).execute });
+
+	uint8_t* body;
+	BlockFunction step = reinterpret_cast<BlockFunction>(emit(block, false, false, &body));
+	step(cpu);
+	return cpu->curOpCycles;
+}
+
+int JIT::stepThumb(uint32_t addr, const CPU::thumbInstr& instr)
+{
+	if (!code) return cpu->thumbExecute(instr);
+
+	CPU::decodedBlock block;
+	block.thumb.push_back({ addr, instr, nullptr });
+	block.thumb.back().execute = cpu->opT_functions[static_cast<int>(instr.type)];
+
+	uint8_t* body;
+	BlockFunction step = reinterpret_cast<BlockFunction>(emit(block, true, false, &body));
+	step(cpu);
+	return cpu->curOpCycles;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "CPU.h"
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+
+// x86-64 backend for the block cache. a block that keeps getting hit is translated once: simple ALU ops and
+// branches are emitted inline with the guest registers they touch held in host registers, everything else
+// is a call into the same opA_ / opT_ handler the interpreter would have used. blocks with a known exit
+// address jump straight into the next compiled block instead of going back through tickBlock
+
+class JIT
+{
+public:
+
+	JIT(CPU* cpu);
+	~JIT();
+
+	using BlockFunction = void (*)(CPU*);
+
+	static constexpr uint32_t hotThreshold = 8;   // block cache hits before a block gets compiled
+	static constexpr int32_t linkBudget = 64;     // linked blocks run per call before handing back to tickBlock
+	static constexpr size_t codeSize = 16 * 1024 * 1024;
+	static constexpr size_t maxBlockCode = 64 * 1024;
+
+	static bool isSupported(); // only x86-64 hosts get a backend
+
+	BlockFunction lookup(uint64_t key) const;
+	BlockFunction compile(const CPU::decodedBlock& block, uint64_t key);
+	void invalidate(uint64_t key);
+	void flush();
+
+	// single instr through the backend, same contract as armExecute for the test runner
+	int stepArm(uint32_t addr, uint32_t opcode, const CPU::armInstr& instr);
+	int stepThumb(uint32_t addr, const CPU::thumbInstr& instr);
+
+	uint64_t compiledBlocks;
+	uint64_t nativeInstrs;   // emitted inline
+	uint64_t fallbackInstrs; // emitted as a handler call
+
+private:
+
+	friend class BlockCompiler;
+
+	struct compiledBlock
+	{
+		uint8_t* entry; // prologue, called from tickBlock
+		uint8_t* body;  // jumped to from other blocks, null once invalidated
+	};
+
+	struct cpuOffsets // byte offsets from the CPU pointer the compiled code is handed
+	{
+		int32_t reg;
+		int32_t pc;
+		int32_t cpsr;
+		int32_t cycleTotal;
+		int32_t curOpCycles;
+		int32_t instruction;
+		int32_t cachedInstrs;
+		int32_t blockHits;
+		int32_t jitAbort;
+		int32_t jitLinksLeft;
+	};
+
+	CPU* cpu;
+	cpuOffsets offsets;
+
+	uint8_t* code;
+	size_t codeUsed;
+	uint8_t* epilogue;
+
+	// node addresses never move, so linked code can jump through &blocks[key].body
+	std::unordered_map<uint64_t, compiledBlock> blocks;
+
+	// compiled code points at these for its handler calls, they outlive the block cache entry
+	std::deque<CPU::armBlockEntry> armEntries;
+	std::deque<CPU::thumbBlockEntry> thumbEntries;
+
+	uint8_t* emit(const CPU::decodedBlock& block, bool thumb, bool link, uint8_t** body);
+	void emitEpilogue();
+};
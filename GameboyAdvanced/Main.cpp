@@ -2,9 +2,11 @@
 
 
 
-int main()
+int main(int argc, char** argv)
 {
-	GBA gba;
+	if (argc > 1) return GBA::runTool(argc - 1, argv + 1) ? 0 : 1; // a DebuggerCPU test or benchmark instead
+
+	GBA gba; // GBA gba(true, "armwrestler.gba"); skips the bios and starts the cartridge directly
 
 	int x = 0;
 	while (x<100)
@@ -0,0 +1,170 @@
+#include "RomImage.h"
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// which file, and which version of it, without reading it
+	struct fileKey
+	{
+		uint64_t device;
+		uint64_t index;
+		uint64_t size;
+		uint64_t modified; // as fine as the file system keeps it, nanoseconds on POSIX
+
+		bool operator<(const fileKey& other) const
+		{
+			if (device != other.device) return device < other.device;
+			if (index != other.index) return index < other.index;
+			if (size != other.size) return size < other.size;
+			return modified < other.modified;
+		}
+	};
+
+	std::mutex cacheLock;
+	std::map<fileKey, std::weak_ptr<const RomImage>> imageOfFile;
+	std::unordered_map<uint64_t, std::weak_ptr<const RomImage>> imageOfHash;
+
+	// entries for images every Bus has let go of, swept on each open so neither map outgrows the
+	// images actually held
+	template <typename Map>
+	void dropExpired(Map& images)
+	{
+		for (auto it = images.begin(); it != images.end();)
+		{
+			if (it->second.expired()) it = images.erase(it);
+			else ++it;
+		}
+	}
+}
+
+uint64_t RomImage::hashBytes(const uint8_t* bytes, uint32_t size)
+{
+	uint64_t hash = 1469598103934665603ULL; // FNV-1a
+	for (uint32_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	return hash;
+}
+
+// the lock is held over the mapping and the hash, so instances starting together on the same file
+// map it once between them. a file is hashed every time it is mapped, nothing is remembered about it
+// once its image is gone
+std::shared_ptr<const RomImage> RomImage::open(const char* filename)
+{
+	fileKey key;
+
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+	BY_HANDLE_FILE_INFORMATION info;
+	if (!GetFileInformationByHandle(file, &info))
+	{
+		CloseHandle(file);
+		return nullptr;
+	}
+	key.device = info.dwVolumeSerialNumber;
+	key.index = (uint64_t(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+	key.size = (uint64_t(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+	key.modified = (uint64_t(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+#else
+	int file = ::open(filename, O_RDONLY);
+	if (file < 0) return nullptr;
+
+	struct stat info;
+	if (fstat(file, &info) != 0)
+	{
+		close(file);
+		return nullptr;
+	}
+	key.device = uint64_t(info.st_dev);
+	key.index = uint64_t(info.st_ino);
+	key.size = uint64_t(info.st_size);
+#if defined(__APPLE__)
+	key.modified = uint64_t(info.st_mtimespec.tv_sec) * 1000000000u + uint64_t(info.st_mtimespec.tv_nsec);
+#else
+	key.modified = uint64_t(info.st_mtim.tv_sec) * 1000000000u + uint64_t(info.st_mtim.tv_nsec);
+#endif
+#endif
+
+	std::lock_guard<std::mutex> hold(cacheLock);
+	dropExpired(imageOfFile);
+	dropExpired(imageOfHash);
+
+	bool mapped = key.size != 0 && key.size <= UINT32_MAX;
+	auto known = imageOfFile.find(key);
+	if (known != imageOfFile.end())
+	{
+		if (std::shared_ptr<const RomImage> held = known->second.lock())
+		{
+#if defined(_WIN32)
+			CloseHandle(file);
+#else
+			close(file);
+#endif
+			return held;
+		}
+	}
+
+	std::shared_ptr<RomImage> image(new RomImage());
+#if defined(_WIN32)
+	HANDLE mapping = mapped ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	CloseHandle(file);
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!view)
+	{
+		if (mapping) CloseHandle(mapping);
+		return nullptr;
+	}
+	image->mapping = mapping;
+#else
+	void* view = mapped ? mmap(nullptr, size_t(key.size), PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+	close(file);
+	if (view == MAP_FAILED) return nullptr;
+#endif
+
+	image->bytes = static_cast<const uint8_t*>(view);
+	image->length = uint32_t(key.size);
+	image->contentHash = hashBytes(image->bytes, image->length);
+
+	// the same contents under another name, compared in full since the hash alone can collide. this
+	// mapping goes again as image is dropped
+	auto same = imageOfHash.find(image->contentHash);
+	if (same != imageOfHash.end())
+	{
+		std::shared_ptr<const RomImage> held = same->second.lock();
+		if (held && held->length == image->length && memcmp(held->bytes, image->bytes, image->length) == 0)
+		{
+			imageOfFile[key] = held;
+			return held;
+		}
+	}
+
+	imageOfFile[key] = image;
+	imageOfHash[image->contentHash] = image;
+	return image;
+}
+
+RomImage::~RomImage()
+{
+	if (!bytes) return;
+#if defined(_WIN32)
+	UnmapViewOfFile(bytes);
+	CloseHandle(static_cast<HANDLE>(mapping));
+#else
+	munmap(const_cast<uint8_t*>(bytes), length);
+#endif
+}
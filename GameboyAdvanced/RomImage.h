@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+
+// a cartridge image mapped read only from its file, shared by every Bus in the process that loads it,
+// all the instances read the same physical pages. open hands back the image already mapped when the
+// file is one that is still held (same file, size and modified time, so only a stat), or when a new
+// mapping hashes the same as an image held under another name and its bytes compare equal. an image
+// is unmapped once the last Bus holding it lets go, and is hashed again if it is ever mapped again.
+//
+// the file must not be rewritten in place or truncated while an image of it is held. the mapping is
+// private but only pages this process writes are copied, so a page the file changes under shows the
+// new bytes, and on POSIX touching a page past a truncated end raises SIGBUS (Windows refuses to
+// truncate a mapped file). a tool rebuilding a ROM should write a new file and rename it over the
+// old one, the mapped file is left alone and the next open sees a new one
+
+class RomImage
+{
+public:
+
+	// null if the file can not be opened or mapped, or is empty
+	static std::shared_ptr<const RomImage> open(const char* filename);
+
+	~RomImage();
+
+	RomImage(const RomImage&) = delete;
+	RomImage& operator=(const RomImage&) = delete;
+
+	const uint8_t* data() const { return bytes; }
+	uint32_t size() const { return length; }
+	uint64_t hash() const { return contentHash; } // FNV-1a over the whole image, as AOT::hashImage
+
+	static uint64_t hashBytes(const uint8_t* bytes, uint32_t size);
+
+private:
+
+	RomImage() = default;
+
+	const uint8_t* bytes = nullptr;
+	uint32_t length = 0;
+	uint64_t contentHash = 0;
+#if defined(_WIN32)
+	void* mapping = nullptr; // the file mapping object, the file handle is closed once it is made
+#endif
+};
@@ -0,0 +1,129 @@
+#include "TraceBuffer.h"
+#include <csignal>
+#include <initializer_list>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+TraceBuffer::TraceBuffer(uint32_t capacityLog2)
+	: captureRegisters(false), captureMemory(false), slots(new slot[size_t(1) << capacityLog2]),
+	mask((uint32_t(1) << capacityLog2) - 1), written(0)
+{
+}
+
+void TraceBuffer::resize(uint32_t capacityLog2)
+{
+	slots.reset(new slot[size_t(1) << capacityLog2]);
+	mask = (uint32_t(1) << capacityLog2) - 1;
+	clear();
+}
+
+// the dump goes straight through the OS rather than stdio so the crash handler can use it: no
+// locks, no allocation, the header is built on the stack
+
+namespace
+{
+#if defined(_WIN32)
+	using dumpFile = HANDLE;
+	const dumpFile noFile = INVALID_HANDLE_VALUE;
+
+	dumpFile openDump(const char* path)
+	{
+		return CreateFileA(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	}
+
+	bool writeDump(dumpFile file, const void* data, size_t size)
+	{
+		const char* from = static_cast<const char*>(data);
+		while (size)
+		{
+			DWORD chunk = size < 0x40000000 ? DWORD(size) : 0x40000000, done = 0;
+			if (!WriteFile(file, from, chunk, &done, nullptr) || !done) return false;
+			from += done;
+			size -= done;
+		}
+		return true;
+	}
+
+	bool closeDump(dumpFile file) { return CloseHandle(file) != 0; }
+#else
+	using dumpFile = int;
+	const dumpFile noFile = -1;
+
+	dumpFile openDump(const char* path)
+	{
+		return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+
+	bool writeDump(dumpFile file, const void* data, size_t size)
+	{
+		const char* from = static_cast<const char*>(data);
+		while (size)
+		{
+			ssize_t done = write(file, from, size);
+			if (done < 0 && errno == EINTR) continue;
+			if (done <= 0) return false;
+			from += done;
+			size -= size_t(done);
+		}
+		return true;
+	}
+
+	bool closeDump(dumpFile file) { return close(file) == 0; }
+#endif
+}
+
+bool TraceBuffer::dump(const char* path) const
+{
+	dumpFile file = openDump(path);
+	if (file == noFile) return false;
+
+	uint64_t total = count();
+	uint64_t live = total < capacity() ? total : capacity();
+	fileHeader header = { fileMagic, fileVersion, uint32_t(live), 0, total };
+	bool ok = writeDump(file, &header, sizeof(header));
+
+	// oldest first, in at most two runs depending on where the ring wraps
+	uint32_t first = uint32_t((total - live) & mask);
+	uint32_t tail = uint32_t(live) < capacity() - first ? uint32_t(live) : capacity() - first;
+	if (ok && tail) ok = writeDump(file, &slots[first], sizeof(slot) * tail);
+	if (ok && live > tail) ok = writeDump(file, &slots[0], sizeof(slot) * size_t(live - tail));
+
+	return closeDump(file) && ok;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//				               CRASH DUMP								//
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+	const TraceBuffer* crashBuffer = nullptr;
+	const char* crashPath = nullptr;
+
+	void crashHandler(int sig)
+	{
+		// dump only makes OS calls, and the ring is never left half written since written is bumped last
+		if (crashBuffer) crashBuffer->dump(crashPath);
+		std::signal(sig, SIG_DFL);
+		std::raise(sig);
+	}
+}
+
+void TraceBuffer::dumpOnCrash(const TraceBuffer* buffer, const char* path)
+{
+	crashBuffer = buffer;
+	crashPath = path;
+
+	for (int sig : { SIGSEGV, SIGILL, SIGFPE, SIGABRT })
+	{
+		std::signal(sig, buffer ? crashHandler : SIG_DFL);
+	}
+}
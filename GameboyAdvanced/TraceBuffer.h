@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// fixed size binary log of what the cpu ran, filled at the Records trace level. every entry is one
+// 16 byte slot: an Instr slot per instr, then optionally a Reg slot per register it changed and a
+// Read / Write slot per data access it made. only the emulation thread writes, it fills the slot and
+// then publishes it by bumping written, so a dump from another thread that reads written first only
+// sees finished slots (bar the oldest few if the cpu laps it meanwhile). when full the oldest slots
+// are overwritten, the decoder skips anything before the first Instr slot it sees. dump() writes the
+// live contents out for DebuggerCPU::decodeTrace
+
+class TraceBuffer
+{
+public:
+
+	enum class kind : uint8_t { Instr, Reg, Read, Write };
+
+	struct slot
+	{
+		uint32_t a;    // Instr: addr     Reg: register   Read / Write: addr
+		uint32_t b;    // Instr: opcode   Reg: new value  Read / Write: value
+		uint32_t c;    // Instr: cpsr before it ran (T says which opcode size)   Read / Write: size in bytes
+		kind type;
+		uint8_t pad[3];
+	};
+
+	struct fileHeader
+	{
+		uint32_t magic;   // 'GBAT'
+		uint32_t version;
+		uint32_t slots;   // that follow, oldest first
+		uint32_t pad;
+		uint64_t written; // over the whole run, so how many were lost is written - slots
+	};
+
+	static constexpr uint32_t fileMagic = 0x54414247;
+	static constexpr uint32_t fileVersion = 1;
+
+	explicit TraceBuffer(uint32_t capacityLog2);
+
+	bool captureRegisters; // Reg slots for every register an instr changed
+	bool captureMemory;    // Read / Write slots for the data accesses that go through CPU::read / write
+
+	void push(kind type, uint32_t a, uint32_t b, uint32_t c = 0)
+	{
+		uint64_t at = written.load(std::memory_order_relaxed);
+		slots[at & mask] = { a, b, c, type, {} };
+		written.store(at + 1, std::memory_order_release);
+	}
+
+	void resize(uint32_t capacityLog2); // drops whatever was in it
+	void clear() { written.store(0, std::memory_order_release); }
+	uint64_t count() const { return written.load(std::memory_order_acquire); }
+	uint32_t capacity() const { return mask + 1; }
+
+	bool dump(const char* path) const; // OS calls only, so it is safe from a signal handler
+
+	// dumps to path from a signal handler if the process goes down with SIGSEGV, SIGILL, SIGFPE or
+	// SIGABRT. one buffer at a time, null turns it off again
+	static void dumpOnCrash(const TraceBuffer* buffer, const char* path);
+
+private:
+
+	std::unique_ptr<slot[]> slots;
+	uint32_t mask;
+	std::atomic<uint64_t> written;
+};
@@ -0,0 +1,141 @@
+#include "UndoJournal.h"
+#include "Bus.h"
+#include "CPU.h"
+#include <cstddef>
+#include <cstring>
+
+namespace
+{
+	static_assert(sizeof(CPUState) % sizeof(uint32_t) == 0, "Reg slots name CPUState's words");
+
+	// the words a Reg slot can name: r0-r14 (pc, CPSR and the mode come back from the Instr slot) and
+	// the banks, which only move on a mode switch or an SPSR write
+	constexpr uint32_t regWords = 15;
+	constexpr uint32_t bankFirst = offsetof(CPUState, r8FIQ) / sizeof(uint32_t);
+	constexpr uint32_t bankEnd = (offsetof(CPUState, spsrBank) + sizeof(CPUState::spsrBank)) / sizeof(uint32_t);
+
+	// lowest set bit to its index, as in CPU::traceRegisters
+	uint32_t lowestBit(uint32_t bits)
+	{
+		static const uint8_t table[32] = { 0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+			31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9 };
+		return table[((bits & (0u - bits)) * 0x077CB531u) >> 27];
+	}
+}
+
+UndoJournal::UndoJournal() : mask(0), written(0), reached(0), inInstr(false)
+{
+}
+
+void UndoJournal::enable(uint32_t capacityLog2)
+{
+	slots.reset(new slot[size_t(1) << capacityLog2]);
+	mask = (uint32_t(1) << capacityLog2) - 1;
+	clear();
+}
+
+void UndoJournal::disable()
+{
+	slots.reset();
+	mask = 0;
+	clear();
+}
+
+void UndoJournal::begin(const CPUState& state, uint32_t writes)
+{
+	push(kind::Instr, state.pc(), uint32_t(state.cycleTotal), state.CPSR, static_cast<uint8_t>(state.curMode));
+	inInstr = true;
+
+	// saved whether or not the instr ends up changing them, most write one register so this is a
+	// slot or two instead of copying and comparing the whole register file
+	for (uint32_t regs = writes & ((1u << regWords) - 1); regs; regs &= regs - 1)
+	{
+		uint32_t i = lowestBit(regs);
+		push(kind::Reg, i, state.reg[i]);
+	}
+
+	if (!(writes & banks)) return;
+
+	const uint8_t* from = reinterpret_cast<const uint8_t*>(&state) + bankFirst * sizeof(uint32_t);
+	for (uint32_t i = bankFirst; i < bankEnd; i++)
+	{
+		uint32_t old;
+		memcpy(&old, from + (i - bankFirst) * sizeof(uint32_t), sizeof(old));
+		push(kind::Reg, i, old);
+	}
+}
+
+void UndoJournal::saveBytes(uint32_t addr, uint32_t size, const uint8_t* old)
+{
+	if (!inInstr) return;
+
+	for (uint32_t done = 0; done < size; done += 4)
+	{
+		uint32_t chunk = size - done < 4 ? size - done : 4;
+		uint32_t bytes = 0;
+		memcpy(&bytes, old + done, chunk);
+		push(kind::Write, addr + done, bytes, chunk);
+	}
+}
+
+bool UndoJournal::undoInstr(CPUState& state, Bus& bus)
+{
+	if (!slots) return false;
+
+	// the newest Instr slot, which has to be inside the live part of the ring
+	uint64_t oldest = oldestLive();
+	uint64_t at = written;
+	while (at > oldest && slots[(at - 1) & mask].type != kind::Instr) at--;
+	if (at == oldest) return false;
+
+	uint64_t instrAt = at - 1;
+	if (written > reached) reached = written;
+	for (uint64_t i = written; i-- > at;)
+	{
+		const slot& entry = slots[i & mask];
+		if (entry.type == kind::Reg)
+		{
+			memcpy(reinterpret_cast<uint8_t*>(&state) + entry.a * sizeof(uint32_t), &entry.b, sizeof(uint32_t));
+		}
+		else if (uint8_t* to = bus.writeRange(entry.a, entry.c))
+		{
+			memcpy(to, &entry.b, entry.c);
+		}
+	}
+
+	const slot& instr = slots[instrAt & mask];
+	state.pc() = instr.a;
+	state.cycleTotal = int(instr.b);
+	state.CPSR = instr.c;
+	state.curMode = static_cast<CPUState::mode>(instr.mode);
+	state.pendingFlagOp = CPUState::flagOp::None;
+	state.pipelineFlushed = true; // refetched from the restored memory
+
+	written = instrAt;
+	return true;
+}
+
+uint64_t UndoJournal::instrsSinceWrite(uint32_t addr) const
+{
+	if (!slots) return 0;
+
+	uint64_t oldest = oldestLive();
+	uint64_t instrs = 0;
+	bool found = false;
+
+	for (uint64_t i = written; i-- > oldest;)
+	{
+		const slot& entry = slots[i & mask];
+		if (entry.type == kind::Instr)
+		{
+			instrs++;
+			if (found) return instrs;
+		}
+		else if (entry.type == kind::Write && addr - entry.a < entry.c)
+		{
+			found = true; // counted once its Instr slot turns up, which has to still be in the ring
+		}
+	}
+
+	return 0;
+}
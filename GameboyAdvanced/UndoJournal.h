@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+
+struct CPUState;
+class Bus;
+
+// bounded log of how to take instrs back, for stepping backwards through a divergence instead of
+// rerunning it from a snapshot. begin / end bracket one instr: begin leaves an Instr slot with the pc,
+// CPSR, mode and cycleTotal it started from and a Reg slot with the old value of each register the
+// caller says the instr can write, nothing is compared afterwards. the bus hands over the old bytes
+// under every write made in between as Write slots. undoing an instr pops its slots newest first down
+// to its Instr slot. when full the oldest slots are overwritten, only instrs whose Instr slot is still
+// there can be undone. it starts off, with nothing allocated
+
+class UndoJournal
+{
+public:
+
+	enum class kind : uint8_t { Instr, Reg, Write };
+
+	struct slot
+	{
+		uint32_t a;    // Instr: pc (r15 as the run loop has it)   Reg: word index into CPUState   Write: addr
+		uint32_t b;    // Instr: cycleTotal                        Reg: old value                  Write: old bytes, little endian
+		uint32_t c;    // Instr: CPSR                                                              Write: size in bytes, 1-4
+		kind type;
+		uint8_t mode;  // Instr: curMode
+		uint8_t pad[2];
+	};
+
+	UndoJournal();
+
+	bool enabled() const { return slots != nullptr; }
+	void enable(uint32_t capacityLog2); // drops whatever was in it
+	void disable();
+	void clear() { written = 0; reached = 0; inInstr = false; }
+
+	// begin's writes: bit n for rn, r0-r14 (pc comes back from the Instr slot). everything adds the
+	// banked registers and SPSRs, for an instr that can switch mode or write an SPSR
+	static constexpr uint32_t banks = 1u << 16;
+	static constexpr uint32_t everything = 0x7FFF | banks;
+
+	void begin(const CPUState& state, uint32_t writes);
+	void end() { inInstr = false; }
+	void saveBytes(uint32_t addr, uint32_t size, const uint8_t* old); // from the bus, before it writes
+
+	// takes the newest instr back, false once there is none left. bus writes go back through writeRange
+	// so any blocks cached over them are dropped
+	bool undoInstr(CPUState& state, Bus& bus);
+
+	// how many of the newest instrs have to be undone to take back the last one that wrote addr, 0 if
+	// none of the instrs still held did
+	uint64_t instrsSinceWrite(uint32_t addr) const;
+
+	uint64_t count() const { return written; }
+	uint32_t capacity() const { return mask + 1; }
+
+private:
+
+	std::unique_ptr<slot[]> slots;
+	uint32_t mask;
+	uint64_t written;
+	uint64_t reached;   // highest written has been, undoing moves written back but not what has been lapped
+	bool inInstr;       // writes outside begin / end (tools, restores) are not the guest's and are not kept
+
+	void push(kind type, uint32_t a, uint32_t b, uint32_t c = 0, uint8_t mode = 0)
+	{
+		slots[written & mask] = { a, b, c, type, mode, {} };
+		written++;
+	}
+
+	uint64_t oldestLive() const
+	{
+		uint64_t top = written > reached ? written : reached;
+		return top > capacity() ? top - capacity() : 0;
+	}
+};